@@ -18,7 +18,8 @@ template <typename Dtype>
 class BaseConvolutionLayer : public Layer<Dtype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), fused_relu_(false),
+        fused_relu_negative_slope_(0) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -28,19 +29,49 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
 
+  /**
+   * @brief Apply a ReLU with negative_slope to the output in Forward_cpu,
+   *        together with the bias, while each tile of output is in cache.
+   *
+   * Net sets this for a Convolution followed by an in-place ReLU, whose CPU
+   * forward pass it then skips.
+   */
+  void set_fused_relu(bool fused, Dtype negative_slope = 0) {
+    fused_relu_ = fused;
+    fused_relu_negative_slope_ = negative_slope;
+  }
+  inline bool fused_relu() const { return fused_relu_; }
+
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
-  // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // The skip_im2col argument in forward_cpu_gemm is so that we can skip the
+  // im2col if we just called weight_cpu_gemm with the same input. The CPU
+  // helpers lower into col_buff, or into col_buffer_ if it is NULL.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, bool skip_im2col = false);
+      Dtype* output, bool skip_im2col = false, Dtype* col_buff = NULL);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
+  // forward_cpu_gemm, then the bias (if not NULL) and the fused ReLU, one
+  // tile of output columns at a time.
+  void forward_cpu_gemm_fused(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output, Dtype* col_buff = NULL);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, Dtype* col_buff = NULL);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, Dtype* col_buff = NULL);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
 
+  // forward_cpu_gemm_fused or forward_cpu_gemm and forward_cpu_bias, as
+  // set up; bias may be NULL.
+  void forward_cpu_sample(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output, Dtype* col_buff);
+  // Convolution forward and backward over the num_ samples of one bottom,
+  // on parallel threads with column buffers of their own if batch_parallel
+  // is set. weight_diff and bottom_diff may be NULL to skip them.
+  void forward_cpu_samples(const Dtype* bottom_data, const Dtype* weights,
+      Dtype* top_data);
+  void backward_cpu_samples(const Dtype* bottom_data, const Dtype* top_diff,
+      const Dtype* weights, Dtype* weight_diff, Dtype* bottom_diff);
+
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
@@ -92,6 +123,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  bool fused_relu_;
+  Dtype fused_relu_negative_slope_;
+  bool batch_parallel_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
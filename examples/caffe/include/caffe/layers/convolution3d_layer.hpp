@@ -53,6 +53,18 @@ class Convolution3DLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // The passes over one sample, with col as its column buffer. The weight
+  // and bias diffs are accumulated; bottom_diff may be NULL. Both lower the
+  // sample one tile at a time.
+  void forward_cpu_sample(const Dtype* bottom_data, const Dtype* weight,
+      const Dtype* bias, Dtype* col, Dtype* top_data);
+  void backward_cpu_sample(const Dtype* top_diff, const Dtype* bottom_data,
+      const Dtype* weight, Dtype* col, Dtype* weight_diff, Dtype* bias_diff,
+      Dtype* bottom_diff);
+  // Grows col_buffer_ to the whole column matrix, which the GPU passes lower
+  // at once even if the layer was set up in CPU mode with implicit_gemm.
+  void reshape_col_buffer_for_image();
+
   int kernel_size_;
   int kernel_depth_;
   int stride_;
@@ -66,6 +78,15 @@ class Convolution3DLayer : public Layer<Dtype> {
   int width_;
   int num_output_;
   int filter_group_;
+  bool batch_parallel_;
+  // The column matrix has col_rows_ rows of col_width_ output columns,
+  // lowered tile_rows_ rows at a time: all of them unless implicit_gemm.
+  int col_rows_;
+  int col_width_;
+  int tile_rows_;
+  // column buffer of the serial path, one tile large, or the whole column
+  // matrix once a GPU pass ran; parallel threads take theirs from the
+  // WorkspacePool
   Blob<Dtype> col_buffer_;
   shared_ptr<SyncedMemory> bias_multiplier_;
   bool bias_term_;
@@ -0,0 +1,172 @@
+#ifndef CAFFE_DRAGON_BASE_DATA_LAYER_HPP_
+#define CAFFE_DRAGON_BASE_DATA_LAYER_HPP_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/dragon_codec.hpp"
+#include "caffe/util/dragon_mem.hpp"
+#include "caffe/util/dragon_sampler.hpp"
+
+namespace caffe {
+
+/**
+ * @brief count_ items of a Dragon data source, as runs of consecutive items.
+ *        Layers that map the source point the tops straight at a batch of a
+ *        single run; other batches are gathered into data_ and label_.
+ */
+template <typename Dtype>
+class DragonBatch : public Batch<Dtype> {
+ public:
+  bool contiguous() const { return runs_.size() == 1; }
+
+  vector<DragonSampler::Run> runs_;
+  uint32_t count_;
+};
+
+/**
+ * @brief Base of the layers that feed the raw files written by
+ *        DragonConvertData / DragonConvertVideoData to the Net.
+ *
+ * The shape and number of items come from the DragonMemHeader of the
+ * source when it has one; dragon_data_param() only needs them for files of
+ * older converters, and fails setup if they disagree with the header.
+ *
+ * Items stored in a type other than Dtype, such as UINT8, FLOAT16 or the
+ * other floating-point type, are decoded into the batches, with the
+ * mean_value and scale of transform_param() applied on the way; items of
+ * type Dtype are used as they are stored. Labels are decoded the same way
+ * from whatever type their source holds, without mean or scale.
+ *
+ * A prefetch thread takes batches from a DragonSampler
+ * dragon_data_param().prefetch() batches ahead of Forward and calls
+ * load_batch on each, so that reading batch N + k overlaps the computation
+ * on batch N.
+ */
+template <typename Dtype>
+class DragonBaseDataLayer :
+    public BaseDataLayer<Dtype>, public InternalThread {
+ public:
+  explicit DragonBaseDataLayer(const LayerParameter& param);
+  virtual ~DragonBaseDataLayer();
+  // LayerSetUp: opens the source through DataLayerSetUp, shapes the tops
+  // and starts prefetching. This method may not be overridden.
+  void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+  virtual inline bool is_3d_data() {
+      return this->data_depth_ > 0;
+  }
+  // Bytes of items and labels brought into batches so far.
+  uint64_t bytes_read() const { return this->bytes_read_; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  // Takes the shape and length from the headers of the sources, if any.
+  void ReadHeaders(bool with_labels);
+  virtual void InternalThreadEntry();
+  // Checks transform_param() and takes the mean and scale to decode with.
+  void SetUpDecoding();
+  // Whether every batch is read into its data_ and label_, not only the
+  // batches of several runs.
+  virtual bool reads_into_batches() { return false; }
+  // Whether the stored items must be decoded rather than used in place.
+  bool decodes() { return this->storage_ != dragon_mem_dtype<Dtype>(); }
+  // Whether the stored labels must be decoded rather than used in place.
+  bool decodes_labels() {
+    return this->output_labels_ &&
+        this->labels_storage_ != dragon_mem_dtype<Dtype>();
+  }
+  // Whether batch is copied into its data_ and label_ by layers that map
+  // the sources.
+  bool gathers(DragonBatch<Dtype>* batch) {
+    return !batch->contiguous() || this->decodes() || this->decodes_labels();
+  }
+  // Called on the prefetch thread with the chunks that are about to be
+  // sampled from, so that they can be read ahead sequentially.
+  virtual void Readahead(const DragonSampler::Run& chunk) {}
+  // Called on the prefetch thread to bring in the items of batch.
+  virtual void load_batch(DragonBatch<Dtype>* batch) = 0;
+  // Points the reshaped tops at the items of batch.
+  virtual void SetTops(DragonBatch<Dtype>* batch,
+      const vector<Blob<Dtype>*>& top) = 0;
+  // Copies the items of batch from mapped data and labels into the batch.
+  void GatherBatch(DragonBatch<Dtype>* batch, const char* data,
+      const char* labels);
+  // Decodes count stored items at src into dst.
+  void DecodeItems(const char* src, size_t count, Dtype* dst);
+
+  // Reads one byte every stride bytes of [ptr, ptr + size) so that the
+  // pages behind a mapping are faulted in.
+  static void TouchPages(const void* ptr, size_t size, size_t stride);
+
+  vector<int> data_shape_(uint32_t count);
+
+  virtual inline size_t data_size_() {
+      return this->size_per_data_item_() * this->data_length_;
+  }
+
+  virtual inline size_t size_per_data_item_() {
+      return this->num_elements_per_data_item_() * DragonMemDtypeSize(this->storage_);
+  }
+
+  inline size_t size_per_label_() {
+      return DragonMemDtypeSize(this->labels_storage_);
+  }
+
+  virtual inline size_t num_elements_per_data_item_() {
+      size_t size = this->data_width_ * this->data_height_ * this->data_channels_;
+      if (this->data_depth_ > 0)
+          size *= this->data_depth_;
+      return size;
+  }
+
+  ::std::string data_source_;
+  uint32_t data_width_;
+  uint32_t data_height_;
+  uint32_t data_depth_;
+  uint32_t data_channels_;
+  uint32_t data_length_;
+
+  ::std::string labels_source_;
+  uint32_t labels_length_;
+
+  // offset of the first item in the sources, past the header
+  uint64_t data_offset_;
+  uint64_t labels_offset_;
+
+  // type the items are stored as, and the per channel mean and the scale
+  // applied when decoding them
+  DragonMemDtype storage_;
+  vector<Dtype> decode_mean_;
+  Dtype decode_scale_;
+  // type the labels are stored as
+  DragonMemDtype labels_storage_;
+
+  uint32_t batch_size_;
+
+  // owned by the prefetch thread once it is started
+  shared_ptr<DragonSampler> sampler_;
+  std::atomic<uint64_t> bytes_read_;
+
+  vector<shared_ptr<DragonBatch<Dtype> > > prefetch_;
+  BlockingQueue<DragonBatch<Dtype>*> prefetch_free_;
+  BlockingQueue<DragonBatch<Dtype>*> prefetch_full_;
+  DragonBatch<Dtype>* prefetch_current_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DRAGON_BASE_DATA_LAYER_HPP_
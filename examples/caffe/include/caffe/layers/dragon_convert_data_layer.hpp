@@ -1,6 +1,8 @@
-#ifndef CAFFE_DATA_LAYER_HPP_
-#define CAFFE_DATA_LAYER_HPP_
+#ifndef CAFFE_DRAGON_CONVERT_DATA_LAYER_HPP_
+#define CAFFE_DRAGON_CONVERT_DATA_LAYER_HPP_
 
+#include <atomic>
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -9,9 +11,18 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/dragon_convert_writer.hpp"
 
 namespace caffe {
 
+/**
+ * @brief Converts a Datum DB into the data_out / labels_out files read by
+ *        the Dragon data layers, then exits.
+ *
+ * The cursor is read a chunk at a time on the calling thread, the records
+ * of a chunk are transformed by num_threads threads, and a
+ * DragonConvertWriter writes the chunk while the next one is transformed.
+ */
 template <typename Dtype>
 class DragonConvertDataLayer : public BaseDataLayer<Dtype> {
  public:
@@ -26,15 +37,25 @@ class DragonConvertDataLayer : public BaseDataLayer<Dtype> {
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {};
+  // Converts records of chunk until none is left; run by every worker.
+  void ConvertRecords(DragonConvertChunk* chunk, int worker);
+  void ConvertRecord(DragonConvertChunk* chunk, uint32_t i, int worker);
+
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
-
-  Blob<Dtype> transformed_data_;
-
-  FILE *out_data_file_;
-  FILE *out_label_file_;
+  shared_ptr<DragonConvertWriter> writer_;
+
+  vector<int> top_shape_;
+  // type the records are stored as
+  DragonMemDtype storage_;
+  // serialized Datum of each record of the chunk being converted
+  vector<string> values_;
+  std::atomic<uint32_t> next_record_;
+  // one per worker
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  vector<shared_ptr<Blob<Dtype> > > transformed_data_;
 };
 
 }  // namespace caffe
 
-#endif  // CAFFE_DATA_LAYER_HPP_
+#endif  // CAFFE_DRAGON_CONVERT_DATA_LAYER_HPP_
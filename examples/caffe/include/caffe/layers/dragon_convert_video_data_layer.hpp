@@ -17,6 +17,7 @@
 #ifndef CAFFE_DRAGON_CONVERT_VIDEO_DATA_LAYER_HPP_
 #define CAFFE_DRAGON_CONVERT_VIDEO_DATA_LAYER_HPP_
 
+#include <atomic>
 #include <string>
 #include <utility>
 #include <vector>
@@ -26,13 +27,17 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/dragon_convert_writer.hpp"
 
 namespace caffe {
 
 /**
- * @brief Provides data to the Net from image files.
+ * @brief Converts the clips of a video list into the data_out / labels_out
+ *        files read by the Dragon data layers, then exits.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * The clips of a chunk are picked on the calling thread, then decoded and
+ * transformed by num_threads threads while a DragonConvertWriter writes the
+ * chunk before.
  */
 template <typename Dtype>
 class DragonConvertVideoDataLayer : public BaseDataLayer<Dtype> {
@@ -51,7 +56,27 @@ class DragonConvertVideoDataLayer : public BaseDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleClips();
 
-  Blob<Dtype> transformed_data_;
+  // A clip picked from the list, to be read by one of the workers.
+  struct Clip {
+    int id;
+    int start_frm;
+    int sampling_rate;
+  };
+  static const int kNotEnoughFrames = -2;
+
+  // Converts clips of chunk until none is left; run by every worker.
+  void ConvertClips(DragonConvertChunk* chunk, int worker);
+  void ConvertClip(DragonConvertChunk* chunk, uint32_t i, int worker);
+
+  vector<int> top_shape_;
+  // type the records are stored as
+  DragonMemDtype storage_;
+  vector<Clip> clips_;
+  std::atomic<uint32_t> next_clip_;
+  // one per worker
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  vector<shared_ptr<Blob<Dtype> > > transformed_data_;
+  shared_ptr<DragonConvertWriter> writer_;
 
   vector<string> file_list_;
   vector<int> start_frm_list_;
@@ -60,9 +85,6 @@ class DragonConvertVideoDataLayer : public BaseDataLayer<Dtype> {
   vector<int> shuffle_index_;
   int lines_id_;
 
-  FILE *out_data_file_;
-  FILE *out_label_file_;
-
   int limit_num_items_;
 };
 
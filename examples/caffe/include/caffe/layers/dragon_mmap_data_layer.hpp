@@ -5,61 +5,34 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
-#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/layers/dragon_base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 namespace caffe {
 
+/**
+ * @brief Feeds a Dragon data source mapped with mmap; the tops point into
+ *        the mapping and the prefetch thread reads batches in ahead.
+ *        Batches that are not contiguous in the source are copied out.
+ */
 template <typename Dtype>
-class DragonMmapDataLayer : public BaseDataLayer<Dtype> {
+class DragonMmapDataLayer : public DragonBaseDataLayer<Dtype> {
  public:
-  explicit DragonMmapDataLayer(const LayerParameter& param);
+  explicit DragonMmapDataLayer(const LayerParameter& param)
+      : DragonBaseDataLayer<Dtype>(param) {}
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual inline const char* type() const { return "DragonData"; }
-  virtual inline int ExactNumBottomBlobs() const { return 0; }
-  virtual inline int MinTopBlobs() const { return 1; }
-  virtual inline int MaxTopBlobs() const { return 2; }
-
-  virtual inline bool is_3d_data() {
-      return this->data_depth_ > 0;
-  }
 
  protected:
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+  virtual void Readahead(const DragonSampler::Run& chunk);
+  virtual void load_batch(DragonBatch<Dtype>* batch);
+  virtual void SetTops(DragonBatch<Dtype>* batch,
       const vector<Blob<Dtype>*>& top);
 
-  virtual inline size_t data_size_() {
-      return this->size_per_data_item_() * this->data_length_;
-  }
-
-  virtual inline size_t size_per_data_item_() {
-      return this->num_elements_per_data_item_() * sizeof(Dtype);
-  }
-
-  virtual inline size_t num_elements_per_data_item_() {
-      size_t size = this->data_width_ * this->data_height_ * this->data_channels_;
-      if (this->data_depth_ > 0)
-          size *= this->data_depth_;
-      return size;
-  }
-
-  Dtype* data_;
-  Dtype* labels_;
-
-  ::std::string data_source_;
-  uint32_t data_width_;
-  uint32_t data_height_;
-  uint32_t data_depth_;
-  uint32_t data_channels_;
-  uint32_t data_length_;
-
-  ::std::string labels_source_;
-  uint32_t labels_length_;
-
-  uint32_t batch_size_;
-
-  uint32_t item_index_;
+  // first stored item and label
+  char* data_;
+  char* labels_;
 };
 
 }  // namespace caffe
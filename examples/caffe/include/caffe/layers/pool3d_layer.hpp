@@ -52,6 +52,27 @@ class Pooling3DLayer : public Layer<Dtype> {
 	virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
 	    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // The window of a pooled position along one axis: input positions
+  // [begin, end), and the extent, padding included, that AVE divides by.
+  struct Window {
+    int begin;
+    int end;
+    int size;
+  };
+  static vector<Window> Windows(int size, int pooled_size, int kernel_size,
+      int stride, int pad);
+
+  // Pool or unpool one channel of one sample. row is scratch for one input
+  // row, and row_argmax for its indices. max_pool_channel writes the index
+  // of each max within the channel to argmax; top_data or argmax may be
+  // NULL.
+  void max_pool_channel(const Dtype* bottom_data, Dtype* top_data,
+      int* argmax, Dtype* row, int* row_argmax);
+  void ave_pool_channel(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* row);
+  void ave_unpool_channel(const Dtype* top_diff, Dtype* bottom_diff,
+      Dtype* row);
+
   int kernel_size_;
   int kernel_depth_;
   int stride_;
@@ -65,6 +86,11 @@ class Pooling3DLayer : public Layer<Dtype> {
   int pooled_height_;
   int pooled_width_;
   Blob<Dtype> rand_idx_;
+  vector<Window> length_windows_;
+  vector<Window> height_windows_;
+  vector<Window> width_windows_;
+  // index of the max of each window within its channel, with argmax_mask
+  Blob<int> max_idx_;
 };
 
 }
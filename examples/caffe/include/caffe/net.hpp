@@ -14,6 +14,8 @@
 
 namespace caffe {
 
+template <typename Dtype> class NetProfiler;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -170,6 +172,11 @@ class Net {
   inline const vector<bool>& layer_need_backward() const {
     return layer_need_backward_;
   }
+  /// @brief Whether the CPU forward pass of each layer is fused into the
+  ///        layer before it, and must be skipped
+  inline const vector<bool>& layer_fused() const {
+    return layer_fused_;
+  }
   /// @brief returns the parameters
   inline const vector<shared_ptr<Blob<Dtype> > >& params() const {
     return params_;
@@ -209,6 +216,10 @@ class Net {
   inline const vector<int>& output_blob_indices() const {
     return net_output_blob_indices_;
   }
+  /// @brief Bytes saved by share_activation_memory; 0 if it is off.
+  inline size_t activation_memory_saved() const {
+    return activation_memory_saved_;
+  }
   bool has_blob(const string& blob_name) const;
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name) const;
   bool has_layer(const string& layer_name) const;
@@ -265,6 +276,10 @@ class Net {
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /// @brief Place activations with disjoint lifetimes in one shared buffer.
+  void PlanActivationMemory(const bool with_backward);
+  /// @brief Fuse in-place ReLUs into the Convolutions before them.
+  void FuseConvolutionReLU();
 
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
@@ -282,6 +297,8 @@ class Net {
   vector<string> layer_names_;
   map<string, int> layer_names_index_;
   vector<bool> layer_need_backward_;
+  /// Layers whose CPU forward pass is done by the layer before them.
+  vector<bool> layer_fused_;
   /// @brief the blobs storing intermediate results between the layer.
   vector<shared_ptr<Blob<Dtype> > > blobs_;
   vector<string> blob_names_;
@@ -328,6 +345,9 @@ class Net {
   vector<bool> has_params_decay_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// The buffer shared by the planned activations, and the bytes it saves
+  shared_ptr<SyncedMemory> activation_memory_;
+  size_t activation_memory_saved_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
   // Callbacks
@@ -335,6 +355,8 @@ class Net {
   vector<Callback*> after_forward_;
   vector<Callback*> before_backward_;
   vector<Callback*> after_backward_;
+  /// Records the layers with the Profiler, when it is enabled
+  shared_ptr<NetProfiler<Dtype> > profiler_;
 
 DISABLE_COPY_AND_ASSIGN(Net);
 };
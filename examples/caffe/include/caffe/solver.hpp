@@ -7,6 +7,7 @@
 #include "caffe/net.hpp"
 #include "caffe/solver_factory.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/snapshot_writer.hpp"
 
 namespace caffe {
 
@@ -64,7 +65,9 @@ class Solver {
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
-  // written to disk together with the learned net.
+  // written to disk together with the learned net. With async_snapshots,
+  // BINARYPROTO snapshots are only copied here, and written in the
+  // background.
   void Snapshot();
   virtual ~Solver() {}
   inline const SolverParameter& param() const { return param_; }
@@ -104,6 +107,8 @@ class Solver {
   void TestAll();
   void Test(const int test_net_id = 0);
   virtual void SnapshotSolverState(const string& model_filename) = 0;
+  virtual void SolverStateToProto(const string& model_filename,
+      SolverState* state) = 0;
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
   void DisplayOutputBlobs(const int net_id);
@@ -129,6 +134,9 @@ class Solver {
   Timer iteration_timer_;
   float iterations_last_;
 
+  // Writes snapshots in the background, if async_snapshots is set.
+  shared_ptr<SnapshotWriter> snapshot_writer_;
+
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
 
@@ -8,6 +8,7 @@
 #endif
 
 #include "caffe/common.hpp"
+#include "caffe/util/memfile_arena.hpp"
 
 namespace caffe {
 
@@ -74,8 +75,13 @@ class SyncedMemory {
   void async_gpu_push(const cudaStream_t& stream);
 #endif
 
+  // Name and usage of the backing files of the DRAGON or mmap backend;
+  // false if neither is enabled.
+  static bool memfile_stats(string* backend, MemfileArena::Stats* stats);
+
  private:
   void check_device();
+  void free_arena_data();
 
   void to_cpu();
   void to_gpu();
@@ -90,6 +96,8 @@ class SyncedMemory {
   void* dragon_ptr_;
   bool use_dragon_;
   bool use_mmap_;
+  // the DRAGON or mmap arena that dragon_ptr_ or cpu_ptr_ came from
+  MemfileArena* arena_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,34 @@
+#ifndef CAFFE_UTIL_DRAGON_CODEC_HPP_
+#define CAFFE_UTIL_DRAGON_CODEC_HPP_
+
+#include <stdint.h>
+
+#include "caffe/util/dragon_mem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Decodes num_items items of a .mem payload of type dtype at src
+ *        into dst, as (x - mean[c]) * scale for each value x of channel c.
+ *
+ * An item is channels channels of inner consecutive values. mean is NULL
+ * or holds a value per channel. UINT8 and FLOAT16 payloads are decoded with
+ * AVX2 / F16C or NEON where the CPU has them.
+ */
+template <typename Dtype>
+void dragon_decode(DragonMemDtype dtype, const void* src, size_t num_items,
+    int channels, size_t inner, const Dtype* mean, Dtype scale, Dtype* dst);
+
+// Stores the n values of src into dst as dtype. UINT8 rounds to the
+// nearest integer and saturates to [0, 255].
+template <typename Dtype>
+void dragon_encode(DragonMemDtype dtype, const Dtype* src, size_t n,
+    void* dst);
+
+// IEEE 754 binary16 conversions, rounding to nearest even.
+float dragon_half_to_float(uint16_t h);
+uint16_t dragon_float_to_half(float f);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DRAGON_CODEC_HPP_
@@ -0,0 +1,116 @@
+#ifndef CAFFE_UTIL_DRAGON_CONVERT_WRITER_HPP_
+#define CAFFE_UTIL_DRAGON_CONVERT_WRITER_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/dragon_mem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Fixed-size records converted together and written with one write
+ *        per output file.
+ */
+struct DragonConvertChunk {
+  // num_records records of record_size bytes, and their labels
+  vector<char> data;
+  vector<char> labels;
+  // records that failed to convert are dropped when the chunk is written
+  vector<char> valid;
+  uint32_t num_records;
+  // source position right after the last record of the chunk
+  uint64_t cursor;
+};
+
+/**
+ * @brief Writes the data_out / labels_out of the Dragon converters in
+ *        order on a background thread, while the next chunk is converted.
+ *
+ * Both files start with a DragonMemHeader, which is brought up to date
+ * after each chunk. The number of records written and the source position
+ * to continue from are then saved to data_out + ".progress", so that a
+ * converter that was killed resumes after the last chunk it wrote instead
+ * of starting over. The progress index is removed once the conversion
+ * finishes.
+ */
+class DragonConvertWriter : public InternalThread {
+ public:
+  explicit DragonConvertWriter(const DragonConvertDataParameter& param);
+  virtual ~DragonConvertWriter();
+
+  // Resume point: records already written and the source position after
+  // them. Both are 0 unless an earlier run was interrupted.
+  uint64_t records() const { return records_; }
+  uint64_t cursor() const { return cursor_; }
+
+  // Threads to convert with: num_threads, or one per core. A single one
+  // when the conversion draws random numbers, as records converted on other
+  // threads would draw from other streams.
+  static int num_workers(const DragonConvertDataParameter& param,
+      bool random);
+  // Type to store the records as: param.storage(), where FLOAT is native.
+  static DragonMemDtype storage(const DragonConvertDataParameter& param,
+      DragonMemDtype native);
+  // The part of transform_param applied before storing: all of it, but for
+  // the mean subtraction and scaling of compact storage, which the Dragon
+  // data layers fuse into decoding instead.
+  static TransformationParameter stored_transform(
+      const DragonConvertDataParameter& param, DragonMemDtype native,
+      const TransformationParameter& transform_param);
+
+  // Starts the writer thread. labels_header is NULL if the records have no
+  // labels. Chunks hold chunk_records records.
+  void Start(const DragonMemHeader& data_header,
+      const DragonMemHeader* labels_header, uint32_t chunk_records);
+  // An empty chunk to convert into; blocks while both are being written.
+  DragonConvertChunk* free_chunk();
+  // Queues chunk to be written after the chunks pushed before it.
+  void Push(DragonConvertChunk* chunk);
+  // Waits for the queued chunks, then closes the outputs.
+  void Finish();
+
+ protected:
+  virtual void InternalThreadEntry();
+  void Write(DragonConvertChunk* chunk);
+  void WriteHeaders();
+  void ReadProgress();
+  void WriteProgress();
+
+  static const int kChunks = 2;
+
+  string data_out_;
+  string labels_out_;
+  string progress_out_;
+  int data_fd_;
+  int labels_fd_;
+
+  DragonMemHeader data_header_;
+  DragonMemHeader labels_header_;
+  size_t record_size_;
+  size_t label_size_;
+  uint64_t records_;
+  uint64_t cursor_;
+  uint64_t resumed_records_;
+  uint32_t data_crc_;
+  uint32_t labels_crc_;
+
+  vector<shared_ptr<DragonConvertChunk> > chunks_;
+  BlockingQueue<DragonConvertChunk*> free_;
+  BlockingQueue<DragonConvertChunk*> full_;
+  CPUTimer timer_;
+  float seconds_;
+
+  DISABLE_COPY_AND_ASSIGN(DragonConvertWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DRAGON_CONVERT_WRITER_HPP_
@@ -0,0 +1,89 @@
+#ifndef CAFFE_UTIL_DRAGON_MEM_HPP_
+#define CAFFE_UTIL_DRAGON_MEM_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Type of the items stored in a .mem file.
+enum DragonMemDtype {
+  DRAGON_MEM_FLOAT32 = 0,
+  DRAGON_MEM_FLOAT64 = 1,
+  DRAGON_MEM_UINT8 = 2,
+  DRAGON_MEM_FLOAT16 = 3
+};
+
+// The DragonMemDtype that stores Dtype.
+template <typename Dtype> DragonMemDtype dragon_mem_dtype();
+template <> inline DragonMemDtype dragon_mem_dtype<float>() {
+  return DRAGON_MEM_FLOAT32;
+}
+template <> inline DragonMemDtype dragon_mem_dtype<double>() {
+  return DRAGON_MEM_FLOAT64;
+}
+
+/**
+ * @brief Header at the start of the .mem files written by the Dragon
+ *        converters.
+ *
+ * The payload starts payload_offset bytes into the file, a multiple of the
+ * 2 MiB UVM block size, so that item 0 starts a block of a DRAGON mapping of
+ * the file and the payload can be read with O_DIRECT. The bytes between the
+ * header and the payload are a hole. All items have the same size, so item
+ * i starts i * item_size bytes into the payload.
+ */
+struct DragonMemHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t dtype;
+  uint64_t num_items;
+  // bytes per item
+  uint64_t item_size;
+  // shape of an item, such as C, H, W or C, D, H, W
+  uint32_t num_axes;
+  uint32_t shape[8];
+  uint32_t reserved;
+  uint64_t payload_offset;
+  uint64_t payload_size;
+  // zero, reserved for later versions
+  uint64_t reserved2;
+  // CRC-32 of the payload, and of the header up to header_crc
+  uint32_t payload_crc;
+  uint32_t header_crc;
+};
+
+static const uint64_t kDragonMemMagic = 0x4d4d4e4f47415244ULL;  // "DRAGONMM"
+static const uint32_t kDragonMemVersion = 1;
+static const uint64_t kDragonMemPayloadOffset = 1 << 21;
+
+size_t DragonMemDtypeSize(DragonMemDtype dtype);
+
+// Header of a new file of fixed-size items of item_shape.
+DragonMemHeader NewDragonMemHeader(DragonMemDtype dtype,
+    const vector<int>& item_shape);
+
+/**
+ * Reads the header of filename into header. Returns false if filename has
+ * no header, as the files of older converters, and fails if the header is
+ * damaged or of a newer version.
+ */
+bool ReadDragonMemHeader(const string& filename, DragonMemHeader* header);
+
+// Writes header, with its header_crc updated, to the start of fd.
+void WriteDragonMemHeader(int fd, DragonMemHeader* header);
+
+// Fails unless the payload of filename matches header.payload_crc.
+void CheckDragonMemPayload(const string& filename,
+    const DragonMemHeader& header);
+
+// Extends the CRC-32 crc of some bytes with size more bytes at data.
+uint32_t DragonMemCrc(uint32_t crc, const void* data, size_t size);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DRAGON_MEM_HPP_
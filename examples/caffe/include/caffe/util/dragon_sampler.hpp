@@ -0,0 +1,76 @@
+#ifndef CAFFE_UTIL_DRAGON_SAMPLER_HPP_
+#define CAFFE_UTIL_DRAGON_SAMPLER_HPP_
+
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Decides which items of a Dragon data source make up each batch.
+ *
+ * An epoch visits the source in chunks of chunk_items consecutive items.
+ * Shard r of num_shards takes every num_shards-th chunk starting from chunk
+ * r, so shards never read the same item. With shuffle, the chunk order is a
+ * seeded permutation that is the same on every shard, and the items of each
+ * window of window_chunks chunks are shuffled among themselves: the source
+ * is still read a whole chunk at a time, while batches mix items from all
+ * the chunks of a window.
+ */
+class DragonSampler {
+ public:
+  // first item, number of items
+  typedef std::pair<uint32_t, uint32_t> Run;
+
+  DragonSampler(uint32_t num_items, uint32_t chunk_items,
+      uint32_t window_chunks, bool shuffle, uint32_t seed,
+      uint32_t num_shards, uint32_t shard_id);
+
+  /**
+   * Takes up to max_items next items, appending them to runs as runs of
+   * consecutive items. A batch never spans two epochs, so the last one of
+   * an epoch may be short. The chunks of the window after the one these
+   * items come from are appended to window once, so that they can be read
+   * ahead. Returns the number of items taken.
+   */
+  uint32_t Next(uint32_t max_items, vector<Run>* runs, vector<Run>* window);
+
+  // Whether every batch is a single run of the source.
+  bool contiguous() const { return !shuffle_ && num_shards_ == 1; }
+  int epoch() const { return epoch_; }
+  // Items this shard visits in an epoch.
+  uint32_t epoch_items() const;
+
+ private:
+  void StartEpoch();
+
+  const uint32_t num_items_;
+  const uint32_t chunk_items_;
+  const uint32_t window_chunks_;
+  const bool shuffle_;
+  const uint32_t num_shards_;
+  const uint32_t shard_id_;
+
+  // same stream on every shard, so that the shards agree on chunk order
+  rng_t chunk_rng_;
+  rng_t item_rng_;
+
+  int epoch_;
+  vector<uint32_t> order_;
+  size_t position_;
+  // position in order_ where each window starts, and its chunks
+  vector<size_t> window_begin_;
+  vector<vector<Run> > windows_;
+  size_t windows_emitted_;
+
+  DISABLE_COPY_AND_ASSIGN(DragonSampler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DRAGON_SAMPLER_HPP_
@@ -0,0 +1,150 @@
+#ifndef CAFFE_UTIL_MEMFILE_ARENA_HPP_
+#define CAFFE_UTIL_MEMFILE_ARENA_HPP_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Allocates blob storage out of large memory-backend files
+ *        (the DRAGON and mmap backends of SyncedMemory).
+ *
+ * Files are mapped on demand through a Backend. Free space is kept as
+ * extents in power-of-two size classes, allocation is best fit within the
+ * smallest class that can serve the request, and freed extents are
+ * coalesced with their free neighbours. Each thread keeps a few recently
+ * freed extents to itself, so a net that reshapes to the same sizes does
+ * not go through the arena lock.
+ */
+class MemfileArena {
+ public:
+  class Backend {
+   public:
+    virtual ~Backend() {}
+    // Maps backing file number `index` of `size` bytes; NULL on failure.
+    virtual void* Map(long index, size_t size) = 0;
+    virtual void Unmap(long index, void* base, size_t size) {}
+    // Drops a range of a file that is no longer used. Returns true if the
+    // range reads as zeros afterwards.
+    virtual bool Discard(long index, size_t offset, size_t size) {
+      return false;
+    }
+  };
+
+  struct Stats {
+    size_t mapped_bytes;
+    size_t in_use_bytes;
+    size_t high_water_bytes;
+    // includes the extents held by per-thread caches
+    size_t free_bytes;
+    size_t largest_free_bytes;
+    size_t num_files;
+    size_t num_allocs;
+    size_t num_frees;
+    size_t num_cache_hits;
+
+    // Share of the free space that a request as large as the largest free
+    // extent cannot use; 0 when all free space is contiguous.
+    double fragmentation() const {
+      return free_bytes ?
+          1.0 - static_cast<double>(largest_free_bytes) / free_bytes : 0.0;
+    }
+  };
+
+  static const size_t kAlignment = (size_t)1 << 12;
+  static const size_t kThreadCacheEntries = 8;
+
+  MemfileArena(const string& name, shared_ptr<Backend> backend,
+      size_t file_size);
+  // The arena must outlive the threads that used it, except the caller.
+  ~MemfileArena();
+
+  /**
+   * Returns `size` bytes of file-backed memory. `*zeroed` tells whether the
+   * memory is known to read as zeros; reused extents are only zeroed if the
+   * backend could discard them.
+   */
+  void* Allocate(size_t size, bool* zeroed);
+  // `size` must be the size passed to Allocate.
+  void Free(void* ptr, size_t size);
+  // Hands the extents cached by the calling thread back to the arena.
+  void FlushThreadCache();
+
+  Stats GetStats();
+  void LogStats();
+
+  // Per-thread lists of freed extents, see memfile_arena.cpp.
+  class ThreadCache;
+
+ private:
+  friend class ThreadCache;
+
+  struct File {
+    long index;
+    char* base;
+    size_t size;
+  };
+
+  // A run of `size` bytes at `offset` in files_[file].
+  struct Extent {
+    size_t file;
+    size_t offset;
+    size_t size;
+    bool operator<(const Extent& other) const {
+      if (size != other.size) return size < other.size;
+      if (file != other.file) return file < other.file;
+      return offset < other.offset;
+    }
+  };
+
+  // Free bytes at an offset; clean if known to read as zeros.
+  struct FreeRun {
+    size_t size;
+    bool clean;
+  };
+
+  static size_t RoundUp(size_t size) {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+  }
+  static size_t SizeClass(size_t size);
+
+  void UpdateHighWater(size_t in_use);
+  bool TakeFreeLocked(size_t size, Extent* extent, bool* clean);
+  bool MapFileLocked(size_t size);
+  void InsertFreeLocked(const Extent& extent, bool clean);
+  void EraseFreeLocked(const Extent& extent);
+  void Release(char* ptr, size_t size);
+
+  const string name_;
+  shared_ptr<Backend> backend_;
+  const size_t file_size_;
+
+  std::mutex mutex_;
+  std::vector<File> files_;
+  // free extents by size class, smallest first
+  std::vector<std::set<Extent> > free_classes_;
+  // free runs of each file by offset, for coalescing
+  std::vector<std::map<size_t, FreeRun> > free_runs_;
+  size_t free_bytes_;
+  size_t mapped_bytes_;
+
+  std::atomic<size_t> in_use_bytes_;
+  std::atomic<size_t> high_water_bytes_;
+  std::atomic<size_t> cached_bytes_;
+  std::atomic<size_t> num_allocs_;
+  std::atomic<size_t> num_frees_;
+  std::atomic<size_t> num_cache_hits_;
+
+  DISABLE_COPY_AND_ASSIGN(MemfileArena);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEMFILE_ARENA_HPP_
@@ -0,0 +1,96 @@
+#ifndef CAFFE_UTIL_PROFILER_HPP_
+#define CAFFE_UTIL_PROFILER_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Records when each layer of the Nets runs, and writes the events as
+ *        Chrome trace JSON (chrome://tracing, Perfetto), or as CSV if the
+ *        file name ends in ".csv".
+ *
+ * Each thread records into a ring of its own, so that recording takes no
+ * lock; a ring keeps the last kRingSize events of its thread. Nets only
+ * hook a NetProfiler when the profiler is enabled, so that it costs
+ * nothing when off.
+ */
+class Profiler {
+ public:
+  enum Phase { FORWARD, BACKWARD };
+
+  struct Event {
+    int name;
+    Phase phase;
+    // nanoseconds since the profiler started
+    uint64_t start;
+    uint64_t end;
+    // bytes of the bottoms, tops and parameters of the layer
+    uint64_t bytes;
+  };
+
+  static const size_t kRingSize = 1 << 16;
+
+  static bool enabled() { return enabled_; }
+  // Starts profiling the Nets created from now on; the events are written
+  // to filename at exit.
+  static void Enable(const string& filename);
+
+  // Id of name in the events; takes a lock, so call it ahead of recording.
+  static int Intern(const string& name);
+  static uint64_t Now();
+  static void Record(int name, Phase phase, uint64_t start, uint64_t end,
+      uint64_t bytes);
+  // Writes the events recorded so far by all threads.
+  static void Write(const string& filename);
+
+ private:
+  static void WriteAtExit();
+
+  static bool enabled_;
+};
+
+/**
+ * @brief Records the Forward and Backward of each layer of a Net with the
+ *        Profiler, through the callbacks of the Net.
+ */
+template <typename Dtype>
+class NetProfiler {
+ public:
+  explicit NetProfiler(Net<Dtype>* net);
+
+ protected:
+  class Hook : public Net<Dtype>::Callback {
+   public:
+    Hook(NetProfiler* profiler, Profiler::Phase phase, bool begin)
+        : profiler_(profiler), phase_(phase), begin_(begin) {}
+
+   protected:
+    virtual void run(int layer);
+
+    NetProfiler* profiler_;
+    Profiler::Phase phase_;
+    bool begin_;
+  };
+
+  uint64_t bytes(int layer) const;
+
+  Net<Dtype>* net_;
+  // interned names of the layers
+  vector<int> names_;
+  // start of the running layer
+  uint64_t start_;
+  vector<shared_ptr<Hook> > hooks_;
+
+  DISABLE_COPY_AND_ASSIGN(NetProfiler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PROFILER_HPP_
@@ -0,0 +1,61 @@
+#ifndef CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+#define CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Copies of the learned net and solver state taken on the training
+ *        thread, and the files to write them to, in order.
+ */
+struct StagedSnapshot {
+  vector<shared_ptr< ::google::protobuf::Message> > protos;
+  vector<string> filenames;
+};
+
+/**
+ * @brief Writes the snapshots of a Solver on a background thread, so that
+ *        training goes on while they are serialized and synced.
+ *
+ * At most max_in_flight snapshots are staged or being written at a time;
+ * staging another one waits for the oldest to be written. Each file is
+ * written as filename + ".tmp", synced, and renamed over filename, so that
+ * a crash never leaves a partial snapshot behind.
+ */
+class SnapshotWriter : public InternalThread {
+ public:
+  explicit SnapshotWriter(int max_in_flight);
+  // Waits for the queued snapshots.
+  virtual ~SnapshotWriter();
+
+  // An empty snapshot to stage into.
+  StagedSnapshot* free_snapshot();
+  // Queues snapshot to be written after the snapshots pushed before it.
+  void Push(StagedSnapshot* snapshot);
+  // Waits until the queued snapshots are written.
+  void Wait();
+
+  static void WriteAtomically(const ::google::protobuf::Message& proto,
+      const string& filename);
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  vector<shared_ptr<StagedSnapshot> > snapshots_;
+  BlockingQueue<StagedSnapshot*> free_;
+  BlockingQueue<StagedSnapshot*> full_;
+
+  DISABLE_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
@@ -31,6 +31,26 @@ void col2vol_cpu(const Dtype* data_col, const int channels, const int length,
     const int height, const int width, const int ksize, const int kdepth, const int pad,
     const int temporal_pad, const int stride, const int temporal_stride, Dtype* data_im);
 
+// Rows row_begin, ..., row_end - 1 of the column matrix, where output row
+// l * height_col + h holds the width_col columns at depth l and height h.
+// The tile is packed: it has (row_end - row_begin) * width_col columns.
+// With row_begin = 0 and row_end = length_col * height_col, this is the
+// whole of vol2col_cpu. Used to lower the volume one tile at a time.
+template <typename Dtype>
+void vol2col_rows_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int row_begin, const int row_end,
+    Dtype* data_col);
+
+// Adds a tile from vol2col_rows_cpu back into data_im, without clearing it.
+template <typename Dtype>
+void col2vol_rows_cpu(const Dtype* data_col, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int row_begin, const int row_end,
+    Dtype* data_im);
+
 template <typename Dtype>
 void vol2col_gpu(const Dtype* data_im, const int channels, const int length,
 	    const int height, const int width, const int ksize, const int kdepth, const int pad,
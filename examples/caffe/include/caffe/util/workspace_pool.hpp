@@ -0,0 +1,98 @@
+#ifndef CAFFE_UTIL_WORKSPACE_POOL_HPP_
+#define CAFFE_UTIL_WORKSPACE_POOL_HPP_
+
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Host scratch buffers for the worker threads of a parallel layer,
+ *        such as per-thread column buffers.
+ *
+ * Each thread that runs a net has its own pool, shared by all the layers
+ * it runs: layers run one at a time, so a buffer only has to be as large as
+ * the largest request. Buffers only grow; call Reserve before entering the
+ * parallel region, as it is not safe to call from the workers.
+ */
+class WorkspacePool {
+ public:
+  ~WorkspacePool();
+
+  // The pool of the calling thread.
+  static WorkspacePool& Get();
+
+  // Makes buffers 0, ..., num_buffers - 1 at least size bytes each.
+  void Reserve(int num_buffers, size_t size);
+  // Buffer i, valid until the next Reserve that grows it.
+  inline void* buffer(int i) { return buffers_[i]; }
+  // Total bytes held by the pool.
+  size_t size() const;
+
+ private:
+  WorkspacePool() {}
+
+  vector<void*> buffers_;
+  vector<size_t> sizes_;
+  vector<bool> use_cuda_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkspacePool);
+};
+
+// Number of threads to run n independent items on: at most n, and 1 when
+// built without OpenMP.
+int ParallelThreads(int n);
+
+// Index of the calling thread within the enclosing parallel region.
+int ParallelThreadId();
+
+/**
+ * @brief Runs sample(n, scratch, thread_diff) for each n in [0, num) on
+ *        num_threads threads, and sums the diffs they accumulate.
+ *
+ * Each thread accumulates the diffs of its samples in its own buffer of the
+ * calling thread's pool, after scratch_count values of scratch space, so
+ * that the samples need no locking; they are summed up at the end. Each
+ * diff is a target and its count; thread_diff holds them back to back,
+ * zeroed, in the same order.
+ */
+template <typename Dtype, typename Sample>
+void ParallelAccumulate(int num, int num_threads, int scratch_count,
+    const vector<std::pair<Dtype*, int> >& diffs, const Sample& sample) {
+  int diff_count = 0;
+  for (int i = 0; i < diffs.size(); ++i) {
+    diff_count += diffs[i].second;
+  }
+  WorkspacePool& pool = WorkspacePool::Get();
+  pool.Reserve(num_threads, (scratch_count + diff_count) * sizeof(Dtype));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+    Dtype* scratch = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+    Dtype* thread_diff = scratch + scratch_count;
+    caffe_set(diff_count, Dtype(0), thread_diff);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int n = 0; n < num; ++n) {
+      sample(n, scratch, thread_diff);
+    }
+  }
+  for (int t = 0; t < num_threads; ++t) {
+    const Dtype* thread_diff =
+        static_cast<const Dtype*>(pool.buffer(t)) + scratch_count;
+    for (int i = 0; i < diffs.size(); ++i) {
+      caffe_axpy<Dtype>(diffs[i].second, Dtype(1), thread_diff,
+          diffs[i].first);
+      thread_diff += diffs[i].second;
+    }
+  }
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKSPACE_POOL_HPP_
@@ -5,6 +5,7 @@
 #include "caffe/layers/base_conv_layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/workspace_pool.hpp"
 
 namespace caffe {
 
@@ -14,6 +15,7 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
   force_nd_im2col_ = conv_param.force_nd_im2col();
+  batch_parallel_ = conv_param.batch_parallel();
   channel_axis_ = bottom[0]->CanonicalAxisIndex(conv_param.axis());
   const int first_spatial_axis = channel_axis_ + 1;
   const int num_axes = bottom[0]->num_axes();
@@ -254,18 +256,21 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
-    const Dtype* weights, Dtype* output, bool skip_im2col) {
-  const Dtype* col_buff = input;
+    const Dtype* weights, Dtype* output, bool skip_im2col, Dtype* col_buff) {
+  const Dtype* col_input = input;
   if (!is_1x1_) {
+    if (!col_buff) {
+      col_buff = col_buffer_.mutable_cpu_data();
+    }
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buff);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_input = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
         group_, conv_out_spatial_dim_, kernel_dim_,
-        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., weights + weight_offset_ * g, col_input + col_offset_ * g,
         (Dtype)0., output + output_offset_ * g);
   }
 }
@@ -278,10 +283,56 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
       (Dtype)1., output);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_fused(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output, Dtype* col_buff) {
+  // Output tiles of about 256 KiB stay in L2 between the gemm and the
+  // epilogue.
+  const int kTileBytes = 256 * 1024;
+  const int tile_size = std::max(1, std::min(conv_out_spatial_dim_,
+      kTileBytes / static_cast<int>(sizeof(Dtype) * conv_out_channels_)));
+  const Dtype* col_input = input;
+  if (!is_1x1_) {
+    if (!col_buff) {
+      col_buff = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_buff);
+    col_input = col_buff;
+  }
+  for (int begin = 0; begin < conv_out_spatial_dim_; begin += tile_size) {
+    const int size = std::min(tile_size, conv_out_spatial_dim_ - begin);
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm_ld<Dtype>(CblasNoTrans, CblasNoTrans,
+          conv_out_channels_ / group_, size, kernel_dim_,
+          (Dtype)1., weights + weight_offset_ * g, kernel_dim_,
+          col_input + col_offset_ * g + begin, conv_out_spatial_dim_,
+          (Dtype)0., output + output_offset_ * g + begin,
+          conv_out_spatial_dim_);
+    }
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      Dtype* out = output + c * conv_out_spatial_dim_ + begin;
+      const Dtype b = bias ? bias[c] : Dtype(0);
+      if (fused_relu_) {
+        const Dtype slope = fused_relu_negative_slope_;
+        for (int i = 0; i < size; ++i) {
+          const Dtype value = out[i] + b;
+          out[i] = value > 0 ? value : value * slope;
+        }
+      } else {
+        for (int i = 0; i < size; ++i) {
+          out[i] += b;
+        }
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+    const Dtype* weights, Dtype* input, Dtype* col_buff) {
+  if (!col_buff) {
+    col_buff = col_buffer_.mutable_cpu_data();
+  }
   if (is_1x1_) {
     col_buff = input;
   }
@@ -298,16 +349,19 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
-  const Dtype* col_buff = input;
+    const Dtype* output, Dtype* weights, Dtype* col_buff) {
+  const Dtype* col_input = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    if (!col_buff) {
+      col_buff = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_buff);
+    col_input = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
         kernel_dim_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., output + output_offset_ * g, col_input + col_offset_ * g,
         (Dtype)1., weights + weight_offset_ * g);
   }
 }
@@ -319,6 +373,82 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_sample(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output, Dtype* col_buff) {
+  if (fused_relu_) {
+    forward_cpu_gemm_fused(input, weights, bias, output, col_buff);
+    return;
+  }
+  forward_cpu_gemm(input, weights, output, false, col_buff);
+  if (bias) {
+    forward_cpu_bias(output, bias);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_samples(const Dtype* bottom_data,
+    const Dtype* weights, Dtype* top_data) {
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const int num_threads = batch_parallel_ ? ParallelThreads(num_) : 1;
+  if (num_threads == 1) {
+    for (int n = 0; n < num_; ++n) {
+      forward_cpu_sample(bottom_data + n * bottom_dim_, weights, bias,
+          top_data + n * top_dim_, NULL);
+    }
+    return;
+  }
+
+  WorkspacePool& pool = WorkspacePool::Get();
+  pool.Reserve(num_threads, col_buffer_.count() * sizeof(Dtype));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+  for (int n = 0; n < num_; ++n) {
+    Dtype* col_buff = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+    forward_cpu_sample(bottom_data + n * bottom_dim_, weights, bias,
+        top_data + n * top_dim_, col_buff);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_samples(
+    const Dtype* bottom_data, const Dtype* top_diff, const Dtype* weights,
+    Dtype* weight_diff, Dtype* bottom_diff) {
+  const int num_threads = batch_parallel_ ? ParallelThreads(num_) : 1;
+  if (num_threads == 1) {
+    for (int n = 0; n < num_; ++n) {
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (weight_diff) {
+        weight_cpu_gemm(bottom_data + n * bottom_dim_,
+            top_diff + n * top_dim_, weight_diff);
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (bottom_diff) {
+        backward_cpu_gemm(top_diff + n * top_dim_, weights,
+            bottom_diff + n * bottom_dim_);
+      }
+    }
+    return;
+  }
+
+  vector<std::pair<Dtype*, int> > diffs;
+  if (weight_diff) {
+    diffs.push_back(std::make_pair(weight_diff, this->blobs_[0]->count()));
+  }
+  ParallelAccumulate(num_, num_threads, col_buffer_.count(), diffs,
+      [&](int n, Dtype* col_buff, Dtype* thread_weight_diff) {
+        if (weight_diff) {
+          weight_cpu_gemm(bottom_data + n * bottom_dim_,
+              top_diff + n * top_dim_, thread_weight_diff, col_buff);
+        }
+        if (bottom_diff) {
+          backward_cpu_gemm(top_diff + n * top_dim_, weights,
+              bottom_diff + n * bottom_dim_, col_buff);
+        }
+      });
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
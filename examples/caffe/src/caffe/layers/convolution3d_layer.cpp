@@ -15,6 +15,8 @@
  */
 
 
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -22,7 +24,7 @@
 #include "caffe/util/vol2col.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
-#include "caffe/util/benchmark.hpp"
+#include "caffe/util/workspace_pool.hpp"
 
 namespace caffe {
 
@@ -52,6 +54,7 @@ void Convolution3DLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   width_ = bottom[0]->shape(4);
   num_output_ = this->layer_param_.convolution3d_param().num_output();
   filter_group_ = this->layer_param_.convolution3d_param().filter_group();
+  batch_parallel_ = this->layer_param_.convolution3d_param().batch_parallel();
   CHECK_GT(num_output_, 0);
 
   // number of output filters must be divided by filter_group
@@ -64,6 +67,20 @@ void Convolution3DLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   int width_out = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
   int length_out = (length_ + 2 * temporal_pad_ - kernel_depth_) / temporal_stride_ + 1;
 
+  // With implicit_gemm, it only holds a tile of rows that fits in cache.
+  // The GPU kernels always lower the whole image, and grow it when they run.
+  const size_t kTileBytes = 1 << 20;
+  col_rows_ = length_out * height_out;
+  col_width_ = width_out;
+  tile_rows_ = col_rows_;
+  if (this->layer_param_.convolution3d_param().implicit_gemm()
+      && Caffe::mode() == Caffe::CPU) {
+    const size_t row_bytes = sizeof(Dtype) * width_out
+        * channels_ * kernel_depth_ * kernel_size_ * kernel_size_;
+    tile_rows_ = std::max(1, std::min(col_rows_,
+        static_cast<int>(kTileBytes / row_bytes)));
+  }
+
   vector<int> top_shape(5);
   vector<int> weight_shape(5);
   vector<int> col_shape(5);
@@ -71,8 +88,8 @@ void Convolution3DLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   col_shape[0] = 1;
   col_shape[1] = channels_ * kernel_depth_ * kernel_size_ * kernel_size_;
-  col_shape[2] = length_out;
-  col_shape[3] = height_out;
+  col_shape[2] = 1;
+  col_shape[3] = tile_rows_;
   col_shape[4] = width_out;
 
 
@@ -151,123 +168,181 @@ void Convolution3DLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::reshape_col_buffer_for_image() {
+  if (col_buffer_.shape(3) < col_rows_) {
+    vector<int> col_shape = col_buffer_.shape();
+    col_shape[3] = col_rows_;
+    col_buffer_.Reshape(col_shape);
+  }
+}
 
 template <typename Dtype>
-void Convolution3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-	    const vector<Blob<Dtype>*>& top) {
+void Convolution3DLayer<Dtype>::forward_cpu_sample(const Dtype* bottom_data,
+    const Dtype* weight, const Dtype* bias, Dtype* col, Dtype* top_data) {
+  int weight_offset = M_ * K_;
+  int top_offset = M_ * N_;
 
-  CPUTimer timer;
-  timer.Start();
-  double computation;
+  for (int row = 0; row < col_rows_; row += tile_rows_) {
+    const int row_end = std::min(col_rows_, row + tile_rows_);
+    const int tile_offset = row * col_width_;
+    const int tile_N = (row_end - row) * col_width_;
 
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
+    // First, im2col
+    vol2col_rows_cpu(bottom_data, channels_, length_, height_, width_,
+        kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_,
+        temporal_stride_, row, row_end, col);
+
+    // Second, inner-product without filter groups
+    for (int g = 0; g < filter_group_; ++g) {
+      caffe_cpu_gemm_ld<Dtype>(CblasNoTrans, CblasNoTrans, M_, tile_N, K_,
+          (Dtype)1., weight + g * weight_offset, K_, col, tile_N,
+          (Dtype)0., top_data + g * top_offset + tile_offset, N_);
+    }
+  }
+  // third, add bias
+  if (bias_term_) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+        N_, 1, (Dtype)1., bias,
+        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+        (Dtype)1., top_data);
+  }
+}
 
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::backward_cpu_sample(const Dtype* top_diff,
+    const Dtype* bottom_data, const Dtype* weight, Dtype* col,
+    Dtype* weight_diff, Dtype* bias_diff, Dtype* bottom_diff) {
   int weight_offset = M_ * K_;
   int top_offset = M_ * N_;
-  static const int zero_array[] = {0, 0, 0, 0, 0};
-  vector<int> offset_indices(zero_array, zero_array + 5);
 
-  for (int n = 0; n < num_; ++n) {
-	offset_indices[0] = n;
+  if (bias_term_) {
+    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
+        1., top_diff,
+        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), 1.,
+        bias_diff);
+  }
+  if (bottom_diff) {
+    caffe_set(channels_ * length_ * height_ * width_, Dtype(0), bottom_diff);
+  }
+
+  for (int row = 0; row < col_rows_; row += tile_rows_) {
+    const int row_end = std::min(col_rows_, row + tile_rows_);
+    const int tile_offset = row * col_width_;
+    const int tile_N = (row_end - row) * col_width_;
+
+    // since we saved memory in the forward pass by not storing all col data,
+    // we will need to recompute them.
+    vol2col_rows_cpu(bottom_data, channels_, length_, height_, width_,
+        kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_,
+        temporal_stride_, row, row_end, col);
+
+    // gradient w.r.t. weight. Note that we will accumulate diffs.
+    for (int g = 0; g < filter_group_; ++g) {
+      caffe_cpu_gemm_ld<Dtype>(CblasNoTrans, CblasTrans, M_, K_, tile_N,
+          (Dtype)1., top_diff + g * top_offset + tile_offset, N_, col, tile_N,
+          (Dtype)1., weight_diff + g * weight_offset, K_);
+    }
 
-	// First, im2col
-    vol2col_cpu(bottom_data + bottom[0]->offset(offset_indices), channels_, length_, height_,
-	    		  width_, kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_, temporal_stride_, col_data);
+    // gradient w.r.t. bottom data, if necessary
+    if (bottom_diff) {
+      // The col data is no longer needed, so col holds col_diff from here on.
+      // compute first filter group -> col_diff
+      caffe_cpu_gemm_ld<Dtype>(CblasTrans, CblasNoTrans, K_, tile_N, M_,
+          (Dtype)1., weight, K_, top_diff + tile_offset, N_,
+          (Dtype)0., col, tile_N);
+
+      // accumulate the other filter groups -> col_diff
+      for (int g = 1; g < filter_group_; ++g) {
+        caffe_cpu_gemm_ld<Dtype>(CblasTrans, CblasNoTrans, K_, tile_N, M_,
+            (Dtype)1., weight + g * weight_offset, K_,
+            top_diff + g * top_offset + tile_offset, N_,
+            (Dtype)1., col, tile_N);
+      }
+
+      // vol2im back to the data
+      col2vol_rows_cpu(col, channels_, length_, height_, width_, kernel_size_,
+          kernel_depth_, pad_, temporal_pad_, stride_, temporal_stride_, row,
+          row_end, bottom_diff);
+    }
+  }
+}
 
-    // Second, inner-product without filter groups
-	for (int g=0 ; g < filter_group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-	    (Dtype)1., weight + g * weight_offset, col_data,
-	    (Dtype)0., top_data + top[0]->offset(offset_indices) + g * top_offset);
-	}
-      // third, add bias
-	if (bias_term_) {
-	  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-	   N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-	   reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-	   (Dtype)1., top_data + top[0]->offset(offset_indices));
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const int bottom_dim = bottom[0]->count(1);
+  const int top_dim = top[0]->count(1);
+
+  const int num_threads = batch_parallel_ ? ParallelThreads(num_) : 1;
+  if (num_threads == 1) {
+    Dtype* col_data = col_buffer_.mutable_cpu_data();
+    for (int n = 0; n < num_; ++n) {
+      forward_cpu_sample(bottom_data + n * bottom_dim, weight, bias, col_data,
+          top_data + n * top_dim);
     }
+    return;
+  }
 
+  WorkspacePool& pool = WorkspacePool::Get();
+  pool.Reserve(num_threads, col_buffer_.count() * sizeof(Dtype));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+  for (int n = 0; n < num_; ++n) {
+    Dtype* col_data = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+    forward_cpu_sample(bottom_data + n * bottom_dim, weight, bias, col_data,
+        top_data + n * top_dim);
   }
-  computation = timer.MilliSeconds();
-  std::ofstream out("profile_inference.log", std::ofstream::out | std::ofstream::app);
-  out << this->layer_param_.name() << " CPU " << computation << "\n";
-  out.close();
 }
 
 template <typename Dtype>
 void Convolution3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-	      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
+  Dtype* bottom_diff = propagate_down[0] ? bottom[0]->mutable_cpu_diff() : NULL;
+  const int weight_count = this->blobs_[0]->count();
+  const int bottom_dim = bottom[0]->count(1);
+  const int top_dim = top[0]->count(1);
   // bias gradient if necessary
   Dtype* bias_diff = NULL;
 
-  static const int zero_array[] = {0, 0, 0, 0, 0};
-  vector<int> offset_indices(zero_array, zero_array + 5);
-
+  memset(weight_diff, 0, sizeof(Dtype) * weight_count);
   if (bias_term_) {
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
     memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+  }
+
+  const int num_threads = batch_parallel_ ? ParallelThreads(num_) : 1;
+  if (num_threads == 1) {
+    Dtype* col = col_buffer_.mutable_cpu_data();
     for (int n = 0; n < num_; ++n) {
-      offset_indices[0] = n;
-	  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
-		  1., top_diff + top[0]->offset(offset_indices),
-		  reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), 1.,
-		  bias_diff);
+      backward_cpu_sample(top_diff + n * top_dim,
+          bottom_data + n * bottom_dim, weight, col, weight_diff, bias_diff,
+          bottom_diff ? bottom_diff + n * bottom_dim : NULL);
     }
+    return;
   }
 
-  int weight_offset = M_ * K_;
-  int top_offset = M_ * N_;
-
-  memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
-  for (int n = 0; n < num_; ++n) {
-	  offset_indices[0] = n;
-	// since we saved memory in the forward pass by not storing all col data,
-	// we will need to recompute them.
-	vol2col_cpu(bottom_data + bottom[0]->offset(offset_indices), channels_, length_, height_,
-					  width_, kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_,
-					  temporal_stride_, col_data);
-
-	// gradient w.r.t. weight. Note that we will accumulate diffs.
-	for (int g=0; g<filter_group_; ++g){
-		caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-				(Dtype)1., top_diff + top[0]->offset(offset_indices) + g * top_offset,
-				col_data, (Dtype)1.,
-				weight_diff + g * weight_offset);
-	}
-
-	// gradient w.r.t. bottom data, if necessary
-	if (propagate_down[0]) {
-	  // compute first filter group -> col_diff
-	  caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-	    (Dtype)1., weight,
-		top_diff + top[0]->offset(offset_indices),
-		(Dtype)0., col_diff);
-
-	  // accumulate the other filter groups -> col_diff
-	  for (int g=1; g<filter_group_; ++g){
-	    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-	      (Dtype)1., weight + g * weight_offset,
-		  top_diff + top[0]->offset(offset_indices) + g * top_offset,
-		  (Dtype)1., col_diff);
-	  }
-
-	  // vol2im back to the data
-	  col2vol_cpu(col_diff, channels_, length_, height_, width_, kernel_size_, kernel_depth_, pad_,
-		  temporal_pad_, stride_, temporal_stride_, bottom_diff + bottom[0]->offset(offset_indices));
-	}
-
+  vector<std::pair<Dtype*, int> > diffs(1,
+      std::make_pair(weight_diff, weight_count));
+  if (bias_term_) {
+    diffs.push_back(std::make_pair(bias_diff, num_output_));
   }
+  ParallelAccumulate(num_, num_threads, col_buffer_.count(), diffs,
+      [&](int n, Dtype* col, Dtype* thread_diff) {
+        backward_cpu_sample(top_diff + n * top_dim,
+            bottom_data + n * bottom_dim, weight, col, thread_diff,
+            thread_diff + weight_count,
+            bottom_diff ? bottom_diff + n * bottom_dim : NULL);
+      });
 }
 
 #ifdef CPU_ONLY
@@ -0,0 +1,305 @@
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/dragon_base_data_layer.hpp"
+
+namespace caffe
+{
+    template <typename Dtype>
+    DragonBaseDataLayer<Dtype>::DragonBaseDataLayer(const LayerParameter& param)
+        : BaseDataLayer<Dtype>(param),
+          data_offset_(0), labels_offset_(0),
+          storage_(dragon_mem_dtype<Dtype>()), decode_scale_(1),
+          labels_storage_(dragon_mem_dtype<Dtype>()),
+          bytes_read_(0),
+          prefetch_(param.dragon_data_param().prefetch()),
+          prefetch_free_(), prefetch_full_(), prefetch_current_()
+    {
+        this->data_source_ = this->layer_param_.dragon_data_param().data_source();
+        this->data_width_ = this->layer_param_.dragon_data_param().width();
+        this->data_height_ = this->layer_param_.dragon_data_param().height();
+        this->data_depth_ = this->layer_param_.dragon_data_param().depth();
+        this->data_channels_ = this->layer_param_.dragon_data_param().channels();
+        this->data_length_ = this->layer_param_.dragon_data_param().length();
+
+        this->labels_source_ = this->layer_param_.dragon_data_param().labels_source();
+        this->labels_length_ = this->data_length_;
+
+        this->batch_size_ = this->layer_param_.dragon_data_param().batch_size();
+
+        CHECK_GT(this->prefetch_.size(), 0U) << "prefetch must be at least 1";
+        for (int i = 0; i < this->prefetch_.size(); ++i)
+        {
+            this->prefetch_[i].reset(new DragonBatch<Dtype>());
+            this->prefetch_free_.push(this->prefetch_[i].get());
+        }
+    }
+
+    template <typename Dtype>
+    DragonBaseDataLayer<Dtype>::~DragonBaseDataLayer()
+    {
+        this->StopInternalThread();
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+          const vector<Blob<Dtype>*>& top)
+    {
+        this->ReadHeaders(top.size() > 1);
+        this->SetUpDecoding();
+        CHECK_GT(this->data_length_, 0U) << "length must be set";
+        BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
+
+        top[0]->Reshape(this->data_shape_(this->batch_size_));
+        if (this->output_labels_)
+        {
+            vector<int> label_shape(1, this->batch_size_);
+            top[1]->Reshape(label_shape);
+        }
+
+        const DragonDataParameter& param = this->layer_param_.dragon_data_param();
+        uint32_t num_shards = 1;
+        uint32_t shard_id = 0;
+        if (this->phase_ == TRAIN)
+        {
+            num_shards = Caffe::solver_count();
+            shard_id = Caffe::solver_rank();
+        }
+        if (param.has_num_shards())
+            num_shards = param.num_shards();
+        if (param.has_shard_id())
+            shard_id = param.shard_id();
+        this->sampler_.reset(new DragonSampler(
+            this->data_length_,
+            param.chunk_size() / this->size_per_data_item_(),
+            param.shuffle_window(),
+            param.shuffle(),
+            param.shuffle_seed(),
+            num_shards,
+            shard_id
+        ));
+
+        // Allocate on this thread, as BasePrefetchingDataLayer does, so that
+        // the prefetch thread never races the main one on cudaMallocHost.
+        if (this->reads_into_batches() || !this->sampler_->contiguous() || this->decodes())
+        {
+            for (int i = 0; i < this->prefetch_.size(); ++i)
+            {
+                this->prefetch_[i]->data_.Reshape(this->data_shape_(this->batch_size_));
+                this->prefetch_[i]->data_.mutable_cpu_data();
+                if (this->output_labels_)
+                {
+                    vector<int> label_shape(1, this->batch_size_);
+                    this->prefetch_[i]->label_.Reshape(label_shape);
+                    this->prefetch_[i]->label_.mutable_cpu_data();
+                }
+            }
+        }
+
+        DLOG(INFO) << "Initializing prefetch";
+        this->StartInternalThread();
+        DLOG(INFO) << "Prefetch initialized.";
+    }
+
+    // Fails if a dimension given in the layer parameters differs from the
+    // one in the header.
+    static void check_dim(const char *name, bool has, uint32_t given, uint32_t dim,
+          const std::string& source)
+    {
+        CHECK(!has || given == dim) << name << " is " << given << " but "
+            << source << " holds items of " << name << " " << dim;
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::ReadHeaders(bool with_labels)
+    {
+        const DragonDataParameter& param = this->layer_param_.dragon_data_param();
+        DragonMemHeader header;
+        if (!ReadDragonMemHeader(this->data_source_, &header))
+        {
+            LOG(WARNING) << this->data_source_ << " has no header; "
+                "trusting the shape in dragon_data_param";
+            return;
+        }
+        // Items of any type are decoded into Dtype.
+        CHECK_LE(header.dtype, (uint32_t)DRAGON_MEM_FLOAT16)
+            << this->data_source_ << " holds items of unknown type " << header.dtype;
+        CHECK(header.num_axes == 3 || header.num_axes == 4)
+            << this->data_source_ << " holds items of " << header.num_axes << " axes";
+
+        uint32_t depth = header.num_axes == 4 ? header.shape[1] : 0;
+        check_dim("channels", param.has_channels(), this->data_channels_, header.shape[0], this->data_source_);
+        check_dim("depth", param.has_depth(), this->data_depth_, depth, this->data_source_);
+        check_dim("height", param.has_height(), this->data_height_, header.shape[header.num_axes - 2], this->data_source_);
+        check_dim("width", param.has_width(), this->data_width_, header.shape[header.num_axes - 1], this->data_source_);
+        CHECK(!param.has_length() || this->data_length_ <= header.num_items)
+            << "length is " << this->data_length_ << " but " << this->data_source_
+            << " holds " << header.num_items << " items";
+        this->data_channels_ = header.shape[0];
+        this->data_depth_ = depth;
+        this->data_height_ = header.shape[header.num_axes - 2];
+        this->data_width_ = header.shape[header.num_axes - 1];
+        if (!param.has_length())
+            this->data_length_ = header.num_items;
+        this->labels_length_ = this->data_length_;
+        this->data_offset_ = header.payload_offset;
+        this->storage_ = (DragonMemDtype)header.dtype;
+        if (param.verify_checksum())
+            CheckDragonMemPayload(this->data_source_, header);
+
+        if (!with_labels)
+            return;
+        CHECK(ReadDragonMemHeader(this->labels_source_, &header))
+            << this->labels_source_ << " has no header but " << this->data_source_ << " has";
+        // Labels of any type are decoded into Dtype as well.
+        CHECK_LE(header.dtype, (uint32_t)DRAGON_MEM_FLOAT16)
+            << this->labels_source_ << " holds labels of unknown type " << header.dtype;
+        CHECK_EQ(header.num_axes, 0U) << this->labels_source_ << " does not hold labels";
+        CHECK_GE(header.num_items, this->labels_length_)
+            << this->labels_source_ << " holds fewer labels than there are items";
+        this->labels_offset_ = header.payload_offset;
+        this->labels_storage_ = (DragonMemDtype)header.dtype;
+        if (param.verify_checksum())
+            CheckDragonMemPayload(this->labels_source_, header);
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::SetUpDecoding()
+    {
+        if (!this->decodes())
+            return;
+        const TransformationParameter& param = this->transform_param_;
+        CHECK(!param.has_mean_file()) << "mean_file cannot be applied while decoding "
+            << this->data_source_ << "; use mean_value";
+        if (param.mean_value_size() > 0)
+        {
+            CHECK(param.mean_value_size() == 1 || param.mean_value_size() == this->data_channels_)
+                << "Specify either 1 mean_value or as many as channels: " << this->data_channels_;
+            for (int c = 0; c < this->data_channels_; ++c)
+                this->decode_mean_.push_back(param.mean_value(param.mean_value_size() == 1 ? 0 : c));
+        }
+        this->decode_scale_ = param.scale();
+        LOG(INFO) << "Decoding " << DragonMemDtypeSize(this->storage_)
+            << "-byte values of " << this->data_source_;
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::InternalThreadEntry()
+    {
+        try
+        {
+            while (!this->must_stop())
+            {
+                DragonBatch<Dtype>* batch = this->prefetch_free_.pop();
+                vector<DragonSampler::Run> window;
+                batch->runs_.clear();
+                batch->count_ = this->sampler_->Next(this->batch_size_, &batch->runs_, &window);
+                for (int i = 0; i < window.size(); ++i)
+                    this->Readahead(window[i]);
+
+                this->load_batch(batch);
+                this->bytes_read_ += batch->count_ * (this->size_per_data_item_() +
+                    (this->output_labels_ ? this->size_per_label_() : 0));
+                this->prefetch_full_.push(batch);
+            }
+        }
+        catch (boost::thread_interrupted&)
+        {
+            // Interrupted exception is expected on shutdown
+        }
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+          const vector<Blob<Dtype>*>& top)
+    {
+        if (this->prefetch_current_)
+            this->prefetch_free_.push(this->prefetch_current_);
+        this->prefetch_current_ = this->prefetch_full_.pop("Waiting for data");
+
+        top[0]->Reshape(this->data_shape_(this->prefetch_current_->count_));
+        if (this->output_labels_)
+        {
+            vector<int> label_shape(1, this->prefetch_current_->count_);
+            top[1]->Reshape(label_shape);
+        }
+        this->SetTops(this->prefetch_current_, top);
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::GatherBatch(DragonBatch<Dtype>* batch,
+          const char* data, const char* labels)
+    {
+        size_t item_size = this->size_per_data_item_();
+        batch->data_.Reshape(this->data_shape_(batch->count_));
+        Dtype *dst = batch->data_.mutable_cpu_data();
+        for (int i = 0; i < batch->runs_.size(); ++i)
+        {
+            const DragonSampler::Run& run = batch->runs_[i];
+            this->DecodeItems(data + run.first * item_size, run.second, dst);
+            dst += run.second * this->num_elements_per_data_item_();
+        }
+
+        if (this->output_labels_)
+        {
+            vector<int> label_shape(1, batch->count_);
+            batch->label_.Reshape(label_shape);
+            Dtype *label_dst = batch->label_.mutable_cpu_data();
+            for (int i = 0; i < batch->runs_.size(); ++i)
+            {
+                const DragonSampler::Run& run = batch->runs_[i];
+                dragon_decode<Dtype>(this->labels_storage_,
+                    labels + run.first * this->size_per_label_(), run.second,
+                    1, 1, NULL, Dtype(1), label_dst);
+                label_dst += run.second;
+            }
+        }
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::DecodeItems(const char* src, size_t count, Dtype* dst)
+    {
+        // Items of type Dtype have no mean nor scale, and are copied.
+        dragon_decode(
+            this->storage_,
+            src,
+            count,
+            this->data_channels_,
+            this->num_elements_per_data_item_() / this->data_channels_,
+            this->decode_mean_.empty() ? (const Dtype *)NULL : &this->decode_mean_[0],
+            this->decode_scale_,
+            dst
+        );
+    }
+
+    template <typename Dtype>
+    void DragonBaseDataLayer<Dtype>::TouchPages(const void* ptr, size_t size, size_t stride)
+    {
+        const volatile char *p = (const volatile char *)ptr;
+        for (size_t offset = 0; offset < size; offset += stride)
+            (void)p[offset];
+        if (size > 0)
+            (void)p[size - 1];
+    }
+
+    template <typename Dtype>
+    vector<int> DragonBaseDataLayer<Dtype>::data_shape_(uint32_t count)
+    {
+        vector<int> data_shape;
+        data_shape.push_back(count);
+        data_shape.push_back(this->data_channels_);
+        if (this->is_3d_data())
+            data_shape.push_back(this->data_depth_);
+        data_shape.push_back(this->data_height_);
+        data_shape.push_back(this->data_width_);
+        return data_shape;
+    }
+
+    INSTANTIATE_CLASS(DragonBaseDataLayer);
+
+}  // namespace caffe
@@ -1,77 +1,146 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
+#include <string>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/dragon_convert_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/dragon_codec.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
 DragonConvertDataLayer<Dtype>::DragonConvertDataLayer(const LayerParameter& param)
-  : BaseDataLayer<Dtype>(param),
-    transformed_data_() {
+  : BaseDataLayer<Dtype>(param), next_record_(0) {
   db_.reset(db::GetDB(param.data_param().backend()));
   db_->Open(param.data_param().source(), db::READ);
   cursor_.reset(db_->NewCursor());
-
-  std::string data_out = this->layer_param_.dragon_convert_data_param().data_out();
-  std::string labels_out = this->layer_param_.dragon_convert_data_param().labels_out();
-
-  out_data_file_ = fopen(data_out.c_str(), "w+");
-  out_label_file_ = fopen(labels_out.c_str(), "w+");
-
-  CHECK(out_data_file_) << "Cannot open/create " << data_out;
-  CHECK(out_label_file_) << "Cannot open/create " << labels_out;
+  writer_.reset(new DragonConvertWriter(param.dragon_convert_data_param()));
 }
 
 template <typename Dtype>
 void DragonConvertDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  // Read a data point, and use it to initialize the top blob.
+  const DragonConvertDataParameter& param =
+      this->layer_param_.dragon_convert_data_param();
+  // Skip the records an interrupted run already converted.
+  for (uint64_t i = 0; i < writer_->cursor() && cursor_->valid(); ++i) {
+    cursor_->Next();
+  }
+
+  // Read a data point, and use it to infer the shape of every record.
+  CHECK(cursor_->valid()) << "No records left to convert";
   Datum datum;
-  size_t write_ret = 0;
-  long data_index = 0;
-  while (cursor_->valid()) {
-      datum.ParseFromString(cursor_->value());
+  datum.ParseFromString(cursor_->value());
+  top_shape_ = this->data_transformer_->InferBlobShape(datum);
+  storage_ = DragonConvertWriter::storage(param, dragon_mem_dtype<Dtype>());
+  const size_t record_size =
+      Blob<Dtype>(top_shape_).count() * DragonMemDtypeSize(storage_);
+  const size_t label_size = this->output_labels_ ? sizeof(Dtype) : 0;
+  const uint32_t chunk_records =
+      std::max<uint64_t>(param.chunk_size() / record_size, 1);
 
-      // Use data_transformer to infer the expected blob shape from datum.
-      vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
-      //fprintf(stderr, "===> top_shape: %d %d %d %d\n", top_shape[0], top_shape[1], top_shape[2], top_shape[3]);
-      this->transformed_data_.Reshape(top_shape);
-      this->data_transformer_->Transform(datum, &(this->transformed_data_));
-      write_ret = fwrite(
-         this->transformed_data_.cpu_data(),
-         this->transformed_data_.count() * sizeof(Dtype),
-         1,
-         this->out_data_file_
-      );
-      CHECK_EQ(write_ret, 1) << "Cannot write to data.mem";
-      // label
-      if (this->output_labels_) {
-          Dtype top_label = datum.label();
-          write_ret = fwrite(
-              &top_label,
-              sizeof(Dtype),
-              1,
-              this->out_label_file_
-          );
-          CHECK_EQ(write_ret, 1) << "Cannot write to labels.mem";
+  const int num_workers = DragonConvertWriter::num_workers(param,
+      this->transform_param_.mirror() ||
+      (this->phase_ == TRAIN && this->transform_param_.crop_size()));
+  const TransformationParameter stored_param =
+      DragonConvertWriter::stored_transform(param, dragon_mem_dtype<Dtype>(),
+      this->transform_param_);
+  for (int i = 0; i < num_workers; ++i) {
+    if (i == 0 && storage_ == dragon_mem_dtype<Dtype>()) {
+      transformers_.push_back(this->data_transformer_);
+    } else {
+      transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(stored_param, this->phase_)));
+      transformers_.back()->InitRand();
+    }
+    transformed_data_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(top_shape_)));
+  }
+  LOG(INFO) << "===> Converting on " << num_workers << " threads, "
+      << chunk_records << " records per chunk";
+
+  const DragonMemHeader data_header = NewDragonMemHeader(storage_,
+      vector<int>(top_shape_.begin() + 1, top_shape_.end()));
+  const DragonMemHeader labels_header =
+      NewDragonMemHeader(dragon_mem_dtype<Dtype>(), vector<int>());
+  writer_->Start(data_header, label_size > 0 ? &labels_header : NULL,
+      chunk_records);
+  values_.resize(chunk_records);
+  uint64_t position = writer_->cursor();
+  while (cursor_->valid()) {
+    DragonConvertChunk* chunk = writer_->free_chunk();
+    while (cursor_->valid() && chunk->num_records < chunk_records) {
+      values_[chunk->num_records] = cursor_->value();
+      if (num_workers == 1) {
+        ConvertRecord(chunk, chunk->num_records, 0);
       }
+      ++chunk->num_records;
       cursor_->Next();
-      if (data_index % 100 == 99)
-          LOG(INFO) << "===> Converted data number: " << data_index + 1;
-      ++data_index;
+      ++position;
+    }
+    if (num_workers > 1) {
+      next_record_ = 0;
+      boost::thread_group workers;
+      for (int i = 1; i < num_workers; ++i) {
+        workers.create_thread(boost::bind(
+            &DragonConvertDataLayer<Dtype>::ConvertRecords, this, chunk, i));
+      }
+      ConvertRecords(chunk, 0);
+      workers.join_all();
+    }
+    chunk->cursor = position;
+    writer_->Push(chunk);
   }
-  LOG(INFO) << "===> Converted data number: " << data_index;
+  writer_->Finish();
   LOG(INFO) << "===> Finish converting the data.";
   exit(EXIT_SUCCESS);
 }
 
+template <typename Dtype>
+void DragonConvertDataLayer<Dtype>::ConvertRecords(DragonConvertChunk* chunk,
+      int worker) {
+  uint32_t i;
+  while ((i = next_record_++) < chunk->num_records) {
+    ConvertRecord(chunk, i, worker);
+  }
+}
+
+template <typename Dtype>
+void DragonConvertDataLayer<Dtype>::ConvertRecord(DragonConvertChunk* chunk,
+      uint32_t i, int worker) {
+  Datum datum;
+  datum.ParseFromString(values_[i]);
+  CHECK(transformers_[worker]->InferBlobShape(datum) == top_shape_)
+      << "Every datum must have the shape of the first one";
+
+  // Transform straight into the chunk, unless the record has to be encoded.
+  Blob<Dtype>* transformed = transformed_data_[worker].get();
+  const size_t record_size = transformed->count() * DragonMemDtypeSize(storage_);
+  if (storage_ == dragon_mem_dtype<Dtype>()) {
+    transformed->set_cpu_data(
+        reinterpret_cast<Dtype*>(&chunk->data[i * record_size]));
+    transformers_[worker]->Transform(datum, transformed);
+  } else {
+    transformers_[worker]->Transform(datum, transformed);
+    dragon_encode(storage_, transformed->cpu_data(), transformed->count(),
+        &chunk->data[i * record_size]);
+  }
+  if (this->output_labels_) {
+    Dtype label = datum.label();
+    memcpy(&chunk->labels[i * sizeof(Dtype)], &label, sizeof(Dtype));
+  }
+  chunk->valid[i] = true;
+}
+
 INSTANTIATE_CLASS(DragonConvertDataLayer);
 REGISTER_LAYER_CLASS(DragonConvertData);
 
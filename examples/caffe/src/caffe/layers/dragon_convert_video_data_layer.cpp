@@ -17,8 +17,12 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -29,6 +33,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/layers/dragon_convert_video_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/dragon_codec.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/image_io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -38,20 +43,19 @@ namespace caffe {
 
 template <typename Dtype>
 DragonConvertVideoDataLayer<Dtype>::DragonConvertVideoDataLayer(const LayerParameter& param)
-  : BaseDataLayer<Dtype>(param),
-    transformed_data_() {
-
-  std::string data_out = this->layer_param_.dragon_convert_data_param().data_out();
-  std::string labels_out = this->layer_param_.dragon_convert_data_param().labels_out();
+  : BaseDataLayer<Dtype>(param), next_clip_(0) {
 
   this->limit_num_items_ = this->layer_param_.dragon_convert_data_param().limit_num_items();
   LOG(INFO) << "===> limit_num_items: " << this->limit_num_items_;
 
-  out_data_file_ = fopen(data_out.c_str(), "w+");
-  out_label_file_ = fopen(labels_out.c_str(), "w+");
-
-  CHECK(out_data_file_) << "Cannot open/create " << data_out;
-  CHECK(out_label_file_) << "Cannot open/create " << labels_out;
+  // A shuffled list is shuffled differently on every run, so the clips an
+  // interrupted run converted cannot be told apart from the others.
+  DragonConvertDataParameter convert_param = param.dragon_convert_data_param();
+  if (param.video_data_param().shuffle() && convert_param.resume()) {
+    LOG(WARNING) << "Cannot resume converting a shuffled list; starting over";
+    convert_param.set_resume(false);
+  }
+  writer_.reset(new DragonConvertWriter(convert_param));
 }
 
 template <typename Dtype>
@@ -219,114 +223,180 @@ void DragonConvertVideoDataLayer<Dtype>::DataLayerSetUp(
   }
 
   // Use data_transformer to infer the expected blob shape from a cv_img.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
-  this->transformed_data_.Reshape(top_shape);
+  top_shape_ = this->data_transformer_->InferBlobShape(datum);
+  const size_t label_size = this->output_labels_ ? sizeof(Dtype) : 0;
+  if (this->output_labels_ && use_multiple_label) {
+    LOG(INFO) << "Multiple labels are not supported.";
+    exit(EXIT_FAILURE);
+  }
 
   int num_items = dataset_size;
   if (this->limit_num_items_ > 0 && this->limit_num_items_ < dataset_size)
     num_items = this->limit_num_items_;
 
-  // datum scales
-  for (int item_id = 0; item_id < num_items; ++item_id) {
-    // get a blob
-    if (use_sampling_rate_jitter) {
-      sampling_rate = caffe::caffe_rng_rand() % (max_sampling_rate) + 1;
-    }
-    CHECK_GT(dataset_size, lines_id_);
-    int id = this->shuffle_index_[this->lines_id_];
-    if (!use_image){
-    	if (!use_temporal_jitter){
-            read_status = ReadVideoToVolumeDatum((root_folder + this->file_list_[id]).c_str(), this->start_frm_list_[id],
-            		this->label_list_[id], new_length, new_height, new_width, sampling_rate, &datum);
-        }else{
-        	read_status = ReadVideoToVolumeDatum((root_folder + this->file_list_[id]).c_str(), -1,
-        			this->label_list_[id], new_length, new_height, new_width, sampling_rate, &datum);
-        }
+  // Continue from where an interrupted run stopped.
+  if (writer_->records() > 0)
+    this->lines_id_ = writer_->cursor();
+
+  // Reading a video with temporal jitter draws its start frame from the
+  // thread's random stream, so that conversion stays on this thread.
+  const DragonConvertDataParameter& param =
+      this->layer_param_.dragon_convert_data_param();
+  const int num_workers = DragonConvertWriter::num_workers(param,
+      this->transform_param_.mirror() ||
+      (this->phase_ == TRAIN && this->transform_param_.crop_size()) ||
+      (!use_image && use_temporal_jitter));
+  storage_ = DragonConvertWriter::storage(param, dragon_mem_dtype<Dtype>());
+  const size_t record_size =
+      Blob<Dtype>(top_shape_).count() * DragonMemDtypeSize(storage_);
+  const TransformationParameter stored_param =
+      DragonConvertWriter::stored_transform(param, dragon_mem_dtype<Dtype>(),
+      this->transform_param_);
+  for (int i = 0; i < num_workers; ++i) {
+    if (i == 0 && storage_ == dragon_mem_dtype<Dtype>()) {
+      transformers_.push_back(this->data_transformer_);
     } else {
-        if (!use_temporal_jitter) {
-        	read_status = ReadImageSequenceToVolumeDatum((root_folder + this->file_list_[id]).c_str(), this->start_frm_list_[id],
-        			this->label_list_[id], new_length, new_height, new_width, sampling_rate, &datum);
-        } else {
-        	int num_of_frames = this->start_frm_list_[id];
-        	int use_start_frame;
-        	if (num_of_frames < new_length * sampling_rate){
-        	    LOG(INFO) << "not enough frames; having " << num_of_frames;
-        	    read_status = false;
-        	} else {
-        	    if (this->phase_ == TRAIN)
-        	    	use_start_frame = caffe_rng_rand()%(num_of_frames-new_length*sampling_rate+1) + 1;
-        	    else
-        	    	use_start_frame = 0;
-        	    read_status = ReadImageSequenceToVolumeDatum((root_folder + this->file_list_[id]).c_str(), use_start_frame,
-        	    			    this->label_list_[id], new_length, new_height, new_width, sampling_rate, &datum);
-        	}
-        }
-    }
-
-    if (this->phase_ == TEST){
-        CHECK(read_status) << "Testing must not miss any example";
+      transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(stored_param, this->phase_)));
+      transformers_.back()->InitRand();
     }
-
-    if (!read_status) {
-        this->lines_id_++;
-        if (this->lines_id_ >= dataset_size) {
-        	// We have reached the end. Restart from the first.
-        	DLOG(INFO) << "Restarting data prefetching from start.";
-        	this->lines_id_ = 0;
-        	if (this->layer_param_.video_data_param().shuffle()){
-        		ShuffleClips();
-        	}
-        }
-        item_id--;
-        continue;
-    }
-
-    // Apply transformations (mirror, crop...) to the video
-   	this->data_transformer_->VideoTransform(datum, &(this->transformed_data_));
-    size_t write_ret = fwrite(
-       this->transformed_data_.cpu_data(),
-       this->transformed_data_.count() * sizeof(Dtype),
-       1,
-       this->out_data_file_
-    );
-    CHECK_EQ(write_ret, 1) << "Cannot write to data.mem";
-
-
-    if (this->output_labels_) {
-        if (!use_multiple_label) {
-          Dtype top_label = datum.label();
-          write_ret = fwrite(
-              &top_label,
-              sizeof(Dtype),
-              1,
-              this->out_label_file_
-          );
-          CHECK_EQ(write_ret, 1) << "Cannot write to labels.mem";
+    transformed_data_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(top_shape_)));
+  }
+  const uint32_t chunk_records =
+      std::max<uint64_t>(param.chunk_size() / record_size, 1);
+  LOG(INFO) << "===> Converting on " << num_workers << " threads, "
+      << chunk_records << " records per chunk";
+
+  const DragonMemHeader data_header = NewDragonMemHeader(storage_,
+      vector<int>(top_shape_.begin() + 1, top_shape_.end()));
+  const DragonMemHeader labels_header =
+      NewDragonMemHeader(dragon_mem_dtype<Dtype>(), vector<int>());
+  writer_->Start(data_header, label_size > 0 ? &labels_header : NULL,
+      chunk_records);
+  clips_.resize(chunk_records);
+  int64_t remaining = num_items - (int64_t)writer_->records();
+  while (remaining > 0) {
+    // A clip that fails to read is skipped, so a chunk takes no more clips
+    // than are still needed and the next chunk makes up for the failures.
+    DragonConvertChunk* chunk = writer_->free_chunk();
+    const uint32_t num_clips = std::min<int64_t>(chunk_records, remaining);
+    for (uint32_t i = 0; i < num_clips; ++i) {
+      if (use_sampling_rate_jitter) {
+        sampling_rate = caffe::caffe_rng_rand() % (max_sampling_rate) + 1;
+      }
+      CHECK_GT(dataset_size, lines_id_);
+      Clip& clip = clips_[i];
+      clip.id = this->shuffle_index_[this->lines_id_];
+      clip.sampling_rate = sampling_rate;
+      if (!use_image) {
+        clip.start_frm = use_temporal_jitter ? -1 : this->start_frm_list_[clip.id];
+      } else if (!use_temporal_jitter) {
+        clip.start_frm = this->start_frm_list_[clip.id];
+      } else {
+        int num_of_frames = this->start_frm_list_[clip.id];
+        if (num_of_frames < new_length * sampling_rate) {
+          LOG(INFO) << "not enough frames; having " << num_of_frames;
+          clip.start_frm = kNotEnoughFrames;
+        } else if (this->phase_ == TRAIN) {
+          clip.start_frm = caffe_rng_rand()%(num_of_frames-new_length*sampling_rate+1) + 1;
         } else {
-            LOG(INFO) << "Multiple labels are not supported.";
-            exit(EXIT_FAILURE);
+          clip.start_frm = 0;
+        }
+      }
+      if (num_workers == 1)
+        ConvertClip(chunk, i, 0);
+      ++chunk->num_records;
+
+      // go to the next iter
+      this->lines_id_++;
+      if (lines_id_ >= dataset_size) {
+        // We have reached the end. Restart from the first.
+        DLOG(INFO) << "Restarting data prefetching from start.";
+        lines_id_ = 0;
+        if (this->layer_param_.video_data_param().shuffle()) {
+          ShuffleClips();
         }
+      }
     }
-
-    // go to the next iter
-    this->lines_id_++;
-    if (lines_id_ >= dataset_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.video_data_param().shuffle()) {
-        ShuffleClips();
+    if (num_workers > 1) {
+      next_clip_ = 0;
+      boost::thread_group workers;
+      for (int i = 1; i < num_workers; ++i) {
+        workers.create_thread(boost::bind(
+            &DragonConvertVideoDataLayer<Dtype>::ConvertClips, this, chunk, i));
       }
+      ConvertClips(chunk, 0);
+      workers.join_all();
     }
-
-    if (this->lines_id_ % 50 == 49)
-        LOG(INFO) << "===> Converted data number: " << this->lines_id_ + 1 << " (from " << num_items << ")";
+    for (uint32_t i = 0; i < num_clips; ++i)
+      remaining -= chunk->valid[i];
+    chunk->cursor = this->lines_id_;
+    writer_->Push(chunk);
   }
-  LOG(INFO) << "===> Converted data number: " << this->lines_id_;
+  writer_->Finish();
   LOG(INFO) << "===> Finish converting the data.";
   exit(EXIT_SUCCESS);
 }
 
+template <typename Dtype>
+void DragonConvertVideoDataLayer<Dtype>::ConvertClips(
+      DragonConvertChunk* chunk, int worker) {
+  uint32_t i;
+  while ((i = next_clip_++) < chunk->num_records)
+    ConvertClip(chunk, i, worker);
+}
+
+template <typename Dtype>
+void DragonConvertVideoDataLayer<Dtype>::ConvertClip(
+      DragonConvertChunk* chunk, uint32_t i, int worker) {
+  const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
+  const int new_length = video_data_param.new_length();
+  const int new_height = video_data_param.new_height();
+  const int new_width  = video_data_param.new_width();
+  const Clip& clip = clips_[i];
+  const string filename = video_data_param.root_folder() + this->file_list_[clip.id];
+
+  VolumeDatum datum;
+  bool read_status = false;
+  if (clip.start_frm == kNotEnoughFrames) {
+    read_status = false;
+  } else if (!video_data_param.use_image()) {
+    read_status = ReadVideoToVolumeDatum(filename.c_str(), clip.start_frm,
+        this->label_list_[clip.id], new_length, new_height, new_width,
+        clip.sampling_rate, &datum);
+  } else {
+    read_status = ReadImageSequenceToVolumeDatum(filename.c_str(), clip.start_frm,
+        this->label_list_[clip.id], new_length, new_height, new_width,
+        clip.sampling_rate, &datum);
+  }
+
+  if (this->phase_ == TEST){
+      CHECK(read_status) << "Testing must not miss any example";
+  }
+  chunk->valid[i] = read_status;
+  if (!read_status)
+    return;
+
+  // Apply transformations (mirror, crop...) to the video, straight into
+  // the chunk unless it has to be encoded
+  Blob<Dtype>* transformed = transformed_data_[worker].get();
+  const size_t record_size = transformed->count() * DragonMemDtypeSize(storage_);
+  if (storage_ == dragon_mem_dtype<Dtype>()) {
+    transformed->set_cpu_data(
+        reinterpret_cast<Dtype*>(&chunk->data[i * record_size]));
+    transformers_[worker]->VideoTransform(datum, transformed);
+  } else {
+    transformers_[worker]->VideoTransform(datum, transformed);
+    dragon_encode(storage_, transformed->cpu_data(), transformed->count(),
+        &chunk->data[i * record_size]);
+  }
+  if (this->output_labels_) {
+    Dtype top_label = datum.label();
+    memcpy(&chunk->labels[i * sizeof(Dtype)], &top_label, sizeof(Dtype));
+  }
+}
+
 template <typename Dtype>
 void DragonConvertVideoDataLayer<Dtype>::ShuffleClips() {
   caffe::rng_t* prefetch_rng =
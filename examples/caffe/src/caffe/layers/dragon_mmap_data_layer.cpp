@@ -2,6 +2,7 @@
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
 #include <stdint.h>
+#include <unistd.h>
 
 #include <vector>
 
@@ -16,161 +17,102 @@
 
 namespace caffe 
 {
-    template <typename Dtype>
-    DragonMmapDataLayer<Dtype>::DragonMmapDataLayer(const LayerParameter& param) 
-        : BaseDataLayer<Dtype>(param)
-    {
-        this->data_source_ = this->layer_param_.dragon_data_param().data_source();
-        this->data_width_ = this->layer_param_.dragon_data_param().width();
-        this->data_height_ = this->layer_param_.dragon_data_param().height();
-        this->data_depth_ = this->layer_param_.dragon_data_param().depth();
-        this->data_channels_ = this->layer_param_.dragon_data_param().channels();
-        this->data_length_ = this->layer_param_.dragon_data_param().length();
-
-        this->labels_source_ = this->layer_param_.dragon_data_param().labels_source();
-        this->labels_length_ = this->data_length_;
-
-        this->batch_size_ = this->layer_param_.dragon_data_param().batch_size();
-
-        if (typeid(Dtype) != typeid(float))
-        {
-            std::cerr << "We expect float but got " << typeid(Dtype).name() << " instead" << std::endl;
-            abort();
-        }
-    }
-
-    template <typename Dtype>
-    void DragonMmapDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
-          const vector<Blob<Dtype>*>& top) 
+    static void *mmap_source(const std::string& source, size_t size)
     {
-        size_t datasize = this->data_size_();
-        int data_fd;
-        if ((data_fd = open(this->data_source_.c_str(), O_RDONLY | O_LARGEFILE)) < 0)
+        int fd;
+        if ((fd = open(source.c_str(), O_RDONLY | O_LARGEFILE)) < 0)
         {
-            std::cerr << "Cannot open " << this->data_source_ << std::endl;
+            std::cerr << "Cannot open " << source << std::endl;
             abort();
         }
-        this->data_ = (Dtype *)mmap(
+        void *ptr = mmap(
             NULL,
-            datasize, 
+            size, 
             PROT_READ,
             MAP_SHARED | MAP_NORESERVE,
-            data_fd,
+            fd,
             0
         );
-        if (this->data_ == MAP_FAILED)
+        if (ptr == MAP_FAILED)
         {
-            std::cerr << "Cannot mmap " << this->data_source_ << std::endl;
+            std::cerr << "Cannot mmap " << source << std::endl;
             abort();
         }
+        close(fd);
+        return ptr;
+    }
 
-        if (this->is_3d_data())
-        {
-            vector<int> data_shape(5);
-            data_shape[0] = this->batch_size_;
-            data_shape[1] = this->data_channels_;
-            data_shape[2] = this->data_depth_;
-            data_shape[3] = this->data_height_;
-            data_shape[4] = this->data_width_;
-
-            top[0]->Reshape(data_shape);
-        }
-        else
-            top[0]->Reshape(
-                this->batch_size_,
-                this->data_channels_,
-                this->data_height_,
-                this->data_width_
-            );
+    // Starts asynchronous readahead of [ptr, ptr + size).
+    static void willneed(const void *ptr, size_t size)
+    {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (uintptr_t)ptr & ~(page_size - 1);
+        madvise((void *)begin, (uintptr_t)ptr + size - begin, MADV_WILLNEED);
+    }
 
+    template <typename Dtype>
+    void DragonMmapDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+          const vector<Blob<Dtype>*>& top) 
+    {
+        char *base = (char *)mmap_source(this->data_source_, this->data_offset_ + this->data_size_());
+        this->data_ = base + this->data_offset_;
         if (this->output_labels_)
         {
-            size_t labelsize = sizeof(Dtype) * this->labels_length_;
-            int label_fd;
-            if ((label_fd = open(this->labels_source_.c_str(), O_RDONLY | O_LARGEFILE)) < 0)
-            {
-                std::cerr << "Cannot open " << this->labels_source_ << std::endl;
-                abort();
-            }
-            this->labels_ = (Dtype *)mmap(
-                NULL,
-                labelsize, 
-                PROT_READ,
-                MAP_SHARED | MAP_NORESERVE,
-                label_fd,
-                0
-            );
-            if (this->labels_ == MAP_FAILED)
-            {
-                std::cerr << "Cannot mmap " << this->labels_source_ << std::endl;
-                abort();
-            }
-            vector<int> label_shape(1, this->batch_size_);
-            top[1]->Reshape(label_shape);
+            base = (char *)mmap_source(this->labels_source_, this->labels_offset_ + this->size_per_label_() * this->labels_length_);
+            this->labels_ = base + this->labels_offset_;
         }
-
-        this->item_index_ = 0;
     }
 
     template <typename Dtype>
-    void DragonMmapDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-          const vector<Blob<Dtype>*>& top) 
+    void DragonMmapDataLayer<Dtype>::Readahead(const DragonSampler::Run& chunk)
     {
-        uint32_t batchsize = MIN(this->batch_size_, this->data_length_ - this->item_index_);
-        if (this->is_3d_data())
-        {
-            vector<int> data_shape(5);
-            data_shape[0] = batchsize;
-            data_shape[1] = this->data_channels_;
-            data_shape[2] = this->data_depth_;
-            data_shape[3] = this->data_height_;
-            data_shape[4] = this->data_width_;
-
-            top[0]->Reshape(data_shape);
-        }
-        else
-            top[0]->Reshape(
-                batchsize,
-                this->data_channels_,
-                this->data_height_,
-                this->data_width_
+        willneed(
+            this->data_ + chunk.first * this->size_per_data_item_(),
+            chunk.second * this->size_per_data_item_()
+        );
+        if (this->output_labels_)
+            willneed(
+                this->labels_ + chunk.first * this->size_per_label_(),
+                chunk.second * this->size_per_label_()
             );
+    }
 
-        Dtype *data_ptr = this->data_ + this->item_index_ * this->num_elements_per_data_item_();
-        char *ptr = (char *)data_ptr;
-        /* Populate the data */
-        size_t block_size = (size_t)1 << 21;
-        size_t data_batch_size = batchsize * this->size_per_data_item_();
-        std::stringstream ss;
-        for (size_t size_index = 0; size_index < data_batch_size; size_index += block_size)
+    template <typename Dtype>
+    void DragonMmapDataLayer<Dtype>::load_batch(DragonBatch<Dtype>* batch)
+    {
+        if (this->gathers(batch))
         {
-            char tmp = ptr[size_index];
-            ss << tmp;
+            this->GatherBatch(batch, this->data_, this->labels_);
+            return;
         }
-        
-        top[0]->set_cpu_data(data_ptr);
 
+        const DragonSampler::Run& run = batch->runs_[0];
+        char *data_ptr = this->data_ + run.first * this->size_per_data_item_();
+        this->TouchPages(data_ptr, run.second * this->size_per_data_item_(), sysconf(_SC_PAGESIZE));
         if (this->output_labels_)
-        {
-            vector<int> label_shape(1, batchsize);
-            top[1]->Reshape(label_shape);
-
-            Dtype *labels_ptr = this->labels_ + this->item_index_;
-            ptr = (char *)labels_ptr;
-
-            size_t labels_batch_size = batchsize * sizeof(Dtype);
-            for (size_t size_index = 0; size_index < labels_batch_size; size_index += block_size)
-            {
-                char tmp = labels_ptr[size_index];
-                ss << tmp;
-            }
+            this->TouchPages(
+                this->labels_ + run.first * this->size_per_label_(),
+                run.second * this->size_per_label_(),
+                sysconf(_SC_PAGESIZE)
+            );
+    }
 
-            top[1]->set_cpu_data(labels_ptr);
+    template <typename Dtype>
+    void DragonMmapDataLayer<Dtype>::SetTops(DragonBatch<Dtype>* batch,
+          const vector<Blob<Dtype>*>& top)
+    {
+        if (this->gathers(batch))
+        {
+            top[0]->set_cpu_data(batch->data_.mutable_cpu_data());
+            if (this->output_labels_)
+                top[1]->set_cpu_data(batch->label_.mutable_cpu_data());
+            return;
         }
 
-        this->item_index_ += batchsize;
-        if (this->item_index_ >= this->data_length_)
-            this->item_index_ = 0;
+        const DragonSampler::Run& run = batch->runs_[0];
+        top[0]->set_cpu_data((Dtype *)(this->data_ + run.first * this->size_per_data_item_()));
+        if (this->output_labels_)
+            top[1]->set_cpu_data((Dtype *)(this->labels_ + run.first * this->size_per_label_()));
     }
 
     INSTANTIATE_CLASS(DragonMmapDataLayer);
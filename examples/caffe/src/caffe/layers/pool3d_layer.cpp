@@ -24,7 +24,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/pool3d_layer.hpp"
 #include "caffe/util/math_functions.hpp"
-#include "caffe/util/benchmark.hpp"
+#include "caffe/util/workspace_pool.hpp"
 
 namespace caffe {
 
@@ -76,6 +76,18 @@ void Pooling3DLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   top[0]->Reshape(top_shape);
   //top[0]->Reshape(bottom[0]->num(), channels_, pooled_length_, pooled_height_, pooled_width_);
 
+  length_windows_ = Windows(length_, pooled_length_, kernel_depth_,
+      temporal_stride_, 0);
+  height_windows_ = Windows(height_, pooled_height_, kernel_size_, stride_,
+      pad_);
+  width_windows_ = Windows(width_, pooled_width_, kernel_size_, stride_, pad_);
+
+  if (this->layer_param_.pooling3d_param().pool() ==
+      Pooling3DParameter_PoolMethod_MAX &&
+      this->layer_param_.pooling3d_param().argmax_mask()) {
+    max_idx_.Reshape(top_shape);
+  }
+
   // If stochastic pooling, we will initialize the random index part.
   if (this->layer_param_.pooling3d_param().pool() ==
       Pooling3DParameter_PoolMethod_STOCHASTIC) {
@@ -85,206 +97,247 @@ void Pooling3DLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 }
 
 template <typename Dtype>
-void Pooling3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-	    const vector<Blob<Dtype>*>& top) {
+vector<typename Pooling3DLayer<Dtype>::Window> Pooling3DLayer<Dtype>::Windows(
+    int size, int pooled_size, int kernel_size, int stride, int pad) {
+  vector<Window> windows(pooled_size);
+  for (int p = 0; p < pooled_size; ++p) {
+    int start = p * stride - pad;
+    int end = min(start + kernel_size, size + pad);
+    windows[p].size = end - start;
+    windows[p].begin = max(start, 0);
+    windows[p].end = max(windows[p].begin, min(end, size));
+  }
+  return windows;
+}
+
+template <typename Dtype>
+void Pooling3DLayer<Dtype>::max_pool_channel(const Dtype* bottom_data,
+    Dtype* top_data, int* argmax, Dtype* row, int* row_argmax) {
+  for (int pl = 0; pl < pooled_length_; ++pl) {
+    const Window& lw = length_windows_[pl];
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const Window& hw = height_windows_[ph];
+      // First the max over the rows of the window, for every input column
+      // at once, then over the columns of each window.
+      bool empty = true;
+      for (int l = lw.begin; l < lw.end; ++l) {
+        for (int h = hw.begin; h < hw.end; ++h) {
+          const int offset = (l * height_ + h) * width_;
+          const Dtype* in = bottom_data + offset;
+          if (empty) {
+            for (int w = 0; w < width_; ++w) {
+              row[w] = in[w];
+              row_argmax[w] = offset + w;
+            }
+            empty = false;
+            continue;
+          }
+          for (int w = 0; w < width_; ++w) {
+            const bool greater = in[w] > row[w];
+            row[w] = greater ? in[w] : row[w];
+            row_argmax[w] = greater ? offset + w : row_argmax[w];
+          }
+        }
+      }
+      const int top_offset = (pl * pooled_height_ + ph) * pooled_width_;
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const Window& ww = width_windows_[pw];
+        Dtype value = Dtype(-FLT_MAX);
+        int index = -1;
+        if (!empty) {
+          for (int w = ww.begin; w < ww.end; ++w) {
+            if (row[w] > value) {
+              value = row[w];
+              index = row_argmax[w];
+            }
+          }
+        }
+        if (top_data) {
+          top_data[top_offset + pw] = value;
+        }
+        if (argmax) {
+          argmax[top_offset + pw] = index;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Pooling3DLayer<Dtype>::ave_pool_channel(const Dtype* bottom_data,
+    Dtype* top_data, Dtype* row) {
+  for (int pl = 0; pl < pooled_length_; ++pl) {
+    const Window& lw = length_windows_[pl];
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const Window& hw = height_windows_[ph];
+      caffe_set(width_, Dtype(0), row);
+      for (int l = lw.begin; l < lw.end; ++l) {
+        for (int h = hw.begin; h < hw.end; ++h) {
+          const Dtype* in = bottom_data + (l * height_ + h) * width_;
+          for (int w = 0; w < width_; ++w) {
+            row[w] += in[w];
+          }
+        }
+      }
+      const int top_offset = (pl * pooled_height_ + ph) * pooled_width_;
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const Window& ww = width_windows_[pw];
+        Dtype sum = 0;
+        for (int w = ww.begin; w < ww.end; ++w) {
+          sum += row[w];
+        }
+        top_data[top_offset + pw] = sum / (lw.size * hw.size * ww.size);
+      }
+    }
+  }
+}
 
-  CPUTimer timer;
-  double computation;
-  timer.Start();
+template <typename Dtype>
+void Pooling3DLayer<Dtype>::ave_unpool_channel(const Dtype* top_diff,
+    Dtype* bottom_diff, Dtype* row) {
+  for (int pl = 0; pl < pooled_length_; ++pl) {
+    const Window& lw = length_windows_[pl];
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const Window& hw = height_windows_[ph];
+      // The diff that every input row of the window receives.
+      caffe_set(width_, Dtype(0), row);
+      const int top_offset = (pl * pooled_height_ + ph) * pooled_width_;
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const Window& ww = width_windows_[pw];
+        const Dtype diff =
+            top_diff[top_offset + pw] / (lw.size * hw.size * ww.size);
+        for (int w = ww.begin; w < ww.end; ++w) {
+          row[w] += diff;
+        }
+      }
+      for (int l = lw.begin; l < lw.end; ++l) {
+        for (int h = hw.begin; h < hw.end; ++h) {
+          Dtype* out = bottom_diff + (l * height_ + h) * width_;
+          for (int w = 0; w < width_; ++w) {
+            out[w] += row[w];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Pooling3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-	  static const int index_array[] = {0, 1, 0, 0, 0};
-	  vector<int> offset_indices(index_array, index_array + 5);
+  const int num_channels = bottom[0]->shape(0) * channels_;
+  const int bottom_dim = length_ * height_ * width_;
+  const int top_dim = pooled_length_ * pooled_height_ * pooled_width_;
+  int* argmax = NULL;
 
-	  // Different pooling methods. We explicitly do the switch outside the for
-	  // loop to save time, although this results in more codes.
-	  int top_count = top[0]->count();
-	  switch (this->layer_param_.pooling3d_param().pool()) {
-	  case Pooling3DParameter_PoolMethod_MAX:
-	    // Initialize
-	    for (int i = 0; i < top_count; ++i) {
-	      top_data[i] = Dtype(-FLT_MAX);
-	    }
-	    // The main loop
-	    for (int n = 0; n < bottom[0]->shape(0); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_;
-	              int wstart = pw * stride_;
-	              int lstart = pl * temporal_stride_;
-	              int hend = min(hstart + kernel_size_, height_);
-	              int wend = min(wstart + kernel_size_, width_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw] =
-	                      max(top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw],
-	                          bottom_data[(l * height_ + h) * width_ + w]);
-	                  }
-	                }
-	              }
-	            }
-	          }
-	    	}
-	        // compute offset
-	        bottom_data += bottom[0]->offset(offset_indices);
-	        top_data += top[0]->offset(offset_indices);
-	      }
-	    }
-	    break;
-	  case Pooling3DParameter_PoolMethod_AVE:
-	    for (int i = 0; i < top_count; ++i) {
-	      top_data[i] = 0;
-	    }
-	    // The main loop
-	    for (int n = 0; n < bottom[0]->shape(0); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_ - pad_;
-	              int wstart = pw * stride_ - pad_;
-	              int lstart = pl * temporal_stride_;
-	              int hend = min(hstart + kernel_size_, height_ + pad_);
-	              int wend = min(wstart + kernel_size_, width_ + pad_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              int pool_size = (hend - hstart) * (wend - wstart) * (lend - lstart);
-	              hstart = max(hstart, 0);
-	              wstart = max(wstart, 0);
+  // Channels are pooled in parallel, each thread with its own row buffers.
+  const int num_threads = ParallelThreads(num_channels);
+  WorkspacePool& pool = WorkspacePool::Get();
+  pool.Reserve(num_threads, (sizeof(Dtype) + sizeof(int)) * width_);
 
-	              hend = min(hend, height_);
-	              wend = min(wend, width_);
-	              lend = min(lend, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw] +=
-	                        bottom_data[(l * height_ + h) * width_ + w];
-	                  }
-	                }
-	              }
-	              top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw] /= pool_size;
-	            }
-	          }
-	    	}
-	        // compute offset
-	        bottom_data += bottom[0]->offset(offset_indices);
-	        top_data += top[0]->offset(offset_indices);
-	      }
-	    }
-	    break;
-	  case Pooling3DParameter_PoolMethod_STOCHASTIC:
-	    NOT_IMPLEMENTED;
-	    break;
-	  default:
-	    LOG(FATAL) << "Unknown pooling method.";
-	  }
-  computation = timer.MilliSeconds();
-  std::ofstream out("profile_inference.log", std::ofstream::out | std::ofstream::app);
-  out << this->layer_param_.name() << " CPU " << computation << "\n";
-  out.close();
+  // Different pooling methods. We explicitly do the switch outside the for
+  // loop to save time, although this results in more codes.
+  switch (this->layer_param_.pooling3d_param().pool()) {
+  case Pooling3DParameter_PoolMethod_MAX:
+    if (this->layer_param_.pooling3d_param().argmax_mask()) {
+      argmax = max_idx_.mutable_cpu_data();
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (int i = 0; i < num_channels; ++i) {
+      Dtype* row = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+      max_pool_channel(bottom_data + i * bottom_dim, top_data + i * top_dim,
+          argmax ? argmax + i * top_dim : NULL, row,
+          reinterpret_cast<int*>(row + width_));
+    }
+    break;
+  case Pooling3DParameter_PoolMethod_AVE:
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (int i = 0; i < num_channels; ++i) {
+      Dtype* row = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+      ave_pool_channel(bottom_data + i * bottom_dim, top_data + i * top_dim,
+          row);
+    }
+    break;
+  case Pooling3DParameter_PoolMethod_STOCHASTIC:
+    NOT_IMPLEMENTED;
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
 }
 
 template <typename Dtype>
 void Pooling3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-	    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-	  if (!propagate_down[0]) {
-	    return;
-	  }
-	  const Dtype* top_diff = top[0]->cpu_diff();
-	  const Dtype* top_data = top[0]->cpu_data();
-	  const Dtype* bottom_data = bottom[0]->cpu_data();
-	  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-
-	  static const int index_array[] = {0, 1, 0, 0, 0};
-	  vector<int> offset_indices(index_array, index_array + 5);
+    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int num_channels = top[0]->shape(0) * channels_;
+  const int bottom_dim = length_ * height_ * width_;
+  const int top_dim = pooled_length_ * pooled_height_ * pooled_width_;
+  const int* argmax = NULL;
 
-	  // Different pooling methods. We explicitly do the switch outside the for
-	  // loop to save time, although this results in more codes.
-	  memset(bottom_diff, 0, bottom[0]->count() * sizeof(Dtype));
-	  switch (this->layer_param_.pooling3d_param().pool()) {
-	  case Pooling3DParameter_PoolMethod_MAX:
-	    // The main loop
-	    for (int n = 0; n < top[0]->shape(0); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_;
-	              int wstart = pw * stride_;
-	              int lstart = pl * temporal_stride_;
-	              int hend = min(hstart + kernel_size_, height_);
-	              int wend = min(wstart + kernel_size_, width_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    bottom_diff[(l * height_ + h) * width_ + w] +=
-	                        top_diff[(pl * pooled_height_ + ph) * pooled_width_ + pw] *
-	                        (bottom_data[(l * height_ + h) * width_ + w] ==
-	                            top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw]);
-	                  }
-	                }
-	              }
-	            }
-	          }
-	    	}
-	        // offset
-	        bottom_data += bottom[0]->offset(offset_indices);
-	        top_data += top[0]->offset(offset_indices);
-	        bottom_diff += bottom[0]->offset(offset_indices);
-	        top_diff += top[0]->offset(offset_indices);
-	      }
-	    }
-	    break;
-	  case Pooling3DParameter_PoolMethod_AVE:
-	    // The main loop0, 1
-	    for (int n = 0; n < top[0]->shape(0); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_ - pad_;
-	              int wstart = pw * stride_ - pad_;
-	              int lstart = pl * temporal_stride_;
-	              int hend = min(hstart + kernel_size_, height_ + pad_);
-	              int wend = min(wstart + kernel_size_, width_ + pad_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              int pool_size = (hend - hstart) * (wend - wstart) * (lend - lstart);
-	              hstart = max(hstart, 0);
-	              wstart = max(wstart, 0);
-	              hend = min(hend, height_);
-	              wend = min(wend, width_);
-	              lend = min(lend, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    bottom_diff[(l * height_ + h) * width_ + w] +=
-	                      top_diff[(pl * pooled_height_ + ph) * pooled_width_ + pw] / pool_size;
-	                  }
-	                }
-	              }
-	            }
-	          }
-	    	}
-	        // offset
-	        bottom_data += bottom[0]->offset(offset_indices);
-	        top_data += top[0]->offset(offset_indices);
-	        bottom_diff += bottom[0]->offset(offset_indices);
-	        top_diff += top[0]->offset(offset_indices);
-	      }
-	    }
-	    break;
-	  case Pooling3DParameter_PoolMethod_STOCHASTIC:
-	    NOT_IMPLEMENTED;
-	    break;
-	  default:
-	    LOG(FATAL) << "Unknown pooling method.";
-	  }
+  // Without a mask, MAX pools again into a per-thread mask of one channel.
+  const int num_threads = ParallelThreads(num_channels);
+  WorkspacePool& pool = WorkspacePool::Get();
+  pool.Reserve(num_threads,
+      (sizeof(Dtype) + sizeof(int)) * width_ + sizeof(int) * top_dim);
 
+  // Different pooling methods. We explicitly do the switch outside the for
+  // loop to save time, although this results in more codes.
+  memset(bottom_diff, 0, bottom[0]->count() * sizeof(Dtype));
+  switch (this->layer_param_.pooling3d_param().pool()) {
+  case Pooling3DParameter_PoolMethod_MAX:
+    if (this->layer_param_.pooling3d_param().argmax_mask()) {
+      argmax = max_idx_.cpu_data();
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (int i = 0; i < num_channels; ++i) {
+      Dtype* row = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+      int* row_argmax = reinterpret_cast<int*>(row + width_);
+      const int* channel_argmax = argmax ? argmax + i * top_dim : NULL;
+      if (!channel_argmax) {
+        int* recomputed = row_argmax + width_;
+        max_pool_channel(bottom_data + i * bottom_dim, NULL, recomputed, row,
+            row_argmax);
+        channel_argmax = recomputed;
+      }
+      const Dtype* channel_top_diff = top_diff + i * top_dim;
+      Dtype* channel_bottom_diff = bottom_diff + i * bottom_dim;
+      for (int j = 0; j < top_dim; ++j) {
+        if (channel_argmax[j] >= 0) {
+          channel_bottom_diff[channel_argmax[j]] += channel_top_diff[j];
+        }
+      }
+    }
+    break;
+  case Pooling3DParameter_PoolMethod_AVE:
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (int i = 0; i < num_channels; ++i) {
+      Dtype* row = static_cast<Dtype*>(pool.buffer(ParallelThreadId()));
+      ave_unpool_channel(top_diff + i * top_dim, bottom_diff + i * bottom_dim,
+          row);
+    }
+    break;
+  case Pooling3DParameter_PoolMethod_STOCHASTIC:
+    NOT_IMPLEMENTED;
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
 }
 
 #ifdef CPU_ONLY
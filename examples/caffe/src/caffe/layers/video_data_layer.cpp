@@ -401,10 +401,6 @@ void VideoDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
-
-  // std::ofstream out("profile_inference.log", std::ofstream::out | std::ofstream::app);
-  // out << "data CPU " << batch_timer.MilliSeconds() << "\n";
-  // out.close();
 }
 
 INSTANTIATE_CLASS(VideoDataLayer);
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
 #include <string>
@@ -9,12 +10,14 @@
 
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/layers/base_conv_layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/profiler.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -251,10 +254,195 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  layer_fused_.assign(layers_.size(), false);
+  if (param.fuse_conv_relu()) {
+    FuseConvolutionReLU();
+  }
+  activation_memory_saved_ = 0;
+  if (param.share_activation_memory()) {
+    PlanActivationMemory(phase_ == TRAIN || param.force_backward());
+  }
   debug_info_ = param.debug_info();
+  if (Profiler::enabled()) {
+    profiler_.reset(new NetProfiler<Dtype>(this));
+  }
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+template <typename Dtype>
+void Net<Dtype>::FuseConvolutionReLU() {
+  for (int i = 0; i + 1 < layers_.size(); ++i) {
+    const int relu_id = i + 1;
+    if (strcmp(layers_[i]->type(), "Convolution") != 0 ||
+        strcmp(layers_[relu_id]->type(), "ReLU") != 0 ||
+        top_vecs_[i].size() != 1 ||
+        bottom_vecs_[relu_id][0] != top_vecs_[i][0] ||
+        top_vecs_[relu_id][0] != top_vecs_[i][0]) {
+      continue;
+    }
+    BaseConvolutionLayer<Dtype>* conv =
+        dynamic_cast<BaseConvolutionLayer<Dtype>*>(layers_[i].get());
+    if (!conv) {
+      continue;
+    }
+    // ReLU's backward pass only looks at the sign of its in-place output,
+    // which the fused output has as well, so it still runs as is.
+    conv->set_fused_relu(true,
+        layers_[relu_id]->layer_param().relu_param().negative_slope());
+    layer_fused_[relu_id] = true;
+    LOG_IF(INFO, Caffe::root_solver()) << "Fusing " << layer_names_[relu_id]
+        << " into " << layer_names_[i] << " on the CPU";
+  }
+}
+
+// A data or diff buffer planned by Net::PlanActivationMemory, live from
+// step first to step last.
+struct ActivationBuffer {
+  SyncedMemory* mem;
+  int first;
+  int last;
+  size_t offset;
+};
+
+static void UseActivation(SyncedMemory* mem, const int step,
+    vector<ActivationBuffer>* buffers, map<SyncedMemory*, int>* buffer_ids) {
+  map<SyncedMemory*, int>::iterator it = buffer_ids->find(mem);
+  if (it == buffer_ids->end()) {
+    ActivationBuffer buffer = { mem, step, step, 0 };
+    (*buffer_ids)[mem] = buffers->size();
+    buffers->push_back(buffer);
+  } else {
+    ActivationBuffer& buffer = (*buffers)[it->second];
+    buffer.first = std::min(buffer.first, step);
+    buffer.last = std::max(buffer.last, step);
+  }
+}
+
+static bool CompareActivationSize(ActivationBuffer* a, ActivationBuffer* b) {
+  return a->mem->size() > b->mem->size();
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanActivationMemory(const bool with_backward) {
+  // Forward of layer i runs at step i and its backward at step 2 * L - 1 - i,
+  // so each data or diff buffer is live from its first to its last use.
+  // Buffers are planned per SyncedMemory: blobs that ShareData/ShareDiff
+  // (split, flatten, reshape) or in-place layers use the same one.
+  vector<ActivationBuffer> buffers;
+  map<SyncedMemory*, int> buffer_ids;
+  const int num_layers = layers_.size();
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+    const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+    for (int i = 0; i < bottom.size(); ++i) {
+      UseActivation(bottom[i]->data().get(), layer_id, &buffers,
+          &buffer_ids);
+    }
+    for (int i = 0; i < top.size(); ++i) {
+      UseActivation(top[i]->data().get(), layer_id, &buffers, &buffer_ids);
+    }
+    if (!with_backward || !layer_need_backward_[layer_id]) {
+      continue;
+    }
+    // Backward may read any bottom or top data (e.g. for parameter
+    // gradients even if no bottom needs backward), reads the top diffs and
+    // writes the diffs of the bottoms that need backward.
+    const int step = 2 * num_layers - 1 - layer_id;
+    for (int i = 0; i < bottom.size(); ++i) {
+      UseActivation(bottom[i]->data().get(), step, &buffers, &buffer_ids);
+      if (bottom_need_backward_[layer_id][i]) {
+        UseActivation(bottom[i]->diff().get(), step, &buffers, &buffer_ids);
+      }
+    }
+    for (int i = 0; i < top.size(); ++i) {
+      UseActivation(top[i]->data().get(), step, &buffers, &buffer_ids);
+      UseActivation(top[i]->diff().get(), step, &buffers, &buffer_ids);
+    }
+  }
+  // The caller reads and writes net inputs and outputs, and loss blobs hold
+  // their loss weight in the diff.
+  vector<int> pinned_blob_ids(net_input_blob_indices_);
+  pinned_blob_ids.insert(pinned_blob_ids.end(),
+      net_output_blob_indices_.begin(), net_output_blob_indices_.end());
+  for (int blob_id = 0; blob_id < blob_loss_weights_.size(); ++blob_id) {
+    if (blob_loss_weights_[blob_id] != Dtype(0)) {
+      pinned_blob_ids.push_back(blob_id);
+    }
+  }
+  set<SyncedMemory*> pinned;
+  for (int i = 0; i < pinned_blob_ids.size(); ++i) {
+    pinned.insert(blobs_[pinned_blob_ids[i]]->data().get());
+    pinned.insert(blobs_[pinned_blob_ids[i]]->diff().get());
+  }
+
+  // Largest first; each buffer goes to the lowest offset that does not
+  // overlap a placed buffer live at the same time.
+  const size_t kAlignment = 256;
+  vector<ActivationBuffer*> order;
+  for (int i = 0; i < buffers.size(); ++i) {
+    ActivationBuffer& buffer = buffers[i];
+    // Buffers a layer already wrote during SetUp (e.g. constant DummyData
+    // tops) must keep their contents.
+    if (pinned.count(buffer.mem) || buffer.mem->size() == 0 ||
+        buffer.mem->head() != SyncedMemory::UNINITIALIZED) {
+      continue;
+    }
+    order.push_back(&buffer);
+  }
+  std::stable_sort(order.begin(), order.end(), CompareActivationSize);
+  size_t total_size = 0;
+  size_t shared_size = 0;
+  for (int i = 0; i < order.size(); ++i) {
+    ActivationBuffer* buffer = order[i];
+    vector<pair<size_t, size_t> > conflicts;
+    for (int j = 0; j < i; ++j) {
+      if (order[j]->first <= buffer->last &&
+          buffer->first <= order[j]->last) {
+        conflicts.push_back(std::make_pair(order[j]->offset,
+            order[j]->offset + order[j]->mem->size()));
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end());
+    size_t offset = 0;
+    for (int j = 0; j < conflicts.size(); ++j) {
+      if (offset + buffer->mem->size() <= conflicts[j].first) {
+        break;
+      }
+      offset = std::max(offset, (conflicts[j].second + kAlignment - 1) /
+          kAlignment * kAlignment);
+    }
+    buffer->offset = offset;
+    total_size += buffer->mem->size();
+    shared_size = std::max(shared_size, offset + buffer->mem->size());
+  }
+  if (order.empty()) {
+    return;
+  }
+
+  activation_memory_.reset(new SyncedMemory(shared_size));
+  char* base;
+  if (Caffe::mode() == Caffe::CPU) {
+    base = static_cast<char*>(activation_memory_->mutable_cpu_data());
+    for (int i = 0; i < order.size(); ++i) {
+      order[i]->mem->set_cpu_data(base + order[i]->offset);
+    }
+  } else {
+#ifndef CPU_ONLY
+    base = static_cast<char*>(activation_memory_->mutable_gpu_data());
+    for (int i = 0; i < order.size(); ++i) {
+      order[i]->mem->set_gpu_data(base + order[i]->offset);
+    }
+#else
+    NO_GPU;
+#endif
+  }
+  activation_memory_saved_ = total_size - shared_size;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Sharing " << shared_size << " bytes among " << order.size()
+      << " activation buffers of " << total_size << " bytes; saved "
+      << activation_memory_saved_ << " bytes";
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -521,8 +709,10 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
     for (int c = 0; c < before_forward_.size(); ++c) {
       before_forward_[c]->run(i);
     }
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
-    loss += layer_loss;
+    if (!layer_fused_[i] || Caffe::mode() != Caffe::CPU) {
+      Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+      loss += layer_loss;
+    }
     if (debug_info_) { ForwardDebugInfo(i); }
     for (int c = 0; c < after_forward_.size(); ++c) {
       after_forward_[c]->run(i);
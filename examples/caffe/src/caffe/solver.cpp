@@ -55,6 +55,9 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
   if (Caffe::root_solver()) {
     LOG(INFO) << "Solver scaffolding done.";
   }
+  if (Caffe::root_solver() && param_.async_snapshots() > 0) {
+    snapshot_writer_.reset(new SnapshotWriter(param_.async_snapshots()));
+  }
   iter_ = 0;
   current_step_ = 0;
 }
@@ -290,6 +293,9 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
     Snapshot();
   }
+  if (snapshot_writer_) {
+    snapshot_writer_->Wait();
+  }
   if (requested_early_exit_) {
     LOG(INFO) << "Optimization stopped early.";
     return;
@@ -402,6 +408,24 @@ void Solver<Dtype>::Test(const int test_net_id) {
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
+  if (snapshot_writer_ && param_.snapshot_format() ==
+      caffe::SolverParameter_SnapshotFormat_BINARYPROTO) {
+    // Copy the net and the solver state; the writer thread serializes them.
+    StagedSnapshot* snapshot = snapshot_writer_->free_snapshot();
+    string model_filename = SnapshotFilename(".caffemodel");
+    LOG(INFO) << "Snapshotting to binary proto file " << model_filename
+        << " in the background";
+    NetParameter* net_param = new NetParameter();
+    snapshot->protos.push_back(shared_ptr<Message>(net_param));
+    snapshot->filenames.push_back(model_filename);
+    net_->ToProto(net_param, param_.snapshot_diff());
+    SolverState* state = new SolverState();
+    snapshot->protos.push_back(shared_ptr<Message>(state));
+    snapshot->filenames.push_back(SnapshotFilename(".solverstate"));
+    SolverStateToProto(model_filename, state);
+    snapshot_writer_->Push(snapshot);
+    return;
+  }
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
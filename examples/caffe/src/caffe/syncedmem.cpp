@@ -5,13 +5,16 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include <map>
 #include <mutex>
+#include <string>
 
 #include <gflags/gflags.h>
 
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memfile_arena.hpp"
 
 DEFINE_bool(enable_dragon, false,
     "Optional; enable DRAGON as memory backend.");
@@ -26,18 +29,108 @@ DEFINE_bool(enable_uvm, false,
 DEFINE_bool(enable_mmap, false,
     "Optional; enable mmap as memory backend.");
 
-static long _memfile_number_ = 0;
 static const size_t _memfile_totalsize = (size_t)1 << 33;
-static size_t _memfile_current_usage = 0;
-static void *_memfile_current_ptr = NULL;
-static std::mutex _memfile_mutex;
-//static size_t _memfile_total_usage = 0;
 
 namespace caffe {
+
+static std::string memfile_path(long index) {
+  std::stringstream sstm;
+  sstm << FLAGS_dragon_tmp_folder << "tmp_" << index << ".mem";
+  return sstm.str();
+}
+
+// Memory files mapped through DRAGON; volatile, so never written back.
+class DragonBackend : public MemfileArena::Backend {
+ public:
+  virtual void* Map(long index, size_t size) {
+    void* ptr = NULL;
+    if (dragon_map(memfile_path(index).c_str(), size,
+        D_F_READ | D_F_WRITE | D_F_CREATE | D_F_VOLATILE, &ptr) != D_OK) {
+      LOG(ERROR) << "Cannot dragon_map " << memfile_path(index);
+      return NULL;
+    }
+    return ptr;
+  }
+};
+
+// Memory files mapped shared with plain mmap. Freed ranges are punched out
+// of the file so that they neither take disk space nor get written back.
+class MmapBackend : public MemfileArena::Backend {
+ public:
+  virtual void* Map(long index, size_t size) {
+    std::string path = memfile_path(index);
+    int fd;
+    if ((fd = creat(path.c_str(), S_IRUSR | S_IWUSR)) >= 0)
+      close(fd);
+    fd = open(path.c_str(), O_RDWR | O_LARGEFILE);
+    CHECK(fd >= 0) << "Cannot open file " << path;
+    CHECK(ftruncate(fd, size) == 0) << "Cannot truncate file " << path;
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (ptr == MAP_FAILED) {
+      LOG(ERROR) << "Cannot mmap file " << path;
+      close(fd);
+      return NULL;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    fds_[index] = fd;
+    return ptr;
+  }
+  virtual void Unmap(long index, void* base, size_t size) {
+    munmap(base, size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    close(fds_[index]);
+    fds_.erase(index);
+  }
+  virtual bool Discard(long index, size_t offset, size_t size) {
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fd = fds_[index];
+    }
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        offset, size) == 0;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<long, int> fds_;
+};
+
+// The arenas live as long as the process; blobs may be freed at exit.
+static MemfileArena* dragon_arena() {
+  static MemfileArena* arena = new MemfileArena("DRAGON",
+      shared_ptr<MemfileArena::Backend>(new DragonBackend()),
+      _memfile_totalsize);
+  return arena;
+}
+
+static MemfileArena* mmap_arena() {
+  static MemfileArena* arena = new MemfileArena("mmap",
+      shared_ptr<MemfileArena::Backend>(new MmapBackend()),
+      _memfile_totalsize);
+  return arena;
+}
+
+bool SyncedMemory::memfile_stats(string* backend,
+    MemfileArena::Stats* stats) {
+  if (FLAGS_enable_dragon) {
+    *backend = "dragon";
+    *stats = dragon_arena()->GetStats();
+    return true;
+  }
+  if (FLAGS_enable_mmap) {
+    *backend = "mmap";
+    *stats = mmap_arena()->GetStats();
+    return true;
+  }
+  return false;
+}
+
 SyncedMemory::SyncedMemory()
   : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
     own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false),
-    dragon_ptr_(NULL), use_dragon_(false), use_mmap_(false) {
+    dragon_ptr_(NULL), use_dragon_(false), use_mmap_(false), arena_(NULL) {
 #ifndef CPU_ONLY
 #ifdef DEBUG
   CUDA_CHECK(cudaGetDevice(&device_));
@@ -49,7 +142,7 @@ SyncedMemory::SyncedMemory()
 SyncedMemory::SyncedMemory(size_t size)
   : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
     own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false),
-    dragon_ptr_(NULL), use_dragon_(false), use_mmap_(false) {
+    dragon_ptr_(NULL), use_dragon_(false), use_mmap_(false), arena_(NULL) {
 #ifndef CPU_ONLY
 #ifdef DEBUG
   CUDA_CHECK(cudaGetDevice(&device_));
@@ -63,6 +156,7 @@ SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_ && !use_mmap_) {
     CaffeFreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
   }
+  free_arena_data();
 
 #ifndef CPU_ONLY
   if (gpu_ptr_ && own_gpu_data_) {
@@ -71,33 +165,38 @@ SyncedMemory::~SyncedMemory() {
 #endif  // CPU_ONLY
 }
 
+void SyncedMemory::free_arena_data() {
+  if (arena_) {
+    // The range may be handed out again right away, so nothing may keep
+    // pointing at it or try to free it as host memory.
+    if (use_mmap_) {
+      arena_->Free(cpu_ptr_, size_);
+      cpu_ptr_ = NULL;
+      own_cpu_data_ = false;
+    } else {
+      arena_->Free(dragon_ptr_, size_);
+      dragon_ptr_ = NULL;
+    }
+    arena_ = NULL;
+  }
+}
+
 inline void SyncedMemory::to_cpu() {
-  std::stringstream sstm;
   check_device();
   if (use_dragon_ && head_ != UNINITIALIZED)
     head_ = SYNCED;
   switch (head_) {
   case UNINITIALIZED:
     if (FLAGS_enable_dragon && size_ >= FLAGS_dragon_enable_threshold) {
-        _memfile_mutex.lock();
-        if (_memfile_current_ptr == NULL || size_ + _memfile_current_usage > _memfile_totalsize) {
-            sstm << FLAGS_dragon_tmp_folder << "tmp_" << _memfile_number_ << ".mem";
-            if (dragon_map(sstm.str().c_str(), _memfile_totalsize, D_F_READ | D_F_WRITE | D_F_CREATE | D_F_VOLATILE, &_memfile_current_ptr) != D_OK) {
-                std::cerr << "Cannot dragon_map " << sstm.str() << std::endl;
-                abort();
-            }
-            _memfile_current_usage = 0;
-            ++_memfile_number_;
-        }
-        dragon_ptr_ = (void *)((char *)_memfile_current_ptr + _memfile_current_usage);
-        _memfile_current_usage += size_;
-        //_memfile_total_usage += size_;
-        //LOG(INFO) << "_memfile_total_usage: " << _memfile_total_usage;
+        bool zeroed;
+        arena_ = dragon_arena();
+        dragon_ptr_ = arena_->Allocate(size_, &zeroed);
+        if (!zeroed)
+            caffe_memset(size_, 0, dragon_ptr_);
         head_ = SYNCED;
         use_dragon_ = true;
         own_cpu_data_ = false;
         own_gpu_data_ = false;
-        _memfile_mutex.unlock();
     }
 #ifndef CPU_ONLY
     else if (FLAGS_enable_uvm && size_ >= FLAGS_dragon_enable_threshold) {
@@ -109,28 +208,14 @@ inline void SyncedMemory::to_cpu() {
     }
 #endif
     else if (FLAGS_enable_mmap && size_ >= FLAGS_dragon_enable_threshold) {
-        _memfile_mutex.lock();
-        if (_memfile_current_ptr == NULL || size_ + _memfile_current_usage > _memfile_totalsize) {
-            int fd;
-            sstm << FLAGS_dragon_tmp_folder << "tmp_" << _memfile_number_ << ".mem";
-            if ((fd = creat(sstm.str().c_str(), S_IRUSR | S_IWUSR)) >= 0)
-                close(fd);
-            fd = open(sstm.str().c_str(), O_RDWR | O_LARGEFILE);
-            CHECK(fd >= 0) << "Cannot open file " << sstm.str();
-            CHECK(ftruncate(fd, _memfile_totalsize) == 0) << "Cannot truncate file " << sstm.str();
-            _memfile_current_ptr = mmap(NULL, _memfile_totalsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
-            CHECK(dragon_ptr_ != MAP_FAILED) << "Cannot mmap file " << sstm.str();
-            _memfile_current_usage = 0;
-            ++_memfile_number_;
-        }
-
-        cpu_ptr_ = (void *)((char *)_memfile_current_ptr + _memfile_current_usage);
-        _memfile_current_usage += size_;
-
+        bool zeroed;
+        arena_ = mmap_arena();
+        cpu_ptr_ = arena_->Allocate(size_, &zeroed);
+        if (!zeroed)
+            caffe_memset(size_, 0, cpu_ptr_);
         head_ = HEAD_AT_CPU;
         use_mmap_ = true;
         own_cpu_data_ = true;
-        _memfile_mutex.unlock();
     }
     else {
         CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_);
@@ -159,7 +244,6 @@ inline void SyncedMemory::to_cpu() {
 }
 
 inline void SyncedMemory::to_gpu() {
-  std::stringstream sstm;
   check_device();
 #ifndef CPU_ONLY
   if (use_dragon_ && head_ != UNINITIALIZED)
@@ -167,25 +251,15 @@ inline void SyncedMemory::to_gpu() {
   switch (head_) {
   case UNINITIALIZED:
     if (FLAGS_enable_dragon && size_ >= FLAGS_dragon_enable_threshold) {
-        _memfile_mutex.lock();
-        if (_memfile_current_ptr == NULL || size_ + _memfile_current_usage > _memfile_totalsize) {
-            sstm << FLAGS_dragon_tmp_folder << "tmp_" << _memfile_number_ << ".mem";
-            if (dragon_map(sstm.str().c_str(), _memfile_totalsize, D_F_READ | D_F_WRITE | D_F_CREATE | D_F_VOLATILE, &_memfile_current_ptr) != D_OK) {
-                std::cerr << "Cannot dragon_map " << sstm.str() << std::endl;
-                abort();
-            }
-            _memfile_current_usage = 0;
-            ++_memfile_number_;
-        }
-        dragon_ptr_ = (void *)((char *)_memfile_current_ptr + _memfile_current_usage);
-        _memfile_current_usage += size_;
-        //_memfile_total_usage += size_;
-        //LOG(INFO) << "_memfile_total_usage: " << _memfile_total_usage;
+        bool zeroed;
+        arena_ = dragon_arena();
+        dragon_ptr_ = arena_->Allocate(size_, &zeroed);
+        if (!zeroed)
+            caffe_gpu_memset(size_, 0, dragon_ptr_);
         head_ = SYNCED;
         use_dragon_ = true;
         own_cpu_data_ = false;
         own_gpu_data_ = false;
-        _memfile_mutex.unlock();
     }
     else if (FLAGS_enable_uvm && size_ >= FLAGS_dragon_enable_threshold) {
         CUDA_CHECK(cudaMallocManaged(&dragon_ptr_, size_));
@@ -234,6 +308,7 @@ void SyncedMemory::set_cpu_data(void* data) {
   if (own_cpu_data_ && !use_mmap_) {
     CaffeFreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
   }
+  free_arena_data();
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
   own_cpu_data_ = false;
@@ -247,6 +322,7 @@ void SyncedMemory::set_dragon_data(void* data) {
   if (own_cpu_data_ && !use_mmap_) {
     CaffeFreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
   }
+  free_arena_data();
   cpu_ptr_ = NULL;
   dragon_ptr_ = data;
   head_ = SYNCED;
@@ -276,6 +352,7 @@ void SyncedMemory::set_gpu_data(void* data) {
   if (own_gpu_data_) {
     CUDA_CHECK(cudaFree(gpu_ptr_));
   }
+  free_arena_data();
   gpu_ptr_ = data;
   head_ = HEAD_AT_GPU;
   own_gpu_data_ = false;
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/convolution3d_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class Convolution3DLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  Convolution3DLayerTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
+    vector<int> bottom_shape(5);
+    bottom_shape[0] = 4;
+    bottom_shape[1] = 3;
+    bottom_shape[2] = 5;
+    bottom_shape[3] = 6;
+    bottom_shape[4] = 7;
+    blob_bottom_->Reshape(bottom_shape);
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~Convolution3DLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  LayerParameter LayerParam() {
+    LayerParameter layer_param;
+    Convolution3DParameter* conv_param =
+        layer_param.mutable_convolution3d_param();
+    conv_param->set_num_output(4);
+    conv_param->set_kernel_size(3);
+    conv_param->set_kernel_depth(3);
+    conv_param->set_pad(1);
+    conv_param->set_temporal_pad(1);
+    conv_param->mutable_weight_filler()->set_type("gaussian");
+    conv_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  // Runs forward and backward through layer, with a fixed top diff.
+  void ForwardBackward(Convolution3DLayer<Dtype>* layer) {
+    layer->SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    Dtype* top_diff = blob_top_->mutable_cpu_diff();
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      top_diff[i] = Dtype(i % 7) - 3;
+    }
+    layer->Backward(blob_top_vec_, vector<bool>(1, true), blob_bottom_vec_);
+  }
+
+  static void ExpectNear(int count, const Dtype* expected,
+      const Dtype* actual) {
+    for (int i = 0; i < count; ++i) {
+      // The sums may be taken in a different order.
+      const Dtype scale = std::max(Dtype(1), std::fabs(expected[i]));
+      EXPECT_NEAR(expected[i], actual[i], 1e-4 * scale);
+    }
+  }
+
+  // Checks the top of layer against a direct convolution of the bottom.
+  void CheckForward(Convolution3DLayer<Dtype>* layer) {
+    const Convolution3DParameter& param =
+        layer->layer_param().convolution3d_param();
+    const int ksize = param.kernel_size();
+    const int kdepth = param.kernel_depth();
+    const Blob<Dtype>& bottom = *blob_bottom_;
+    const Blob<Dtype>& top = *blob_top_;
+    const Blob<Dtype>& weight = *layer->blobs()[0];
+    const Dtype* bias = layer->blobs()[1]->cpu_data();
+    vector<int> index(5);
+    for (int n = 0; n < top.shape(0); ++n) {
+      for (int o = 0; o < top.shape(1); ++o) {
+        for (int l = 0; l < top.shape(2); ++l) {
+          for (int h = 0; h < top.shape(3); ++h) {
+            for (int w = 0; w < top.shape(4); ++w) {
+              Dtype expected = bias[o];
+              for (int c = 0; c < bottom.shape(1); ++c) {
+                for (int kd = 0; kd < kdepth; ++kd) {
+                  for (int kh = 0; kh < ksize; ++kh) {
+                    for (int kw = 0; kw < ksize; ++kw) {
+                      index[0] = n;
+                      index[1] = c;
+                      index[2] = l * param.temporal_stride()
+                          - param.temporal_pad() + kd;
+                      index[3] = h * param.stride() - param.pad() + kh;
+                      index[4] = w * param.stride() - param.pad() + kw;
+                      if (index[2] < 0 || index[2] >= bottom.shape(2) ||
+                          index[3] < 0 || index[3] >= bottom.shape(3) ||
+                          index[4] < 0 || index[4] >= bottom.shape(4)) {
+                        continue;
+                      }
+                      const Dtype x = bottom.data_at(index);
+                      index[0] = o;
+                      index[2] = kd;
+                      index[3] = kh;
+                      index[4] = kw;
+                      expected += x * weight.data_at(index);
+                    }
+                  }
+                }
+              }
+              index[0] = n;
+              index[1] = o;
+              index[2] = l;
+              index[3] = h;
+              index[4] = w;
+              ExpectNear(1, &expected, top.cpu_data() + top.offset(index));
+            }
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(Convolution3DLayerTest, TestDtypes);
+
+TYPED_TEST(Convolution3DLayerTest, TestSetup) {
+  LayerParameter layer_param = this->LayerParam();
+  layer_param.mutable_convolution3d_param()->set_stride(2);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(4, this->blob_top_->shape(0));
+  EXPECT_EQ(4, this->blob_top_->shape(1));
+  EXPECT_EQ(5, this->blob_top_->shape(2));
+  EXPECT_EQ(3, this->blob_top_->shape(3));
+  EXPECT_EQ(4, this->blob_top_->shape(4));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestBatchParallelMatchesSerial) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->LayerParam();
+  Convolution3DLayer<Dtype> serial(layer_param);
+  this->ForwardBackward(&serial);
+  Blob<Dtype> top, bottom_diff, weight_diff, bias_diff;
+  top.CopyFrom(*this->blob_top_, false, true);
+  bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+  weight_diff.CopyFrom(*serial.blobs()[0], true, true);
+  bias_diff.CopyFrom(*serial.blobs()[1], true, true);
+
+  layer_param.mutable_convolution3d_param()->set_batch_parallel(true);
+  Convolution3DLayer<Dtype> parallel(layer_param);
+  parallel.blobs().push_back(serial.blobs()[0]);
+  parallel.blobs().push_back(serial.blobs()[1]);
+  caffe_set(this->blob_bottom_->count(), Dtype(0),
+      this->blob_bottom_->mutable_cpu_diff());
+  this->ForwardBackward(&parallel);
+  this->ExpectNear(top.count(), top.cpu_data(), this->blob_top_->cpu_data());
+  this->ExpectNear(bottom_diff.count(), bottom_diff.cpu_diff(),
+      this->blob_bottom_->cpu_diff());
+  this->ExpectNear(weight_diff.count(), weight_diff.cpu_diff(),
+      parallel.blobs()[0]->cpu_diff());
+  this->ExpectNear(bias_diff.count(), bias_diff.cpu_diff(),
+      parallel.blobs()[1]->cpu_diff());
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestImplicitGemmMatchesExplicit) {
+  typedef TypeParam Dtype;
+  vector<int> bottom_shape = this->blob_bottom_->shape();
+  bottom_shape[1] = 64;
+  bottom_shape[3] = 40;
+  bottom_shape[4] = 40;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param = this->LayerParam();
+  Convolution3DLayer<Dtype> explicit_gemm(layer_param);
+  this->ForwardBackward(&explicit_gemm);
+  Blob<Dtype> top, bottom_diff, weight_diff;
+  top.CopyFrom(*this->blob_top_, false, true);
+  bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+  weight_diff.CopyFrom(*explicit_gemm.blobs()[0], true, true);
+
+  // The column matrix of a sample is 64 * 27 x 5 * 40 * 40, far more than
+  // a tile, so it is lowered in many tiles.
+  layer_param.mutable_convolution3d_param()->set_implicit_gemm(true);
+  Convolution3DLayer<Dtype> implicit_gemm(layer_param);
+  implicit_gemm.blobs().push_back(explicit_gemm.blobs()[0]);
+  implicit_gemm.blobs().push_back(explicit_gemm.blobs()[1]);
+  this->ForwardBackward(&implicit_gemm);
+  this->ExpectNear(top.count(), top.cpu_data(), this->blob_top_->cpu_data());
+  this->ExpectNear(bottom_diff.count(), bottom_diff.cpu_diff(),
+      this->blob_bottom_->cpu_diff());
+  this->ExpectNear(weight_diff.count(), weight_diff.cpu_diff(),
+      implicit_gemm.blobs()[0]->cpu_diff());
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestStridedImplicitGemm) {
+  typedef TypeParam Dtype;
+  vector<int> bottom_shape = this->blob_bottom_->shape();
+  bottom_shape[1] = 64;
+  bottom_shape[3] = 40;
+  bottom_shape[4] = 40;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  // Not 3x3x3, so the generic kernels lower the volume, with strided rows.
+  LayerParameter layer_param = this->LayerParam();
+  Convolution3DParameter* conv_param =
+      layer_param.mutable_convolution3d_param();
+  conv_param->set_kernel_size(2);
+  conv_param->set_kernel_depth(2);
+  conv_param->set_stride(2);
+  conv_param->set_temporal_stride(2);
+  Convolution3DLayer<Dtype> explicit_gemm(layer_param);
+  this->ForwardBackward(&explicit_gemm);
+  this->CheckForward(&explicit_gemm);
+  Blob<Dtype> bottom_diff, weight_diff;
+  bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+  weight_diff.CopyFrom(*explicit_gemm.blobs()[0], true, true);
+
+  // 3 x 21 rows of 21 columns, lowered a few rows at a time.
+  conv_param->set_implicit_gemm(true);
+  Convolution3DLayer<Dtype> implicit_gemm(layer_param);
+  implicit_gemm.blobs().push_back(explicit_gemm.blobs()[0]);
+  implicit_gemm.blobs().push_back(explicit_gemm.blobs()[1]);
+  this->ForwardBackward(&implicit_gemm);
+  this->CheckForward(&implicit_gemm);
+  this->ExpectNear(bottom_diff.count(), bottom_diff.cpu_diff(),
+      this->blob_bottom_->cpu_diff());
+  this->ExpectNear(weight_diff.count(), weight_diff.cpu_diff(),
+      implicit_gemm.blobs()[0]->cpu_diff());
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestGradientStrided) {
+  LayerParameter layer_param = this->LayerParam();
+  Convolution3DParameter* conv_param =
+      layer_param.mutable_convolution3d_param();
+  conv_param->set_kernel_size(2);
+  conv_param->set_kernel_depth(2);
+  conv_param->set_stride(2);
+  conv_param->set_temporal_stride(2);
+  conv_param->set_implicit_gemm(true);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestGradientBatchParallel) {
+  LayerParameter layer_param = this->LayerParam();
+  layer_param.mutable_convolution3d_param()->set_batch_parallel(true);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -0,0 +1,106 @@
+#include <stdint.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dragon_codec.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+TEST(DragonCodecTest, TestHalf) {
+  EXPECT_EQ(0x0000, dragon_float_to_half(0.f));
+  EXPECT_EQ(0x8000, dragon_float_to_half(-0.f));
+  EXPECT_EQ(0x3c00, dragon_float_to_half(1.f));
+  EXPECT_EQ(0xc000, dragon_float_to_half(-2.f));
+  EXPECT_EQ(0x5bf8, dragon_float_to_half(255.f));
+  EXPECT_EQ(0x7bff, dragon_float_to_half(65504.f));
+  EXPECT_EQ(0x7c00, dragon_float_to_half(65520.f));
+  EXPECT_EQ(0x7c00, dragon_float_to_half(std::numeric_limits<float>::infinity()));
+  EXPECT_EQ(0x0001, dragon_float_to_half(std::ldexp(1.f, -24)));
+  EXPECT_EQ(0x0000, dragon_float_to_half(std::ldexp(1.f, -25)));
+  // 1 + 2^-11 is halfway between two halves and rounds to the even one.
+  EXPECT_EQ(0x3c00, dragon_float_to_half(1.f + std::ldexp(1.f, -11)));
+  EXPECT_EQ(0x3c02, dragon_float_to_half(1.f + 3 * std::ldexp(1.f, -11)));
+  EXPECT_TRUE(std::isnan(dragon_half_to_float(
+      dragon_float_to_half(std::numeric_limits<float>::quiet_NaN()))));
+
+  // Every finite half survives a round trip through float.
+  for (uint32_t h = 0; h < 0x10000; ++h) {
+    if ((h & 0x7c00) == 0x7c00) {
+      continue;
+    }
+    EXPECT_EQ(h, dragon_float_to_half(dragon_half_to_float(h)));
+  }
+}
+
+TEST(DragonCodecTest, TestEncodeUint8) {
+  const float values[] = { -3.f, 0.f, 0.4f, 0.6f, 128.f, 254.5f, 300.f };
+  uint8_t encoded[7];
+  dragon_encode(DRAGON_MEM_UINT8, values, 7, encoded);
+  const uint8_t expected[] = { 0, 0, 0, 1, 128, 255, 255 };
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(expected[i], encoded[i]);
+  }
+}
+
+template <typename Encoded, typename Dtype>
+void CheckDecode(DragonMemDtype dtype) {
+  // Odd sizes leave a tail after the vectorized part.
+  const int kItems = 3;
+  const int kChannels = 3;
+  const int kInner = 37;
+  vector<float> values(kItems * kChannels * kInner);
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = (i * 7) % 256;
+  }
+  vector<Encoded> encoded(values.size());
+  dragon_encode(dtype, &values[0], values.size(), &encoded[0]);
+  const Dtype mean[kChannels] = { 104, 117, 123 };
+  const Dtype scale = 0.017;
+  vector<Dtype> decoded(values.size());
+  dragon_decode(dtype, &encoded[0], kItems, kChannels, kInner, mean, scale,
+      &decoded[0]);
+  for (size_t i = 0; i < values.size(); ++i) {
+    const int c = (i / kInner) % kChannels;
+    EXPECT_NEAR((values[i] - mean[c]) * scale, decoded[i], 1e-5);
+  }
+
+  // Without mean and scale the stored values come back.
+  dragon_decode(dtype, &encoded[0], kItems, kChannels, kInner,
+      static_cast<const Dtype*>(NULL), Dtype(1), &decoded[0]);
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[i], decoded[i]);
+  }
+}
+
+TEST(DragonCodecTest, TestDecodeUint8) {
+  CheckDecode<uint8_t, float>(DRAGON_MEM_UINT8);
+}
+
+TEST(DragonCodecTest, TestDecodeFloat16) {
+  CheckDecode<uint16_t, float>(DRAGON_MEM_FLOAT16);
+}
+
+TEST(DragonCodecTest, TestDecodeFloat32) {
+  CheckDecode<float, float>(DRAGON_MEM_FLOAT32);
+}
+
+TEST(DragonCodecTest, TestDecodeUint8ToDouble) {
+  CheckDecode<uint8_t, double>(DRAGON_MEM_UINT8);
+}
+
+TEST(DragonCodecTest, TestDecodeFloat16ToDouble) {
+  CheckDecode<uint16_t, double>(DRAGON_MEM_FLOAT16);
+}
+
+TEST(DragonCodecTest, TestDecodeFloat32ToDouble) {
+  CheckDecode<float, double>(DRAGON_MEM_FLOAT32);
+}
+
+}  // namespace caffe
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dragon_convert_writer.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DragonConvertWriterTest : public ::testing::Test {
+ protected:
+  static const size_t kRecordSize = 12;
+
+  DragonConvertWriterTest() {
+    MakeTempFilename(&data_out_);
+    MakeTempFilename(&labels_out_);
+    param_.set_data_out(data_out_);
+    param_.set_labels_out(labels_out_);
+    data_header_ = NewDragonMemHeader(DRAGON_MEM_FLOAT32,
+        vector<int>(1, kRecordSize / sizeof(float)));
+    labels_header_ = NewDragonMemHeader(DRAGON_MEM_FLOAT32, vector<int>());
+  }
+
+  virtual ~DragonConvertWriterTest() {
+    remove(data_out_.c_str());
+    remove(labels_out_.c_str());
+    remove((data_out_ + ".progress").c_str());
+  }
+
+  // Pushes a chunk of records first, ..., first + n - 1, each filled with
+  // its index; the records for which invalid returns true failed.
+  void PushChunk(DragonConvertWriter* writer, int first, int n,
+      bool (*invalid)(int)) {
+    DragonConvertChunk* chunk = writer->free_chunk();
+    for (int i = 0; i < n; ++i) {
+      memset(&chunk->data[i * kRecordSize], first + i, kRecordSize);
+      const float label = first + i;
+      memcpy(&chunk->labels[i * sizeof(float)], &label, sizeof(float));
+      chunk->valid[i] = !invalid(first + i);
+    }
+    chunk->num_records = n;
+    chunk->cursor = first + n;
+    writer->Push(chunk);
+  }
+
+  static bool None(int i) { return false; }
+  static bool Odd(int i) { return i % 2 == 1; }
+
+  // Payload of filename, after checking its header.
+  static string Payload(const string& filename, uint64_t num_items) {
+    DragonMemHeader header;
+    EXPECT_TRUE(ReadDragonMemHeader(filename, &header));
+    EXPECT_EQ(num_items, header.num_items);
+    CheckDragonMemPayload(filename, header);
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    return string(std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>()).substr(header.payload_offset);
+  }
+
+  // Labels in the payload of labels_out_.
+  vector<float> Labels(uint64_t num_items) {
+    const string payload = Payload(labels_out_, num_items);
+    vector<float> labels(payload.size() / sizeof(float));
+    memcpy(&labels[0], payload.data(), payload.size());
+    return labels;
+  }
+
+  string data_out_;
+  string labels_out_;
+  DragonConvertDataParameter param_;
+  DragonMemHeader data_header_;
+  DragonMemHeader labels_header_;
+};
+
+const size_t DragonConvertWriterTest::kRecordSize;
+
+TEST_F(DragonConvertWriterTest, TestWritesValidRecordsInOrder) {
+  DragonConvertWriter writer(param_);
+  EXPECT_EQ(0, writer.records());
+  writer.Start(data_header_, &labels_header_, 4);
+  PushChunk(&writer, 0, 4, Odd);
+  PushChunk(&writer, 4, 4, Odd);
+  PushChunk(&writer, 8, 3, Odd);
+  writer.Finish();
+
+  const string data = Payload(data_out_, 6);
+  const vector<float> labels = Labels(6);
+  ASSERT_EQ(6 * kRecordSize, data.size());
+  ASSERT_EQ(6, labels.size());
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(2 * i, labels[i]);
+    EXPECT_EQ(string(kRecordSize, 2 * i), data.substr(i * kRecordSize,
+        kRecordSize));
+  }
+  EXPECT_NE(0, access((data_out_ + ".progress").c_str(), F_OK));
+}
+
+TEST_F(DragonConvertWriterTest, TestResume) {
+  {
+    DragonConvertWriter writer(param_);
+    writer.Start(data_header_, &labels_header_, 4);
+    PushChunk(&writer, 0, 4, None);
+    PushChunk(&writer, 4, 4, None);
+    // Killed before Finish: the progress index is left behind.
+    for (int i = 0; i < 2; ++i) {
+      writer.free_chunk();
+    }
+  }
+  // Bytes of a chunk that was being written when the run was killed.
+  FILE* data = fopen(data_out_.c_str(), "a");
+  fputs("partial", data);
+  fclose(data);
+
+  DragonConvertWriter writer(param_);
+  EXPECT_EQ(8, writer.records());
+  EXPECT_EQ(8, writer.cursor());
+  writer.Start(data_header_, &labels_header_, 4);
+  PushChunk(&writer, 8, 2, None);
+  writer.Finish();
+
+  const vector<float> labels = Labels(10);
+  ASSERT_EQ(10 * kRecordSize, Payload(data_out_, 10).size());
+  ASSERT_EQ(10, labels.size());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(i, labels[i]);
+  }
+}
+
+TEST_F(DragonConvertWriterTest, TestNoResume) {
+  {
+    DragonConvertWriter writer(param_);
+    writer.Start(data_header_, &labels_header_, 4);
+    PushChunk(&writer, 0, 4, None);
+    for (int i = 0; i < 2; ++i) {
+      writer.free_chunk();
+    }
+  }
+  param_.set_resume(false);
+  DragonConvertWriter writer(param_);
+  EXPECT_EQ(0, writer.records());
+  writer.Start(data_header_, &labels_header_, 4);
+  PushChunk(&writer, 0, 2, None);
+  writer.Finish();
+  EXPECT_EQ(2 * kRecordSize, Payload(data_out_, 2).size());
+}
+
+}  // namespace caffe
@@ -0,0 +1,112 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dragon_mem.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DragonMemTest : public ::testing::Test {
+ protected:
+  DragonMemTest() {
+    MakeTempFilename(&filename_);
+  }
+
+  virtual ~DragonMemTest() {
+    remove(filename_.c_str());
+  }
+
+  // Writes header and a payload of its payload_size bytes to filename_.
+  void WriteFile(DragonMemHeader* header) {
+    string payload(header->payload_size, 0);
+    for (size_t i = 0; i < payload.size(); ++i) {
+      payload[i] = i;
+    }
+    header->payload_crc = DragonMemCrc(0, payload.data(), payload.size());
+    int fd = open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    ASSERT_GE(fd, 0);
+    WriteDragonMemHeader(fd, header);
+    ASSERT_EQ(payload.size(), pwrite(fd, payload.data(), payload.size(),
+        header->payload_offset));
+    close(fd);
+  }
+
+  string filename_;
+};
+
+TEST_F(DragonMemTest, TestCrc) {
+  const char data[] = "123456789";
+  EXPECT_EQ(0xcbf43926U, DragonMemCrc(0, data, 9));
+  EXPECT_EQ(0xcbf43926U, DragonMemCrc(DragonMemCrc(0, data, 4), data + 4, 5));
+}
+
+TEST_F(DragonMemTest, TestRoundTrip) {
+  vector<int> shape;
+  shape.push_back(3);
+  shape.push_back(16);
+  shape.push_back(112);
+  shape.push_back(112);
+  DragonMemHeader header = NewDragonMemHeader(DRAGON_MEM_FLOAT32, shape);
+  EXPECT_EQ(4 * 3 * 16 * 112 * 112, header.item_size);
+  EXPECT_EQ(0, header.payload_offset % 4096);
+  header.num_items = 2;
+  header.payload_size = 2 * header.item_size;
+  WriteFile(&header);
+
+  DragonMemHeader read;
+  ASSERT_TRUE(ReadDragonMemHeader(filename_, &read));
+  EXPECT_EQ(DRAGON_MEM_FLOAT32, read.dtype);
+  EXPECT_EQ(2, read.num_items);
+  ASSERT_EQ(4, read.num_axes);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(shape[i], read.shape[i]);
+  }
+  CheckDragonMemPayload(filename_, read);
+}
+
+TEST_F(DragonMemTest, TestNoHeader) {
+  FILE* file = fopen(filename_.c_str(), "w");
+  const float data[4] = { 1, 2, 3, 4 };
+  fwrite(data, sizeof(data), 1, file);
+  fclose(file);
+  DragonMemHeader header;
+  EXPECT_FALSE(ReadDragonMemHeader(filename_, &header));
+}
+
+TEST_F(DragonMemTest, TestDamagedHeaderDeath) {
+  DragonMemHeader header = NewDragonMemHeader(DRAGON_MEM_FLOAT32,
+      vector<int>(3, 8));
+  WriteFile(&header);
+  // Flip a bit of num_items behind the checksum.
+  int fd = open(filename_.c_str(), O_WRONLY);
+  const char byte = 1;
+  ASSERT_EQ(1, pwrite(fd, &byte, 1, offsetof(DragonMemHeader, num_items)));
+  close(fd);
+  DragonMemHeader read;
+  EXPECT_DEATH(ReadDragonMemHeader(filename_, &read), "damaged");
+}
+
+TEST_F(DragonMemTest, TestDamagedPayloadDeath) {
+  DragonMemHeader header = NewDragonMemHeader(DRAGON_MEM_FLOAT32,
+      vector<int>(3, 8));
+  header.num_items = 1;
+  header.payload_size = header.item_size;
+  WriteFile(&header);
+  int fd = open(filename_.c_str(), O_WRONLY);
+  const char byte = 0x55;
+  ASSERT_EQ(1, pwrite(fd, &byte, 1, header.payload_offset + 7));
+  close(fd);
+  EXPECT_DEATH(CheckDragonMemPayload(filename_, header), "checksum");
+}
+
+}  // namespace caffe
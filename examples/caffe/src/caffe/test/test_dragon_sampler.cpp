@@ -0,0 +1,120 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dragon_sampler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Items of the runs, in order.
+static vector<uint32_t> Items(const vector<DragonSampler::Run>& runs) {
+  vector<uint32_t> items;
+  for (int i = 0; i < runs.size(); ++i) {
+    for (uint32_t j = 0; j < runs[i].second; ++j) {
+      items.push_back(runs[i].first + j);
+    }
+  }
+  return items;
+}
+
+// Takes a whole epoch of sampler in batches of batch_size.
+static vector<uint32_t> Epoch(DragonSampler* sampler, uint32_t batch_size) {
+  vector<DragonSampler::Run> runs, window;
+  uint32_t taken = 0;
+  while (taken < sampler->epoch_items()) {
+    taken += sampler->Next(batch_size, &runs, &window);
+  }
+  return Items(runs);
+}
+
+TEST(DragonSamplerTest, TestSequential) {
+  DragonSampler sampler(10, 4, 1, false, 0, 1, 0);
+  EXPECT_TRUE(sampler.contiguous());
+  vector<DragonSampler::Run> runs, window;
+  EXPECT_EQ(4, sampler.Next(4, &runs, &window));
+  ASSERT_EQ(1, runs.size());
+  EXPECT_EQ(DragonSampler::Run(0, 4), runs[0]);
+  // The first window and the next one are read ahead.
+  ASSERT_EQ(2, window.size());
+  EXPECT_EQ(DragonSampler::Run(0, 4), window[0]);
+  EXPECT_EQ(DragonSampler::Run(4, 4), window[1]);
+  runs.clear();
+  EXPECT_EQ(4, sampler.Next(4, &runs, &window));
+  EXPECT_EQ(DragonSampler::Run(4, 4), runs[0]);
+  runs.clear();
+  // The last batch of an epoch is short.
+  EXPECT_EQ(2, sampler.Next(4, &runs, &window));
+  EXPECT_EQ(DragonSampler::Run(8, 2), runs[0]);
+  EXPECT_EQ(3, window.size());
+  runs.clear();
+  EXPECT_EQ(4, sampler.Next(4, &runs, &window));
+  EXPECT_EQ(DragonSampler::Run(0, 4), runs[0]);
+  EXPECT_EQ(1, sampler.epoch());
+}
+
+TEST(DragonSamplerTest, TestShuffleIsPermutation) {
+  DragonSampler sampler(100, 7, 3, true, 1701, 1, 0);
+  EXPECT_FALSE(sampler.contiguous());
+  for (int epoch = 0; epoch < 3; ++epoch) {
+    vector<uint32_t> items = Epoch(&sampler, 16);
+    ASSERT_EQ(100, items.size());
+    vector<bool> seen(100, false);
+    for (int i = 0; i < items.size(); ++i) {
+      ASSERT_LT(items[i], 100);
+      EXPECT_FALSE(seen[items[i]]);
+      seen[items[i]] = true;
+    }
+  }
+}
+
+TEST(DragonSamplerTest, TestShuffleWithinWindow) {
+  // With one chunk per window, each run of 8 items comes from one chunk.
+  DragonSampler sampler(40, 8, 1, true, 1701, 1, 0);
+  vector<uint32_t> items = Epoch(&sampler, 8);
+  ASSERT_EQ(40, items.size());
+  bool shuffled = false;
+  for (int i = 0; i < items.size(); ++i) {
+    EXPECT_EQ(items[i - i % 8] / 8, items[i] / 8);
+    shuffled |= items[i] % 8 != i % 8;
+  }
+  EXPECT_TRUE(shuffled);
+}
+
+TEST(DragonSamplerTest, TestDeterministic) {
+  DragonSampler sampler1(100, 5, 2, true, 1701, 1, 0);
+  DragonSampler sampler2(100, 5, 2, true, 1701, 1, 0);
+  DragonSampler sampler3(100, 5, 2, true, 1702, 1, 0);
+  for (int epoch = 0; epoch < 2; ++epoch) {
+    vector<uint32_t> items1 = Epoch(&sampler1, 10);
+    EXPECT_EQ(items1, Epoch(&sampler2, 10));
+    EXPECT_NE(items1, Epoch(&sampler3, 10));
+  }
+}
+
+TEST(DragonSamplerTest, TestShardsAreDisjoint) {
+  const int kShards = 3;
+  for (int shuffle = 0; shuffle < 2; ++shuffle) {
+    vector<shared_ptr<DragonSampler> > samplers;
+    for (int shard = 0; shard < kShards; ++shard) {
+      samplers.push_back(shared_ptr<DragonSampler>(
+          new DragonSampler(100, 6, 2, shuffle, 1701, kShards, shard)));
+    }
+    for (int epoch = 0; epoch < 2; ++epoch) {
+      vector<int> seen(100, 0);
+      for (int shard = 0; shard < kShards; ++shard) {
+        vector<uint32_t> items = Epoch(samplers[shard].get(), 4);
+        for (int i = 0; i < items.size(); ++i) {
+          ++seen[items[i]];
+        }
+      }
+      for (int i = 0; i < seen.size(); ++i) {
+        EXPECT_EQ(1, seen[i]) << "item " << i;
+      }
+    }
+  }
+}
+
+}  // namespace caffe
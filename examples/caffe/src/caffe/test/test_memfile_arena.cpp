@@ -0,0 +1,162 @@
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/memfile_arena.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Backs the arena with plain heap memory.
+class HeapBackend : public MemfileArena::Backend {
+ public:
+  HeapBackend() : num_maps_(0) {}
+  virtual void* Map(long index, size_t size) {
+    void* base = NULL;
+    ++num_maps_;
+    // Files are mapped page-aligned, as mmap does.
+    if (posix_memalign(&base, MemfileArena::kAlignment, size)) {
+      return NULL;
+    }
+    memset(base, 0, size);
+    return base;
+  }
+  virtual void Unmap(long index, void* base, size_t size) {
+    free(base);
+  }
+  virtual bool Discard(long index, size_t offset, size_t size) {
+    return false;
+  }
+  int num_maps_;
+};
+
+class MemfileArenaTest : public ::testing::Test {
+ protected:
+  static const size_t kPage = MemfileArena::kAlignment;
+  static const size_t kFileSize = 16 * MemfileArena::kAlignment;
+
+  MemfileArenaTest()
+      : backend_(new HeapBackend()),
+        arena_(new MemfileArena("test", backend_, kFileSize)) {}
+  virtual ~MemfileArenaTest() { delete arena_; }
+
+  shared_ptr<HeapBackend> backend_;
+  MemfileArena* const arena_;
+};
+
+const size_t MemfileArenaTest::kPage;
+const size_t MemfileArenaTest::kFileSize;
+
+TEST_F(MemfileArenaTest, TestAllocateAligned) {
+  bool zeroed = false;
+  char* a = static_cast<char*>(arena_->Allocate(10, &zeroed));
+  EXPECT_TRUE(zeroed);
+  char* b = static_cast<char*>(arena_->Allocate(kPage + 1, &zeroed));
+  EXPECT_TRUE(zeroed);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(a) % kPage);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(b) % kPage);
+  EXPECT_EQ(kPage, b - a);
+  MemfileArena::Stats stats = arena_->GetStats();
+  EXPECT_EQ(1, stats.num_files);
+  EXPECT_EQ(3 * kPage, stats.in_use_bytes);
+  EXPECT_EQ(kFileSize - 3 * kPage, stats.free_bytes);
+  arena_->Free(a, 10);
+  arena_->Free(b, kPage + 1);
+}
+
+TEST_F(MemfileArenaTest, TestThreadCacheReuse) {
+  bool zeroed;
+  void* a = arena_->Allocate(2 * kPage, &zeroed);
+  memset(a, 1, 2 * kPage);
+  arena_->Free(a, 2 * kPage);
+  void* b = arena_->Allocate(2 * kPage, &zeroed);
+  EXPECT_EQ(a, b);
+  EXPECT_FALSE(zeroed);
+  MemfileArena::Stats stats = arena_->GetStats();
+  EXPECT_EQ(1, stats.num_cache_hits);
+  EXPECT_EQ(2, stats.num_allocs);
+  EXPECT_EQ(1, stats.num_frees);
+  arena_->Free(b, 2 * kPage);
+}
+
+TEST_F(MemfileArenaTest, TestCoalescing) {
+  bool zeroed;
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 16; ++i) {
+    ptrs.push_back(arena_->Allocate(kPage, &zeroed));
+  }
+  EXPECT_EQ(0, arena_->GetStats().free_bytes);
+  // Free every other page first so that nothing can merge yet.
+  for (int i = 0; i < 16; i += 2) {
+    arena_->Free(ptrs[i], kPage);
+  }
+  arena_->FlushThreadCache();
+  MemfileArena::Stats stats = arena_->GetStats();
+  EXPECT_EQ(8 * kPage, stats.free_bytes);
+  EXPECT_EQ(kPage, stats.largest_free_bytes);
+  EXPECT_NEAR(7.0 / 8, stats.fragmentation(), 1e-9);
+  for (int i = 1; i < 16; i += 2) {
+    arena_->Free(ptrs[i], kPage);
+  }
+  arena_->FlushThreadCache();
+  stats = arena_->GetStats();
+  EXPECT_EQ(kFileSize, stats.largest_free_bytes);
+  EXPECT_EQ(0, stats.fragmentation());
+  // The whole file is usable again without mapping another one.
+  void* all = arena_->Allocate(kFileSize, &zeroed);
+  EXPECT_EQ(ptrs[0], all);
+  EXPECT_FALSE(zeroed);
+  EXPECT_EQ(1, backend_->num_maps_);
+  arena_->Free(all, kFileSize);
+}
+
+TEST_F(MemfileArenaTest, TestBestFit) {
+  bool zeroed;
+  void* a = arena_->Allocate(4 * kPage, &zeroed);
+  void* b = arena_->Allocate(kPage, &zeroed);
+  void* c = arena_->Allocate(2 * kPage, &zeroed);
+  void* d = arena_->Allocate(kPage, &zeroed);
+  arena_->Free(a, 4 * kPage);
+  arena_->Free(c, 2 * kPage);
+  arena_->FlushThreadCache();
+  // Both holes and the tail could serve it; the two-page hole fits best.
+  EXPECT_EQ(c, arena_->Allocate(2 * kPage, &zeroed));
+  arena_->Free(b, kPage);
+  arena_->Free(c, 2 * kPage);
+  arena_->Free(d, kPage);
+}
+
+TEST_F(MemfileArenaTest, TestNewFiles) {
+  bool zeroed;
+  void* a = arena_->Allocate(kFileSize - kPage, &zeroed);
+  void* b = arena_->Allocate(2 * kPage, &zeroed);
+  EXPECT_EQ(2, backend_->num_maps_);
+  // Larger than a file: mapped on its own.
+  void* c = arena_->Allocate(2 * kFileSize, &zeroed);
+  EXPECT_TRUE(zeroed);
+  MemfileArena::Stats stats = arena_->GetStats();
+  EXPECT_EQ(3, stats.num_files);
+  EXPECT_EQ(4 * kFileSize, stats.mapped_bytes);
+  arena_->Free(a, kFileSize - kPage);
+  arena_->Free(b, 2 * kPage);
+  arena_->Free(c, 2 * kFileSize);
+}
+
+TEST_F(MemfileArenaTest, TestHighWater) {
+  bool zeroed;
+  void* a = arena_->Allocate(4 * kPage, &zeroed);
+  void* b = arena_->Allocate(4 * kPage, &zeroed);
+  arena_->Free(a, 4 * kPage);
+  arena_->Free(b, 4 * kPage);
+  void* c = arena_->Allocate(kPage, &zeroed);
+  MemfileArena::Stats stats = arena_->GetStats();
+  EXPECT_EQ(kPage, stats.in_use_bytes);
+  EXPECT_EQ(8 * kPage, stats.high_water_bytes);
+  arena_->Free(c, kPage);
+}
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
@@ -629,6 +630,119 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitChainNet(const bool share_activation_memory) {
+    string proto =
+        "name: 'ChainNetwork' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { "
+        "      dim: 4 "
+        "      dim: 8 "
+        "    } "
+        "    shape { "
+        "      dim: 4 "
+        "      dim: 4 "
+        "    } "
+        "    data_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "    data_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'target' "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 16 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 16 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "} "
+        "layer { "
+        "  name: 'ip3' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 16 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "} "
+        "layer { "
+        "  name: 'ip4' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  bottom: 'ip3' "
+        "  top: 'ip4' "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip4' "
+        "  bottom: 'target' "
+        "} ";
+    if (share_activation_memory) {
+      proto += "share_activation_memory: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
   virtual void InitSkipPropNet(bool test_skip_true) {
     string proto =
       "name: 'SkipPropTestNetwork' "
@@ -2446,6 +2560,105 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestShareActivationMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The planner must not change the results of forward and backward, and
+  // the diffs of ip1 and ip3 are never live at the same time.
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(false);
+  EXPECT_EQ(0, this->net_->activation_memory_saved());
+  const Dtype loss = this->net_->ForwardBackward();
+  vector<shared_ptr<Blob<Dtype> > > params;
+  const bool kCopyDiff = true;
+  this->CopyNetParams(kCopyDiff, &params);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(true);
+  EXPECT_GT(this->net_->activation_memory_saved(), 0);
+  EXPECT_FLOAT_EQ(loss, this->net_->ForwardBackward());
+  const vector<shared_ptr<Blob<Dtype> > >& shared_params =
+      this->net_->params();
+  ASSERT_EQ(params.size(), shared_params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_FLOAT_EQ(params[i]->cpu_diff()[j],
+          shared_params[i]->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseConvolutionReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Fusing the leaky ReLU into conv1 must not change forward or backward,
+  // and must not apply the ReLU twice.
+  Caffe::set_mode(Caffe::CPU);
+  const string proto =
+      "name: 'FusedNetwork' "
+      "force_backward: true "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 2 dim: 3 dim: 9 dim: 8 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "  relu_param { negative_slope: 0.1 } "
+      "} "
+      "layer { "
+      "  name: 'data2' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 2 dim: 4 dim: 7 dim: 6 } "
+      "    data_filler { type: 'constant' value: 0.5 } "
+      "  } "
+      "  top: 'data2' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'conv1' "
+      "  bottom: 'data2' "
+      "} ";
+  vector<Dtype> losses;
+  vector<vector<Dtype> > data_diffs;
+  for (int fuse = 0; fuse < 2; ++fuse) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_fuse_conv_relu(fuse);
+    Caffe::set_random_seed(this->seed_);
+    this->net_.reset(new Net<Dtype>(param));
+    EXPECT_EQ(fuse == 1, this->net_->layer_fused()[2]);
+    losses.push_back(this->net_->ForwardBackward());
+    const Blob<Dtype>& data = *this->net_->blob_by_name("data");
+    data_diffs.push_back(vector<Dtype>(data.cpu_diff(),
+        data.cpu_diff() + data.count()));
+  }
+  EXPECT_NEAR(losses[0], losses[1], 1e-4 * std::fabs(losses[0]));
+  for (int i = 0; i < data_diffs[0].size(); ++i) {
+    EXPECT_NEAR(data_diffs[0][i], data_diffs[1][i], 1e-4);
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/pool3d_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class Pooling3DLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  Pooling3DLayerTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
+    vector<int> bottom_shape(5);
+    bottom_shape[0] = 2;
+    bottom_shape[1] = 3;
+    bottom_shape[2] = 4;
+    bottom_shape[3] = 5;
+    bottom_shape[4] = 6;
+    blob_bottom_->Reshape(bottom_shape);
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~Pooling3DLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  LayerParameter LayerParam(Pooling3DParameter_PoolMethod pool) {
+    LayerParameter layer_param;
+    Pooling3DParameter* pooling_param =
+        layer_param.mutable_pooling3d_param();
+    pooling_param->set_pool(pool);
+    pooling_param->set_kernel_size(2);
+    pooling_param->set_kernel_depth(2);
+    pooling_param->set_stride(2);
+    pooling_param->set_temporal_stride(2);
+    return layer_param;
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(Pooling3DLayerTest, TestDtypes);
+
+TYPED_TEST(Pooling3DLayerTest, TestForwardMax) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param =
+      this->LayerParam(Pooling3DParameter_PoolMethod_MAX);
+  Pooling3DLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(2, this->blob_top_->shape(2));
+  EXPECT_EQ(3, this->blob_top_->shape(3));
+  EXPECT_EQ(3, this->blob_top_->shape(4));
+  const Dtype* bottom = this->blob_bottom_->cpu_data();
+  const Dtype* top = this->blob_top_->cpu_data();
+  for (int i = 0; i < 6; ++i) {
+    for (int pl = 0; pl < 2; ++pl) {
+      for (int ph = 0; ph < 3; ++ph) {
+        for (int pw = 0; pw < 3; ++pw) {
+          Dtype expected = -FLT_MAX;
+          for (int l = 2 * pl; l < 2 * pl + 2; ++l) {
+            for (int h = 2 * ph; h < std::min(2 * ph + 2, 5); ++h) {
+              for (int w = 2 * pw; w < 2 * pw + 2; ++w) {
+                expected = std::max(expected,
+                    bottom[((i * 4 + l) * 5 + h) * 6 + w]);
+              }
+            }
+          }
+          EXPECT_EQ(expected, top[((i * 2 + pl) * 3 + ph) * 3 + pw]);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestGradientMax) {
+  LayerParameter layer_param =
+      this->LayerParam(Pooling3DParameter_PoolMethod_MAX);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestGradientMaxArgmaxMask) {
+  LayerParameter layer_param =
+      this->LayerParam(Pooling3DParameter_PoolMethod_MAX);
+  layer_param.mutable_pooling3d_param()->set_argmax_mask(true);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+// On ties the whole top diff goes to a single max, the same one whether the
+// mask is kept or MAX pools again in Backward.
+TYPED_TEST(Pooling3DLayerTest, TestBackwardMaxTies) {
+  typedef TypeParam Dtype;
+  caffe_set(this->blob_bottom_->count(), Dtype(1),
+      this->blob_bottom_->mutable_cpu_data());
+  vector<bool> propagate_down(1, true);
+  Blob<Dtype> repooled_diff;
+  for (int argmax_mask = 0; argmax_mask < 2; ++argmax_mask) {
+    LayerParameter layer_param =
+        this->LayerParam(Pooling3DParameter_PoolMethod_MAX);
+    layer_param.mutable_pooling3d_param()->set_argmax_mask(argmax_mask);
+    Pooling3DLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Dtype* top_diff = this->blob_top_->mutable_cpu_diff();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      top_diff[i] = i + 1;
+    }
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    const Dtype* bottom_diff = this->blob_bottom_->cpu_diff();
+    int num_nonzero = 0;
+    Dtype sum = 0;
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      num_nonzero += bottom_diff[i] != 0;
+      sum += bottom_diff[i];
+    }
+    const int top_count = this->blob_top_->count();
+    EXPECT_EQ(top_count, num_nonzero);
+    EXPECT_EQ(Dtype(top_count) * (top_count + 1) / 2, sum);
+    if (!argmax_mask) {
+      repooled_diff.CopyFrom(*this->blob_bottom_, true, true);
+      continue;
+    }
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(repooled_diff.cpu_diff()[i], bottom_diff[i]);
+    }
+  }
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestGradientAvePadded) {
+  LayerParameter layer_param =
+      this->LayerParam(Pooling3DParameter_PoolMethod_AVE);
+  layer_param.mutable_pooling3d_param()->set_kernel_size(3);
+  layer_param.mutable_pooling3d_param()->set_pad(1);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
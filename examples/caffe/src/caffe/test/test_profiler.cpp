@@ -0,0 +1,100 @@
+#include <boost/thread.hpp>
+#include <stdio.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/profiler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ProfilerTest : public ::testing::Test {
+ protected:
+  ProfilerTest() {
+    MakeTempFilename(&filename_);
+  }
+
+  virtual ~ProfilerTest() {
+    remove(filename_.c_str());
+  }
+
+  // Lines of filename_ that mention name.
+  vector<string> Lines(const string& name) {
+    std::ifstream file(filename_.c_str());
+    vector<string> lines;
+    string line;
+    while (std::getline(file, line)) {
+      if (line.find(name) != string::npos) {
+        lines.push_back(line);
+      }
+    }
+    return lines;
+  }
+
+  static void RecordLayers(int name, int n) {
+    for (int i = 0; i < n; ++i) {
+      const uint64_t start = Profiler::Now();
+      Profiler::Record(name, Profiler::FORWARD, start, Profiler::Now(), 64);
+    }
+  }
+
+  string filename_;
+};
+
+TEST_F(ProfilerTest, TestIntern) {
+  const int conv = Profiler::Intern("intern/conv");
+  EXPECT_NE(conv, Profiler::Intern("intern/pool"));
+  EXPECT_EQ(conv, Profiler::Intern("intern/conv"));
+}
+
+TEST_F(ProfilerTest, TestCsv) {
+  filename_ += ".csv";
+  const int name = Profiler::Intern("csv/conv1");
+  boost::thread_group threads;
+  for (int i = 0; i < 3; ++i) {
+    threads.create_thread(boost::bind(&ProfilerTest::RecordLayers, name, 10));
+  }
+  threads.join_all();
+  Profiler::Record(name, Profiler::BACKWARD, 1000, 3500, 128);
+  Profiler::Write(filename_);
+
+  const vector<string> lines = Lines("csv/conv1");
+  ASSERT_EQ(31, lines.size());
+  EXPECT_NE(string::npos, lines[30].find(",csv/conv1,backward,1.000,3.500,128"))
+      << lines[30];
+}
+
+TEST_F(ProfilerTest, TestChromeTrace) {
+  filename_ += ".json";
+  Profiler::Record(Profiler::Intern("json/\"fc\""), Profiler::FORWARD, 2000,
+      2500, 256);
+  Profiler::Write(filename_);
+
+  std::ifstream file(filename_.c_str());
+  string json((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  EXPECT_EQ(0, json.find("{\"traceEvents\":["));
+  EXPECT_NE(string::npos, json.find("{\"name\":\"json/\\\"fc\\\"\","
+      "\"cat\":\"forward\",\"ph\":\"X\",\"pid\":0,"));
+  EXPECT_NE(string::npos, json.find("\"ts\":2.000,\"dur\":0.500,"
+      "\"args\":{\"bytes\":256}}"));
+}
+
+TEST_F(ProfilerTest, TestRingKeepsLastEvents) {
+  filename_ += ".csv";
+  const int name = Profiler::Intern("ring/conv1");
+  boost::thread thread(boost::bind(&ProfilerTest::RecordLayers, name,
+      Profiler::kRingSize + 5));
+  thread.join();
+  Profiler::Write(filename_);
+  EXPECT_EQ(Profiler::kRingSize, Lines("ring/conv1").size());
+}
+
+}  // namespace caffe
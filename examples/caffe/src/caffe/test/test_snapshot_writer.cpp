@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SnapshotWriterTest : public ::testing::Test {
+ protected:
+  SnapshotWriterTest() {
+    MakeTempFilename(&model_);
+    MakeTempFilename(&state_);
+  }
+
+  virtual ~SnapshotWriterTest() {
+    remove(model_.c_str());
+    remove(state_.c_str());
+  }
+
+  // Stages a net named name and a solver state at iter into writer.
+  void PushSnapshot(SnapshotWriter* writer, const string& name, int iter) {
+    StagedSnapshot* snapshot = writer->free_snapshot();
+    EXPECT_TRUE(snapshot->protos.empty());
+    NetParameter* net_param = new NetParameter();
+    net_param->set_name(name);
+    snapshot->protos.push_back(shared_ptr< ::google::protobuf::Message>(
+        net_param));
+    snapshot->filenames.push_back(model_);
+    SolverState* state = new SolverState();
+    state->set_iter(iter);
+    state->set_learned_net(model_);
+    snapshot->protos.push_back(shared_ptr< ::google::protobuf::Message>(
+        state));
+    snapshot->filenames.push_back(state_);
+    writer->Push(snapshot);
+  }
+
+  string model_;
+  string state_;
+};
+
+TEST_F(SnapshotWriterTest, TestWriteAtomically) {
+  NetParameter net_param;
+  net_param.set_name("atomic");
+  SnapshotWriter::WriteAtomically(net_param, model_);
+  NetParameter read;
+  EXPECT_TRUE(ReadProtoFromBinaryFile(model_, &read));
+  EXPECT_EQ("atomic", read.name());
+  EXPECT_NE(0, access((model_ + ".tmp").c_str(), F_OK));
+}
+
+TEST_F(SnapshotWriterTest, TestWritesInOrder) {
+  SnapshotWriter writer(2);
+  for (int i = 0; i < 5; ++i) {
+    PushSnapshot(&writer, "net", i);
+  }
+  writer.Wait();
+  SolverState state;
+  EXPECT_TRUE(ReadProtoFromBinaryFile(state_, &state));
+  EXPECT_EQ(4, state.iter());
+  EXPECT_EQ(model_, state.learned_net());
+  NetParameter net_param;
+  EXPECT_TRUE(ReadProtoFromBinaryFile(model_, &net_param));
+  EXPECT_EQ("net", net_param.name());
+}
+
+TEST_F(SnapshotWriterTest, TestDestructorWaits) {
+  {
+    SnapshotWriter writer(1);
+    PushSnapshot(&writer, "last", 7);
+  }
+  SolverState state;
+  EXPECT_TRUE(ReadProtoFromBinaryFile(state_, &state));
+  EXPECT_EQ(7, state.iter());
+}
+
+}  // namespace caffe
@@ -1,14 +1,21 @@
+#include <string>
 #include <vector>
 
+#include "gflags/gflags.h"
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
+DECLARE_bool(enable_mmap);
+DECLARE_string(dragon_tmp_folder);
+DECLARE_uint64(dragon_enable_threshold);
+
 namespace caffe {
 
 class SyncedMemoryTest : public ::testing::Test {};
@@ -122,4 +129,91 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
 
 #endif
 
+// Backs large blobs with the mmap memfile arena.
+class SyncedMemoryMmapTest : public ::testing::Test {
+ protected:
+  static const size_t kSize = 1 << 16;
+
+  SyncedMemoryMmapTest()
+      : enable_mmap_(FLAGS_enable_mmap),
+        tmp_folder_(FLAGS_dragon_tmp_folder),
+        threshold_(FLAGS_dragon_enable_threshold) {
+    string folder;
+    MakeTempDir(&folder);
+    FLAGS_enable_mmap = true;
+    FLAGS_dragon_tmp_folder = folder + "/";
+    FLAGS_dragon_enable_threshold = kSize;
+  }
+  virtual ~SyncedMemoryMmapTest() {
+    FLAGS_enable_mmap = enable_mmap_;
+    FLAGS_dragon_tmp_folder = tmp_folder_;
+    FLAGS_dragon_enable_threshold = threshold_;
+  }
+
+  static size_t InUseBytes() {
+    string backend;
+    MemfileArena::Stats stats;
+    EXPECT_TRUE(SyncedMemory::memfile_stats(&backend, &stats));
+    EXPECT_EQ("mmap", backend);
+    return stats.in_use_bytes;
+  }
+
+  const bool enable_mmap_;
+  const string tmp_folder_;
+  const uint64_t threshold_;
+};
+
+const size_t SyncedMemoryMmapTest::kSize;
+
+TEST_F(SyncedMemoryMmapTest, TestSetCPUDataReleasesArena) {
+  vector<char> data(kSize, 3);
+  {
+    SyncedMemory mem(kSize);
+    caffe_memset(kSize, 1, mem.mutable_cpu_data());
+    const size_t in_use = InUseBytes();
+    mem.set_cpu_data(&data[0]);
+    EXPECT_GT(in_use, InUseBytes());
+    EXPECT_EQ(&data[0], mem.cpu_data());
+    // Reuses the range mem has just given back.
+    SyncedMemory other(kSize);
+    caffe_memset(kSize, 7, other.mutable_cpu_data());
+    for (int i = 0; i < kSize; ++i) {
+      EXPECT_EQ(3, static_cast<const char*>(mem.cpu_data())[i]);
+    }
+  }
+  // Destroying mem frees neither data nor the arena range again.
+  for (int i = 0; i < kSize; ++i) {
+    EXPECT_EQ(3, data[i]);
+  }
+}
+
+#ifndef CPU_ONLY  // GPU test
+
+TEST_F(SyncedMemoryMmapTest, TestSetGPUDataReleasesArena) {
+  void* gpu_data;
+  CUDA_CHECK(cudaMalloc(&gpu_data, kSize));
+  caffe_gpu_memset(kSize, 2, gpu_data);
+  {
+    SyncedMemory mem(kSize);
+    caffe_memset(kSize, 1, mem.mutable_cpu_data());
+    const size_t in_use = InUseBytes();
+    mem.set_gpu_data(gpu_data);
+    EXPECT_GT(in_use, InUseBytes());
+    SyncedMemory other(kSize);
+    void* other_data = other.mutable_cpu_data();
+    caffe_memset(kSize, 7, other_data);
+    // The copy back from the GPU goes to fresh host memory, not to the
+    // range that other now owns.
+    const void* cpu_data = mem.cpu_data();
+    EXPECT_NE(other_data, cpu_data);
+    for (int i = 0; i < kSize; ++i) {
+      EXPECT_EQ(2, static_cast<const char*>(cpu_data)[i]);
+      EXPECT_EQ(7, static_cast<const char*>(other_data)[i]);
+    }
+  }
+  CUDA_CHECK(cudaFree(gpu_data));
+}
+
+#endif
+
 }  // namespace caffe
@@ -2,8 +2,11 @@
 #include <string>
 
 #include "caffe/layers/base_data_layer.hpp"
+#include "caffe/layers/dragon_base_data_layer.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/dragon_convert_writer.hpp"
+#include "caffe/util/snapshot_writer.hpp"
 
 namespace caffe {
 
@@ -87,5 +90,9 @@ size_t BlockingQueue<T>::size() const {
 
 template class BlockingQueue<Batch<float>*>;
 template class BlockingQueue<Batch<double>*>;
+template class BlockingQueue<DragonBatch<float>*>;
+template class BlockingQueue<DragonBatch<double>*>;
+template class BlockingQueue<DragonConvertChunk*>;
+template class BlockingQueue<StagedSnapshot*>;
 
 }  // namespace caffe
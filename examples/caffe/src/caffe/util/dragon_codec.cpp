@@ -0,0 +1,279 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DRAGON_CODEC_AVX2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define DRAGON_CODEC_NEON
+#endif
+
+#include "caffe/common.hpp"
+#include "caffe/util/dragon_codec.hpp"
+
+namespace caffe {
+
+float dragon_half_to_float(uint16_t h) {
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t bits;
+  if (exp == 0x1f) {
+    // infinity or NaN
+    bits = sign | 0x7f800000 | (mant << 13);
+  } else if (exp != 0) {
+    bits = sign | ((exp + 112) << 23) | (mant << 13);
+  } else if (mant == 0) {
+    bits = sign;
+  } else {
+    // subnormal: normalize the mantissa
+    exp = 113;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      --exp;
+    }
+    bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+  }
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+uint16_t dragon_float_to_half(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs = bits & 0x7fffffff;
+  if (abs >= 0x7f800000) {
+    // infinity or NaN, keeping NaNs quiet
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477ff000) {
+    // rounds past 65504
+    return sign | 0x7c00;
+  }
+  if (abs < 0x38800000) {
+    // below 2^-14: a subnormal half, round(f * 2^24)
+    if (abs <= 0x33000000) {
+      return sign;
+    }
+    const uint32_t mant = (abs & 0x7fffff) | 0x800000;
+    const int shift = 126 - (abs >> 23);
+    uint32_t h = mant >> shift;
+    const uint32_t rest = mant & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1))) {
+      ++h;
+    }
+    return sign | h;
+  }
+  // rebias the exponent from 127 to 15 and round off 13 mantissa bits
+  const uint32_t h = abs - 0x38000000;
+  return sign | ((h + 0xfff + ((h >> 13) & 1)) >> 13);
+}
+
+#ifdef DRAGON_CODEC_AVX2
+static bool has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+  return avx2;
+}
+
+__attribute__((target("avx2,fma")))
+static size_t decode_uint8_simd(const uint8_t* src, size_t n, float a, float b,
+    float* dst) {
+  const __m256 va = _mm256_set1_ps(a);
+  const __m256 vb = _mm256_set1_ps(b);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i x = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(x), va, vb));
+  }
+  return i;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static size_t decode_half_simd(const uint16_t* src, size_t n, float a, float b,
+    float* dst) {
+  const __m256 va = _mm256_set1_ps(a);
+  const __m256 vb = _mm256_set1_ps(b);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x = _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(x, va, vb));
+  }
+  return i;
+}
+#elif defined(DRAGON_CODEC_NEON)
+static size_t decode_uint8_simd(const uint8_t* src, size_t n, float a, float b,
+    float* dst) {
+  const float32x4_t va = vdupq_n_f32(a);
+  const float32x4_t vb = vdupq_n_f32(b);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const uint16x8_t x = vmovl_u8(vld1_u8(src + i));
+    const float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(x)));
+    const float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(x)));
+    vst1q_f32(dst + i, vfmaq_f32(vb, lo, va));
+    vst1q_f32(dst + i + 4, vfmaq_f32(vb, hi, va));
+  }
+  return i;
+}
+
+static size_t decode_half_simd(const uint16_t* src, size_t n, float a, float b,
+    float* dst) {
+  const float32x4_t va = vdupq_n_f32(a);
+  const float32x4_t vb = vdupq_n_f32(b);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const float32x4_t x = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i)));
+    vst1q_f32(dst + i, vfmaq_f32(vb, x, va));
+  }
+  return i;
+}
+#else
+static size_t decode_uint8_simd(const uint8_t* src, size_t n, float a, float b,
+    float* dst) {
+  return 0;
+}
+
+static size_t decode_half_simd(const uint16_t* src, size_t n, float a, float b,
+    float* dst) {
+  return 0;
+}
+#endif
+
+// dst[i] = src[i] * a + b for the n values of type dtype at src.
+template <typename Dtype>
+static void decode_scalar(DragonMemDtype dtype, const char* src, size_t n,
+    Dtype a, Dtype b, Dtype* dst) {
+  switch (dtype) {
+  case DRAGON_MEM_FLOAT32: {
+    const float* values = reinterpret_cast<const float*>(src);
+    for (size_t i = 0; i < n; ++i) {
+      dst[i] = values[i] * a + b;
+    }
+    break;
+  }
+  case DRAGON_MEM_FLOAT64: {
+    const double* values = reinterpret_cast<const double*>(src);
+    for (size_t i = 0; i < n; ++i) {
+      dst[i] = values[i] * a + b;
+    }
+    break;
+  }
+  case DRAGON_MEM_UINT8: {
+    const uint8_t* values = reinterpret_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < n; ++i) {
+      dst[i] = values[i] * a + b;
+    }
+    break;
+  }
+  case DRAGON_MEM_FLOAT16: {
+    const uint16_t* values = reinterpret_cast<const uint16_t*>(src);
+    for (size_t i = 0; i < n; ++i) {
+      dst[i] = dragon_half_to_float(values[i]) * a + b;
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown .mem dtype " << dtype;
+  }
+}
+
+// Vectorizes what the CPU can, and leaves the tail to decode_scalar.
+static size_t decode_simd(DragonMemDtype dtype, const char* src, size_t n,
+    float a, float b, float* dst) {
+#ifdef DRAGON_CODEC_AVX2
+  if (!has_avx2()) {
+    return 0;
+  }
+#endif
+  if (dtype == DRAGON_MEM_UINT8) {
+    return decode_uint8_simd(reinterpret_cast<const uint8_t*>(src), n, a, b,
+        dst);
+  } else if (dtype == DRAGON_MEM_FLOAT16) {
+    return decode_half_simd(reinterpret_cast<const uint16_t*>(src), n, a, b,
+        dst);
+  }
+  return 0;
+}
+
+static size_t decode_simd(DragonMemDtype dtype, const char* src, size_t n,
+    double a, double b, double* dst) {
+  return 0;
+}
+
+template <typename Dtype>
+void dragon_decode(DragonMemDtype dtype, const void* src, size_t num_items,
+    int channels, size_t inner, const Dtype* mean, Dtype scale, Dtype* dst) {
+  const size_t value_size = DragonMemDtypeSize(dtype);
+  const char* values = static_cast<const char*>(src);
+  if (dtype == dragon_mem_dtype<Dtype>() && !mean && scale == 1) {
+    memcpy(dst, values, num_items * channels * inner * value_size);
+    return;
+  }
+  for (size_t item = 0; item < num_items; ++item) {
+    for (int c = 0; c < channels; ++c) {
+      const Dtype shift = mean ? -mean[c] * scale : 0;
+      const size_t done = decode_simd(dtype, values, inner, scale, shift, dst);
+      decode_scalar(dtype, values + done * value_size, inner - done, scale,
+          shift, dst + done);
+      values += inner * value_size;
+      dst += inner;
+    }
+  }
+}
+
+template <typename Dtype>
+void dragon_encode(DragonMemDtype dtype, const Dtype* src, size_t n,
+    void* dst) {
+  switch (dtype) {
+  case DRAGON_MEM_FLOAT32: {
+    float* values = static_cast<float*>(dst);
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = src[i];
+    }
+    break;
+  }
+  case DRAGON_MEM_FLOAT64: {
+    double* values = static_cast<double*>(dst);
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = src[i];
+    }
+    break;
+  }
+  case DRAGON_MEM_UINT8: {
+    uint8_t* values = static_cast<uint8_t*>(dst);
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = src[i] <= 0 ? 0 : src[i] >= 255 ? 255 :
+          static_cast<uint8_t>(src[i] + Dtype(0.5));
+    }
+    break;
+  }
+  case DRAGON_MEM_FLOAT16: {
+    uint16_t* values = static_cast<uint16_t*>(dst);
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = dragon_float_to_half(src[i]);
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown .mem dtype " << dtype;
+  }
+}
+
+template void dragon_decode<float>(DragonMemDtype dtype, const void* src,
+    size_t num_items, int channels, size_t inner, const float* mean,
+    float scale, float* dst);
+template void dragon_decode<double>(DragonMemDtype dtype, const void* src,
+    size_t num_items, int channels, size_t inner, const double* mean,
+    double scale, double* dst);
+template void dragon_encode<float>(DragonMemDtype dtype, const float* src,
+    size_t n, void* dst);
+template void dragon_encode<double>(DragonMemDtype dtype, const double* src,
+    size_t n, void* dst);
+
+}  // namespace caffe
@@ -0,0 +1,257 @@
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/dragon_convert_writer.hpp"
+
+namespace caffe {
+
+static void write_fully(int fd, const char* buf, size_t size,
+    const string& out) {
+  while (size > 0) {
+    ssize_t ret = write(fd, buf, size);
+    CHECK_GT(ret, 0) << "Cannot write to " << out;
+    buf += ret;
+    size -= ret;
+  }
+}
+
+DragonConvertWriter::DragonConvertWriter(
+    const DragonConvertDataParameter& param)
+    : data_out_(param.data_out()), labels_out_(param.labels_out()),
+      progress_out_(param.data_out() + ".progress"),
+      data_fd_(-1), labels_fd_(-1), record_size_(0), label_size_(0),
+      records_(0), cursor_(0), resumed_records_(0), data_crc_(0),
+      labels_crc_(0), seconds_(0) {
+  if (param.resume()) {
+    ReadProgress();
+  } else {
+    unlink(progress_out_.c_str());
+  }
+
+  data_fd_ = open(data_out_.c_str(), O_WRONLY | O_CREAT | O_LARGEFILE, 0666);
+  CHECK_GE(data_fd_, 0) << "Cannot open/create " << data_out_;
+  labels_fd_ = open(labels_out_.c_str(), O_WRONLY | O_CREAT | O_LARGEFILE,
+      0666);
+  CHECK_GE(labels_fd_, 0) << "Cannot open/create " << labels_out_;
+}
+
+DragonConvertWriter::~DragonConvertWriter() {
+  StopInternalThread();
+  if (data_fd_ >= 0) {
+    close(data_fd_);
+  }
+  if (labels_fd_ >= 0) {
+    close(labels_fd_);
+  }
+}
+
+int DragonConvertWriter::num_workers(const DragonConvertDataParameter& param,
+    bool random) {
+  if (random) {
+    return 1;
+  }
+  if (param.num_threads() > 0) {
+    return param.num_threads();
+  }
+  return std::max(boost::thread::hardware_concurrency(), 1u);
+}
+
+DragonMemDtype DragonConvertWriter::storage(
+    const DragonConvertDataParameter& param, DragonMemDtype native) {
+  switch (param.storage()) {
+  case DragonConvertDataParameter_Storage_UINT8:
+    return DRAGON_MEM_UINT8;
+  case DragonConvertDataParameter_Storage_FLOAT16:
+    return DRAGON_MEM_FLOAT16;
+  default:
+    return native;
+  }
+}
+
+TransformationParameter DragonConvertWriter::stored_transform(
+    const DragonConvertDataParameter& param, DragonMemDtype native,
+    const TransformationParameter& transform_param) {
+  TransformationParameter stored = transform_param;
+  if (storage(param, native) != native) {
+    CHECK(!transform_param.has_mean_file())
+        << "mean_file cannot be applied to UINT8 or FLOAT16 storage; "
+        "use mean_value";
+    stored.clear_mean_value();
+    stored.clear_scale();
+  }
+  return stored;
+}
+
+void DragonConvertWriter::ReadProgress() {
+  std::ifstream progress(progress_out_.c_str());
+  if (!progress) {
+    return;
+  }
+  CHECK(progress >> records_ >> cursor_ >> data_crc_ >> labels_crc_)
+      << "Cannot parse the progress index " << progress_out_;
+  resumed_records_ = records_;
+  LOG(INFO) << "===> Resuming after " << records_ << " converted records";
+}
+
+void DragonConvertWriter::WriteProgress() {
+  // Replace the index atomically, so that it never names a partial chunk.
+  const string tmp = progress_out_ + ".tmp";
+  {
+    std::ofstream progress(tmp.c_str());
+    progress << records_ << " " << cursor_ << " " << data_crc_ << " "
+        << labels_crc_ << std::endl;
+    CHECK(progress) << "Cannot write to " << tmp;
+  }
+  CHECK_EQ(rename(tmp.c_str(), progress_out_.c_str()), 0)
+      << "Cannot write to " << progress_out_;
+}
+
+void DragonConvertWriter::Start(const DragonMemHeader& data_header,
+    const DragonMemHeader* labels_header, uint32_t chunk_records) {
+  CHECK_GT(data_header.item_size, 0U);
+  CHECK_GT(chunk_records, 0U);
+  data_header_ = data_header;
+  record_size_ = data_header_.item_size;
+  label_size_ = 0;
+  if (labels_header) {
+    labels_header_ = *labels_header;
+    label_size_ = labels_header_.item_size;
+  }
+
+  if (records_ > 0) {
+    DragonMemHeader header;
+    CHECK(ReadDragonMemHeader(data_out_, &header) &&
+        header.item_size == record_size_ && header.dtype == data_header_.dtype)
+        << "Cannot resume " << data_out_ << ": it holds other records";
+  }
+  // Drop whatever an interrupted run wrote after its last complete chunk.
+  const uint64_t data_end = data_header_.payload_offset + records_ * record_size_;
+  struct stat st;
+  CHECK_EQ(fstat(data_fd_, &st), 0) << "Cannot stat " << data_out_;
+  CHECK(records_ == 0 || (uint64_t)st.st_size >= data_end)
+      << data_out_ << " is shorter than " << progress_out_ << " says";
+  CHECK_EQ(ftruncate(data_fd_, data_end), 0) << "Cannot truncate " << data_out_;
+  CHECK_EQ((uint64_t)lseek(data_fd_, 0, SEEK_END), data_end);
+  if (label_size_ > 0) {
+    const uint64_t labels_end =
+        labels_header_.payload_offset + records_ * label_size_;
+    CHECK_EQ(ftruncate(labels_fd_, labels_end), 0)
+        << "Cannot truncate " << labels_out_;
+    CHECK_EQ((uint64_t)lseek(labels_fd_, 0, SEEK_END), labels_end);
+  } else {
+    CHECK_EQ(ftruncate(labels_fd_, 0), 0) << "Cannot truncate " << labels_out_;
+  }
+  WriteHeaders();
+
+  for (int i = 0; i < kChunks; ++i) {
+    shared_ptr<DragonConvertChunk> chunk(new DragonConvertChunk());
+    chunk->data.resize(chunk_records * record_size_);
+    chunk->labels.resize(chunk_records * label_size_);
+    chunk->valid.resize(chunk_records);
+    chunks_.push_back(chunk);
+    free_.push(chunk.get());
+  }
+  timer_.Start();
+  StartInternalThread();
+}
+
+DragonConvertChunk* DragonConvertWriter::free_chunk() {
+  DragonConvertChunk* chunk = free_.pop();
+  chunk->num_records = 0;
+  return chunk;
+}
+
+void DragonConvertWriter::Push(DragonConvertChunk* chunk) {
+  full_.push(chunk);
+}
+
+void DragonConvertWriter::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      DragonConvertChunk* chunk = full_.pop();
+      Write(chunk);
+      free_.push(chunk);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+void DragonConvertWriter::Write(DragonConvertChunk* chunk) {
+  // Close the gaps left by the records that failed to convert.
+  uint32_t num_valid = 0;
+  for (uint32_t i = 0; i < chunk->num_records; ++i) {
+    if (!chunk->valid[i]) {
+      continue;
+    }
+    if (num_valid != i) {
+      memmove(&chunk->data[num_valid * record_size_],
+          &chunk->data[i * record_size_], record_size_);
+      memmove(&chunk->labels[num_valid * label_size_],
+          &chunk->labels[i * label_size_], label_size_);
+    }
+    ++num_valid;
+  }
+
+  write_fully(data_fd_, &chunk->data[0], num_valid * record_size_, data_out_);
+  if (label_size_ > 0) {
+    write_fully(labels_fd_, &chunk->labels[0], num_valid * label_size_,
+        labels_out_);
+  }
+  data_crc_ = DragonMemCrc(data_crc_, &chunk->data[0], num_valid * record_size_);
+  if (label_size_ > 0) {
+    labels_crc_ = DragonMemCrc(labels_crc_, &chunk->labels[0],
+        num_valid * label_size_);
+  }
+  records_ += num_valid;
+  cursor_ = chunk->cursor;
+  WriteHeaders();
+  WriteProgress();
+
+  // Reading a CPUTimer stops it.
+  seconds_ += timer_.Seconds();
+  timer_.Start();
+  LOG(INFO) << "===> Converted data number: " << records_ << " ("
+      << (seconds_ > 0 ? (records_ - resumed_records_) / seconds_ : 0)
+      << " records/s)";
+}
+
+void DragonConvertWriter::WriteHeaders() {
+  data_header_.num_items = records_;
+  data_header_.payload_size = records_ * record_size_;
+  data_header_.payload_crc = data_crc_;
+  WriteDragonMemHeader(data_fd_, &data_header_);
+  if (label_size_ > 0) {
+    labels_header_.num_items = records_;
+    labels_header_.payload_size = records_ * label_size_;
+    labels_header_.payload_crc = labels_crc_;
+    WriteDragonMemHeader(labels_fd_, &labels_header_);
+  }
+}
+
+void DragonConvertWriter::Finish() {
+  // Every chunk is back in free_ once the last one has been written.
+  for (int i = 0; i < kChunks; ++i) {
+    free_.pop();
+  }
+  StopInternalThread();
+  CHECK_EQ(close(data_fd_), 0) << "Cannot write to " << data_out_;
+  CHECK_EQ(close(labels_fd_), 0) << "Cannot write to " << labels_out_;
+  data_fd_ = labels_fd_ = -1;
+  unlink(progress_out_.c_str());
+  seconds_ += timer_.Seconds();
+  LOG(INFO) << "===> Converted data number: " << records_ << " in "
+      << seconds_ << " s";
+}
+
+}  // namespace caffe
@@ -0,0 +1,117 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/dragon_mem.hpp"
+
+namespace caffe {
+
+size_t DragonMemDtypeSize(DragonMemDtype dtype) {
+  switch (dtype) {
+  case DRAGON_MEM_FLOAT32:
+    return 4;
+  case DRAGON_MEM_FLOAT64:
+    return 8;
+  case DRAGON_MEM_UINT8:
+    return 1;
+  case DRAGON_MEM_FLOAT16:
+    return 2;
+  default:
+    LOG(FATAL) << "Unknown .mem dtype " << dtype;
+  }
+  return 0;
+}
+
+DragonMemHeader NewDragonMemHeader(DragonMemDtype dtype,
+    const vector<int>& item_shape) {
+  DragonMemHeader header;
+  memset(&header, 0, sizeof(header));
+  CHECK_LE(item_shape.size(), sizeof(header.shape) / sizeof(header.shape[0]))
+      << "Too many axes";
+  header.magic = kDragonMemMagic;
+  header.version = kDragonMemVersion;
+  header.dtype = dtype;
+  header.item_size = DragonMemDtypeSize(dtype);
+  header.num_axes = item_shape.size();
+  for (size_t i = 0; i < item_shape.size(); ++i) {
+    header.shape[i] = item_shape[i];
+    header.item_size *= item_shape[i];
+  }
+  header.payload_offset = kDragonMemPayloadOffset;
+  return header;
+}
+
+static uint32_t header_crc(const DragonMemHeader& header) {
+  return DragonMemCrc(0, &header, offsetof(DragonMemHeader, header_crc));
+}
+
+bool ReadDragonMemHeader(const string& filename, DragonMemHeader* header) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Cannot open " << filename;
+  ssize_t ret = pread(fd, header, sizeof(*header), 0);
+  close(fd);
+  if (ret != sizeof(*header) || header->magic != kDragonMemMagic) {
+    return false;
+  }
+  CHECK_EQ(header->header_crc, header_crc(*header))
+      << "The header of " << filename << " is damaged";
+  CHECK_LE(header->version, kDragonMemVersion) << filename
+      << " was written by a newer converter";
+  return true;
+}
+
+void WriteDragonMemHeader(int fd, DragonMemHeader* header) {
+  header->header_crc = header_crc(*header);
+  CHECK_EQ(pwrite(fd, header, sizeof(*header), 0), sizeof(*header))
+      << "Cannot write the .mem header";
+}
+
+void CheckDragonMemPayload(const string& filename,
+    const DragonMemHeader& header) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Cannot open " << filename;
+  posix_fadvise(fd, header.payload_offset, header.payload_size,
+      POSIX_FADV_SEQUENTIAL);
+  vector<char> buffer(1 << 22);
+  uint32_t crc = 0;
+  for (uint64_t done = 0; done < header.payload_size; ) {
+    size_t size = std::min<uint64_t>(buffer.size(), header.payload_size - done);
+    ssize_t ret = pread(fd, &buffer[0], size, header.payload_offset + done);
+    CHECK_GT(ret, 0) << filename << " is shorter than its header says";
+    crc = DragonMemCrc(crc, &buffer[0], ret);
+    done += ret;
+  }
+  close(fd);
+  CHECK_EQ(crc, header.payload_crc) << "The payload of " << filename
+      << " does not match its checksum";
+}
+
+static vector<uint32_t> crc_table() {
+  vector<uint32_t> table(256);
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) {
+      c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+uint32_t DragonMemCrc(uint32_t crc, const void* data, size_t size) {
+  // CRC-32 (IEEE 802.3), a byte at a time.
+  static const vector<uint32_t> table = crc_table();
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+}  // namespace caffe
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/dragon_sampler.hpp"
+
+namespace caffe {
+
+DragonSampler::DragonSampler(uint32_t num_items, uint32_t chunk_items,
+    uint32_t window_chunks, bool shuffle, uint32_t seed,
+    uint32_t num_shards, uint32_t shard_id)
+    : num_items_(num_items), chunk_items_(std::max(chunk_items, 1u)),
+      window_chunks_(std::max(window_chunks, 1u)), shuffle_(shuffle),
+      num_shards_(num_shards), shard_id_(shard_id),
+      chunk_rng_(seed), item_rng_(seed + shard_id + 1),
+      epoch_(-1), position_(0), windows_emitted_(0) {
+  CHECK_GT(num_items_, 0) << "The source has no items";
+  CHECK_GT(num_shards_, 0);
+  CHECK_LT(shard_id_, num_shards_);
+  CHECK_LT(shard_id_, (num_items_ - 1) / chunk_items_ + 1)
+      << "Shard " << shard_id_ << " of " << num_shards_ << " has no chunks";
+  StartEpoch();
+}
+
+uint32_t DragonSampler::epoch_items() const {
+  return order_.size();
+}
+
+void DragonSampler::StartEpoch() {
+  const uint32_t num_chunks = (num_items_ - 1) / chunk_items_ + 1;
+  vector<uint32_t> chunks(num_chunks);
+  for (uint32_t i = 0; i < num_chunks; ++i) {
+    chunks[i] = i;
+  }
+  if (shuffle_) {
+    caffe::shuffle(chunks.begin(), chunks.end(), &chunk_rng_);
+  }
+
+  ++epoch_;
+  order_.clear();
+  position_ = 0;
+  window_begin_.clear();
+  windows_.clear();
+  windows_emitted_ = 0;
+  for (uint32_t i = shard_id_; i < num_chunks; i += num_shards_) {
+    if (windows_.empty() || windows_.back().size() == window_chunks_) {
+      if (shuffle_ && !windows_.empty()) {
+        caffe::shuffle(order_.begin() + window_begin_.back(), order_.end(),
+            &item_rng_);
+      }
+      window_begin_.push_back(order_.size());
+      windows_.push_back(vector<Run>());
+    }
+    const uint32_t first = chunks[i] * chunk_items_;
+    const uint32_t count = std::min(chunk_items_, num_items_ - first);
+    windows_.back().push_back(Run(first, count));
+    for (uint32_t item = first; item < first + count; ++item) {
+      order_.push_back(item);
+    }
+  }
+  if (shuffle_) {
+    caffe::shuffle(order_.begin() + window_begin_.back(), order_.end(),
+        &item_rng_);
+  }
+}
+
+uint32_t DragonSampler::Next(uint32_t max_items, vector<Run>* runs,
+    vector<Run>* window) {
+  if (position_ == order_.size()) {
+    StartEpoch();
+  }
+  const uint32_t count =
+      std::min<size_t>(max_items, order_.size() - position_);
+  for (size_t i = position_; i < position_ + count; ++i) {
+    // Emit the current window and the one after it.
+    while (windows_emitted_ < windows_.size() &&
+        (windows_emitted_ <= 1 ||
+         window_begin_[windows_emitted_ - 1] <= i)) {
+      window->insert(window->end(), windows_[windows_emitted_].begin(),
+          windows_[windows_emitted_].end());
+      ++windows_emitted_;
+    }
+    const uint32_t item = order_[i];
+    if (!runs->empty() &&
+        runs->back().first + runs->back().second == item) {
+      ++runs->back().second;
+    } else {
+      runs->push_back(Run(item, 1));
+    }
+  }
+  position_ += count;
+  return count;
+}
+
+}  // namespace caffe
@@ -0,0 +1,289 @@
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/memfile_arena.hpp"
+
+namespace caffe {
+
+const size_t MemfileArena::kAlignment;
+const size_t MemfileArena::kThreadCacheEntries;
+
+// Extents freed by this thread and not handed back yet, most recent last.
+class MemfileArena::ThreadCache {
+ public:
+  struct Entry {
+    MemfileArena* arena;
+    char* ptr;
+    size_t size;
+  };
+
+  ~ThreadCache() {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      Return(entries_[i]);
+    }
+  }
+
+  bool Pop(MemfileArena* arena, size_t size, char** ptr) {
+    for (size_t i = entries_.size(); i > 0; --i) {
+      Entry& entry = entries_[i - 1];
+      if (entry.arena == arena && entry.size == size) {
+        *ptr = entry.ptr;
+        entries_.erase(entries_.begin() + (i - 1));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool Push(MemfileArena* arena, char* ptr, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      count += entries_[i].arena == arena;
+    }
+    if (count >= kThreadCacheEntries) {
+      return false;
+    }
+    Entry entry = { arena, ptr, size };
+    entries_.push_back(entry);
+    return true;
+  }
+
+  void Flush(MemfileArena* arena) {
+    std::vector<Entry> kept;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (entries_[i].arena == arena) {
+        Return(entries_[i]);
+      } else {
+        kept.push_back(entries_[i]);
+      }
+    }
+    entries_.swap(kept);
+  }
+
+ private:
+  static void Return(const Entry& entry) {
+    entry.arena->cached_bytes_ -= entry.size;
+    entry.arena->Release(entry.ptr, entry.size);
+  }
+
+  std::vector<Entry> entries_;
+};
+
+static boost::thread_specific_ptr<MemfileArena::ThreadCache> thread_cache_;
+
+static MemfileArena::ThreadCache* GetThreadCache() {
+  if (!thread_cache_.get()) {
+    thread_cache_.reset(new MemfileArena::ThreadCache());
+  }
+  return thread_cache_.get();
+}
+
+MemfileArena::MemfileArena(const string& name, shared_ptr<Backend> backend,
+    size_t file_size)
+    : name_(name), backend_(backend), file_size_(RoundUp(file_size)),
+      free_classes_(sizeof(size_t) * 8), free_bytes_(0), mapped_bytes_(0),
+      in_use_bytes_(0), high_water_bytes_(0), cached_bytes_(0),
+      num_allocs_(0), num_frees_(0), num_cache_hits_(0) {
+  CHECK_GT(file_size_, 0) << "Memory file size of " << name_ << " is zero";
+}
+
+MemfileArena::~MemfileArena() {
+  FlushThreadCache();
+  for (size_t i = 0; i < files_.size(); ++i) {
+    backend_->Unmap(files_[i].index, files_[i].base, files_[i].size);
+  }
+}
+
+size_t MemfileArena::SizeClass(size_t size) {
+  size_t size_class = 0;
+  while (size >>= 1) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+void MemfileArena::UpdateHighWater(size_t in_use) {
+  size_t high_water = high_water_bytes_.load();
+  while (in_use > high_water &&
+      !high_water_bytes_.compare_exchange_weak(high_water, in_use)) {
+  }
+}
+
+void MemfileArena::InsertFreeLocked(const Extent& extent, bool clean) {
+  FreeRun run = { extent.size, clean };
+  free_runs_[extent.file][extent.offset] = run;
+  free_classes_[SizeClass(extent.size)].insert(extent);
+  free_bytes_ += extent.size;
+}
+
+void MemfileArena::EraseFreeLocked(const Extent& extent) {
+  free_runs_[extent.file].erase(extent.offset);
+  free_classes_[SizeClass(extent.size)].erase(extent);
+  free_bytes_ -= extent.size;
+}
+
+bool MemfileArena::TakeFreeLocked(size_t size, Extent* extent, bool* clean) {
+  for (size_t size_class = SizeClass(size);
+      size_class < free_classes_.size(); ++size_class) {
+    // Best fit: the smallest extent of the class that is large enough.
+    Extent key = { 0, 0, size };
+    std::set<Extent>::iterator it = free_classes_[size_class].lower_bound(key);
+    if (it == free_classes_[size_class].end()) {
+      continue;
+    }
+    Extent found = *it;
+    *clean = free_runs_[found.file][found.offset].clean;
+    EraseFreeLocked(found);
+    if (found.size > size) {
+      Extent rest = { found.file, found.offset + size, found.size - size };
+      InsertFreeLocked(rest, *clean);
+    }
+    extent->file = found.file;
+    extent->offset = found.offset;
+    extent->size = size;
+    return true;
+  }
+  return false;
+}
+
+bool MemfileArena::MapFileLocked(size_t size) {
+  static std::atomic<long> next_index(0);
+  File file;
+  file.index = next_index++;
+  // A blob larger than a file gets a file of its own.
+  file.size = std::max(file_size_, size);
+  file.base = static_cast<char*>(backend_->Map(file.index, file.size));
+  if (!file.base) {
+    return false;
+  }
+  files_.push_back(file);
+  free_runs_.resize(files_.size());
+  mapped_bytes_ += file.size;
+  Extent extent = { files_.size() - 1, 0, file.size };
+  InsertFreeLocked(extent, true);
+  return true;
+}
+
+void* MemfileArena::Allocate(size_t size, bool* zeroed) {
+  size = RoundUp(std::max(size, (size_t)1));
+  ++num_allocs_;
+
+  char* ptr;
+  if (GetThreadCache()->Pop(this, size, &ptr)) {
+    cached_bytes_ -= size;
+    ++num_cache_hits_;
+    UpdateHighWater(in_use_bytes_ += size);
+    *zeroed = false;
+    return ptr;
+  }
+
+  Extent extent;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!TakeFreeLocked(size, &extent, zeroed)) {
+      CHECK(MapFileLocked(size)) << "Cannot map a memory file for " << name_;
+      CHECK(TakeFreeLocked(size, &extent, zeroed));
+    }
+    ptr = files_[extent.file].base + extent.offset;
+  }
+  UpdateHighWater(in_use_bytes_ += size);
+  return ptr;
+}
+
+void MemfileArena::Free(void* ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  size = RoundUp(std::max(size, (size_t)1));
+  ++num_frees_;
+  in_use_bytes_ -= size;
+
+  if (GetThreadCache()->Push(this, static_cast<char*>(ptr), size)) {
+    cached_bytes_ += size;
+    return;
+  }
+  Release(static_cast<char*>(ptr), size);
+}
+
+void MemfileArena::FlushThreadCache() {
+  GetThreadCache()->Flush(this);
+}
+
+void MemfileArena::Release(char* ptr, size_t size) {
+  long index = -1;
+  Extent extent = { 0, 0, size };
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < files_.size(); ++i) {
+      if (ptr >= files_[i].base && ptr < files_[i].base + files_[i].size) {
+        extent.file = i;
+        extent.offset = ptr - files_[i].base;
+        index = files_[i].index;
+        break;
+      }
+    }
+  }
+  CHECK_GE(index, 0) << ptr << " was not allocated from " << name_;
+
+  // Give the space back to the file system before anyone can reuse it.
+  bool clean = backend_->Discard(index, extent.offset, extent.size);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<size_t, FreeRun>& runs = free_runs_[extent.file];
+  std::map<size_t, FreeRun>::iterator next = runs.lower_bound(extent.offset);
+  if (next != runs.end() && extent.offset + extent.size == next->first) {
+    Extent neighbour = { extent.file, next->first, next->second.size };
+    clean = clean && next->second.clean;
+    extent.size += neighbour.size;
+    EraseFreeLocked(neighbour);
+  }
+  next = runs.lower_bound(extent.offset);
+  if (next != runs.begin()) {
+    std::map<size_t, FreeRun>::iterator prev = next;
+    --prev;
+    if (prev->first + prev->second.size == extent.offset) {
+      Extent neighbour = { extent.file, prev->first, prev->second.size };
+      clean = clean && prev->second.clean;
+      extent.offset = neighbour.offset;
+      extent.size += neighbour.size;
+      EraseFreeLocked(neighbour);
+    }
+  }
+  InsertFreeLocked(extent, clean);
+}
+
+MemfileArena::Stats MemfileArena::GetStats() {
+  Stats stats;
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats.mapped_bytes = mapped_bytes_;
+  stats.in_use_bytes = in_use_bytes_;
+  stats.high_water_bytes = high_water_bytes_;
+  stats.free_bytes = free_bytes_ + cached_bytes_;
+  stats.largest_free_bytes = 0;
+  for (size_t size_class = free_classes_.size(); size_class > 0; --size_class) {
+    if (!free_classes_[size_class - 1].empty()) {
+      stats.largest_free_bytes = free_classes_[size_class - 1].rbegin()->size;
+      break;
+    }
+  }
+  stats.num_files = files_.size();
+  stats.num_allocs = num_allocs_;
+  stats.num_frees = num_frees_;
+  stats.num_cache_hits = num_cache_hits_;
+  return stats;
+}
+
+void MemfileArena::LogStats() {
+  Stats stats = GetStats();
+  LOG(INFO) << name_ << " memory files: " << stats.num_files << " files, "
+      << stats.mapped_bytes << " bytes mapped, " << stats.in_use_bytes
+      << " in use (high-water " << stats.high_water_bytes << "), "
+      << stats.free_bytes << " free (largest " << stats.largest_free_bytes
+      << ", fragmentation " << stats.fragmentation() << "), "
+      << stats.num_allocs << " allocs (" << stats.num_cache_hits
+      << " from thread caches), " << stats.num_frees << " frees";
+}
+
+}  // namespace caffe
@@ -0,0 +1,225 @@
+#include <boost/thread.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/util/profiler.hpp"
+
+namespace caffe {
+
+const size_t Profiler::kRingSize;
+bool Profiler::enabled_ = false;
+
+namespace {
+
+// Events of one thread; only that thread writes to it.
+struct Ring {
+  explicit Ring(int tid) : tid(tid), head(0), events(Profiler::kRingSize) {}
+
+  int tid;
+  // events recorded so far, of which the last kRingSize are kept
+  std::atomic<uint64_t> head;
+  vector<Profiler::Event> events;
+};
+
+// State shared by the threads, constructed on first use so that it
+// outlives the Nets destroyed by static destructors.
+struct Registry {
+  boost::mutex mutex;
+  vector<shared_ptr<Ring> > rings;
+  map<string, int> ids;
+  vector<string> names;
+  string filename;
+};
+
+Registry& registry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+Ring* thread_ring() {
+  static thread_local Ring* ring = NULL;
+  if (!ring) {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    r.rings.push_back(shared_ptr<Ring>(new Ring(r.rings.size())));
+    ring = r.rings.back().get();
+  }
+  return ring;
+}
+
+string json_escape(const string& s) {
+  string escaped;
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      escaped += '\\';
+      escaped += s[i];
+    } else if (static_cast<unsigned char>(s[i]) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", s[i]);
+      escaped += code;
+    } else {
+      escaped += s[i];
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+void Profiler::Enable(const string& filename) {
+  Registry& r = registry();
+  {
+    boost::mutex::scoped_lock lock(r.mutex);
+    if (r.filename.empty()) {
+      atexit(&Profiler::WriteAtExit);
+    }
+    r.filename = filename;
+  }
+  Now();
+  enabled_ = true;
+  LOG(INFO) << "Profiling the layers into " << filename;
+}
+
+int Profiler::Intern(const string& name) {
+  Registry& r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  map<string, int>::iterator it = r.ids.find(name);
+  if (it != r.ids.end()) {
+    return it->second;
+  }
+  r.names.push_back(name);
+  return r.ids[name] = r.names.size() - 1;
+}
+
+uint64_t Profiler::Now() {
+  typedef std::chrono::steady_clock clock;
+  static const clock::time_point origin = clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now() - origin).count();
+}
+
+void Profiler::Record(int name, Phase phase, uint64_t start, uint64_t end,
+    uint64_t bytes) {
+  Ring* ring = thread_ring();
+  const uint64_t head = ring->head.load(std::memory_order_relaxed);
+  Event& event = ring->events[head % kRingSize];
+  event.name = name;
+  event.phase = phase;
+  event.start = start;
+  event.end = end;
+  event.bytes = bytes;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::Write(const string& filename) {
+  Registry& r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  FILE* file = fopen(filename.c_str(), "w");
+  CHECK(file) << "Cannot open " << filename;
+  const bool csv = filename.size() >= 4 &&
+      filename.compare(filename.size() - 4, 4, ".csv") == 0;
+  const char* phases[] = { "forward", "backward" };
+  if (csv) {
+    fprintf(file, "thread,layer,phase,start_us,end_us,bytes\n");
+  } else {
+    fprintf(file, "{\"traceEvents\":[");
+  }
+  bool first = true;
+  for (int i = 0; i < r.rings.size(); ++i) {
+    const Ring& ring = *r.rings[i];
+    const uint64_t head = ring.head.load(std::memory_order_acquire);
+    for (uint64_t j = head > kRingSize ? head - kRingSize : 0; j < head; ++j) {
+      const Event& event = ring.events[j % kRingSize];
+      if (csv) {
+        fprintf(file, "%d,%s,%s,%.3f,%.3f,%llu\n", ring.tid,
+            r.names[event.name].c_str(), phases[event.phase],
+            event.start / 1e3, event.end / 1e3,
+            (unsigned long long)event.bytes);  // NOLINT(runtime/int)
+      } else {
+        fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"bytes\":%llu}}", first ? "" : ",",
+            json_escape(r.names[event.name]).c_str(), phases[event.phase],
+            ring.tid, event.start / 1e3, (event.end - event.start) / 1e3,
+            (unsigned long long)event.bytes);  // NOLINT(runtime/int)
+      }
+      first = false;
+    }
+  }
+  if (!csv) {
+    fprintf(file, "\n]}\n");
+  }
+  CHECK_EQ(fclose(file), 0) << "Cannot write " << filename;
+}
+
+void Profiler::WriteAtExit() {
+  string filename;
+  {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    filename = r.filename;
+  }
+  Write(filename);
+  LOG(INFO) << "Wrote the layer profile to " << filename;
+}
+
+template <typename Dtype>
+NetProfiler<Dtype>::NetProfiler(Net<Dtype>* net) : net_(net), start_(0) {
+  for (int i = 0; i < net->layer_names().size(); ++i) {
+    names_.push_back(Profiler::Intern(net->name() + "/" +
+        net->layer_names()[i]));
+  }
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, Profiler::FORWARD, true)));
+  net->add_before_forward(hooks_.back().get());
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, Profiler::FORWARD, false)));
+  net->add_after_forward(hooks_.back().get());
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, Profiler::BACKWARD, true)));
+  net->add_before_backward(hooks_.back().get());
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, Profiler::BACKWARD, false)));
+  net->add_after_backward(hooks_.back().get());
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Hook::run(int layer) {
+#ifndef CPU_ONLY
+  // Time the kernels of the layer, not their launch.
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaDeviceSynchronize());
+  }
+#endif
+  if (begin_) {
+    profiler_->start_ = Profiler::Now();
+  } else {
+    Profiler::Record(profiler_->names_[layer], phase_, profiler_->start_,
+        Profiler::Now(), profiler_->bytes(layer));
+  }
+}
+
+template <typename Dtype>
+uint64_t NetProfiler<Dtype>::bytes(int layer) const {
+  uint64_t count = 0;
+  const vector<Blob<Dtype>*>& bottom = net_->bottom_vecs()[layer];
+  for (int i = 0; i < bottom.size(); ++i) {
+    count += bottom[i]->count();
+  }
+  const vector<Blob<Dtype>*>& top = net_->top_vecs()[layer];
+  for (int i = 0; i < top.size(); ++i) {
+    count += top[i]->count();
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& params =
+      net_->layers()[layer]->blobs();
+  for (int i = 0; i < params.size(); ++i) {
+    count += params[i]->count();
+  }
+  return count * sizeof(Dtype);
+}
+
+INSTANTIATE_CLASS(NetProfiler);
+
+}  // namespace caffe
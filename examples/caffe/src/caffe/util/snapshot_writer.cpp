@@ -0,0 +1,93 @@
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+
+namespace caffe {
+
+using google::protobuf::io::FileOutputStream;
+using google::protobuf::Message;
+
+SnapshotWriter::SnapshotWriter(int max_in_flight) {
+  CHECK_GT(max_in_flight, 0);
+  for (int i = 0; i < max_in_flight; ++i) {
+    snapshots_.push_back(shared_ptr<StagedSnapshot>(new StagedSnapshot()));
+    free_.push(snapshots_.back().get());
+  }
+  StartInternalThread();
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  Wait();
+  StopInternalThread();
+}
+
+StagedSnapshot* SnapshotWriter::free_snapshot() {
+  StagedSnapshot* snapshot =
+      free_.pop("Waiting for an earlier snapshot to be written");
+  snapshot->protos.clear();
+  snapshot->filenames.clear();
+  return snapshot;
+}
+
+void SnapshotWriter::Push(StagedSnapshot* snapshot) {
+  CHECK_EQ(snapshot->protos.size(), snapshot->filenames.size());
+  full_.push(snapshot);
+}
+
+void SnapshotWriter::Wait() {
+  // Every snapshot is back in free_ once the last one has been written.
+  for (int i = 0; i < snapshots_.size(); ++i) {
+    free_.pop();
+  }
+  for (int i = 0; i < snapshots_.size(); ++i) {
+    free_.push(snapshots_[i].get());
+  }
+}
+
+void SnapshotWriter::WriteAtomically(const Message& proto,
+    const string& filename) {
+  const string tmp = filename + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_GE(fd, 0) << "Cannot create " << tmp;
+  {
+    FileOutputStream output(fd);
+    CHECK(proto.SerializeToZeroCopyStream(&output) && output.Flush())
+        << "Cannot write " << tmp;
+  }
+  CHECK_EQ(fsync(fd), 0) << "Cannot sync " << tmp;
+  CHECK_EQ(close(fd), 0) << "Cannot write " << tmp;
+  CHECK_EQ(rename(tmp.c_str(), filename.c_str()), 0)
+      << "Cannot rename " << tmp << " to " << filename;
+}
+
+void SnapshotWriter::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      StagedSnapshot* snapshot = full_.pop();
+      CPUTimer timer;
+      timer.Start();
+      for (int i = 0; i < snapshot->protos.size(); ++i) {
+        WriteAtomically(*snapshot->protos[i], snapshot->filenames[i]);
+      }
+      if (!snapshot->filenames.empty()) {
+        LOG(INFO) << "Wrote snapshot " << snapshot->filenames[0] << " in "
+            << timer.Seconds() << " s";
+      }
+      // Free the copies before handing the snapshot back.
+      snapshot->protos.clear();
+      free_.push(snapshot);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+}  // namespace caffe
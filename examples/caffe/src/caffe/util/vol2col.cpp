@@ -14,6 +14,7 @@
  *
  */
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -22,39 +23,187 @@
 
 namespace caffe {
 
-template <typename Dtype>
-void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
-	    const int height, const int width, const int ksize, const int kdepth, const int pad,
-	    const int temporal_pad, const int stride, const int temporal_stride, Dtype* data_col) {
-  int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride + 1;
-  int height_col = (height + 2 * pad - ksize) / stride + 1;
-  int width_col = (width + 2 * pad - ksize) / stride + 1;
+// The output columns w whose input column w * stride + offset lies inside
+// [0, width) are [*begin, *end).
+static inline void valid_cols(const int offset, const int stride,
+    const int width, const int width_col, int* begin, int* end) {
+  *begin = offset >= 0 ? 0 : (-offset + stride - 1) / stride;
+  *end = width - 1 - offset < 0 ? 0 : (width - 1 - offset) / stride + 1;
+  *begin = std::min(*begin, width_col);
+  *end = std::max(*begin, std::min(*end, width_col));
+}
 
-  int channels_col = channels * kdepth * ksize * ksize;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % ksize;
-    int h_offset = (c / ksize) % ksize;
-    int l_offset = (c / ksize / ksize) % kdepth;
-    int c_im = c / ksize / ksize / kdepth;
-    for (int l=0; l < length_col; ++l) {
-      for (int h = 0; h < height_col; ++h) {
-        for (int w = 0; w < width_col; ++w) {
-          int l_pad = l * temporal_stride - temporal_pad + l_offset;
-          int h_pad = h * stride - pad + h_offset;
-          int w_pad = w * stride - pad + w_offset;
+// kKsize and kKdepth, when not 0, fix the kernel size at compile time so
+// that the loops over the kernel unroll; ksize and kdepth are used
+// otherwise.
+template <typename Dtype, int kKsize, int kKdepth>
+static void vol2col_rows(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize_,
+    const int kdepth_, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const int row_begin,
+    const int row_end, Dtype* data_col) {
+  const int ksize = kKsize ? kKsize : ksize_;
+  const int kdepth = kKdepth ? kKdepth : kdepth_;
+  const int height_col = (height + 2 * pad - ksize) / stride + 1;
+  const int width_col = (width + 2 * pad - ksize) / stride + 1;
+  const int image_size = length * height * width;
+  Dtype* col = data_col;
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    const Dtype* im = data_im + c_im * image_size;
+    for (int l_offset = 0; l_offset < kdepth; ++l_offset) {
+      for (int h_offset = 0; h_offset < ksize; ++h_offset) {
+        for (int w_offset = 0; w_offset < ksize; ++w_offset) {
+          const int w_shift = w_offset - pad;
+          int w_begin, w_end;
+          valid_cols(w_shift, stride, width, width_col, &w_begin, &w_end);
+          int l = row_begin / height_col;
+          int h = row_begin % height_col;
+          for (int r = row_begin; r < row_end; ++r, col += width_col) {
+            const int l_pad = l * temporal_stride - temporal_pad + l_offset;
+            const int h_pad = h * stride - pad + h_offset;
+            if (++h == height_col) {
+              h = 0;
+              ++l;
+            }
+            if (l_pad < 0 || l_pad >= length || h_pad < 0 || h_pad >= height) {
+              memset(col, 0, sizeof(Dtype) * width_col);
+              continue;
+            }
+            const Dtype* im_row = im + (l_pad * height + h_pad) * width;
+            // Border columns read the padding; interior ones the row.
+            memset(col, 0, sizeof(Dtype) * w_begin);
+            if (stride == 1) {
+              memcpy(col + w_begin, im_row + w_begin + w_shift,
+                  sizeof(Dtype) * (w_end - w_begin));
+            } else {
+              for (int w = w_begin; w < w_end; ++w) {
+                col[w] = im_row[w * stride + w_shift];
+              }
+            }
+            memset(col + w_end, 0, sizeof(Dtype) * (width_col - w_end));
+          }
+        }
+      }
+    }
+  }
+}
 
-          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width
-        		  && l_pad >=0 && l_pad < length)
-            data_col[((c * length_col + l) * height_col + h) * width_col + w] =
-              data_im[((c_im * length + l_pad) * height + h_pad) * width + w_pad];
-          else
-            data_col[((c * length_col + l) * height_col + h) * width_col + w] = 0;
+template <typename Dtype, int kKsize, int kKdepth>
+static void col2vol_rows(const Dtype* data_col, const int channels,
+    const int length, const int height, const int width, const int ksize_,
+    const int kdepth_, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const int row_begin,
+    const int row_end, Dtype* data_im) {
+  const int ksize = kKsize ? kKsize : ksize_;
+  const int kdepth = kKdepth ? kKdepth : kdepth_;
+  const int height_col = (height + 2 * pad - ksize) / stride + 1;
+  const int width_col = (width + 2 * pad - ksize) / stride + 1;
+  const int image_size = length * height * width;
+  const Dtype* col = data_col;
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    Dtype* im = data_im + c_im * image_size;
+    for (int l_offset = 0; l_offset < kdepth; ++l_offset) {
+      for (int h_offset = 0; h_offset < ksize; ++h_offset) {
+        for (int w_offset = 0; w_offset < ksize; ++w_offset) {
+          const int w_shift = w_offset - pad;
+          int w_begin, w_end;
+          valid_cols(w_shift, stride, width, width_col, &w_begin, &w_end);
+          int l = row_begin / height_col;
+          int h = row_begin % height_col;
+          for (int r = row_begin; r < row_end; ++r, col += width_col) {
+            const int l_pad = l * temporal_stride - temporal_pad + l_offset;
+            const int h_pad = h * stride - pad + h_offset;
+            if (++h == height_col) {
+              h = 0;
+              ++l;
+            }
+            if (l_pad < 0 || l_pad >= length || h_pad < 0 || h_pad >= height) {
+              continue;
+            }
+            Dtype* im_row = im + (l_pad * height + h_pad) * width;
+            if (stride == 1) {
+              Dtype* im_cols = im_row + w_shift;
+              for (int w = w_begin; w < w_end; ++w) {
+                im_cols[w] += col[w];
+              }
+            } else {
+              for (int w = w_begin; w < w_end; ++w) {
+                im_row[w * stride + w_shift] += col[w];
+              }
+            }
+          }
         }
       }
     }
   }
 }
 
+template <typename Dtype>
+void vol2col_rows_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int row_begin, const int row_end,
+    Dtype* data_col) {
+  if (ksize == 3 && kdepth == 3) {
+    vol2col_rows<Dtype, 3, 3>(data_im, channels, length, height, width, ksize,
+        kdepth, pad, temporal_pad, stride, temporal_stride, row_begin,
+        row_end, data_col);
+  } else {
+    vol2col_rows<Dtype, 0, 0>(data_im, channels, length, height, width, ksize,
+        kdepth, pad, temporal_pad, stride, temporal_stride, row_begin,
+        row_end, data_col);
+  }
+}
+
+template <typename Dtype>
+void col2vol_rows_cpu(const Dtype* data_col, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int row_begin, const int row_end,
+    Dtype* data_im) {
+  if (ksize == 3 && kdepth == 3) {
+    col2vol_rows<Dtype, 3, 3>(data_col, channels, length, height, width,
+        ksize, kdepth, pad, temporal_pad, stride, temporal_stride, row_begin,
+        row_end, data_im);
+  } else {
+    col2vol_rows<Dtype, 0, 0>(data_col, channels, length, height, width,
+        ksize, kdepth, pad, temporal_pad, stride, temporal_stride, row_begin,
+        row_end, data_im);
+  }
+}
+
+template void vol2col_rows_cpu<float>(const float* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const int row_begin,
+    const int row_end, float* data_col);
+template void vol2col_rows_cpu<double>(const double* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const int row_begin,
+    const int row_end, double* data_col);
+template void col2vol_rows_cpu<float>(const float* data_col,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const int row_begin,
+    const int row_end, float* data_im);
+template void col2vol_rows_cpu<double>(const double* data_col,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const int row_begin,
+    const int row_end, double* data_im);
+
+template <typename Dtype>
+void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
+	    const int height, const int width, const int ksize, const int kdepth, const int pad,
+	    const int temporal_pad, const int stride, const int temporal_stride, Dtype* data_col) {
+  int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride + 1;
+  int height_col = (height + 2 * pad - ksize) / stride + 1;
+  vol2col_rows_cpu(data_im, channels, length, height, width, ksize, kdepth,
+      pad, temporal_pad, stride, temporal_stride, 0, length_col * height_col,
+      data_col);
+}
+
 // Explicit instantiation
 template void vol2col_cpu<float>(const float* data_im, const int channels, const int length,
     const int height, const int width, const int ksize, const int kdepth, const int pad,
@@ -70,27 +219,9 @@ void col2vol_cpu(const Dtype* data_col, const int channels, const int length,
   memset(data_im, 0, sizeof(Dtype) * length * height * width * channels);
   int length_col = (length + 2* temporal_pad - kdepth) / temporal_stride + 1;
   int height_col = (height + 2 * pad - ksize) / stride + 1;
-  int width_col = (width + 2 * pad - ksize) / stride + 1;
-  int channels_col = channels * kdepth * ksize * ksize;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % ksize;
-    int h_offset = (c / ksize) % ksize;
-    int l_offset = (c / ksize / ksize) % kdepth;
-    int c_im = c / ksize / ksize / kdepth;
-    for (int l=0; l < length_col; ++l) {
-      for (int h = 0; h < height_col; ++h) {
-        for (int w = 0; w < width_col; ++w) {
-          int l_pad = l * temporal_stride - temporal_pad + l_offset;
-          int h_pad = h * stride - pad + h_offset;
-          int w_pad = w * stride - pad + w_offset;
-          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width
-        		  && l_pad >= 0 && l_pad < length)
-            data_im[((c_im * length + l_pad) * height + h_pad) * width + w_pad] +=
-                data_col[((c * length_col + l) * height_col + h) * width_col + w];
-        }
-      }
-    }
-  }
+  col2vol_rows_cpu(data_col, channels, length, height, width, ksize, kdepth,
+      pad, temporal_pad, stride, temporal_stride, 0, length_col * height_col,
+      data_im);
 }
 
 // Explicit instantiation
@@ -0,0 +1,74 @@
+#include <boost/thread.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/workspace_pool.hpp"
+
+namespace caffe {
+
+static boost::thread_specific_ptr<WorkspacePool> thread_pool_;
+
+WorkspacePool& WorkspacePool::Get() {
+  if (!thread_pool_.get()) {
+    thread_pool_.reset(new WorkspacePool());
+  }
+  return *thread_pool_;
+}
+
+WorkspacePool::~WorkspacePool() {
+  for (int i = 0; i < buffers_.size(); ++i) {
+    CaffeFreeHost(buffers_[i], use_cuda_[i]);
+  }
+}
+
+void WorkspacePool::Reserve(int num_buffers, size_t size) {
+  CHECK_GE(num_buffers, 0);
+  if (buffers_.size() < num_buffers) {
+    buffers_.resize(num_buffers, NULL);
+    sizes_.resize(num_buffers, 0);
+    use_cuda_.resize(num_buffers, false);
+  }
+  for (int i = 0; i < num_buffers; ++i) {
+    if (sizes_[i] >= size) {
+      continue;
+    }
+    if (buffers_[i]) {
+      CaffeFreeHost(buffers_[i], use_cuda_[i]);
+    }
+    bool use_cuda;
+    CaffeMallocHost(&buffers_[i], size, &use_cuda);
+    use_cuda_[i] = use_cuda;
+    sizes_[i] = size;
+  }
+}
+
+size_t WorkspacePool::size() const {
+  size_t total = 0;
+  for (int i = 0; i < sizes_.size(); ++i) {
+    total += sizes_[i];
+  }
+  return total;
+}
+
+int ParallelThreads(int n) {
+#ifdef _OPENMP
+  return std::max(1, std::min(n, omp_get_max_threads()));
+#else
+  return 1;
+#endif
+}
+
+int ParallelThreadId() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+}  // namespace caffe
@@ -6,13 +6,21 @@ namespace bp = boost::python;
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
 #include <map>
+#include <numeric>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/layers/dragon_base_data_layer.hpp"
+#include "caffe/util/profiler.hpp"
 #include "caffe/util/signal_handler.h"
 
 using caffe::Blob;
@@ -26,6 +34,10 @@ using caffe::Timer;
 using caffe::vector;
 using std::ostringstream;
 
+DECLARE_bool(enable_dragon);
+DECLARE_bool(enable_uvm);
+DECLARE_bool(enable_mmap);
+
 DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
@@ -54,6 +66,14 @@ DEFINE_string(sigint_effect, "stop",
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
+DEFINE_int32(warmup, 1,
+    "Optional; the number of untimed forward-backward passes before 'time' "
+    "starts measuring.");
+DEFINE_string(time_json, "",
+    "Optional; write the results of 'time' to this file as JSON.");
+DEFINE_string(profile, "",
+    "Optional; record the time each layer runs and write it to this file "
+    "at exit, as Chrome trace JSON, or as CSV if it ends in .csv.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -335,9 +355,82 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Mean, median and 99th percentile of a series of timings.
+struct TimeStats {
+  explicit TimeStats(vector<double> values) {
+    CHECK_GT(values.size(), 0);
+    std::sort(values.begin(), values.end());
+    mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+    p50 = percentile(values, 50);
+    p99 = percentile(values, 99);
+  }
+
+  // Nearest-rank percentile of sorted values.
+  static double percentile(const vector<double>& sorted, double p) {
+    size_t rank = std::ceil(p / 100 * sorted.size());
+    return sorted[std::max<size_t>(rank, 1) - 1];
+  }
+
+  double mean;
+  double p50;
+  double p99;
+};
+
+static string json_string(const string& s) {
+  ostringstream json;
+  json << '"';
+  for (int i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      json << '\\';
+    }
+    json << s[i];
+  }
+  json << '"';
+  return json.str();
+}
+
+// stats hold microseconds; the JSON reports milliseconds.
+static string json_stats(const TimeStats& stats) {
+  ostringstream json;
+  json << "{\"mean\": " << stats.mean / 1000 << ", \"p50\": "
+      << stats.p50 / 1000 << ", \"p99\": " << stats.p99 / 1000 << "}";
+  return json.str();
+}
+
+// I/O counters of the process from /proc/self/io, or none if unavailable.
+static std::map<string, uint64_t> proc_io() {
+  std::map<string, uint64_t> counters;
+  std::ifstream io("/proc/self/io");
+  string key;
+  uint64_t value;
+  while (io >> key >> value) {
+    counters[key.substr(0, key.size() - 1)] = value;
+  }
+  return counters;
+}
+
+// Bytes of the Dragon data sources read into batches so far.
+static uint64_t dataset_bytes_read(const Net<float>& net) {
+  uint64_t bytes = 0;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    const caffe::DragonBaseDataLayer<float>* layer =
+        dynamic_cast<const caffe::DragonBaseDataLayer<float>*>(
+        net.layers()[i].get());
+    if (layer) {
+      bytes += layer->bytes_read();
+    }
+  }
+  return bytes;
+}
+
+static uint64_t blob_bytes(const Blob<float>& blob) {
+  return blob.count() * sizeof(float);
+}
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
+  CHECK_GT(FLAGS_iterations, 0) << "Need at least one iteration to time.";
   caffe::Phase phase = get_phase_from_flags(caffe::TRAIN);
   vector<string> stages = get_stages_from_flags();
 
@@ -355,73 +448,192 @@ int time() {
   // Instantiate the caffe net.
   Net<float> caffe_net(FLAGS_model, phase, FLAGS_level, &stages);
 
-  // Do a clean forward and backward pass, so that memory allocation are done
+  // Do clean forward and backward passes, so that memory allocation are done
   // and future iterations will be more stable.
-  LOG(INFO) << "Performing Forward";
   // Note that for the speed benchmark, we will assume that the network does
   // not take any input blobs.
-  float initial_loss;
-  caffe_net.Forward(&initial_loss);
-  LOG(INFO) << "Initial loss: " << initial_loss;
-  LOG(INFO) << "Performing Backward";
-  caffe_net.Backward();
+  for (int j = 0; j < FLAGS_warmup; ++j) {
+    LOG(INFO) << "Performing Forward";
+    float initial_loss;
+    caffe_net.Forward(&initial_loss);
+    LOG(INFO) << "Initial loss: " << initial_loss;
+    LOG(INFO) << "Performing Backward";
+    caffe_net.Backward();
+  }
 
   const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
   const vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
   const vector<vector<Blob<float>*> >& top_vecs = caffe_net.top_vecs();
   const vector<vector<bool> >& bottom_need_backward =
       caffe_net.bottom_need_backward();
+  const vector<bool>& layer_fused = caffe_net.layer_fused();
   LOG(INFO) << "*** Benchmark begins ***";
   LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
+  struct rusage usage_begin;
+  getrusage(RUSAGE_SELF, &usage_begin);
+  const std::map<string, uint64_t> io_begin = proc_io();
+  const uint64_t dataset_begin = dataset_bytes_read(caffe_net);
   Timer total_timer;
   total_timer.Start();
   Timer forward_timer;
   Timer backward_timer;
   Timer timer;
-  std::vector<double> forward_time_per_layer(layers.size(), 0.0);
-  std::vector<double> backward_time_per_layer(layers.size(), 0.0);
-  double forward_time = 0.0;
-  double backward_time = 0.0;
+  // microseconds of each iteration
+  vector<vector<double> > forward_time_per_layer(layers.size());
+  vector<vector<double> > backward_time_per_layer(layers.size());
+  vector<double> forward_time;
+  vector<double> backward_time;
+  vector<double> iter_time;
   for (int j = 0; j < FLAGS_iterations; ++j) {
     Timer iter_timer;
     iter_timer.Start();
     forward_timer.Start();
     for (int i = 0; i < layers.size(); ++i) {
       timer.Start();
-      layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
-      forward_time_per_layer[i] += timer.MicroSeconds();
+      if (!layer_fused[i] || Caffe::mode() != Caffe::CPU) {
+        layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
+      }
+      forward_time_per_layer[i].push_back(timer.MicroSeconds());
     }
-    forward_time += forward_timer.MicroSeconds();
+    forward_time.push_back(forward_timer.MicroSeconds());
     backward_timer.Start();
     for (int i = layers.size() - 1; i >= 0; --i) {
       timer.Start();
       layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
                           bottom_vecs[i]);
-      backward_time_per_layer[i] += timer.MicroSeconds();
+      backward_time_per_layer[i].push_back(timer.MicroSeconds());
     }
-    backward_time += backward_timer.MicroSeconds();
+    backward_time.push_back(backward_timer.MicroSeconds());
+    iter_time.push_back(iter_timer.MicroSeconds());
     LOG(INFO) << "Iteration: " << j + 1 << " forward-backward time: "
-      << iter_timer.MilliSeconds() << " ms.";
+      << iter_time.back() / 1000 << " ms.";
   }
-  LOG(INFO) << "Average time per layer: ";
+  total_timer.Stop();
+  struct rusage usage_end;
+  getrusage(RUSAGE_SELF, &usage_end);
+  const std::map<string, uint64_t> io_end = proc_io();
+  const uint64_t dataset_end = dataset_bytes_read(caffe_net);
+
+  ostringstream json;
+  json << std::setprecision(6) << "{\n  \"model\": " << json_string(FLAGS_model)
+      << ",\n  \"phase\": \"" << (phase == caffe::TRAIN ? "TRAIN" : "TEST")
+      << "\",\n  \"mode\": \"" << (gpus.size() ? "GPU" : "CPU")
+      << "\",\n  \"backend\": \"" << (FLAGS_enable_dragon ? "dragon" :
+      FLAGS_enable_uvm ? "uvm" : FLAGS_enable_mmap ? "mmap" : "default")
+      << "\",\n  \"warmup\": " << FLAGS_warmup
+      << ",\n  \"iterations\": " << FLAGS_iterations << ",\n  \"layers\": [";
+  LOG(INFO) << "Time per layer (mean / p50 / p99): ";
   for (int i = 0; i < layers.size(); ++i) {
     const caffe::string& layername = layers[i]->layer_param().name();
+    const TimeStats forward(forward_time_per_layer[i]);
+    const TimeStats backward(backward_time_per_layer[i]);
     LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
-      "\tforward: " << forward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+      "\tforward: " << forward.mean / 1000 << " / " << forward.p50 / 1000 <<
+      " / " << forward.p99 / 1000 << " ms.";
     LOG(INFO) << std::setfill(' ') << std::setw(10) << layername  <<
-      "\tbackward: " << backward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+      "\tbackward: " << backward.mean / 1000 << " / " << backward.p50 / 1000 <<
+      " / " << backward.p99 / 1000 << " ms.";
+
+    // Forward reads the bottoms and params and writes the tops; Backward
+    // reads the top diffs, bottoms and params and writes the diffs of the
+    // bottoms and params it propagates to.
+    uint64_t bottom_bytes = 0;
+    uint64_t bottom_diff_bytes = 0;
+    ostringstream bottoms;
+    for (int k = 0; k < bottom_vecs[i].size(); ++k) {
+      const uint64_t bytes = blob_bytes(*bottom_vecs[i][k]);
+      bottom_bytes += bytes;
+      bottom_diff_bytes += bottom_need_backward[i][k] ? bytes : 0;
+      bottoms << (k ? ", " : "") << "{\"blob\": " << json_string(
+          caffe_net.blob_names()[caffe_net.bottom_ids(i)[k]])
+          << ", \"bytes\": " << bytes << "}";
+    }
+    uint64_t top_bytes = 0;
+    ostringstream tops;
+    for (int k = 0; k < top_vecs[i].size(); ++k) {
+      const uint64_t bytes = blob_bytes(*top_vecs[i][k]);
+      top_bytes += bytes;
+      tops << (k ? ", " : "") << "{\"blob\": " << json_string(
+          caffe_net.blob_names()[caffe_net.top_ids(i)[k]])
+          << ", \"bytes\": " << bytes << "}";
+    }
+    uint64_t param_bytes = 0;
+    for (int k = 0; k < layers[i]->blobs().size(); ++k) {
+      param_bytes += blob_bytes(*layers[i]->blobs()[k]);
+    }
+    const uint64_t param_diff_bytes =
+        caffe_net.layer_need_backward()[i] ? param_bytes : 0;
+    json << (i ? "," : "") << "\n    {\"name\": " << json_string(layername)
+        << ", \"type\": " << json_string(layers[i]->type())
+        << ",\n     \"forward_ms\": " << json_stats(forward)
+        << ", \"backward_ms\": " << json_stats(backward)
+        << ",\n     \"forward_bytes_read\": " << bottom_bytes + param_bytes
+        << ", \"forward_bytes_written\": " << top_bytes
+        << ", \"backward_bytes_read\": "
+        << top_bytes + bottom_bytes + param_bytes
+        << ", \"backward_bytes_written\": "
+        << bottom_diff_bytes + param_diff_bytes
+        << ",\n     \"bottoms\": [" << bottoms.str() << "], \"tops\": ["
+        << tops.str() << "], \"param_bytes\": " << param_bytes << "}";
   }
-  total_timer.Stop();
-  LOG(INFO) << "Average Forward pass: " << forward_time / 1000 /
-    FLAGS_iterations << " ms.";
-  LOG(INFO) << "Average Backward pass: " << backward_time / 1000 /
-    FLAGS_iterations << " ms.";
-  LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
-    FLAGS_iterations << " ms.";
+  const TimeStats forward(forward_time);
+  const TimeStats backward(backward_time);
+  const TimeStats iter(iter_time);
+  LOG(INFO) << "Forward pass (mean / p50 / p99): " << forward.mean / 1000 <<
+    " / " << forward.p50 / 1000 << " / " << forward.p99 / 1000 << " ms.";
+  LOG(INFO) << "Backward pass (mean / p50 / p99): " << backward.mean / 1000 <<
+    " / " << backward.p50 / 1000 << " / " << backward.p99 / 1000 << " ms.";
+  LOG(INFO) << "Forward-Backward (mean / p50 / p99): " << iter.mean / 1000 <<
+    " / " << iter.p50 / 1000 << " / " << iter.p99 / 1000 << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+
+  // ru_maxrss is in kilobytes on Linux.
+  const uint64_t peak_rss = usage_end.ru_maxrss * 1024ULL;
+  const long minor_faults = usage_end.ru_minflt - usage_begin.ru_minflt;  // NOLINT(runtime/int)
+  const long major_faults = usage_end.ru_majflt - usage_begin.ru_majflt;  // NOLINT(runtime/int)
+  LOG(INFO) << "Peak RSS: " << peak_rss / (1 << 20) << " MiB, page faults: "
+    << minor_faults << " minor, " << major_faults << " major.";
+  LOG(INFO) << "Dataset bytes read: " << dataset_end - dataset_begin;
+  json << "\n  ],\n  \"forward_ms\": " << json_stats(forward)
+      << ",\n  \"backward_ms\": " << json_stats(backward)
+      << ",\n  \"forward_backward_ms\": " << json_stats(iter)
+      << ",\n  \"total_ms\": " << total_timer.MilliSeconds()
+      << ",\n  \"peak_rss_bytes\": " << peak_rss
+      << ",\n  \"minor_faults\": " << minor_faults
+      << ",\n  \"major_faults\": " << major_faults
+      << ",\n  \"block_reads\": "
+      << usage_end.ru_inblock - usage_begin.ru_inblock
+      << ",\n  \"block_writes\": "
+      << usage_end.ru_oublock - usage_begin.ru_oublock
+      << ",\n  \"dataset_bytes_read\": " << dataset_end - dataset_begin
+      << ",\n  \"io\": {";
+  for (std::map<string, uint64_t>::const_iterator it = io_end.begin();
+      it != io_end.end(); ++it) {
+    const std::map<string, uint64_t>::const_iterator begin =
+        io_begin.find(it->first);
+    json << (it == io_end.begin() ? "" : ", ") << json_string(it->first)
+        << ": " << it->second - (begin != io_begin.end() ? begin->second : 0);
+  }
+  json << "}";
+  string backend;
+  caffe::MemfileArena::Stats stats;
+  if (caffe::SyncedMemory::memfile_stats(&backend, &stats)) {
+    LOG(INFO) << "Backing files (" << backend << "): " << stats.num_files
+      << " mapped, " << stats.high_water_bytes << " bytes at peak.";
+    json << ",\n  \"backing_files\": {\"mapped_bytes\": " << stats.mapped_bytes
+        << ", \"in_use_bytes\": " << stats.in_use_bytes
+        << ", \"high_water_bytes\": " << stats.high_water_bytes
+        << ", \"num_files\": " << stats.num_files << "}";
+  }
+  json << "\n}\n";
   LOG(INFO) << "*** Benchmark ends ***";
+
+  if (FLAGS_time_json.size()) {
+    std::ofstream out(FLAGS_time_json.c_str());
+    out << json.str();
+    CHECK(out) << "Cannot write " << FLAGS_time_json;
+    LOG(INFO) << "Wrote the benchmark results to " << FLAGS_time_json;
+  }
   return 0;
 }
 RegisterBrewFunction(time);
@@ -441,6 +653,9 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  if (FLAGS_profile.size()) {
+    caffe::Profiler::Enable(FLAGS_profile);
+  }
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
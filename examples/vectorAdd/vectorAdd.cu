@@ -91,7 +91,8 @@ main(int argc, char *argv[])
 
 	if (getenv("N_SUB_ELEMENTS")) {
 		n_elems_sub = atol(getenv("N_SUB_ELEMENTS"));
-		if (cuio_get_type() == CUIO_TYPE_HREG) {
+		/* Both map each window at its file offset, which must be page aligned. */
+		if (cuio_get_type() == CUIO_TYPE_HREG || cuio_get_type() == CUIO_TYPE_UXU) {
 			n_elems_sub = PAGE_ALIGN(n_elems_sub);
 		}
 	}
@@ -2584,6 +2584,32 @@ compile_test() {
             compile_check_conftest "$CODE" "NV_USLEEP_RANGE_PRESENT" "" "functions"
         ;;
 
+        iov_iter_has_type)
+            #
+            # Determine if the iov_iter type is kept apart from the direction,
+            # in which case iov_iter_bvec() must be passed the direction only.
+            # Before, the type was or-ed into the direction.
+            #
+            # Changed by commit aa563d7bca6e ("iov_iter: Separate type from
+            # direction and use accessor functions") in v4.20 (2018-10-24)
+            #
+            echo "$CONFTEST_PREAMBLE
+            #include <linux/uio.h>
+            int conftest_iov_iter_has_type(const struct iov_iter *i) {
+                return iov_iter_type(i);
+            }" > conftest$$.c
+
+            $CC $CFLAGS -c conftest$$.c > /dev/null 2>&1
+            rm -f conftest$$.c
+
+            if [ -f conftest$$.o ]; then
+                rm -f conftest$$.o
+                echo "#define NV_IOV_ITER_HAS_TYPE" | append_conftest "functions"
+            else
+                echo "#undef NV_IOV_ITER_HAS_TYPE" | append_conftest "functions"
+            fi
+        ;;
+
         radix_tree_empty)
             #
             # Determine if the function radix_tree_empty() is present.
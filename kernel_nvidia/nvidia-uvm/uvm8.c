@@ -964,7 +964,10 @@ static long uvm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_NVMGPU_INITIALIZE,              uvm_api_nvmgpu_initialize);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_NVMGPU_REGISTER_FILE_VA_SPACE,  uvm_api_nvmgpu_register_file_va_space);
+        UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_NVMGPU_SET_TRASH,               uvm_api_nvmgpu_set_trash);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_NVMGPU_REMAP,                   uvm_api_nvmgpu_remap);
+        UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_NVMGPU_FLUSH,                   uvm_api_nvmgpu_flush);
+        UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_NVMGPU_GET_STATS,               uvm_api_nvmgpu_get_stats);
     }
 
     // Try the test ioctls if none of the above matched
@@ -255,6 +255,9 @@ NV_STATUS uvm_api_populate_pageable(const UVM_POPULATE_PAGEABLE_PARAMS *params,
 
 NV_STATUS uvm_api_nvmgpu_initialize(UVM_NVMGPU_INITIALIZE_PARAMS *params, struct file *filp);
 NV_STATUS uvm_api_nvmgpu_register_file_va_space(UVM_NVMGPU_REGISTER_FILE_VA_SPACE_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_nvmgpu_set_trash(UVM_NVMGPU_SET_TRASH_PARAMS *params, struct file *filp);
 NV_STATUS uvm_api_nvmgpu_remap(UVM_NVMGPU_REMAP_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_nvmgpu_flush(UVM_NVMGPU_FLUSH_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_nvmgpu_get_stats(UVM_NVMGPU_GET_STATS_PARAMS *params, struct file *filp);
 
 #endif // __UVM8_API_H__
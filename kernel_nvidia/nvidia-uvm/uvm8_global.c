@@ -35,6 +35,7 @@
 #include "uvm8_pmm_sysmem.h"
 #include "uvm8_ats_ibm.h"
 #include "uvm8_migrate.h"
+#include "uvm8_nvmgpu.h"
 #include "uvm8_gpu_access_counters.h"
 #include "nv_uvm_interface.h"
 
@@ -161,6 +162,12 @@ NV_STATUS uvm_global_init(void)
         goto error;
     }
 
+    status = uvm_nvmgpu_global_init();
+    if (status != NV_OK) {
+        UVM_ERR_PRINT("uvm_nvmgpu_global_init() failed: %s\n", nvstatusToString(status));
+        goto error;
+    }
+
     status = uvm_range_group_init();
     if (status != NV_OK) {
         UVM_ERR_PRINT("uvm_range_group_init() failed: %s\n", nvstatusToString(status));
@@ -214,6 +221,7 @@ void uvm_global_exit(void)
     uvm_perf_events_exit();
     uvm_migrate_exit();
     uvm_range_group_exit();
+    uvm_nvmgpu_global_exit();
     uvm_va_range_exit();
     uvm_mem_global_exit();
     uvm_pmm_sysmem_exit();
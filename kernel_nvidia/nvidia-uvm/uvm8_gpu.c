@@ -2859,9 +2859,27 @@ NV_STATUS uvm_api_nvmgpu_register_file_va_space(UVM_NVMGPU_REGISTER_FILE_VA_SPAC
     return uvm_nvmgpu_register_file_va_space(va_space, params);
 }
 
+NV_STATUS uvm_api_nvmgpu_set_trash(UVM_NVMGPU_SET_TRASH_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    return uvm_nvmgpu_set_trash(va_space, params);
+}
+
 NV_STATUS uvm_api_nvmgpu_remap(UVM_NVMGPU_REMAP_PARAMS *params, struct file *filp)
 {
     uvm_va_space_t *va_space = uvm_va_space_get(filp);
     return uvm_nvmgpu_remap(va_space, params);
 }
 
+NV_STATUS uvm_api_nvmgpu_flush(UVM_NVMGPU_FLUSH_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    return uvm_nvmgpu_flush_range(va_space, params);
+}
+
+NV_STATUS uvm_api_nvmgpu_get_stats(UVM_NVMGPU_GET_STATS_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    return uvm_nvmgpu_get_stats(va_space, params);
+}
+
@@ -37,7 +37,262 @@
 
 #define MIN(x,y) (x < y ? x : y)
 
-static void *fsdata_array[PAGES_PER_UVM_VA_BLOCK];
+static struct kmem_cache *g_uvm_nvmgpu_wb_ctx_cache __read_mostly;
+
+NV_STATUS
+uvm_nvmgpu_global_init(void)
+{
+	g_uvm_nvmgpu_wb_ctx_cache = NV_KMEM_CACHE_CREATE("uvm_nvmgpu_wb_ctx_t", uvm_nvmgpu_wb_ctx_t);
+	if (!g_uvm_nvmgpu_wb_ctx_cache)
+		return NV_ERR_NO_MEMORY;
+
+	return NV_OK;
+}
+
+void
+uvm_nvmgpu_global_exit(void)
+{
+	kmem_cache_destroy_safe(&g_uvm_nvmgpu_wb_ctx_cache);
+}
+
+/**
+ * Take a cleared writeback context from the pool.
+ *
+ * @return: the context, or NULL if out of memory.
+ */
+uvm_nvmgpu_wb_ctx_t *
+uvm_nvmgpu_wb_ctx_alloc(void)
+{
+	return nv_kmem_cache_zalloc(g_uvm_nvmgpu_wb_ctx_cache, NV_UVM_GFP_FLAGS);
+}
+
+void
+uvm_nvmgpu_wb_ctx_free(uvm_nvmgpu_wb_ctx_t *wb_ctx)
+{
+	if (wb_ctx)
+		kmem_cache_free(g_uvm_nvmgpu_wb_ctx_cache, wb_ctx);
+}
+
+/*
+ * One contiguous run of an evicted block on its way to the file. The pages
+ * and the file stay pinned until the write completes, so the block can be
+ * released as soon as the run is queued.
+ */
+typedef struct {
+	uvm_nvmgpu_va_space_t	*nvmgpu_va_space;
+	struct file	*filp;
+	struct kiocb	kiocb;
+	nv_kthread_q_item_t	q_item;
+	struct list_head	list;
+	loff_t	start;
+	size_t	bytes;
+	unsigned int	nr_pages;
+	struct bio_vec	bvec[];
+} uvm_nvmgpu_wb_req_t;
+
+static bool
+wb_range_busy(uvm_nvmgpu_va_space_t *nvmgpu_va_space, struct file *filp, loff_t start, loff_t end)
+{
+	uvm_nvmgpu_wb_req_t	*req;
+	unsigned long	irq_flags;
+	bool	busy = false;
+
+	spin_lock_irqsave(&nvmgpu_va_space->wb_lock, irq_flags);
+	list_for_each_entry(req, &nvmgpu_va_space->wb_inflight, list) {
+		if (req->filp->f_mapping == filp->f_mapping
+		    && req->start < end && start < req->start + (loff_t)req->bytes) {
+			busy = true;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&nvmgpu_va_space->wb_lock, irq_flags);
+
+	return busy;
+}
+
+/**
+ * Wait for asynchronous eviction writes overlapping [start, end) of this
+ * file. Called before anything reads or rewrites the range, so older data
+ * cannot land after newer data.
+ *
+ * @param nvmgpu_va_space: the va_space information related to NVMGPU.
+ * @param filp: the backing file.
+ * @param start: first byte of the range in the file.
+ * @param end: the byte right after the range.
+ */
+void
+uvm_nvmgpu_wb_wait_range(uvm_nvmgpu_va_space_t *nvmgpu_va_space, struct file *filp, loff_t start, loff_t end)
+{
+	if (!nvmgpu_va_space->wb_q_started)
+		return;
+
+	wait_event(nvmgpu_va_space->wb_done, !wb_range_busy(nvmgpu_va_space, filp, start, end));
+}
+
+/**
+ * Report the first asynchronous write error since the last call.
+ *
+ * @return: 0 or a negative errno.
+ */
+static int
+wb_take_error(uvm_nvmgpu_va_space_t *nvmgpu_va_space)
+{
+	return atomic_xchg(&nvmgpu_va_space->wb_error, 0);
+}
+
+static void
+wb_req_complete(struct kiocb *kiocb, long ret, long ret2)
+{
+	uvm_nvmgpu_wb_req_t	*req = container_of(kiocb, uvm_nvmgpu_wb_req_t, kiocb);
+	uvm_nvmgpu_va_space_t	*nvmgpu_va_space = req->nvmgpu_va_space;
+	unsigned long	irq_flags;
+	unsigned int	i;
+
+	if (ret >= 0 && ret != req->bytes)
+		ret = -EIO;
+	if (ret < 0) {
+		printk(KERN_DEBUG "Asynchronous writeback at %lld failed: %ld\n", req->start, ret);
+		atomic_cmpxchg(&nvmgpu_va_space->wb_error, 0, (int)ret);
+	}
+
+	for (i = 0; i < req->nr_pages; i++)
+		put_page(req->bvec[i].bv_page);
+	fput(req->filp);
+
+	// Everything touching nvmgpu_va_space stays under wb_lock so that the
+	// teardown can wait for the last completion to leave.
+	spin_lock_irqsave(&nvmgpu_va_space->wb_lock, irq_flags);
+	list_del(&req->list);
+	atomic64_inc(&nvmgpu_va_space->wb_nr_completed);
+	atomic_dec(&nvmgpu_va_space->wb_nr_inflight);
+	wake_up_all(&nvmgpu_va_space->wb_done);
+	spin_unlock_irqrestore(&nvmgpu_va_space->wb_lock, irq_flags);
+
+	kfree(req);
+}
+
+static void
+wb_req_run(void *args)
+{
+	uvm_nvmgpu_wb_req_t	*req = (uvm_nvmgpu_wb_req_t *)args;
+	struct iov_iter	iter;
+	ssize_t	ret;
+
+	init_sync_kiocb(&req->kiocb, req->filp);
+	req->kiocb.ki_pos = req->start;
+	// Files opened with O_DIRECT complete through the callback later.
+	req->kiocb.ki_complete = wb_req_complete;
+
+#if defined(NV_IOV_ITER_HAS_TYPE)
+	iov_iter_bvec(&iter, WRITE, req->bvec, req->nr_pages, req->bytes);
+#else
+	iov_iter_bvec(&iter, ITER_BVEC | WRITE, req->bvec, req->nr_pages, req->bytes);
+#endif
+	ret = call_write_iter(req->filp, &req->kiocb, &iter);
+	if (ret != -EIOCBQUEUED)
+		wb_req_complete(&req->kiocb, ret, 0);
+}
+
+/**
+ * Queue one run of kernel pages for writing on the writeback queue. Blocks
+ * while UVM_NVMGPU_WB_MAX_INFLIGHT writes are already pending.
+ *
+ * @param nvmgpu_va_space: the va_space information related to NVMGPU.
+ * @param filp: the backing file.
+ * @param iov: page-sized kernel buffers of the run.
+ * @param nr: number of entries in `iov`.
+ * @param bytes: total length of the run.
+ * @param start: file position of the run.
+ *
+ * @return: NV_OK if queued. NV_ERR_NO_MEMORY if the caller has to write
+ * the run itself.
+ */
+static NV_STATUS
+wb_submit_run(uvm_nvmgpu_va_space_t *nvmgpu_va_space, struct file *filp,
+	      const struct iovec *iov, unsigned int nr, size_t bytes, loff_t start)
+{
+	uvm_nvmgpu_wb_req_t	*req;
+	unsigned long	irq_flags;
+	unsigned int	i;
+
+	req = kmalloc(sizeof(*req) + nr * sizeof(req->bvec[0]), NV_UVM_GFP_FLAGS);
+	if (!req)
+		return NV_ERR_NO_MEMORY;
+
+	req->nvmgpu_va_space = nvmgpu_va_space;
+	req->filp = get_file(filp);
+	req->start = start;
+	req->bytes = bytes;
+	req->nr_pages = nr;
+	for (i = 0; i < nr; i++) {
+		req->bvec[i].bv_page = virt_to_page(iov[i].iov_base);
+		req->bvec[i].bv_len = iov[i].iov_len;
+		req->bvec[i].bv_offset = 0;
+		get_page(req->bvec[i].bv_page);
+	}
+	nv_kthread_q_item_init(&req->q_item, wb_req_run, req);
+
+	wait_event(nvmgpu_va_space->wb_done,
+		   atomic_add_unless(&nvmgpu_va_space->wb_nr_inflight, 1, UVM_NVMGPU_WB_MAX_INFLIGHT));
+
+	spin_lock_irqsave(&nvmgpu_va_space->wb_lock, irq_flags);
+	list_add_tail(&req->list, &nvmgpu_va_space->wb_inflight);
+	spin_unlock_irqrestore(&nvmgpu_va_space->wb_lock, irq_flags);
+
+	atomic64_inc(&nvmgpu_va_space->wb_nr_submitted);
+	nv_kthread_q_schedule_q_item(&nvmgpu_va_space->wb_q, &req->q_item);
+
+	return NV_OK;
+}
+
+static void
+write_run_sync(struct file *filp, struct iovec *iov, unsigned int nr, size_t bytes, loff_t start)
+{
+	struct kiocb	kiocb;
+	struct iov_iter	iter;
+	ssize_t	_ret;
+
+	init_sync_kiocb(&kiocb, filp);
+	kiocb.ki_pos = start;
+	iov_iter_init(&iter, WRITE, iov, nr, bytes);
+	_ret = call_write_iter(filp, &kiocb, &iter);
+	BUG_ON(_ret == -EIOCBQUEUED);
+}
+
+/*
+ * Eviction takes the va_space lock and writes to files, neither of which is
+ * allowed from reclaim context. The shrinker therefore only hands the work to
+ * the reducer and reports nothing freeable, so scan_objects is never called.
+ */
+static unsigned long
+reducer_shrinker_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	uvm_nvmgpu_va_space_t	*nvmgpu_va_space = container_of(shrinker, uvm_nvmgpu_va_space_t, reducer_shrinker);
+
+	if (READ_ONCE(nvmgpu_va_space->lru_nr_blocks) > 0) {
+		atomic64_inc(&nvmgpu_va_space->reducer_nr_shrinker_kicks);
+		uvm_nvmgpu_kick_reducer(nvmgpu_va_space, UVM_NVMGPU_REDUCER_KICK_SHRINKER);
+	}
+
+	return 0;
+}
+
+static unsigned long
+reducer_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	return SHRINK_STOP;
+}
+
+static int
+register_reducer_shrinker(uvm_nvmgpu_va_space_t *nvmgpu_va_space)
+{
+	struct shrinker	*shrinker = &nvmgpu_va_space->reducer_shrinker;
+
+	shrinker->count_objects = reducer_shrinker_count;
+	shrinker->scan_objects = reducer_shrinker_scan;
+	shrinker->seeks = DEFAULT_SEEKS;
+	return register_shrinker(shrinker);
+}
 
 static int pagecache_reducer(void *ctx)
 {
@@ -48,9 +303,29 @@ static int pagecache_reducer(void *ctx)
 	uvm_thread_context_add(&thread_context.context);
 
 	while (!kthread_should_stop()) {
-		if (uvm_nvmgpu_has_to_reclaim_blocks(nvmgpu_va_space))
+		int	kicked = 0;
+		bool	forced;
+
+		// Sleep until the fault path or the shrinker reports memory pressure.
+		wait_event_interruptible(nvmgpu_va_space->reducer_wq,
+					 (kicked = atomic_xchg(&nvmgpu_va_space->reducer_kicked, 0)) != 0
+					 || kthread_should_stop());
+		if (kicked == 0)
+			continue;
+
+		atomic64_inc(&nvmgpu_va_space->reducer_nr_wakeups);
+		forced = !!(kicked & UVM_NVMGPU_REDUCER_KICK_SHRINKER);
+
+		// A pass that frees nothing is stuck behind blocks resident on GPUs.
+		// Give up until the next kick rather than spinning on them.
+		while (!kthread_should_stop() && (forced || uvm_nvmgpu_has_to_reclaim_blocks(nvmgpu_va_space))) {
+			long long	nr_reclaimed = atomic64_read(&nvmgpu_va_space->reducer_nr_reclaimed);
+
 			uvm_nvmgpu_reduce_memory_consumption(va_space);
-		schedule_timeout_idle(10);
+			if (atomic64_read(&nvmgpu_va_space->reducer_nr_reclaimed) == nr_reclaimed)
+				break;
+			forced = false;
+		}
 	}
 
 	uvm_thread_context_remove(&thread_context.context);
@@ -61,9 +336,41 @@ void
 stop_pagecache_reducer(uvm_va_space_t *va_space)
 {
 	uvm_nvmgpu_va_space_t *nvmgpu_va_space = &va_space->nvmgpu_va_space;
+
+	// Unregistering waits for running callbacks, so none can kick a
+	// reducer that is gone.
+	if (nvmgpu_va_space->reducer_shrinker_registered) {
+		unregister_shrinker(&nvmgpu_va_space->reducer_shrinker);
+		nvmgpu_va_space->reducer_shrinker_registered = false;
+	}
+
 	if (nvmgpu_va_space->reducer) {
 		kthread_stop(nvmgpu_va_space->reducer);
 		nvmgpu_va_space->reducer = NULL;
+
+		printk(KERN_DEBUG "nvmgpu reducer: %lld kicks (%lld by shrinker), %lld wakeups, %lld passes, %lld blocks reclaimed in %lld us (max pass %lld us)\n",
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_nr_kicks),
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_nr_shrinker_kicks),
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_nr_wakeups),
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_nr_passes),
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_nr_reclaimed),
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_reclaim_ns) / NSEC_PER_USEC,
+		       (long long)atomic64_read(&nvmgpu_va_space->reducer_max_reclaim_ns) / NSEC_PER_USEC);
+	}
+
+	if (nvmgpu_va_space->wb_q_started) {
+		wait_event(nvmgpu_va_space->wb_done, atomic_read(&nvmgpu_va_space->wb_nr_inflight) == 0);
+
+		// The last completion may still be waking us up under wb_lock.
+		spin_lock_irq(&nvmgpu_va_space->wb_lock);
+		spin_unlock_irq(&nvmgpu_va_space->wb_lock);
+
+		nv_kthread_q_stop(&nvmgpu_va_space->wb_q);
+		nvmgpu_va_space->wb_q_started = false;
+
+		printk(KERN_DEBUG "nvmgpu writeback: %lld submitted, %lld completed\n",
+		       (long long)atomic64_read(&nvmgpu_va_space->wb_nr_submitted),
+		       (long long)atomic64_read(&nvmgpu_va_space->wb_nr_completed));
 	}
 }
 
@@ -94,6 +401,7 @@ uvm_nvmgpu_initialize(uvm_va_space_t *va_space, unsigned long trash_nr_blocks, u
 
 	if (!nvmgpu_va_space->is_initailized) {
 		INIT_LIST_HEAD(&nvmgpu_va_space->lru_head);
+		nvmgpu_va_space->lru_nr_blocks = 0;
 		/* TODO: Lower down the locking order.
 		 * Because invalid locking order warnings are generated when debug mode is enabled.
 		 */
@@ -101,10 +409,47 @@ uvm_nvmgpu_initialize(uvm_va_space_t *va_space, unsigned long trash_nr_blocks, u
 		uvm_mutex_init(&nvmgpu_va_space->lock_blocks, UVM_LOCK_ORDER_VA_SPACE_NVMGPU);
 		nvmgpu_va_space->trash_nr_blocks = trash_nr_blocks;
 		nvmgpu_va_space->trash_reserved_nr_pages = trash_reserved_nr_pages;
+		nvmgpu_va_space->trash_adaptive = !!(flags & UVM_NVMGPU_INIT_ADAPTIVE_TRASH);
+		nvmgpu_va_space->trash_cur_nr_blocks = trash_nr_blocks;
 		nvmgpu_va_space->flags = flags;
+
+		spin_lock_init(&nvmgpu_va_space->wb_lock);
+		INIT_LIST_HEAD(&nvmgpu_va_space->wb_inflight);
+		atomic_set(&nvmgpu_va_space->wb_nr_inflight, 0);
+		atomic64_set(&nvmgpu_va_space->wb_nr_submitted, 0);
+		atomic64_set(&nvmgpu_va_space->wb_nr_completed, 0);
+		atomic_set(&nvmgpu_va_space->wb_error, 0);
+		init_waitqueue_head(&nvmgpu_va_space->wb_done);
+		if (flags & UVM_NVMGPU_INIT_ENABLE_AIO_WRITE) {
+			// Fall back to synchronous eviction if the queue cannot start.
+			nvmgpu_va_space->wb_q_started = nv_kthread_q_init(&nvmgpu_va_space->wb_q, "nvmgpu_wb") == 0;
+			if (!nvmgpu_va_space->wb_q_started)
+				printk(KERN_DEBUG "Cannot start the writeback queue, evicting synchronously\n");
+		}
+
+		init_waitqueue_head(&nvmgpu_va_space->reducer_wq);
+		atomic_set(&nvmgpu_va_space->reducer_kicked, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_nr_kicks, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_nr_shrinker_kicks, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_nr_wakeups, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_nr_passes, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_nr_reclaimed, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_reclaim_ns, 0);
+		atomic64_set(&nvmgpu_va_space->reducer_max_reclaim_ns, 0);
+
 		nvmgpu_va_space->is_initailized = true;
 
 		nvmgpu_va_space->reducer = kthread_run(pagecache_reducer, va_space, "reducer");
+		if (IS_ERR(nvmgpu_va_space->reducer)) {
+			printk(KERN_DEBUG "Cannot start the page-cache reducer: %ld\n", PTR_ERR(nvmgpu_va_space->reducer));
+			nvmgpu_va_space->reducer = NULL;
+		}
+		else {
+			// Faults still kick the reducer if the kernel does not take a shrinker.
+			nvmgpu_va_space->reducer_shrinker_registered = register_reducer_shrinker(nvmgpu_va_space) == 0;
+			if (!nvmgpu_va_space->reducer_shrinker_registered)
+				printk(KERN_DEBUG "Cannot register the page-cache reducer shrinker\n");
+		}
 		return NV_OK;
 	}
 	else
@@ -139,6 +484,12 @@ uvm_nvmgpu_register_file_va_space(uvm_va_space_t *va_space, UVM_NVMGPU_REGISTER_
 		return NV_ERR_INVALID_OPERATION;
 	}
 
+	// The window is shared with the page cache page by page.
+	if (!PAGE_ALIGNED(params->offset)) {
+		printk(KERN_DEBUG "Error: file offset 0x%zx is not page aligned\n", params->offset);
+		return NV_ERR_INVALID_ARGUMENT;
+	}
+
 	// Find uvm node associated with the specified UVM address range.
 	if (node == NULL) {
 		printk(KERN_DEBUG "Error: no matching va range for 0x%llx-0x%llx\n", expected_start_addr, expected_end_addr);
@@ -160,8 +511,9 @@ uvm_nvmgpu_register_file_va_space(uvm_va_space_t *va_space, UVM_NVMGPU_REGISTER_
 		return NV_ERR_OPERATING_SYSTEM;
 	}
 
-	// Record the flags and the file size.
+	// Record the flags and the file window.
 	nvmgpu_rtn->flags = params->flags;
+	nvmgpu_rtn->file_offset = params->offset;
 	nvmgpu_rtn->size = params->size;
 
 	// Calculate the number of blocks associated with this UVM range.
@@ -181,8 +533,9 @@ uvm_nvmgpu_register_file_va_space(uvm_va_space_t *va_space, UVM_NVMGPU_REGISTER_
 		goto _register_err_1;
 	}
 
-	nvmgpu_rtn->iov = kmalloc(sizeof(struct iovec) * PAGES_PER_UVM_VA_BLOCK, GFP_KERNEL);
-	if (!nvmgpu_rtn->iov) {
+	// Allocate the bitmap of blocks touched since the reducer last looked at them.
+	nvmgpu_rtn->referenced_bitmaps = kzalloc(sizeof(unsigned long) * BITS_TO_LONGS(max_nr_blocks), GFP_KERNEL);
+	if (!nvmgpu_rtn->referenced_bitmaps) {
 		ret = NV_ERR_NO_MEMORY;
 		goto _register_err_2;
 	}
@@ -198,6 +551,58 @@ _register_err_0:
 	return ret;
 }
 
+/**
+ * Change the eviction parameters of an initialized `va_space` at runtime.
+ * The reducer picks up the new values on its next pass.
+ *
+ * @param va_space: va_space to be tuned.
+ *
+ * @param params: new values. Only the ones selected by
+ * UVM_NVMGPU_TRASH_SET_* in `params->flags` are applied. Adaptive mode is
+ * toggled by UVM_NVMGPU_TRASH_{ENABLE,DISABLE}_ADAPTIVE.
+ *
+ * @return: NV_ERR_INVALID_OPERATION if `va_space` is not initialized,
+ * NV_ERR_INVALID_ARGUMENT on bad values, otherwise NV_OK.
+ */
+NV_STATUS
+uvm_nvmgpu_set_trash(uvm_va_space_t *va_space, UVM_NVMGPU_SET_TRASH_PARAMS *params)
+{
+	uvm_nvmgpu_va_space_t	*nvmgpu_va_space = &va_space->nvmgpu_va_space;
+
+	if (!nvmgpu_va_space->is_initailized) {
+		printk(KERN_DEBUG "Error: Call uvm_nvmgpu_set_trash before uvm_nvmgpu_initialize\n");
+		return NV_ERR_INVALID_OPERATION;
+	}
+
+	if ((params->flags & UVM_NVMGPU_TRASH_SET_NR_BLOCKS) && params->trash_nr_blocks == 0)
+		return NV_ERR_INVALID_ARGUMENT;
+
+	if ((params->flags & UVM_NVMGPU_TRASH_ENABLE_ADAPTIVE) && (params->flags & UVM_NVMGPU_TRASH_DISABLE_ADAPTIVE))
+		return NV_ERR_INVALID_ARGUMENT;
+
+	uvm_mutex_lock(&nvmgpu_va_space->lock);
+
+	if (params->flags & UVM_NVMGPU_TRASH_SET_NR_BLOCKS) {
+		WRITE_ONCE(nvmgpu_va_space->trash_nr_blocks, params->trash_nr_blocks);
+		// Restart adaptation from the new value.
+		WRITE_ONCE(nvmgpu_va_space->trash_cur_nr_blocks, params->trash_nr_blocks);
+	}
+	if (params->flags & UVM_NVMGPU_TRASH_SET_RESERVED_NR_PAGES)
+		WRITE_ONCE(nvmgpu_va_space->trash_reserved_nr_pages, params->trash_reserved_nr_pages);
+	if (params->flags & UVM_NVMGPU_TRASH_ENABLE_ADAPTIVE)
+		WRITE_ONCE(nvmgpu_va_space->trash_adaptive, true);
+	if (params->flags & UVM_NVMGPU_TRASH_DISABLE_ADAPTIVE)
+		WRITE_ONCE(nvmgpu_va_space->trash_adaptive, false);
+
+	uvm_mutex_unlock(&nvmgpu_va_space->lock);
+
+	// A larger reservation may already be crossed.
+	if (params->flags & UVM_NVMGPU_TRASH_SET_RESERVED_NR_PAGES)
+		uvm_nvmgpu_check_memory_pressure(nvmgpu_va_space);
+
+	return NV_OK;
+}
+
 NV_STATUS
 uvm_nvmgpu_remap(uvm_va_space_t *va_space, UVM_NVMGPU_REMAP_PARAMS *params)
 {
@@ -230,8 +635,8 @@ uvm_nvmgpu_remap(uvm_va_space_t *va_space, UVM_NVMGPU_REMAP_PARAMS *params)
 	for_each_va_block_in_va_range_safe(va_range, va_block, va_block_next) {
 		uvm_nvmgpu_block_clear_file_dirty(va_block);
 		if (nvmgpu_rtn->flags & UVM_NVMGPU_FLAG_VOLATILE) {
+			uvm_nvmgpu_lru_del(va_block);
 			uvm_nvmgpu_release_block(va_block);
-			list_del(&va_block->nvmgpu_lru);
 		}
 	}
 
@@ -255,6 +660,7 @@ NV_STATUS
 uvm_nvmgpu_unregister_va_range(uvm_va_range_t *va_range)
 {
 	struct file	*filp;
+	uvm_va_block_t	*va_block;
 
 	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
 
@@ -262,14 +668,22 @@ uvm_nvmgpu_unregister_va_range(uvm_va_range_t *va_range)
 
 	UVM_ASSERT(filp != NULL);
 
+	// The reducer must not find these blocks once the bitmaps are gone.
+	for_each_va_block_in_va_range(va_range, va_block)
+		uvm_nvmgpu_lru_del(va_block);
+
 	if (nvmgpu_rtn->is_file_dirty_bitmaps)
 		kfree(nvmgpu_rtn->is_file_dirty_bitmaps);
 
 	if (nvmgpu_rtn->has_data_bitmaps)
 		kfree(nvmgpu_rtn->has_data_bitmaps);
 
-	if (nvmgpu_rtn->iov)
-		kfree(nvmgpu_rtn->iov);
+	if (nvmgpu_rtn->referenced_bitmaps)
+		kfree(nvmgpu_rtn->referenced_bitmaps);
+	nvmgpu_rtn->referenced_bitmaps = NULL;
+
+	// Evicted data still on its way must reach the file before the sync.
+	uvm_nvmgpu_wb_wait_range(&va_range->va_space->nvmgpu_va_space, filp, 0, LLONG_MAX);
 
 	if ((nvmgpu_rtn->flags & UVM_NVMGPU_FLAG_WRITE) && !(nvmgpu_rtn->flags & UVM_NVMGPU_FLAG_VOLATILE))
 		vfs_fsync(filp, 1);
@@ -353,285 +767,163 @@ insert_pagecache_to_va_block_error:
 	return status;
 }
 
+struct page *
+assign_pagecache(uvm_va_block_t *block, uvm_page_index_t page_index)
+{
+	uvm_va_range_t	*va_range = block->va_range;
+	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
+	struct file	*nvmgpu_file = nvmgpu_rtn->filp;
+	loff_t	file_start_offset = uvm_nvmgpu_block_file_start(block);
+	loff_t	offset;
+	int	page_id = page_index;
+	struct page	*page;
+
+	offset = file_start_offset + page_id * PAGE_SIZE;
+	page = read_mapping_page(nvmgpu_file->f_mapping, offset >> PAGE_SHIFT, NULL);
+	if (IS_ERR(page))
+		return NULL;
+	insert_pagecache_to_va_block(block, page_index, page);
+	unlock_page(page);
+	return page;
+}
+
 /**
- * Inspired by generic_file_buffered_read in /mm/filemap.c.
+ * Bring the page-cache pages backing `region` of the block up to date and
+ * insert them into the block, locked. The whole range is looked up in one
+ * pass and the missing pages are requested by readahead, one window at a
+ * time, before any of them is waited for, instead of walking the generic
+ * read path page by page.
+ *
+ * @param nvmgpu_file: the backing file.
+ * @param va_block: data will be put in this va_block.
+ * @param region: pages of the block to fill.
+ *
+ * @return: true on success, false otherwise.
  */
-static int
-prepare_page_for_read(struct file *filp, loff_t ppos, uvm_va_block_t *va_block, int page_id)
+static bool
+fill_pagecaches_for_read(struct file *nvmgpu_file, uvm_va_block_t *va_block, uvm_va_block_region_t region)
 {
-	struct address_space	*mapping = filp->f_mapping;
+	struct address_space	*mapping = nvmgpu_file->f_mapping;
 	struct inode	*inode = mapping->host;
-	struct file_ra_state	*ra = &filp->f_ra;
-	pgoff_t	index;
-	pgoff_t	last_index;
-	pgoff_t	prev_index;
-	unsigned long	offset;      /* offset into pagecache page */
-	unsigned int	prev_offset;
+	struct file_ra_state	*ra = &nvmgpu_file->f_ra;
+	struct page	**pages;
+	loff_t	isize;
+	// Calculate the file offset based on the block start address.
+	loff_t	file_start_offset = uvm_nvmgpu_block_file_start(va_block);
+	pgoff_t	first_index = file_start_offset >> PAGE_SHIFT;
+	uvm_page_index_t	outer = region.first;
+	int	page_id, first_missing = -1, last_missing = -1;
 	int	error = 0;
 
-	index = ppos >> PAGE_SHIFT;
-	prev_index = ra->prev_pos >> PAGE_SHIFT;
-	prev_offset = ra->prev_pos & (PAGE_SIZE-1);
-	last_index = (ppos + PAGE_SIZE + PAGE_SIZE-1) >> PAGE_SHIFT;
-	offset = ppos & ~PAGE_MASK;
-
-	for (;;) {
-		struct page	*page;
-		pgoff_t	end_index;
-		loff_t	isize;
-		unsigned long	nr;
-		NV_STATUS	ret;
-
-		cond_resched();
-find_page:
-		if (fatal_signal_pending(current)) {
-			error = -EINTR;
-			goto out;
-		}
-
-		page = find_get_page(mapping, index);
-		if (!page) {
-			page_cache_sync_readahead(mapping, ra, filp, index, last_index - index);
-			page = find_get_page(mapping, index);
-			if (unlikely(page == NULL))
-				goto no_cached_page;
-		}
-		if (PageReadahead(page)) {
-			page_cache_async_readahead(mapping, ra, filp, page, index, last_index - index);
-		}
-		if (!PageUptodate(page)) {
-			/*
-			 * See comment in do_read_cache_page on why
-			 * wait_on_page_locked is used to avoid unnecessarily
-			 * serialisations and why it's safe.
-			 */
-			error = wait_on_page_locked_killable(page);
-			if (unlikely(error))
-				goto readpage_error;
-			if (PageUptodate(page))
-				goto page_ok;
-
-			if (inode->i_blkbits == PAGE_SHIFT ||
-			    !mapping->a_ops->is_partially_uptodate)
-				goto page_not_up_to_date;
-			if (!trylock_page(page))
-				goto page_not_up_to_date;
-			/* Did it get truncated before we got the lock? */
-			if (!page->mapping)
-				goto page_not_up_to_date_locked;
-			if (!mapping->a_ops->is_partially_uptodate(page, offset, PAGE_SIZE))
-				goto page_not_up_to_date_locked;
-			unlock_page(page);
-		}
-page_ok:
-		/*
-		 * i_size must be checked after we know the page is Uptodate.
-		 *
-		 * Checking i_size after the check allows us to calculate
-		 * the correct value for "nr", which means the zero-filled
-		 * part of the page is not copied back to userspace (unless
-		 * another truncate extends the file - this is desired though).
-		 */
-
-		isize = i_size_read(inode);
-		end_index = (isize - 1) >> PAGE_SHIFT;
-		if (unlikely(!isize || index > end_index)) {
-			put_page(page);
-			goto out;
-		}
-
-		/* nr is the maximum number of bytes to copy from this page */
-		nr = PAGE_SIZE;
-		if (index == end_index) {
-			nr = ((isize - 1) & ~PAGE_MASK) + 1;
-			if (nr <= offset) {
-				put_page(page);
-				goto out;
-			}
-		}
-		nr = nr - offset;
+	// Pages past the end of the file have nothing to read.
+	isize = i_size_read(inode);
+	if (isize > file_start_offset)
+		outer = max_t(loff_t, region.first, min_t(loff_t, region.outer, DIV_ROUND_UP(isize - file_start_offset, PAGE_SIZE)));
 
-		/* If users can be writing to this page using arbitrary
-		 * virtual addresses, take care about potential aliasing
-		 * before reading the page on the kernel side.
-		 */
-		if (mapping_writably_mapped(mapping))
-			flush_dcache_page(page);
+	pages = uvm_kvmalloc_zero(sizeof(*pages) * PAGES_PER_UVM_VA_BLOCK);
+	if (!pages)
+		return false;
 
-		/*
-		 * When a sequential read accesses a page several times,
-		 * only mark it as accessed the first time.
-		 */
-		if (prev_index != index || offset != prev_offset)
-			mark_page_accessed(page);
-		prev_index = index;
+	// Look up the whole range first.
+	for (page_id = region.first; page_id < outer; page_id++) {
+		struct page	*page = find_get_page(mapping, first_index + page_id);
 
-		/*
-		 * Ok, we have the page, and it's up-to-date, so
-		 * now we can insert it to the va_block...
-		 */
-		ret = insert_pagecache_to_va_block(va_block, page_id, page);
-		if (ret != NV_OK) {
-			error = ret;
-			goto out;
+		if (!page) {
+			if (first_missing < 0)
+				first_missing = page_id;
+			last_missing = page_id;
+			continue;
 		}
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, ra, nvmgpu_file, page, first_index + page_id, outer - page_id);
+		pages[page_id] = page;
+	}
 
-		offset += PAGE_SIZE;
-		index += offset >> PAGE_SHIFT;
-		offset &= ~PAGE_MASK;
-		prev_offset = offset;
-
-		goto out;
+	// Readahead never reads more than ra_pages per call, so the missing span
+	// is submitted in windows of that size. Each call only queues the I/O;
+	// it is all waited for below.
+	if (first_missing >= 0) {
+		unsigned long	window = max_t(unsigned long, ra->ra_pages, 1);
 
-page_not_up_to_date:
-		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
-		if (unlikely(error))
-			goto readpage_error;
+		page_id = first_missing;
+		while (page_id <= last_missing) {
+			unsigned long	nr_pages;
 
-page_not_up_to_date_locked:
-		/* Did it get truncated before we got the lock? */
-		if (!page->mapping) {
-			unlock_page(page);
-			put_page(page);
-			continue;
+			if (pages[page_id]) {
+				page_id++;
+				continue;
+			}
+			nr_pages = min_t(unsigned long, window, last_missing - page_id + 1);
+			page_cache_sync_readahead(mapping, ra, nvmgpu_file, first_index + page_id, nr_pages);
+			page_id += nr_pages;
 		}
-
-		/* Did somebody else fill it already? */
-		if (PageUptodate(page)) {
-			unlock_page(page);
-			goto page_ok;
+		for (page_id = first_missing; page_id <= last_missing; page_id++) {
+			if (!pages[page_id])
+				pages[page_id] = find_get_page(mapping, first_index + page_id);
 		}
+	}
 
-readpage:
-		/*
-		 * A previous I/O error may have been due to temporary
-		 * failures, eg. multipath errors.
-		 * PG_error will be set again if readpage fails.
-		 */
-		ClearPageError(page);
-		/* Start the actual read. The read will unlock the page. */
-		error = mapping->a_ops->readpage(filp, page);
+	// Wait for the I/O in flight. Pages the readahead skipped or failed are
+	// read synchronously.
+	for (page_id = region.first; page_id < outer; page_id++) {
+		struct page	*page = pages[page_id];
 
-		if (unlikely(error)) {
-			if (error == AOP_TRUNCATED_PAGE) {
-				put_page(page);
-				error = 0;
-				goto find_page;
-			}
-			goto readpage_error;
+		if (fatal_signal_pending(current)) {
+			error = -EINTR;
+			break;
 		}
 
-		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+		if (page && !PageUptodate(page)) {
+			error = wait_on_page_locked_killable(page);
 			if (unlikely(error))
-				goto readpage_error;
+				break;
 			if (!PageUptodate(page)) {
-				if (page->mapping == NULL) {
-					/*
-					 * invalidate_mapping_pages got it
-					 */
-					unlock_page(page);
-					put_page(page);
-					goto find_page;
-				}
-				unlock_page(page);
-				ra->ra_pages /= 4;
-				error = -EIO;
-				goto readpage_error;
+				put_page(page);
+				pages[page_id] = page = NULL;
 			}
-			unlock_page(page);
 		}
-
-		goto page_ok;
-
-readpage_error:
-		/* UHHUH! A synchronous read error occurred. Report it */
-		put_page(page);
-		goto out;
-
-no_cached_page:
-		/*
-		 * Ok, it wasn't cached, so we need to create a new
-		 * page..
-		 */
-		page = page_cache_alloc(mapping);
 		if (!page) {
-			error = -ENOMEM;
-			goto out;
-		}
-		error = add_to_page_cache_lru(page, mapping, index,
-					      mapping_gfp_constraint(mapping, GFP_KERNEL));
-		if (error) {
-			put_page(page);
-			if (error == -EEXIST) {
-				error = 0;
-				goto find_page;
+			page = read_mapping_page(mapping, first_index + page_id, nvmgpu_file);
+			if (IS_ERR(page)) {
+				error = PTR_ERR(page);
+				break;
 			}
-			goto out;
+			pages[page_id] = page;
 		}
-		goto readpage;
-	}
 
-	error = -EAGAIN;
-out:
-	ra->prev_pos = prev_index;
-	ra->prev_pos <<= PAGE_SHIFT;
-	ra->prev_pos |= prev_offset;
-
-	file_accessed(filp);
-	return error;
-}
-
-struct page *
-assign_pagecache(uvm_va_block_t *block, uvm_page_index_t page_index)
-{
-	uvm_va_range_t	*va_range = block->va_range;
-	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
-	struct file	*nvmgpu_file = nvmgpu_rtn->filp;
-	loff_t	file_start_offset = block->start - block->va_range->node.start;
-	loff_t	offset;
-	int	page_id = page_index;
-	struct page	*page;
-
-	offset = file_start_offset + page_id * PAGE_SIZE;
-	page = read_mapping_page(nvmgpu_file->f_mapping, offset, NULL);
-	if (page == NULL)
-		return NULL;
-	insert_pagecache_to_va_block(block, page_index, page);
-	unlock_page(page);
-	return page;
-}
+		if (mapping_writably_mapped(mapping))
+			flush_dcache_page(page);
+		mark_page_accessed(page);
+	}
 
-static bool
-fill_pagecaches_for_read(struct file *nvmgpu_file, uvm_va_block_t *va_block, uvm_va_block_region_t region)
-{
-	struct inode	*inode = nvmgpu_file->f_mapping->host;
-	loff_t	isize;
-	uvm_page_mask_t read_mask;
-	int page_id;
-	// Calculate the file offset based on the block start address.
-	loff_t	file_start_offset = va_block->start - va_block->va_range->node.start;
+	// Hand the pages over to the block together.
+	for (page_id = region.first; page_id < outer && error == 0; page_id++) {
+		if (insert_pagecache_to_va_block(va_block, page_id, pages[page_id]) != NV_OK) {
+			put_page(pages[page_id]);
+			error = -ENOMEM;
+		}
+		pages[page_id] = NULL;
+	}
 
-	uvm_page_mask_fill(&read_mask);
+	for (page_id = region.first; page_id < outer; page_id++) {
+		if (pages[page_id])
+			put_page(pages[page_id]);
+	}
+	uvm_kvfree(pages);
 
-	isize = i_size_read(inode);
+	if (error != 0) {
+		printk(KERN_DEBUG "Cannot prepare pages for read at file offset 0x%llx: %d\n", file_start_offset, error);
+		return false;
+	}
 
-	// Fill in page-cache pages to va_block
-	for_each_va_block_page_in_region_mask(page_id, &read_mask, region) {
-		loff_t	offset = file_start_offset + page_id * PAGE_SIZE;
+	if (outer > region.first)
+		ra->prev_pos = (loff_t)(first_index + outer - 1) << PAGE_SHIFT;
+	file_accessed(nvmgpu_file);
 
-		if (unlikely(offset >= isize)) {
-			struct page	*page = va_block->cpu.pages[page_id];
-			if (page)
-				lock_page(page);
-			continue;
-		}
-		if (prepare_page_for_read(nvmgpu_file, offset, va_block, page_id) != 0) {
-			printk(KERN_DEBUG "Cannot prepare page for read at file offset 0x%llx\n", offset);
-			return false;
-		}
-		UVM_ASSERT(va_block->cpu.pages[page_id]);
+	for (page_id = outer; page_id < region.outer; page_id++) {
+		struct page	*page = va_block->cpu.pages[page_id];
+		if (page)
+			lock_page(page);
 	}
 
 	return true;
@@ -642,9 +934,10 @@ get_region_readable_outer(uvm_va_block_t *va_block, struct file *nvmgpu_file)
 {
 	uvm_page_index_t	outer = ((va_block->end - va_block->start) >> PAGE_SHIFT) + 1;
 	uvm_page_index_t	outer_max;
-	struct inode	*inode = nvmgpu_file->f_mapping->host;
-	loff_t	len_remain = i_size_read(inode) - (va_block->start - va_block->va_range->node.start);
+	loff_t	len_remain = uvm_nvmgpu_block_file_remain(va_block);
 
+	if (len_remain <= 0)
+		return 0;
 	outer_max = (len_remain + PAGE_SIZE - 1) >> PAGE_SHIFT;
 	if (outer > outer_max)
 		return outer_max;
@@ -681,6 +974,11 @@ uvm_nvmgpu_read_begin(uvm_va_block_t *va_block, uvm_va_block_retry_t *block_retr
 	// Record the original page mask and set the mask to all 1s.
 	uvm_page_mask_t	original_page_mask;
 
+	// Do not read back a range whose evicted data has not landed yet.
+	uvm_nvmgpu_wb_wait_range(&va_range->va_space->nvmgpu_va_space, nvmgpu_file,
+				 uvm_nvmgpu_block_file_start(va_block),
+				 uvm_nvmgpu_block_file_start(va_block) + uvm_va_block_size(va_block));
+
 	uvm_page_mask_copy(&original_page_mask, &service_context->block_context.make_resident.page_mask);
 
 	uvm_page_mask_init_from_region(&service_context->block_context.make_resident.page_mask, region, NULL);
@@ -846,6 +1144,169 @@ uvm_nvmgpu_flush(uvm_va_range_t *va_range)
 	return status;
 }
 
+static int
+sync_file_run(struct file *filp, loff_t start, loff_t end)
+{
+	if (start < 0)
+		return 0;
+	return filemap_write_and_wait_range(filp->f_mapping, start, end);
+}
+
+/**
+ * Write back a part of a registered va_range without unregistering it.
+ * Blocks that have never been populated are skipped. Data held by GPUs or
+ * by the host buffer is moved to the page cache first, and then only the
+ * blocks marked in `is_file_dirty_bitmaps` are written to the file.
+ *
+ * @param va_space: va_space that owns the mapping.
+ *
+ * @param params: the start address of the mapping and the byte range,
+ * relative to the mapping, to be written back.
+ *
+ * @return: NV_OK on success, NV_ERR_* otherwise.
+ */
+NV_STATUS
+uvm_nvmgpu_flush_range(uvm_va_space_t *va_space, UVM_NVMGPU_FLUSH_PARAMS *params)
+{
+	NV_STATUS	status = NV_OK;
+	uvm_va_range_t	*va_range;
+	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn;
+	uvm_va_block_t	*va_block;
+	NvU64	expected_start_addr = (NvU64)params->uvm_addr;
+	size_t	index, first_index, last_index;
+	loff_t	run_start = -1, run_end = -1;
+	loff_t	sync_start = -1, sync_end = -1;
+	int	error = 0;
+
+	// Make sure that uvm_nvmgpu_initialize is called before this function.
+	if (!va_space->nvmgpu_va_space.is_initailized) {
+		printk(KERN_DEBUG "Error: Call uvm_nvmgpu_flush_range before uvm_nvmgpu_initialize\n");
+		return NV_ERR_INVALID_OPERATION;
+	}
+
+	// mmap_sem is needed since flushing a block may change its CPU mappings.
+	uvm_down_read_mmap_sem(&current->mm->mmap_sem);
+	uvm_va_space_down_read(va_space);
+
+	va_range = uvm_va_range_find(va_space, expected_start_addr);
+	if (!va_range || va_range->node.start != expected_start_addr || !uvm_nvmgpu_is_managed(va_range)) {
+		printk(KERN_DEBUG "Cannot find nvmgpu range whose address starts from 0x%llx\n", expected_start_addr);
+		status = NV_ERR_INVALID_ADDRESS;
+		goto flush_range_out;
+	}
+
+	nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
+
+	// Nothing is persisted for read-only or volatile mappings.
+	if (!(nvmgpu_rtn->flags & UVM_NVMGPU_FLAG_WRITE) || (nvmgpu_rtn->flags & UVM_NVMGPU_FLAG_VOLATILE))
+		goto flush_range_out;
+
+	if (params->length == 0)
+		goto flush_range_out;
+
+	if (params->offset >= nvmgpu_rtn->size || params->length > nvmgpu_rtn->size - params->offset) {
+		status = NV_ERR_INVALID_ARGUMENT;
+		goto flush_range_out;
+	}
+
+	first_index = uvm_va_range_block_index(va_range, expected_start_addr + params->offset);
+	last_index = uvm_va_range_block_index(va_range, expected_start_addr + params->offset + params->length - 1);
+
+	for (index = first_index; index <= last_index; ++index) {
+		loff_t	block_start, block_end;
+
+		va_block = uvm_va_range_block(va_range, index);
+		if (!va_block)
+			continue;
+
+		status = uvm_nvmgpu_flush_block(va_block);
+		if (status != NV_OK) {
+			printk(KERN_DEBUG "Encountered a problem with uvm_nvmgpu_flush_block\n");
+			goto flush_range_out;
+		}
+
+		if (!uvm_nvmgpu_block_file_dirty(va_block))
+			continue;
+
+		block_start = uvm_nvmgpu_block_file_start(va_block);
+		block_end = MIN(block_start + uvm_va_block_size(va_block), uvm_nvmgpu_file_end(nvmgpu_rtn)) - 1;
+
+		if (sync_start < 0)
+			sync_start = block_start;
+		sync_end = block_end;
+
+		// Coalesce adjacent dirty blocks into a single writeback.
+		if (run_start >= 0 && block_start == run_end + 1) {
+			run_end = block_end;
+			continue;
+		}
+		if ((error = sync_file_run(nvmgpu_rtn->filp, run_start, run_end)) != 0)
+			break;
+		run_start = block_start;
+		run_end = block_end;
+	}
+
+	if (error == 0)
+		error = sync_file_run(nvmgpu_rtn->filp, run_start, run_end);
+
+	// Blocks evicted asynchronously are gone from the range but their data
+	// may still be in flight, so wait for it and sync the whole window.
+	if (error == 0 && va_space->nvmgpu_va_space.wb_q_started) {
+		loff_t	req_start = nvmgpu_rtn->file_offset + params->offset;
+
+		uvm_nvmgpu_wb_wait_range(&va_space->nvmgpu_va_space, nvmgpu_rtn->filp, req_start, req_start + params->length);
+		error = wb_take_error(&va_space->nvmgpu_va_space);
+		sync_start = req_start;
+		sync_end = req_start + params->length - 1;
+	}
+
+	// Data pages are clean now. Persist the metadata for the whole span once.
+	if (error == 0 && sync_start >= 0)
+		error = vfs_fsync_range(nvmgpu_rtn->filp, sync_start, sync_end, 1);
+
+	if (error != 0) {
+		printk(KERN_DEBUG "Cannot write back file range: %d\n", error);
+		status = errno_to_nv_status(error);
+	}
+
+flush_range_out:
+	uvm_va_space_up_read(va_space);
+	uvm_up_read_mmap_sem(&current->mm->mmap_sem);
+
+	return status;
+}
+
+/**
+ * Report the page-cache reducer counters of this va_space.
+ *
+ * @param va_space: va_space to be examined.
+ *
+ * @param params: receives the counters accumulated since uvm_nvmgpu_initialize.
+ *
+ * @return: NV_ERR_INVALID_OPERATION if `va_space` has not been initialized,
+ * otherwise NV_OK.
+ */
+NV_STATUS
+uvm_nvmgpu_get_stats(uvm_va_space_t *va_space, UVM_NVMGPU_GET_STATS_PARAMS *params)
+{
+	uvm_nvmgpu_va_space_t	*nvmgpu_va_space = &va_space->nvmgpu_va_space;
+
+	if (!nvmgpu_va_space->is_initailized) {
+		printk(KERN_DEBUG "Error: Call uvm_nvmgpu_get_stats before uvm_nvmgpu_initialize\n");
+		return NV_ERR_INVALID_OPERATION;
+	}
+
+	params->reducer_nr_kicks = atomic64_read(&nvmgpu_va_space->reducer_nr_kicks);
+	params->reducer_nr_shrinker_kicks = atomic64_read(&nvmgpu_va_space->reducer_nr_shrinker_kicks);
+	params->reducer_nr_wakeups = atomic64_read(&nvmgpu_va_space->reducer_nr_wakeups);
+	params->reducer_nr_passes = atomic64_read(&nvmgpu_va_space->reducer_nr_passes);
+	params->reducer_nr_reclaimed = atomic64_read(&nvmgpu_va_space->reducer_nr_reclaimed);
+	params->reducer_reclaim_ns = atomic64_read(&nvmgpu_va_space->reducer_reclaim_ns);
+	params->reducer_max_reclaim_ns = atomic64_read(&nvmgpu_va_space->reducer_max_reclaim_ns);
+
+	return NV_OK;
+}
+
 /**
  * Free memory associated with the `va_block`.
  *
@@ -896,6 +1357,19 @@ uvm_nvmgpu_prepare_block_for_hostbuf(uvm_va_block_t *va_block)
 	return NV_OK;
 }
 
+/**
+ * Pull the block's pages into the page cache of the backing file. Takes the
+ * inode lock and a writeback context that uvm_nvmgpu_write_end releases, so
+ * every successful call must be paired with it under the same block lock.
+ *
+ * @param va_block: va_block to be written back.
+ * @param is_flush: true if called for an explicit migration to the CPU.
+ *
+ * @return: NV_OK on success, NV_ERR_NO_MEMORY if no context is available,
+ * or the error of the first page the filesystem could not begin. On error the
+ * block's pages and mappings are left untouched, the inode is unlocked and no
+ * context is left on the block, so uvm_nvmgpu_write_end must not be called.
+ */
 NV_STATUS
 uvm_nvmgpu_write_begin(uvm_va_block_t *va_block, bool is_flush)
 {
@@ -905,7 +1379,8 @@ uvm_nvmgpu_write_begin(uvm_va_block_t *va_block, bool is_flush)
 	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_block->va_range->node.nvmgpu_rtn;
 
 	// Calculate the file offset based on the block start address.
-	loff_t	file_start_offset = va_block->start - va_block->va_range->node.start;
+	loff_t	file_start_offset = uvm_nvmgpu_block_file_start(va_block);
+	loff_t	file_end = uvm_nvmgpu_file_end(nvmgpu_rtn);
 	loff_t	file_position;
 
 	struct file	*nvmgpu_file = nvmgpu_rtn->filp;
@@ -918,11 +1393,23 @@ uvm_nvmgpu_write_begin(uvm_va_block_t *va_block, bool is_flush)
 	void	*fsdata;
 
 	uvm_va_space_t	*va_space;
+	uvm_nvmgpu_wb_ctx_t	*wb_ctx;
+	uvm_va_block_test_t	*block_test = uvm_va_block_get_test(va_block);
 
 	UVM_ASSERT(va_block->va_range);
 	UVM_ASSERT(va_block->va_range->va_space);
+	UVM_ASSERT(!va_block->nvmgpu_wb_ctx);
 	va_space = va_block->va_range->va_space;
 
+	wb_ctx = uvm_nvmgpu_wb_ctx_alloc();
+	if (!wb_ctx)
+		return NV_ERR_NO_MEMORY;
+	va_block->nvmgpu_wb_ctx = wb_ctx;
+
+	// An older eviction of this range must not land on top of newer data.
+	uvm_nvmgpu_wb_wait_range(&va_space->nvmgpu_va_space, nvmgpu_file,
+				 file_start_offset, file_start_offset + uvm_va_block_size(va_block));
+
 	inode_lock(f_inode);
 
 	current->backing_dev_info = inode_to_bdi(m_inode);
@@ -931,26 +1418,47 @@ uvm_nvmgpu_write_begin(uvm_va_block_t *va_block, bool is_flush)
 
 	file_update_time(nvmgpu_file);
 
+	// Begin every page before touching the block, so that a failure leaves
+	// the block exactly as it was.
 	for_each_va_block_page(page_id, va_block) {
-		uvm_gpu_id_t id;
 		long f_status = 0;
 
 		file_position = file_start_offset + page_id * PAGE_SIZE;
 
-		if (file_position >= nvmgpu_rtn->size)
+		if (file_position >= file_end)
 			break;
 
-		f_status = a_ops->write_begin(nvmgpu_file, mapping, file_position,
-					      MIN(PAGE_SIZE, nvmgpu_rtn->size - file_position), 0, &page, &fsdata);
-        
-		if (f_status != 0 || page == NULL)
-			continue;
+		page = NULL;
+		if (block_test && block_test->inject_nvmgpu_write_begin_error
+		    && (page_id + 1 == uvm_va_block_num_cpu_pages(va_block)
+			|| file_position + PAGE_SIZE >= file_end)) {
+			// Fail the last page, after all the others have begun.
+			block_test->inject_nvmgpu_write_begin_error = false;
+			f_status = -ENOSPC;
+		}
+		else {
+			f_status = a_ops->write_begin(nvmgpu_file, mapping, file_position,
+						      MIN(PAGE_SIZE, file_end - file_position), 0, &page, &fsdata);
+		}
+		if (f_status != 0 || page == NULL) {
+			status = f_status != 0 ? errno_to_nv_status(f_status) : NV_ERR_NO_MEMORY;
+			goto error;
+		}
+
+		wb_ctx->pages[page_id] = page;
+		wb_ctx->fsdata[page_id] = fsdata;
+		uvm_page_mask_set(&wb_ctx->began, page_id);
+	}
+
+	// Then swap the page cache pages in for the block's CPU pages.
+	for_each_va_block_page_in_mask(page_id, &wb_ctx->began, va_block) {
+		uvm_gpu_id_t id;
+
+		page = wb_ctx->pages[page_id];
 
 		if (mapping_writably_mapped(mapping))
 			flush_dcache_page(page);
 
-		fsdata_array[page_id] = fsdata;
-
 		if (va_block->cpu.pages[page_id] != NULL)
 			uvm_nvmgpu_unmap_page(va_block, page_id);
 
@@ -990,6 +1498,25 @@ uvm_nvmgpu_write_begin(uvm_va_block_t *va_block, bool is_flush)
 		uvm_page_mask_set(&va_block->cpu.pagecached, page_id);
 	}
 
+	return NV_OK;
+
+error:
+	// The block has not been touched yet. The pages begun so far are
+	// released without being dirtied, and the caller sees the failure.
+	for_each_va_block_page_in_mask(page_id, &wb_ctx->began, va_block) {
+		file_position = file_start_offset + page_id * PAGE_SIZE;
+		a_ops->write_end(nvmgpu_file, mapping, file_position,
+				 MIN(PAGE_SIZE, file_end - file_position), 0,
+				 wb_ctx->pages[page_id], wb_ctx->fsdata[page_id]);
+	}
+
+	va_block->nvmgpu_wb_ctx = NULL;
+	uvm_nvmgpu_wb_ctx_free(wb_ctx);
+
+	current->backing_dev_info = NULL;
+
+	inode_unlock(f_inode);
+
 	return status;
 }
 
@@ -1006,30 +1533,34 @@ uvm_nvmgpu_write_end(uvm_va_block_t *va_block, bool is_flush)
 
 	int	page_id;
 
-	loff_t	file_start_offset = va_block->start - va_block->va_range->node.start;
+	loff_t	file_start_offset = uvm_nvmgpu_block_file_start(va_block);
+	loff_t	file_end = uvm_nvmgpu_file_end(nvmgpu_rtn);
 	loff_t	file_position;
 
-	for_each_va_block_page(page_id, va_block) {
+	uvm_nvmgpu_wb_ctx_t	*wb_ctx = va_block->nvmgpu_wb_ctx;
+
+	UVM_ASSERT(wb_ctx);
+
+	// Only pages handed out by write_begin are locked and own fsdata.
+	for_each_va_block_page_in_mask(page_id, &wb_ctx->began, va_block) {
 		struct page *page = va_block->cpu.pages[page_id];
-		void *fsdata = fsdata_array[page_id];
+		size_t bytes;
 
 		file_position = file_start_offset + page_id * PAGE_SIZE;
+		bytes = MIN(PAGE_SIZE, file_end - file_position);
 
-		if (file_position >= nvmgpu_rtn->size)
-			break;
-
-		if (page) {
-			size_t bytes = MIN(PAGE_SIZE, nvmgpu_rtn->size - file_position);
-			flush_dcache_page(page);
-			mark_page_accessed(page);
+		flush_dcache_page(page);
+		mark_page_accessed(page);
 
-			a_ops->write_end(nvmgpu_file, mapping, file_position, bytes, 
-					 bytes, page, fsdata);
+		a_ops->write_end(nvmgpu_file, mapping, file_position, bytes,
+				 bytes, page, wb_ctx->fsdata[page_id]);
 
-			balance_dirty_pages_ratelimited(mapping);
-		}
+		balance_dirty_pages_ratelimited(mapping);
 	}
 
+	va_block->nvmgpu_wb_ctx = NULL;
+	uvm_nvmgpu_wb_ctx_free(wb_ctx);
+
 	uvm_nvmgpu_block_set_has_data(va_block);
 	uvm_nvmgpu_block_set_file_dirty(va_block);
 
@@ -1040,61 +1571,263 @@ uvm_nvmgpu_write_end(uvm_va_block_t *va_block, bool is_flush)
 	return status;
 }
 
+/**
+ * Scale the number of blocks trashed per pass with the measured latency of
+ * the last pass. A pass holds the va_space lock for writing, so the batch is
+ * halved when it takes longer than UVM_NVMGPU_TRASH_TARGET_LATENCY_NS and
+ * doubled when a full batch was cheap but did not relieve the pressure.
+ *
+ * @param nvmgpu_va_space: the va_space information related to NVMGPU.
+ * @param nr_reclaimed: number of blocks reclaimed by the last pass.
+ * @param elapsed_ns: duration of the last pass.
+ */
+static void
+adapt_trash_nr_blocks(uvm_nvmgpu_va_space_t *nvmgpu_va_space, unsigned long nr_reclaimed, u64 elapsed_ns)
+{
+	unsigned long	cur = READ_ONCE(nvmgpu_va_space->trash_cur_nr_blocks);
+
+	if (nr_reclaimed == 0)
+		return;
+
+	if (elapsed_ns > UVM_NVMGPU_TRASH_TARGET_LATENCY_NS)
+		cur = max(cur / 2, 1UL);
+	else if (nr_reclaimed >= cur && elapsed_ns < UVM_NVMGPU_TRASH_TARGET_LATENCY_NS / 2
+		 && uvm_nvmgpu_has_to_reclaim_blocks(nvmgpu_va_space))
+		cur = min(cur * 2, (unsigned long)UVM_NVMGPU_TRASH_MAX_NR_BLOCKS);
+
+	WRITE_ONCE(nvmgpu_va_space->trash_cur_nr_blocks, cur);
+}
+
+/**
+ * Pick up to `max_victims` eviction candidates by sweeping the LRU like a
+ * CLOCK hand. Every visited block is rotated to the tail: referenced ones
+ * lose their bit and get a second chance, blocks with a copy on a GPU are
+ * skipped, and the rest are returned with a reference held.
+ *
+ * @param nvmgpu_va_space: the va_space information related to NVMGPU.
+ * @param victims: receives the candidates.
+ * @param max_victims: capacity of `victims`.
+ * @param budget: number of blocks the sweep may still visit in this pass.
+ * It is decremented by the number of blocks visited.
+ *
+ * @return: the number of candidates.
+ */
+static unsigned int
+lru_sweep(uvm_nvmgpu_va_space_t *nvmgpu_va_space, uvm_va_block_t **victims, unsigned int max_victims, unsigned long *budget)
+{
+	unsigned int	nr_victims = 0;
+	uvm_va_block_t	*va_block;
+
+	uvm_mutex_lock(&nvmgpu_va_space->lock_blocks);
+
+	while (nr_victims < max_victims && *budget > 0 && !list_empty(&nvmgpu_va_space->lru_head)) {
+		va_block = list_first_entry(&nvmgpu_va_space->lru_head, uvm_va_block_t, nvmgpu_lru);
+		list_move_tail(&va_block->nvmgpu_lru, &nvmgpu_va_space->lru_head);
+		--*budget;
+
+		if (uvm_nvmgpu_block_test_and_clear_referenced(va_block))
+			continue;
+
+		// We cannot trash out blocks that have a copy on GPU.
+		if (uvm_processor_mask_get_gpu_count(&va_block->resident) > 0)
+			continue;
+
+		uvm_va_block_retain(va_block);
+		victims[nr_victims++] = va_block;
+	}
+
+	uvm_mutex_unlock(&nvmgpu_va_space->lock_blocks);
+
+	return nr_victims;
+}
+
+/**
+ * Check whether any processor other than a UVM-Lite GPU may write to the
+ * block without faulting first.
+ *
+ * @param va_block: va_block to be checked. Its lock or the va_space lock in
+ * write mode must be held.
+ *
+ * @return: true if some page of the block is mapped writable.
+ */
+static bool
+block_write_mapped(uvm_va_block_t *va_block)
+{
+	uvm_gpu_id_t	id;
+
+	if (!uvm_page_mask_empty(&va_block->cpu.pte_bits[UVM_PTE_BITS_CPU_WRITE]))
+		return true;
+
+	for_each_gpu_id(id) {
+		uvm_va_block_gpu_state_t	*gpu_state = va_block->gpus[uvm_id_gpu_index(id)];
+
+		if (!gpu_state || uvm_processor_mask_test(&va_block->va_range->uvm_lite_gpus, id))
+			continue;
+		if (!uvm_page_mask_empty(&gpu_state->pte_bits[UVM_PTE_BITS_GPU_WRITE]))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Write-protect a block and write its data back to the file.
+ *
+ * Write permission is revoked before the writeback, so a write that lands
+ * after this point has to fault and map the block writable again, which the
+ * caller detects with block_write_mapped() before releasing the block.
+ *
+ * @param va_space: va_space that governs this operation.
+ * @param va_block: the block to be written back. Its lock must be held.
+ * @param block_context: scratch context for the revocation.
+ *
+ * @return: NV_OK on success, NV_ERR_* otherwise.
+ */
+static NV_STATUS
+write_protect_and_flush_block(uvm_va_space_t *va_space, uvm_va_block_t *va_block, uvm_va_block_context_t *block_context)
+{
+	NV_STATUS	status;
+	uvm_processor_mask_t	revoke_processors;
+
+	// UVM-Lite GPUs keep their mappings, as everywhere else.
+	uvm_processor_mask_andnot(&revoke_processors, &va_block->mapped, &va_block->va_range->uvm_lite_gpus);
+
+	status = UVM_VA_BLOCK_RETRY_LOCKED(va_block, NULL,
+					   uvm_va_block_revoke_prot_mask(va_block, block_context, &revoke_processors,
+									 uvm_va_block_region_from_block(va_block),
+									 NULL, UVM_PROT_READ_WRITE));
+	if (status == NV_OK)
+		status = uvm_tracker_wait(&va_block->tracker);
+	if (status != NV_OK)
+		return status;
+
+	return uvm_nvmgpu_flush_host_block(va_space, va_block->va_range, va_block, true, NULL);
+}
+
 /**
  * Automatically reduce memory usage if we need to.
- * 
+ *
+ * Candidates are chosen under lock_blocks and written back under the
+ * va_space lock in read mode, so faults keep being serviced during the file
+ * I/O. The write lock is only taken to release the blocks that were not
+ * touched, written or moved to a GPU in the meantime. Blocks are
+ * write-protected before their writeback, so a write in between shows up as
+ * a writable mapping again, even if it did not go through a migration that
+ * sets the referenced bit.
+ *
  * @param va_space: va_space that governs this operation.
- * @param force: if true, we will evict some blocks without checking for the memory pressure.
  *
  * @return: NV_OK on success, NV_ERR_* otherwise.
  */
 NV_STATUS
 uvm_nvmgpu_reduce_memory_consumption(uvm_va_space_t *va_space)
 {
-	/*
-	 * TODO: locking assertion failed. write lock is required.
-	 */
 	NV_STATUS	status = NV_OK;
 
 	uvm_nvmgpu_va_space_t	*nvmgpu_va_space = &va_space->nvmgpu_va_space;
 
 	unsigned long	counter = 0;
+	unsigned long	nr_blocks;
+	unsigned long	budget;
+	bool	adaptive = READ_ONCE(nvmgpu_va_space->trash_adaptive);
+	ktime_t	started;
+	u64	elapsed_ns;
+
+	uvm_va_block_t	*victims[UVM_NVMGPU_RECLAIM_BATCH];
+	unsigned int	nr_victims, i;
+	uvm_va_block_context_t	*block_context;
+
+	block_context = uvm_va_block_context_alloc();
+	if (!block_context)
+		return NV_ERR_NO_MEMORY;
+
+	if (adaptive)
+		nr_blocks = READ_ONCE(nvmgpu_va_space->trash_cur_nr_blocks);
+	else
+		nr_blocks = READ_ONCE(nvmgpu_va_space->trash_nr_blocks);
 
-	uvm_va_block_t	*va_block;
-	struct list_head *lp, *next;
+	started = ktime_get();
 
-	uvm_va_space_down_write(va_space);
-	// Reclaim blocks based on least recent transfer.
+	// Visit every block at most once per pass.
+	budget = READ_ONCE(nvmgpu_va_space->lru_nr_blocks);
 
-	list_for_each_safe(lp, next, &nvmgpu_va_space->lru_head) {
-		if (counter >= nvmgpu_va_space->trash_nr_blocks)
-			break;
-		va_block = list_entry(lp, uvm_va_block_t, nvmgpu_lru);
+	while (counter < nr_blocks && budget > 0) {
+		uvm_va_space_down_read(va_space);
 
-		// Terminate the loop since we cannot trash out blocks that have a copy on GPU
-		if (uvm_processor_mask_get_gpu_count(&(va_block->resident)) > 0) {
-			//printk(KERN_DEBUG "Encounter a block whose data are in GPU!!!\n");
-			continue;
+		nr_victims = lru_sweep(nvmgpu_va_space, victims, min_t(unsigned long, nr_blocks - counter, UVM_NVMGPU_RECLAIM_BATCH), &budget);
+		if (nr_victims == 0) {
+			uvm_va_space_up_read(va_space);
+			break;
 		}
-		// Evict the block if it is on CPU only and this `va_range` has the write flag.
-		if (uvm_processor_mask_get_count(&(va_block->resident)) > 0 && va_block->va_range->node.nvmgpu_rtn.flags & UVM_NVMGPU_FLAG_WRITE) {
-			status = uvm_nvmgpu_flush_host_block(va_block->va_range->va_space, va_block->va_range, va_block, true, NULL);
-			if (status != NV_OK) {
+
+		// Evict the blocks that are on CPU only and whose `va_range` has the write flag.
+		for (i = 0; i < nr_victims; ++i) {
+			uvm_va_block_t	*va_block = victims[i];
+			NV_STATUS	flush_status = NV_OK;
+
+			uvm_mutex_lock(&va_block->lock);
+			if (va_block->va_range
+			    && uvm_processor_mask_get_gpu_count(&va_block->resident) == 0
+			    && uvm_processor_mask_get_count(&va_block->resident) > 0
+			    && (va_block->va_range->node.nvmgpu_rtn.flags & UVM_NVMGPU_FLAG_WRITE)) {
+				flush_status = write_protect_and_flush_block(va_space, va_block, block_context);
+			}
+			uvm_mutex_unlock(&va_block->lock);
+
+			if (flush_status != NV_OK) {
 				printk(KERN_DEBUG "Cannot evict block\n");
-				continue;
+				status = flush_status;
+				// Keep it out of the release below.
+				uvm_va_block_release(va_block);
+				victims[i] = NULL;
 			}
 		}
 
-		uvm_mutex_lock(&nvmgpu_va_space->lock_blocks);
-		// Remove this block from the list and release it.
-		list_del_init(&va_block->nvmgpu_lru);
-		uvm_mutex_unlock(&nvmgpu_va_space->lock_blocks);
+		uvm_va_space_up_read(va_space);
+
+		uvm_va_space_down_write(va_space);
+		for (i = 0; i < nr_victims; ++i) {
+			uvm_va_block_t	*va_block = victims[i];
 
-		uvm_nvmgpu_release_block(va_block);
-		++counter;
+			if (!va_block)
+				continue;
+
+			// The va_range may have been unregistered or destroyed, or the
+			// block touched or written again, while the va_space was
+			// unlocked. Either of the former takes the block off the LRU.
+			if (!va_block->va_range || list_empty(&va_block->nvmgpu_lru)
+			    || uvm_processor_mask_get_gpu_count(&va_block->resident) > 0
+			    || uvm_nvmgpu_block_referenced(va_block))
+				continue;
+
+			// Data written after the writeback would be lost.
+			if ((va_block->va_range->node.nvmgpu_rtn.flags & UVM_NVMGPU_FLAG_WRITE)
+			    && block_write_mapped(va_block))
+				continue;
+
+			uvm_nvmgpu_lru_del(va_block);
+			uvm_nvmgpu_release_block(va_block);
+			++counter;
+		}
+		uvm_va_space_up_write(va_space);
+
+		for (i = 0; i < nr_victims; ++i)
+			uvm_va_block_release(victims[i]);
 	}
 
-	uvm_va_space_up_write(va_space);
+	uvm_va_block_context_free(block_context);
+
+	elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), started));
+
+	atomic64_inc(&nvmgpu_va_space->reducer_nr_passes);
+	atomic64_add(counter, &nvmgpu_va_space->reducer_nr_reclaimed);
+	atomic64_add(elapsed_ns, &nvmgpu_va_space->reducer_reclaim_ns);
+	// Only the reducer runs passes, so there is no concurrent update to lose.
+	if (elapsed_ns > atomic64_read(&nvmgpu_va_space->reducer_max_reclaim_ns))
+		atomic64_set(&nvmgpu_va_space->reducer_max_reclaim_ns, elapsed_ns);
+
+	if (adaptive)
+		adapt_trash_nr_blocks(nvmgpu_va_space, counter, elapsed_ns);
 
 	return status;
 }
@@ -1117,34 +1850,48 @@ uvm_nvmgpu_flush_host_block(uvm_va_space_t *va_space, uvm_va_range_t *va_range,
 {
 	NV_STATUS	status = NV_OK;
 
+	uvm_nvmgpu_va_space_t	*nvmgpu_va_space = &va_space->nvmgpu_va_space;
 	struct file	*nvmgpu_file = va_range->node.nvmgpu_rtn.filp;
 	mm_segment_t	fs;
 
 	int	page_id, prev_page_id;
 
 	// Compute the file start offset based on `va_block`.
-	loff_t	file_start_offset = va_block->start - va_range->node.start;
+	loff_t	file_start_offset = uvm_nvmgpu_block_file_start(va_block);
+	loff_t	file_end = uvm_nvmgpu_file_end(&va_range->node.nvmgpu_rtn);
 	loff_t	offset;
 
-	struct kiocb	kiocb;
-	struct iovec	*iov = va_range->node.nvmgpu_rtn.iov;
-	struct iov_iter	iter;
+	// Several flushes of one range may run at a time under the read lock.
+	struct iovec	*iov;
 	unsigned int	iov_index = 0;
-	ssize_t	_ret;
+	size_t	iov_bytes = 0;
 
 	void	*page_addr;
 
-	uvm_va_block_region_t	region = uvm_va_block_region(0, (va_block->end - va_block->start + 1) / PAGE_SIZE);
+	// Never write past the mapped window, which may be followed by other data.
+	uvm_page_index_t	outer = max_t(loff_t, 0, min_t(loff_t, (va_block->end - va_block->start + 1) / PAGE_SIZE,
+							      (file_end - file_start_offset + PAGE_SIZE - 1) >> PAGE_SHIFT));
+	uvm_va_block_region_t	region = uvm_va_block_region(0, outer);
 
 	uvm_page_mask_t	mask;
 
+	// Evicted blocks are released right after this returns, so their runs
+	// can be written in the background while they hold the pages.
+	bool	async = is_evict && nvmgpu_va_space->wb_q_started;
+
 	UVM_ASSERT(nvmgpu_file != NULL);
 
+	iov = uvm_kvmalloc(sizeof(*iov) * PAGES_PER_UVM_VA_BLOCK);
+	if (!iov)
+		return NV_ERR_NO_MEMORY;
+
 	if (!page_mask)
 		uvm_page_mask_fill(&mask);
 	else
 		uvm_page_mask_copy(&mask, page_mask);
 
+	uvm_nvmgpu_wb_wait_range(nvmgpu_va_space, nvmgpu_file, file_start_offset, file_start_offset + outer * PAGE_SIZE);
+
 	// Switch the filesystem space to kernel space.
 	fs = get_fs();
 	set_fs(KERNEL_DS);
@@ -1153,35 +1900,34 @@ uvm_nvmgpu_flush_host_block(uvm_va_space_t *va_space, uvm_va_range_t *va_range,
 	prev_page_id = -2;
 	offset = file_start_offset;
 	for_each_va_block_page_in_region_mask(page_id, &mask, region) {
+		loff_t	page_position = file_start_offset + page_id * PAGE_SIZE;
+
 		if (!va_block->cpu.pages[page_id])
 			continue;
 
 		page_addr = page_address(va_block->cpu.pages[page_id]);
 
-		// Perform asynchronous write.
+		// Write out the run that just ended.
 		if (page_id - 1 != prev_page_id && iov_index > 0) {
-			init_sync_kiocb(&kiocb, nvmgpu_file);
-			kiocb.ki_pos = offset;
-			iov_iter_init(&iter, WRITE, iov, iov_index, iov_index * PAGE_SIZE);
-			_ret = call_write_iter(nvmgpu_file, &kiocb, &iter);
-			BUG_ON(_ret == -EIOCBQUEUED);
+			if (!async || wb_submit_run(nvmgpu_va_space, nvmgpu_file, iov, iov_index, iov_bytes, offset) != NV_OK)
+				write_run_sync(nvmgpu_file, iov, iov_index, iov_bytes, offset);
 
 			iov_index = 0;
-			offset = file_start_offset + page_id * PAGE_SIZE;
+			iov_bytes = 0;
 		}
+		if (iov_index == 0)
+			offset = page_position;
 		iov[iov_index].iov_base = page_addr;
-		iov[iov_index].iov_len = PAGE_SIZE;
+		iov[iov_index].iov_len = MIN(PAGE_SIZE, file_end - page_position);
+		iov_bytes += iov[iov_index].iov_len;
 		++iov_index;
 		prev_page_id = page_id;
 	}
 
-	// Start asynchronous write.
+	// Write out the last run.
 	if (iov_index > 0) {
-		init_sync_kiocb(&kiocb, nvmgpu_file);
-		kiocb.ki_pos = offset;
-		iov_iter_init(&iter, WRITE, iov, iov_index, iov_index * PAGE_SIZE);
-		_ret = call_write_iter(nvmgpu_file, &kiocb, &iter);
-		BUG_ON(_ret == -EIOCBQUEUED);
+		if (!async || wb_submit_run(nvmgpu_va_space, nvmgpu_file, iov, iov_index, iov_bytes, offset) != NV_OK)
+			write_run_sync(nvmgpu_file, iov, iov_index, iov_bytes, offset);
 	}
 
 	// Mark that this block has dirty data on the file.
@@ -1190,6 +1936,8 @@ uvm_nvmgpu_flush_host_block(uvm_va_space_t *va_space, uvm_va_range_t *va_range,
 	// Switch back to the original space.
 	set_fs(fs);
 
+	uvm_kvfree(iov);
+
 	return status;
 }
 
@@ -12,12 +12,65 @@
 #define UVM_NVMGPU_FLAG_VOLATILE    0x10
 #define UVM_NVMGPU_FLAG_USEHOSTBUF  0x20
 
+// Flags for uvm_nvmgpu_initialize
+#define UVM_NVMGPU_INIT_ENABLE_READ_CACHE   0x01
+#define UVM_NVMGPU_INIT_ENABLE_LAZY_WRITE   0x02
+#define UVM_NVMGPU_INIT_ENABLE_AIO_READ     0x04
+#define UVM_NVMGPU_INIT_ENABLE_AIO_WRITE    0x08
+#define UVM_NVMGPU_INIT_ADAPTIVE_TRASH      0x10
+
+// Flags for uvm_nvmgpu_set_trash
+#define UVM_NVMGPU_TRASH_SET_NR_BLOCKS          0x01
+#define UVM_NVMGPU_TRASH_SET_RESERVED_NR_PAGES  0x02
+#define UVM_NVMGPU_TRASH_ENABLE_ADAPTIVE        0x04
+#define UVM_NVMGPU_TRASH_DISABLE_ADAPTIVE       0x08
+
+// In adaptive mode, a reclaim pass that holds the va_space lock longer than
+// this shrinks the batch. Passes well below it grow the batch under pressure.
+#define UVM_NVMGPU_TRASH_TARGET_LATENCY_NS  (10 * NSEC_PER_MSEC)
+#define UVM_NVMGPU_TRASH_MAX_NR_BLOCKS      4096
+
+// Blocks the reducer writes back under one va_space read lock before taking
+// the write lock to release them.
+#define UVM_NVMGPU_RECLAIM_BATCH            32
+
+// Eviction writes allowed in flight per va_space with asynchronous writeback.
+// Each covers one contiguous run, which is a whole block in the common case.
+#define UVM_NVMGPU_WB_MAX_INFLIGHT          32
+
+// Why the page-cache reducer was woken up. A watermark kick only reclaims
+// while free plus page-cache pages stay below trash_reserved_nr_pages; a
+// shrinker kick runs at least one pass because the kernel is already
+// reclaiming on our behalf.
+#define UVM_NVMGPU_REDUCER_KICK_WATERMARK   0x01
+#define UVM_NVMGPU_REDUCER_KICK_SHRINKER    0x02
+
+/**
+ * Per-page state a filesystem hands from write_begin to write_end. One is
+ * taken from a slab pool for every block being written back, so blocks of
+ * different files no longer share a single global array.
+ */
+struct uvm_nvmgpu_wb_ctx_struct {
+	// Pages whose write_begin succeeded and still need write_end.
+	uvm_page_mask_t	began;
+	struct page	*pages[PAGES_PER_UVM_VA_BLOCK];
+	void	*fsdata[PAGES_PER_UVM_VA_BLOCK];
+};
+
+NV_STATUS uvm_nvmgpu_global_init(void);
+void uvm_nvmgpu_global_exit(void);
+
+uvm_nvmgpu_wb_ctx_t *uvm_nvmgpu_wb_ctx_alloc(void);
+void uvm_nvmgpu_wb_ctx_free(uvm_nvmgpu_wb_ctx_t *wb_ctx);
+
 NV_STATUS uvm_nvmgpu_initialize(uvm_va_space_t *va_space,
 				unsigned long trash_nr_blocks,
 				unsigned long trash_reserved_nr_pages,
 				unsigned short flags);
 NV_STATUS uvm_nvmgpu_register_file_va_space(uvm_va_space_t *va_space,
 					    UVM_NVMGPU_REGISTER_FILE_VA_SPACE_PARAMS *params);
+NV_STATUS uvm_nvmgpu_set_trash(uvm_va_space_t *va_space,
+			       UVM_NVMGPU_SET_TRASH_PARAMS *params);
 NV_STATUS uvm_nvmgpu_remap(uvm_va_space_t *va_space,
 			   UVM_NVMGPU_REMAP_PARAMS *params);
 NV_STATUS uvm_nvmgpu_unregister_va_range(uvm_va_range_t *va_range);
@@ -26,8 +79,14 @@ NV_STATUS uvm_nvmgpu_flush_host_block(uvm_va_space_t *va_space,
 				      uvm_va_range_t *va_range,
 				      uvm_va_block_t *va_block, bool is_evict,
 				      const uvm_page_mask_t *page_mask);
+void uvm_nvmgpu_wb_wait_range(uvm_nvmgpu_va_space_t *nvmgpu_va_space,
+			      struct file *filp, loff_t start, loff_t end);
 NV_STATUS uvm_nvmgpu_flush_block(uvm_va_block_t *va_block);
 NV_STATUS uvm_nvmgpu_flush(uvm_va_range_t *va_range);
+NV_STATUS uvm_nvmgpu_flush_range(uvm_va_space_t *va_space,
+				 UVM_NVMGPU_FLUSH_PARAMS *params);
+NV_STATUS uvm_nvmgpu_get_stats(uvm_va_space_t *va_space,
+			       UVM_NVMGPU_GET_STATS_PARAMS *params);
 NV_STATUS uvm_nvmgpu_release_block(uvm_va_block_t *va_block);
 
 NV_STATUS uvm_nvmgpu_read_begin(uvm_va_block_t *va_block,
@@ -73,7 +132,85 @@ uvm_nvmgpu_has_to_reclaim_blocks(uvm_nvmgpu_va_space_t *
 {
 	unsigned long	freeram = global_zone_page_state(NR_FREE_PAGES);
 	unsigned long	pagecacheram = global_zone_page_state(NR_FILE_PAGES);
-	return freeram + pagecacheram < nvmgpu_va_space->trash_reserved_nr_pages;
+	return freeram + pagecacheram < READ_ONCE(nvmgpu_va_space->trash_reserved_nr_pages);
+}
+
+/**
+ * Wake the page-cache reducer of this va_space up.
+ * Only the first kick since the reducer last woke issues a wakeup, so this
+ * is cheap enough to be called from the fault path.
+ *
+ * @param nvmgpu_va_space: the va_space information related to NVMGPU.
+ * @param reason: UVM_NVMGPU_REDUCER_KICK_*.
+ */
+static inline void
+uvm_nvmgpu_kick_reducer(uvm_nvmgpu_va_space_t *nvmgpu_va_space, int reason)
+{
+	if (!nvmgpu_va_space->is_initailized)
+		return;
+
+	if (atomic_fetch_or(reason, &nvmgpu_va_space->reducer_kicked) == 0) {
+		atomic64_inc(&nvmgpu_va_space->reducer_nr_kicks);
+		wake_up(&nvmgpu_va_space->reducer_wq);
+	}
+}
+
+/**
+ * Kick the reducer if the free memory is below the reserved watermark.
+ *
+ * @param nvmgpu_va_space: the va_space information related to NVMGPU.
+ */
+static inline void
+uvm_nvmgpu_check_memory_pressure(uvm_nvmgpu_va_space_t *nvmgpu_va_space)
+{
+	if (uvm_nvmgpu_has_to_reclaim_blocks(nvmgpu_va_space))
+		uvm_nvmgpu_kick_reducer(nvmgpu_va_space, UVM_NVMGPU_REDUCER_KICK_WATERMARK);
+}
+
+/**
+ * Get the file position backing the first byte of this va_block.
+ *
+ * @param va_block: va_block of an nvmgpu-managed va_range.
+ *
+ * @return: the file position.
+ */
+static inline loff_t
+uvm_nvmgpu_block_file_start(uvm_va_block_t *va_block)
+{
+	uvm_va_range_t	*va_range = va_block->va_range;
+
+	return va_range->node.nvmgpu_rtn.file_offset + (va_block->start - va_range->node.start);
+}
+
+/**
+ * Get the end of the file window mapped by this va_range.
+ *
+ * @param nvmgpu_rtn: nvmgpu information of the va_range.
+ *
+ * @return: the file position right after the last mapped byte.
+ */
+static inline loff_t
+uvm_nvmgpu_file_end(uvm_nvmgpu_range_tree_node_t *nvmgpu_rtn)
+{
+	return nvmgpu_rtn->file_offset + nvmgpu_rtn->size;
+}
+
+/**
+ * Get the number of bytes the file can provide for this va_block, bounded
+ * by both the file size and the end of the mapped window.
+ *
+ * @param va_block: va_block of an nvmgpu-managed va_range.
+ *
+ * @return: the number of bytes, which may be zero or negative.
+ */
+static inline loff_t
+uvm_nvmgpu_block_file_remain(uvm_va_block_t *va_block)
+{
+	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_block->va_range->node.nvmgpu_rtn;
+	loff_t	isize = i_size_read(nvmgpu_rtn->filp->f_mapping->host);
+	loff_t	end = min_t(loff_t, isize, uvm_nvmgpu_file_end(nvmgpu_rtn));
+
+	return end - uvm_nvmgpu_block_file_start(va_block);
 }
 
 static inline bool
@@ -181,22 +318,99 @@ uvm_nvmgpu_need_to_evict_from_gpu(uvm_va_block_t *va_block)
 	    || (nvmgpu_rtn->flags & UVM_NVMGPU_FLAG_USEHOSTBUF);
 }
 
+static inline bool
+uvm_nvmgpu_block_referenced(uvm_va_block_t *va_block)
+{
+	uvm_va_range_t	*va_range = va_block->va_range;
+	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
+
+	size_t	index = uvm_va_range_block_index(va_range, va_block->start);
+	size_t	list_index = index / BITS_PER_LONG;
+	size_t	bitmap_index = index % BITS_PER_LONG;
+
+	return test_bit(bitmap_index, &nvmgpu_rtn->referenced_bitmaps[list_index]);
+}
+
+static inline bool
+uvm_nvmgpu_block_test_and_clear_referenced(uvm_va_block_t *va_block)
+{
+	uvm_va_range_t	*va_range = va_block->va_range;
+	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
+
+	size_t	index = uvm_va_range_block_index(va_range, va_block->start);
+	size_t	list_index = index / BITS_PER_LONG;
+	size_t	bitmap_index = index % BITS_PER_LONG;
+
+	return test_and_clear_bit(bitmap_index, &nvmgpu_rtn->referenced_bitmaps[list_index]);
+}
+
+/**
+ * Put a newly created block at the tail of the LRU.
+ *
+ * @param va_block: va_block of an nvmgpu-managed va_range.
+ */
+static inline void
+uvm_nvmgpu_lru_add(uvm_va_block_t *va_block)
+{
+	uvm_nvmgpu_va_space_t *nvmgpu_va_space = &va_block->va_range->va_space->nvmgpu_va_space;
+
+	uvm_mutex_lock(&nvmgpu_va_space->lock_blocks);
+	if (list_empty(&va_block->nvmgpu_lru)) {
+		list_add_tail(&va_block->nvmgpu_lru, &nvmgpu_va_space->lru_head);
+		++nvmgpu_va_space->lru_nr_blocks;
+	}
+	uvm_mutex_unlock(&nvmgpu_va_space->lock_blocks);
+}
+
+/**
+ * Take a block off the LRU. Harmless if it was never added.
+ *
+ * @param va_block: va_block to be removed.
+ */
+static inline void
+uvm_nvmgpu_lru_del(uvm_va_block_t *va_block)
+{
+	uvm_nvmgpu_va_space_t *nvmgpu_va_space = &va_block->va_range->va_space->nvmgpu_va_space;
+
+	// Blocks of va_spaces without nvmgpu are never added, and lock_blocks
+	// is not even initialized there.
+	if (list_empty(&va_block->nvmgpu_lru))
+		return;
+
+	uvm_mutex_lock(&nvmgpu_va_space->lock_blocks);
+	if (!list_empty(&va_block->nvmgpu_lru)) {
+		list_del_init(&va_block->nvmgpu_lru);
+		--nvmgpu_va_space->lru_nr_blocks;
+	}
+	uvm_mutex_unlock(&nvmgpu_va_space->lock_blocks);
+}
+
 /**
  * Mark that we just touch this block, which has in-buffer data.
+ * This only sets the block's referenced bit, so faults never contend on
+ * the LRU; the reducer gives referenced blocks a second chance.
  *
  * @param va_block: va_block to be marked.
  */
 static inline void
 uvm_nvmgpu_block_mark_recent_in_buffer(uvm_va_block_t *va_block)
 {
-	uvm_nvmgpu_va_space_t *nvmgpu_va_space = &va_block->va_range->va_space->nvmgpu_va_space;
+	uvm_va_range_t	*va_range = va_block->va_range;
+	uvm_nvmgpu_range_tree_node_t	*nvmgpu_rtn = &va_range->node.nvmgpu_rtn;
+
+	size_t	index = uvm_va_range_block_index(va_range, va_block->start);
+	size_t	list_index = index / BITS_PER_LONG;
+	size_t	bitmap_index = index % BITS_PER_LONG;
+
+	if (!nvmgpu_rtn->referenced_bitmaps)
+		return;
+
+	// Avoid dirtying the shared cache line when the bit is already set.
+	if (!test_bit(bitmap_index, &nvmgpu_rtn->referenced_bitmaps[list_index]))
+		set_bit(bitmap_index, &nvmgpu_rtn->referenced_bitmaps[list_index]);
 
-	// Move this block to the tail of the LRU list.
-	// mutex locking is commented out. It has been already held.
-        uvm_mutex_lock(&nvmgpu_va_space->lock_blocks);
-	if (!list_empty(&va_block->nvmgpu_lru))
-		list_move_tail(&va_block->nvmgpu_lru, &nvmgpu_va_space->lru_head);
-        uvm_mutex_unlock(&nvmgpu_va_space->lock_blocks);
+	// The block has just been filled, which is when the watermark is crossed.
+	uvm_nvmgpu_check_memory_pressure(&va_range->va_space->nvmgpu_va_space);
 }
 
 #endif
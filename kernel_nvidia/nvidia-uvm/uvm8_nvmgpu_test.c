@@ -0,0 +1,171 @@
+#include "uvm_common.h"
+#include "uvm_linux.h"
+#include "uvm8_nvmgpu.h"
+#include "uvm8_test.h"
+#include "uvm8_va_block.h"
+#include "uvm8_va_space.h"
+
+static NV_STATUS check_wb_ctx_empty(uvm_nvmgpu_wb_ctx_t *wb_ctx)
+{
+    size_t i;
+
+    TEST_CHECK_RET(uvm_page_mask_empty(&wb_ctx->began));
+
+    for (i = 0; i < ARRAY_SIZE(wb_ctx->fsdata); i++) {
+        TEST_CHECK_RET(wb_ctx->pages[i] == NULL);
+        TEST_CHECK_RET(wb_ctx->fsdata[i] == NULL);
+    }
+
+    return NV_OK;
+}
+
+static void fill_wb_ctx(uvm_nvmgpu_wb_ctx_t *wb_ctx)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(wb_ctx->fsdata); i++) {
+        uvm_page_mask_set(&wb_ctx->began, i);
+        wb_ctx->pages[i] = (struct page *)(i + 1);
+        wb_ctx->fsdata[i] = (void *)(i + 1);
+    }
+}
+
+// Two blocks written back at the same time must not see each other's fsdata,
+// which is what happened with the old file-static array.
+static NV_STATUS test_wb_ctx_isolation(void)
+{
+    uvm_nvmgpu_wb_ctx_t *wb_ctx_a;
+    uvm_nvmgpu_wb_ctx_t *wb_ctx_b = NULL;
+    NV_STATUS status = NV_OK;
+    size_t i;
+
+    BUILD_BUG_ON(ARRAY_SIZE(wb_ctx_a->fsdata) != PAGES_PER_UVM_VA_BLOCK);
+
+    wb_ctx_a = uvm_nvmgpu_wb_ctx_alloc();
+    TEST_CHECK_RET(wb_ctx_a != NULL);
+
+    wb_ctx_b = uvm_nvmgpu_wb_ctx_alloc();
+    TEST_CHECK_GOTO(wb_ctx_b != NULL, done);
+    TEST_CHECK_GOTO(wb_ctx_a != wb_ctx_b, done);
+
+    TEST_NV_CHECK_GOTO(check_wb_ctx_empty(wb_ctx_a), done);
+    TEST_NV_CHECK_GOTO(check_wb_ctx_empty(wb_ctx_b), done);
+
+    fill_wb_ctx(wb_ctx_a);
+    TEST_NV_CHECK_GOTO(check_wb_ctx_empty(wb_ctx_b), done);
+
+    fill_wb_ctx(wb_ctx_b);
+    for (i = 0; i < ARRAY_SIZE(wb_ctx_a->fsdata); i++) {
+        TEST_CHECK_GOTO(uvm_page_mask_test(&wb_ctx_a->began, i), done);
+        TEST_CHECK_GOTO(wb_ctx_a->fsdata[i] == (void *)(i + 1), done);
+    }
+
+done:
+    uvm_nvmgpu_wb_ctx_free(wb_ctx_b);
+    uvm_nvmgpu_wb_ctx_free(wb_ctx_a);
+
+    return status;
+}
+
+// Contexts come back from the pool dirty, so allocation has to clear them.
+static NV_STATUS test_wb_ctx_reuse(void)
+{
+    uvm_nvmgpu_wb_ctx_t *wb_ctx;
+    NV_STATUS status;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        wb_ctx = uvm_nvmgpu_wb_ctx_alloc();
+        TEST_CHECK_RET(wb_ctx != NULL);
+
+        status = check_wb_ctx_empty(wb_ctx);
+        fill_wb_ctx(wb_ctx);
+        uvm_nvmgpu_wb_ctx_free(wb_ctx);
+
+        if (status != NV_OK)
+            return status;
+    }
+
+    // Freeing nothing is allowed so error paths can stay simple.
+    uvm_nvmgpu_wb_ctx_free(NULL);
+
+    return NV_OK;
+}
+
+NV_STATUS uvm8_test_nvmgpu_wb_ctx(UVM_TEST_NVMGPU_WB_CTX_PARAMS *params, struct file *filp)
+{
+    TEST_NV_CHECK_RET(test_wb_ctx_isolation());
+    TEST_NV_CHECK_RET(test_wb_ctx_reuse());
+
+    return NV_OK;
+}
+
+// A write_begin that fails part way must not have swapped any page of the
+// block for a page cache page, or the block's data would be lost.
+static NV_STATUS test_write_begin_error(uvm_va_block_t *va_block)
+{
+    struct page **old_pages;
+    uvm_page_mask_t *old_pagecached;
+    struct inode *f_inode = file_inode(va_block->va_range->node.nvmgpu_rtn.filp);
+    uvm_va_block_test_t *block_test = uvm_va_block_get_test(va_block);
+    NV_STATUS status = NV_OK;
+    size_t i;
+
+    TEST_CHECK_RET(block_test != NULL);
+
+    old_pages = uvm_kvmalloc(sizeof(va_block->cpu.pages));
+    old_pagecached = uvm_kvmalloc(sizeof(*old_pagecached));
+    if (!old_pages || !old_pagecached) {
+        status = NV_ERR_NO_MEMORY;
+        goto out;
+    }
+
+    memcpy(old_pages, va_block->cpu.pages, sizeof(va_block->cpu.pages));
+    uvm_page_mask_copy(old_pagecached, &va_block->cpu.pagecached);
+
+    block_test->inject_nvmgpu_write_begin_error = true;
+    TEST_CHECK_GOTO(uvm_nvmgpu_write_begin(va_block, false) != NV_OK, out);
+    TEST_CHECK_GOTO(!block_test->inject_nvmgpu_write_begin_error, out);
+
+    for (i = 0; i < PAGES_PER_UVM_VA_BLOCK; i++)
+        TEST_CHECK_GOTO(va_block->cpu.pages[i] == old_pages[i], out);
+    TEST_CHECK_GOTO(bitmap_equal(va_block->cpu.pagecached.bitmap, old_pagecached->bitmap, PAGES_PER_UVM_VA_BLOCK), out);
+    TEST_CHECK_GOTO(va_block->nvmgpu_wb_ctx == NULL, out);
+
+    // The inode must have been unlocked on the way out.
+    TEST_CHECK_GOTO(inode_trylock(f_inode), out);
+    inode_unlock(f_inode);
+
+out:
+    block_test->inject_nvmgpu_write_begin_error = false;
+    uvm_kvfree(old_pagecached);
+    uvm_kvfree(old_pages);
+
+    return status;
+}
+
+NV_STATUS uvm8_test_nvmgpu_write_begin_error(UVM_TEST_NVMGPU_WRITE_BEGIN_ERROR_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    uvm_va_block_t *va_block;
+    NV_STATUS status;
+
+    uvm_va_space_down_read(va_space);
+
+    status = uvm_va_block_find(va_space, params->lookup_address, &va_block);
+    if (status != NV_OK)
+        goto out;
+
+    if (!uvm_nvmgpu_is_managed(va_block->va_range)) {
+        status = NV_ERR_INVALID_ADDRESS;
+        goto out;
+    }
+
+    uvm_mutex_lock(&va_block->lock);
+    status = test_write_begin_error(va_block);
+    uvm_mutex_unlock(&va_block->lock);
+
+out:
+    uvm_va_space_up_read(va_space);
+    return status;
+}
@@ -31,10 +31,13 @@ typedef struct uvm_nvmgpu_range_tree_node_t
 {
     struct file *filp;
     unsigned short flags;
+    // the mapping covers [file_offset, file_offset + size) of the file
+    loff_t file_offset;
     size_t size;
     unsigned long *is_file_dirty_bitmaps;
     unsigned long *has_data_bitmaps;
-    struct iovec *iov;
+    // blocks touched since the reducer last visited them, see uvm_nvmgpu_block_mark_recent_in_buffer
+    unsigned long *referenced_bitmaps;
 } uvm_nvmgpu_range_tree_node_t; 
 
 // Tree-based data structure for looking up and iterating over objects with
@@ -298,6 +298,8 @@ long uvm8_test_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_PMM_RELEASE_FREE_ROOT_CHUNKS, uvm8_test_pmm_release_free_root_chunks);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_DRAIN_REPLAYABLE_FAULTS,      uvm8_test_drain_replayable_faults);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_PMA_GET_BATCH_SIZE,           uvm8_test_pma_get_batch_size);
+        UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_NVMGPU_WB_CTX,                uvm8_test_nvmgpu_wb_ctx);
+        UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_NVMGPU_WRITE_BEGIN_ERROR,     uvm8_test_nvmgpu_write_begin_error);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_PMM_QUERY_PMA_STATS,          uvm8_test_pmm_query_pma_stats);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_NUMA_GET_CLOSEST_CPU_NODE_TO_GPU, uvm8_test_numa_get_closest_cpu_node_to_gpu);
         UVM_ROUTE_CMD_STACK_INIT_CHECK(UVM_TEST_NUMA_CHECK_AFFINITY,          uvm8_test_numa_check_affinity);
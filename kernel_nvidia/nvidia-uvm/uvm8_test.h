@@ -176,6 +176,9 @@ NV_STATUS uvm8_test_va_space_inject_error(UVM_TEST_VA_SPACE_INJECT_ERROR_PARAMS
 
 NV_STATUS uvm8_test_get_gpu_time(UVM_TEST_GET_GPU_TIME_PARAMS *params, struct file *filp);
 
+NV_STATUS uvm8_test_nvmgpu_wb_ctx(UVM_TEST_NVMGPU_WB_CTX_PARAMS *params, struct file *filp);
+NV_STATUS uvm8_test_nvmgpu_write_begin_error(UVM_TEST_NVMGPU_WRITE_BEGIN_ERROR_PARAMS *params, struct file *filp);
+
 NV_STATUS uvm8_test_pmm_release_free_root_chunks(UVM_TEST_PMM_RELEASE_FREE_ROOT_CHUNKS_PARAMS *params, struct file *filp);
 
 NV_STATUS uvm8_test_drain_replayable_faults(UVM_TEST_DRAIN_REPLAYABLE_FAULTS_PARAMS *params, struct file *filp);
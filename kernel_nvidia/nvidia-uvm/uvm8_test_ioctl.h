@@ -1282,6 +1282,22 @@ typedef struct
     NV_STATUS                       rmStatus;                                           // Out
 } UVM_TEST_GET_PAGEABLE_MEM_ACCESS_TYPE_PARAMS;
 
+#define UVM_TEST_NVMGPU_WB_CTX                          UVM8_TEST_IOCTL_BASE(84)
+typedef struct
+{
+    NV_STATUS rmStatus; // Out
+} UVM_TEST_NVMGPU_WB_CTX_PARAMS;
+
+// Make uvm_nvmgpu_write_begin fail on the last page of the block containing
+// lookup_address, and check that the block is left as it was. The address must
+// be in a range registered with nvmgpu.
+#define UVM_TEST_NVMGPU_WRITE_BEGIN_ERROR               UVM8_TEST_IOCTL_BASE(85)
+typedef struct
+{
+    NvU64     lookup_address NV_ALIGN_BYTES(8); // In
+    NV_STATUS rmStatus;                         // Out
+} UVM_TEST_NVMGPU_WRITE_BEGIN_ERROR_PARAMS;
+
 #ifdef __cplusplus
 }
 #endif
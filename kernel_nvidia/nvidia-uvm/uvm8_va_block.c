@@ -525,6 +525,7 @@ NV_STATUS uvm_va_block_create(uvm_va_range_t *va_range,
     block->end = end;
     block->va_range = va_range;
     uvm_tracker_init(&block->tracker);
+    INIT_LIST_HEAD(&block->nvmgpu_lru);
 
     nv_kthread_q_item_init(&block->eviction_mappings_q_item, block_deferred_eviction_mappings_entry, block);
 
@@ -870,7 +871,6 @@ assign_page(uvm_va_block_t *block, bool zero)
 
 static inline bool nvmgpu_is_pagecachable(uvm_va_block_t *block, uvm_page_index_t page_id)
 {
-    struct inode *inode;
     uvm_page_index_t	outer_max;
     loff_t len_remain;
 
@@ -878,8 +878,9 @@ static inline bool nvmgpu_is_pagecachable(uvm_va_block_t *block, uvm_page_index_
         return false;
     if (block->va_range->node.nvmgpu_rtn.flags & (UVM_NVMGPU_FLAG_VOLATILE | UVM_NVMGPU_FLAG_USEHOSTBUF))
         return false;
-    inode = block->va_range->node.nvmgpu_rtn.filp->f_mapping->host;
-    len_remain = i_size_read(inode) - (block->start - block->va_range->node.start);
+    len_remain = uvm_nvmgpu_block_file_remain(block);
+    if (len_remain <= 0)
+        return false;
     outer_max = (len_remain + PAGE_SIZE - 1) >> PAGE_SHIFT;
     if (page_id >= outer_max)
         return false;
@@ -923,8 +924,12 @@ static NV_STATUS block_populate_page_cpu(uvm_va_block_t *block, uvm_page_index_t
 		uvm_page_mask_clear(&block->cpu.pagecached, page_index);
     }
 
-    if (page == NULL)
+    if (page == NULL) {
+        // Let the reducer give back page cache held by evictable blocks.
+        if (uvm_nvmgpu_is_managed(block->va_range))
+            uvm_nvmgpu_kick_reducer(&block->va_range->va_space->nvmgpu_va_space, UVM_NVMGPU_REDUCER_KICK_SHRINKER);
         return NV_ERR_NO_MEMORY;
+    }
 
     status = block_map_phys_cpu_page_on_gpus(block, page_index, page);
     if (status != NV_OK)
@@ -3042,13 +3047,17 @@ NV_STATUS uvm_va_block_make_resident(uvm_va_block_t *va_block,
             uvm_nvmgpu_block_mark_recent_in_buffer(va_block);
         }
         else {
-            uvm_nvmgpu_write_begin(va_block, cause == UVM_MAKE_RESIDENT_CAUSE_API_MIGRATE);
+            status = uvm_nvmgpu_write_begin(va_block, cause == UVM_MAKE_RESIDENT_CAUSE_API_MIGRATE);
+            if (status != NV_OK)
+                return status;
             do_nvmgpu_write = true;
         }
     }
     resident_mask = block_resident_mask_get_alloc(va_block, dest_id);
-    if (!resident_mask)
-        return NV_ERR_NO_MEMORY;
+    if (!resident_mask) {
+        status = NV_ERR_NO_MEMORY;
+        goto out;
+    }
 
     // Unmap all mapped processors except for UVM-Lite GPUs as their mappings
     // are largely persistent.
@@ -3062,7 +3071,7 @@ NV_STATUS uvm_va_block_make_resident(uvm_va_block_t *va_block,
     // Unmap all pages not resident on the destination
     status = uvm_va_block_unmap_mask(va_block, va_block_context, &unmap_processor_mask, region, unmap_page_mask);
     if (status != NV_OK)
-        return status;
+        goto out;
 
     if (page_mask)
         uvm_page_mask_and(unmap_page_mask, page_mask, &va_block->read_duplicated_pages);
@@ -3073,7 +3082,7 @@ NV_STATUS uvm_va_block_make_resident(uvm_va_block_t *va_block,
     uvm_processor_mask_clear(&unmap_processor_mask, dest_id);
     status = uvm_va_block_unmap_mask(va_block, va_block_context, &unmap_processor_mask, region, unmap_page_mask);
     if (status != NV_OK)
-        return status;
+        goto out;
 
     uvm_tools_record_read_duplicate_invalidate(va_block,
                                                dest_id,
@@ -3086,7 +3095,7 @@ NV_STATUS uvm_va_block_make_resident(uvm_va_block_t *va_block,
 
     status = block_populate_pages(va_block, va_block_retry, va_block_context, dest_id, region, page_mask);
     if (status != NV_OK)
-        return status;
+        goto out;
 
     status = block_copy_resident_pages(va_block,
                                        va_block_context,
@@ -3096,7 +3105,7 @@ NV_STATUS uvm_va_block_make_resident(uvm_va_block_t *va_block,
                                        prefetch_page_mask,
                                        UVM_VA_BLOCK_TRANSFER_MODE_MOVE);
     if (status != NV_OK)
-        return status;
+        goto out;
 
     // Update eviction heuristics, if needed. Notably this could repeat the call
     // done in block_set_resident_processor(), but that doesn't do anything bad
@@ -3106,14 +3115,18 @@ NV_STATUS uvm_va_block_make_resident(uvm_va_block_t *va_block,
     // empty).
     if (uvm_processor_mask_test(&va_block->resident, dest_id))
         block_mark_memory_used(va_block, dest_id);
+out:
+    // write_begin left the inode and the page cache pages locked, so they
+    // have to be released on every path, including retries.
     if (do_nvmgpu_write) {
-        status = uvm_tracker_wait(&va_block->tracker);
+        NV_STATUS wait_status = uvm_tracker_wait(&va_block->tracker);
+
         uvm_nvmgpu_write_end(va_block, cause == UVM_MAKE_RESIDENT_CAUSE_API_MIGRATE);
-        if (status != NV_OK)
-            return status;
+        if (status == NV_OK)
+            status = wait_status;
     }
 
-    return NV_OK;
+    return status;
 }
 
 // Combination function which prepares the input {region, page_mask} for
@@ -7893,6 +7906,7 @@ void uvm_va_block_destroy(nv_kref_t *nv_kref)
 
     // Nobody else should have a reference when freeing
     uvm_assert_mutex_unlocked(&block->lock);
+    UVM_ASSERT(!block->nvmgpu_wb_ctx);
 
     uvm_mutex_lock(&block->lock);
     block_kill(block);
@@ -9964,8 +9978,12 @@ error:
         uvm_nvmgpu_read_end(va_block);
 
         if (UVM_ID_IS_CPU(processor_id)) {
-            uvm_nvmgpu_write_begin(va_block, false);
-            uvm_nvmgpu_write_end(va_block, false);
+            NV_STATUS write_status = uvm_nvmgpu_write_begin(va_block, false);
+
+            if (write_status == NV_OK)
+                uvm_nvmgpu_write_end(va_block, false);
+            else if (status == NV_OK)
+                status = write_status;
         }
     }
 
@@ -458,6 +458,10 @@ struct uvm_va_block_struct
 
     bool nvmgpu_use_uvm_buffer;
     struct list_head nvmgpu_lru;
+
+    // Writeback state between uvm_nvmgpu_write_begin and
+    // uvm_nvmgpu_write_end. Only valid with the block lock held in between.
+    uvm_nvmgpu_wb_ctx_t *nvmgpu_wb_ctx;
 };
 
 // We define additional per-VA Block fields for testing. When
@@ -494,6 +498,10 @@ struct uvm_va_block_wrapper_struct
         // Force the next successful chunk allocation to then fail. Used for testing
         // only to simulate driver metadata allocation failure.
         bool inject_populate_error;
+
+        // Force the next uvm_nvmgpu_write_begin on this block to fail on its
+        // last page. Used for testing only.
+        bool inject_nvmgpu_write_begin_error;
     } test;
 };
 
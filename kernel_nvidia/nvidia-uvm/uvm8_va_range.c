@@ -30,6 +30,7 @@
 #include "uvm8_kvmalloc.h"
 #include "uvm8_map_external.h"
 #include "uvm8_perf_thrashing.h"
+#include "uvm8_nvmgpu.h"
 #include "nv_uvm_interface.h"
 
 static struct kmem_cache *g_uvm_va_range_cache __read_mostly;
@@ -366,7 +367,7 @@ static void uvm_va_range_destroy_managed(uvm_va_range_t *va_range)
     if (va_range->blocks) {
         // Unmap and drop our ref count on each block
         for_each_va_block_in_va_range_safe(va_range, block, block_tmp) {
-            list_del_init(&block->nvmgpu_lru);
+            uvm_nvmgpu_lru_del(block);
             uvm_va_block_kill(block);
         }
 
@@ -1154,12 +1155,9 @@ NV_STATUS uvm_va_range_block_create(uvm_va_range_t *va_range, size_t index, uvm_
             block = old;
         }
         else {
-            uvm_nvmgpu_va_space_t *nvmgpu_va_space = &va_range->va_space->nvmgpu_va_space;
-            INIT_LIST_HEAD(&block->nvmgpu_lru);
 	    if (va_range->node.nvmgpu_rtn.has_data_bitmaps) {
-                uvm_mutex_lock(&nvmgpu_va_space->lock_blocks);
-                list_move_tail(&block->nvmgpu_lru, &nvmgpu_va_space->lru_head);
-                uvm_mutex_unlock(&nvmgpu_va_space->lock_blocks);
+                uvm_nvmgpu_lru_add(block);
+                uvm_nvmgpu_check_memory_pressure(&va_range->va_space->nvmgpu_va_space);
             }
 	}
     }
@@ -52,6 +52,10 @@ typedef struct uvm_nvmgpu_va_space_t
     unsigned long trash_nr_blocks; 
     // number of pages reserved for the system 
     unsigned long trash_reserved_nr_pages; 
+    // scale the number of blocks trashed at a time with the reclaim latency
+    bool trash_adaptive;
+    // number of blocks trashed at a time while trash_adaptive is set
+    unsigned long trash_cur_nr_blocks;
     // init flags that dictate the optimization behaviors
     unsigned short flags;
 
@@ -59,9 +63,43 @@ typedef struct uvm_nvmgpu_va_space_t
     int fd_pending;
     struct task_struct *reducer;
     uvm_mutex_t lock;
+    // protects lru_head and lru_nr_blocks, never taken on the fault path
     uvm_mutex_t lock_blocks;
 
+    // CLOCK ring of the blocks with host data, oldest first
     struct list_head lru_head;
+    unsigned long lru_nr_blocks;
+
+    // asynchronous eviction writeback, see UVM_NVMGPU_INIT_ENABLE_AIO_WRITE
+    nv_kthread_q_t wb_q;
+    bool wb_q_started;
+    // protects wb_inflight
+    spinlock_t wb_lock;
+    // writes queued or in progress, kept to order later file accesses
+    struct list_head wb_inflight;
+    atomic_t wb_nr_inflight;
+    atomic64_t wb_nr_submitted;
+    atomic64_t wb_nr_completed;
+    // first error since it was last reported, as a negative errno
+    atomic_t wb_error;
+    // woken whenever a write completes
+    wait_queue_head_t wb_done;
+
+    // page-cache reducer wakeups, see uvm_nvmgpu_kick_reducer
+    wait_queue_head_t reducer_wq;
+    // UVM_NVMGPU_REDUCER_KICK_* reasons pending since the reducer last woke
+    atomic_t reducer_kicked;
+    // kicks the reducer whenever the kernel reclaims memory
+    struct shrinker reducer_shrinker;
+    bool reducer_shrinker_registered;
+    atomic64_t reducer_nr_kicks;
+    atomic64_t reducer_nr_shrinker_kicks;
+    atomic64_t reducer_nr_wakeups;
+    atomic64_t reducer_nr_passes;
+    atomic64_t reducer_nr_reclaimed;
+    // time spent in reclaim passes, total and the longest single pass
+    atomic64_t reducer_reclaim_ns;
+    atomic64_t reducer_max_reclaim_ns;
 } uvm_nvmgpu_va_space_t;
 
 // uvm_deferred_free_object provides a mechanism for building and later freeing
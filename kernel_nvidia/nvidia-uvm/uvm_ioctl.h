@@ -1076,10 +1076,24 @@ typedef struct
     int             backing_fd;         // IN
     void            *uvm_addr;          // IN
     size_t          size;               // IN
+    size_t          offset;             // IN
     unsigned short  flags;              // IN
     NV_STATUS       rmStatus;           // OUT
 } UVM_NVMGPU_REGISTER_FILE_VA_SPACE_PARAMS;
 
+//
+// UvmNvmgpuSetTrash
+//
+#define UVM_NVMGPU_SET_TRASH                                          UVM_IOCTL_BASE(1002)
+
+typedef struct
+{
+    unsigned long    trash_nr_blocks;           // IN
+    unsigned long    trash_reserved_nr_pages;   // IN
+    unsigned short   flags;                     // IN
+    NV_STATUS        rmStatus;                  // OUT
+} UVM_NVMGPU_SET_TRASH_PARAMS;
+
 //
 // UvmNvmgpuRemap
 //
@@ -1090,10 +1104,41 @@ typedef struct
     int             backing_fd;         // IN
     void            *uvm_addr;          // IN
     size_t          size;               // IN
+    size_t          offset;             // IN
     unsigned short  flags;              // IN
     NV_STATUS       rmStatus;           // OUT
 } UVM_NVMGPU_REMAP_PARAMS;                          
 
+//
+// UvmNvmgpuFlush
+//
+#define UVM_NVMGPU_FLUSH                                              UVM_IOCTL_BASE(1005)
+
+typedef struct
+{
+    void            *uvm_addr;          // IN
+    size_t          offset;             // IN
+    size_t          length;             // IN
+    NV_STATUS       rmStatus;           // OUT
+} UVM_NVMGPU_FLUSH_PARAMS;
+
+//
+// UvmNvmgpuGetStats
+//
+#define UVM_NVMGPU_GET_STATS                                          UVM_IOCTL_BASE(1006)
+
+typedef struct
+{
+    NvU64           reducer_nr_kicks            NV_ALIGN_BYTES(8); // OUT
+    NvU64           reducer_nr_shrinker_kicks   NV_ALIGN_BYTES(8); // OUT
+    NvU64           reducer_nr_wakeups          NV_ALIGN_BYTES(8); // OUT
+    NvU64           reducer_nr_passes           NV_ALIGN_BYTES(8); // OUT
+    NvU64           reducer_nr_reclaimed        NV_ALIGN_BYTES(8); // OUT
+    NvU64           reducer_reclaim_ns          NV_ALIGN_BYTES(8); // OUT
+    NvU64           reducer_max_reclaim_ns      NV_ALIGN_BYTES(8); // OUT
+    NV_STATUS       rmStatus;                                      // OUT
+} UVM_NVMGPU_GET_STATS_PARAMS;
+
 //
 // Temporary ioctls which should be removed before UVM 8 release
 // Number backwards from 2047 - highest custom ioctl function number
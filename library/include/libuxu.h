@@ -22,16 +22,45 @@ typedef enum {
 	D_ERR_NOT_IMPLEMENTED
 } uxu_err_t;
 
+/* Accumulated I/O of the fallback engine used when NO_DRAGON is set */
+typedef struct {
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	unsigned long long usecs_read;
+	unsigned long long usecs_written;
+} uxu_fallback_stats_t;
+
+/* Page-cache reducer activity of the driver since initialization */
+typedef struct {
+	unsigned long long nr_kicks;		/* wakeups requested by faults or the shrinker */
+	unsigned long long nr_shrinker_kicks;	/* times the kernel reclaimed while blocks were cached */
+	unsigned long long nr_wakeups;
+	unsigned long long nr_passes;
+	unsigned long long nr_reclaimed;	/* blocks evicted */
+	unsigned long long reclaim_ns;
+	unsigned long long max_reclaim_ns;	/* longest single pass */
+} uxu_reducer_stats_t;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
+	/* D_F_CREATE truncates the file to size. */
 	uxu_err_t uxu_map(const char *filename, size_t size, unsigned short flags, void **addr);
+	/* offset must be page aligned. D_F_CREATE creates or extends the file but
+	 * never truncates it, whatever the offset. */
+	uxu_err_t uxu_map_range(const char *filename, size_t offset, size_t size, unsigned short flags, void **addr);
+	/* remap and flush accept any address inside a mapping; offset is relative to addr. */
 	uxu_err_t uxu_remap(void *addr, unsigned short flags);
 	uxu_err_t uxu_trash_set_num_blocks(unsigned long nrblocks);
 	uxu_err_t uxu_trash_set_num_reserved_sys_cache_pages(unsigned long nrpages);
+	uxu_err_t uxu_trash_set_adaptive(int enable);
 	uxu_err_t uxu_flush(void *addr);
+	uxu_err_t uxu_flush_range(void *addr, size_t offset, size_t len);
 	uxu_err_t uxu_unmap(void *addr);
+	uxu_err_t uxu_fallback_get_stats(uxu_fallback_stats_t *stats);
+	/* All zero when NO_DRAGON is set. */
+	uxu_err_t uxu_reducer_get_stats(uxu_reducer_stats_t *stats);
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <errno.h>
 #include <glib.h>
 
 #include <cuda.h>
@@ -22,34 +23,61 @@
 #define NVIDIA_UVM_PATH	"/dev/nvidia-uvm"
 #define DRAGON_IOCTL_INIT			1000
 #define DRAGON_IOCTL_MAP			1001
-#define DRAGON_IOCTL_TRASH_NRBLOCKS		1002
-#define DRAGON_IOCTL_TRASH_RESERVED_NRPAGES	1003
+#define DRAGON_IOCTL_SET_TRASH			1002
 #define DRAGON_IOCTL_REMAP			1004
+#define DRAGON_IOCTL_FLUSH			1005
+#define DRAGON_IOCTL_GET_STATS			1006
 
 #define MIN_SIZE			((size_t)1 << 21)
 #define DEFAULT_TRASH_NR_BLOCKS		32
 #define DEFAULT_TRASH_NR_RESERVED_PAGES	(((unsigned long)1 << 21) * 4)
 
+/* I/O engine used instead of the driver when NO_DRAGON is set */
+#define DEFAULT_FALLBACK_NR_THREADS	8
+#define MAX_FALLBACK_NR_THREADS		64
+#define DEFAULT_FALLBACK_CHUNK_SIZE	((size_t)1 << 24)
+#define FALLBACK_ALIGN			((size_t)1 << 12)
+
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#define ALIGN_UP(addr, size)	(((addr)+((size)-1))&(~((typeof(addr))(size)-1)))
+#define ALIGN_DOWN(addr, size)	((addr)&(~((typeof(addr))(size)-1)))
+
 #define DRAGON_ENVNAME_ENABLE_READ_CACHE	"DRAGON_ENABLE_READ_CACHE"
 #define DRAGON_ENVNAME_ENABLE_LAZY_WRITE	"DRAGON_ENABLE_LAZY_WRITE"
 #define DRAGON_ENVNAME_ENABLE_AIO_READ		"DRAGON_ENABLE_AIO_READ"
 #define DRAGON_ENVNAME_ENABLE_AIO_WRITE		"DRAGON_ENABLE_AIO_WRITE"
 #define DRAGON_ENVNAME_READAHEAD_TYPE		"DRAGON_READAHEAD_TYPE"
 #define DRAGON_ENVNAME_NR_RESERVED_PAGES	"DRAGON_NR_RESERVED_PAGES"
+#define DRAGON_ENVNAME_ADAPTIVE_TRASH		"DRAGON_ADAPTIVE_TRASH"
+#define DRAGON_ENVNAME_FALLBACK_NR_THREADS	"DRAGON_FALLBACK_NR_THREADS"
+#define DRAGON_ENVNAME_FALLBACK_CHUNK_SIZE	"DRAGON_FALLBACK_CHUNK_SIZE"
+#define DRAGON_ENVNAME_FALLBACK_DIRECT_IO	"DRAGON_FALLBACK_DIRECT_IO"
 
 #define DRAGON_INIT_FLAG_ENABLE_READ_CACHE	0x01
 #define DRAGON_INIT_FLAG_ENABLE_LAZY_WRITE	0x02
 #define DRAGON_INIT_FLAG_ENABLE_AIO_READ	0x04
 #define DRAGON_INIT_FLAG_ENABLE_AIO_WRITE	0x08
+#define DRAGON_INIT_FLAG_ADAPTIVE_TRASH		0x10
+
+#define DRAGON_TRASH_SET_NR_BLOCKS		0x01
+#define DRAGON_TRASH_SET_RESERVED_NR_PAGES	0x02
+#define DRAGON_TRASH_ENABLE_ADAPTIVE		0x04
+#define DRAGON_TRASH_DISABLE_ADAPTIVE		0x08
 
 static int	fadvice = -1;
 static int	fd_uvm = -1;
 static int	initialized;
+static GMutex	init_lock;
 
 static int	minsize = MIN_SIZE;
 static int	disabled_uxu = 0;
 
-static GHashTable	*addr_map;
+static unsigned int	fallback_nr_threads = DEFAULT_FALLBACK_NR_THREADS;
+static size_t	fallback_chunk_size = DEFAULT_FALLBACK_CHUNK_SIZE;
+static int	fallback_direct_io = 0;
+
+static GMutex	fallback_stats_lock;
+static uxu_fallback_stats_t	fallback_stats;
 
 typedef struct {
 	unsigned long trash_nr_blocks;
@@ -58,14 +86,60 @@ typedef struct {
 	unsigned int status;
 } uxu_ioctl_init_t;
 
+typedef struct {
+	unsigned long trash_nr_blocks;
+	unsigned long trash_reserved_nr_pages;
+	unsigned short flags;
+	unsigned int status;
+} uxu_ioctl_trash_t;
+
 typedef struct {
 	int backing_fd;
 	void *uvm_addr;
 	size_t size;
+	size_t offset;
 	unsigned short flags;
 	unsigned int status;
+	/* not passed to the driver: per-chunk digests in fallback mode */
+	uint64_t *digests;
 } uxu_ioctl_map_t;
 
+typedef struct {
+	void *uvm_addr;
+	size_t offset;
+	size_t length;
+	unsigned int status;
+} uxu_ioctl_flush_t;
+
+typedef struct {
+	uxu_reducer_stats_t reducer;
+	unsigned int status;
+} uxu_ioctl_stats_t;
+
+/*
+ * Mappings are kept in an immutable array sorted by address. Lookups
+ * binary-search the published snapshot without taking any lock; map and
+ * unmap serialize on registry_lock, publish a modified copy and free the
+ * old one once every reader that could have seen it has left. Readers
+ * announce themselves in one of two counters selected by registry_epoch,
+ * so a writer flipping the epoch only waits for readers already inside.
+ */
+typedef struct {
+	uintptr_t start;
+	uintptr_t end;
+	uxu_ioctl_map_t *request;
+} registry_entry_t;
+
+typedef struct {
+	unsigned int nr_entries;
+	registry_entry_t entries[];
+} registry_snapshot_t;
+
+static registry_snapshot_t	*registry;
+static GMutex	registry_lock;
+static int	registry_epoch;
+static int	registry_readers[2];
+
 static int
 open_uvm_dev(void)
 {
@@ -132,6 +206,34 @@ setup_fd_uvm(void)
 	return err;
 }
 
+static void
+init_fallback(void)
+{
+	unsigned long	val;
+	char	*env_val;
+	char	*endptr;
+
+	env_val = secure_getenv(DRAGON_ENVNAME_FALLBACK_NR_THREADS);
+	if (env_val && *env_val != '\0') {
+		val = strtoul(env_val, &endptr, 10);
+		if (*endptr == '\0' && val > 0)
+			fallback_nr_threads = MIN(val, MAX_FALLBACK_NR_THREADS);
+	}
+
+	env_val = secure_getenv(DRAGON_ENVNAME_FALLBACK_CHUNK_SIZE);
+	if (env_val && *env_val != '\0') {
+		val = strtoul(env_val, &endptr, 10);
+		if (*endptr == '\0' && val > 0)
+			fallback_chunk_size = ALIGN_UP((size_t)val, FALLBACK_ALIGN);
+	}
+
+	env_val = secure_getenv(DRAGON_ENVNAME_FALLBACK_DIRECT_IO);
+	if (env_val && strncasecmp(env_val, "yes", 3) == 0) {
+		fallback_direct_io = 1;
+		fprintf(stderr, "Direct I/O is enabled for fallback mode.\n");
+	}
+}
+
 static uxu_err_t
 init_module(void)
 {
@@ -142,11 +244,9 @@ init_module(void)
 	int	status;
 	uxu_err_t	err;
 
-	addr_map = g_hash_table_new(NULL, NULL);
-
 	if (secure_getenv("NO_DRAGON")) {
+		init_fallback();
 		disabled_uxu = 1;
-		initialized = 1;
 		return D_OK;
 	}
 
@@ -190,6 +290,10 @@ init_module(void)
 	if (!(env_val && strncasecmp(env_val, "no", 2) == 0))
 		request.flags |= DRAGON_INIT_FLAG_ENABLE_AIO_WRITE;
 
+	env_val = secure_getenv(DRAGON_ENVNAME_ADAPTIVE_TRASH);
+	if (env_val && strncasecmp(env_val, "yes", 3) == 0)
+		request.flags |= DRAGON_INIT_FLAG_ADAPTIVE_TRASH;
+
 	env_val = secure_getenv(DRAGON_ENVNAME_READAHEAD_TYPE);
 	if (env_val && strncasecmp(env_val, "agg", 3) == 0) {
 		fadvice = POSIX_FADV_SEQUENTIAL;
@@ -207,68 +311,315 @@ init_module(void)
 		close(fd_uvm);
 		err = D_ERR_IOCTL;
 	}
-	else {
-		initialized = 1;
-	}
 
 	return err;
 }
 
-#define BUFSIZE	(1024 * 4)
-
+/* init_module() runs once; a failed attempt is retried by the next caller. */
 static uxu_err_t
-fillup_from_file(uxu_ioctl_map_t *request)
+ensure_initialized(void)
 {
-	size_t	size;
-	unsigned char	*addr;
+	uxu_err_t	err = D_OK;
 
-	if (!(request->flags & D_F_READ))
+	if (g_atomic_int_get(&initialized))
 		return D_OK;
 
-	addr = (unsigned char *)request->uvm_addr;
-	size = request->size;
-	while (size > 0) {
-		char buf[BUFSIZE];
-		int nread = BUFSIZE;
+	g_mutex_lock(&init_lock);
+	if (!g_atomic_int_get(&initialized)) {
+		err = init_module();
+		if (err == D_OK)
+			g_atomic_int_set(&initialized, 1);
+	}
+	g_mutex_unlock(&init_lock);
+
+	return err;
+}
+
+typedef struct {
+	int fd;
+	int direct_fd;
+	off_t file_offset;
+	unsigned char *addr;
+	size_t size;
+	size_t chunk_size;
+	size_t first_chunk;
+	size_t last_chunk;
+	uint64_t *digests;
+	unsigned int index;
+	unsigned int nr_workers;
+	int is_write;
+	size_t nbytes;
+	uxu_err_t err;
+} fallback_worker_t;
+
+#define ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+/**
+ * Compute a 64-bit digest of a chunk to detect whether it has changed since
+ * the last transfer. Zero is never returned so that it can mean "unknown".
+ */
+static uint64_t
+fallback_digest(const unsigned char *buf, size_t len)
+{
+	const uint64_t	c1 = 0x87c37b91114253d5ULL;
+	const uint64_t	c2 = 0x4cf5ad432745937fULL;
+	uint64_t	h = len;
+	uint64_t	k;
+	size_t	i;
+
+	for (i = 0; i + sizeof(k) <= len; i += sizeof(k)) {
+		memcpy(&k, buf + i, sizeof(k));
+		k *= c1;
+		k = ROTL64(k, 31);
+		k *= c2;
+		h ^= k;
+		h = ROTL64(h, 27) * 5 + 0x52dce729;
+	}
+	for (; i < len; i++) {
+		h ^= buf[i];
+		h = ROTL64(h * c1, 31);
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h | 1;
+}
 
-		if (nread > size)
-			nread = size;
-		nread = read(request->backing_fd, buf, nread);
-		if (nread == 0)
+/**
+ * Transfer `len` bytes at file offset `off` with positional I/O.
+ * Short transfers are retried; a read stops at the end of file.
+ *
+ * @return: the number of bytes transferred, or -1 on error.
+ */
+static ssize_t
+fallback_xfer(int fd, unsigned char *buf, size_t len, off_t off, int is_write)
+{
+	size_t	done = 0;
+
+	while (done < len) {
+		ssize_t	ret;
+
+		if (is_write)
+			ret = pwrite(fd, buf + done, len - done, off + done);
+		else
+			ret = pread(fd, buf + done, len - done, off + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
 			break;
-		memcpy(addr, buf, nread);
-		addr += nread;
-		size -= nread;
+		done += ret;
 	}
+	return done;
+}
 
-	return D_OK;
+/**
+ * Transfer a chunk. With O_DIRECT, the aligned part goes through an aligned
+ * bounce buffer since the managed memory cannot be pinned by the block layer,
+ * and the unaligned tail goes through the page cache.
+ */
+static ssize_t
+fallback_xfer_chunk(fallback_worker_t *w, unsigned char *bounce, size_t off, size_t len)
+{
+	size_t	len_direct = bounce ? ALIGN_DOWN(len, FALLBACK_ALIGN) : 0;
+	ssize_t	done = 0;
+	ssize_t	ret;
+
+	if (len_direct > 0) {
+		if (w->is_write)
+			memcpy(bounce, w->addr + off, len_direct);
+		if ((done = fallback_xfer(w->direct_fd, bounce, len_direct, w->file_offset + off, w->is_write)) < 0)
+			return -1;
+		if (!w->is_write)
+			memcpy(w->addr + off, bounce, done);
+		if ((size_t)done < len_direct)
+			return done;
+	}
+
+	ret = fallback_xfer(w->fd, w->addr + off + len_direct, len - len_direct,
+			    w->file_offset + off + len_direct, w->is_write);
+	if (ret < 0)
+		return -1;
+	return done + ret;
 }
 
-static void
-flush_to_file(uxu_ioctl_map_t *request)
+/*
+ * Each worker owns every `nr_workers`-th chunk, so the ranges never overlap
+ * and no coordination is needed between workers. When digests are kept,
+ * chunks that are unchanged since the last transfer are not written.
+ */
+static gpointer
+fallback_worker(gpointer data)
 {
-	size_t	size;
-	unsigned char	*addr;
+	fallback_worker_t	*w = (fallback_worker_t *)data;
+	unsigned char	*bounce = NULL;
+	size_t	chunk;
 
-	if (!(request->flags & D_F_WRITE))
-		return;
+	if (w->direct_fd >= 0 && posix_memalign((void **)&bounce, FALLBACK_ALIGN, w->chunk_size) != 0) {
+		w->err = D_ERR_MEM;
+		return NULL;
+	}
+
+	for (chunk = w->first_chunk + w->index; chunk <= w->last_chunk; chunk += w->nr_workers) {
+		size_t	off = chunk * w->chunk_size;
+		size_t	len = MIN(w->chunk_size, w->size - off);
+		uint64_t	digest = 0;
+		ssize_t	ret;
 
-	addr = (unsigned char *)request->uvm_addr;
-	size = request->size;
-	while (size > 0) {
-		char	buf[BUFSIZE];
-		int	nwrite = BUFSIZE;
+		if (w->digests && w->is_write) {
+			digest = fallback_digest(w->addr + off, len);
+			if (w->digests[chunk] == digest)
+				continue;
+		}
 
-		if (nwrite > size)
-			nwrite = size;
+		ret = fallback_xfer_chunk(w, bounce, off, len);
+		if (ret < 0) {
+			w->err = D_ERR_FILE;
+			break;
+		}
+		w->nbytes += ret;
 
-		memcpy(buf, addr, nwrite);
-		nwrite = write(request->backing_fd, buf, nwrite);
-		if (nwrite == 0)
+		if (w->digests) {
+			/* A partially read chunk does not match the file. */
+			if (!w->is_write)
+				digest = (size_t)ret == len ? fallback_digest(w->addr + off, len) : 0;
+			w->digests[chunk] = digest;
+		}
+		if ((size_t)ret < len)
 			break;
-		addr += nwrite;
-		size -= nwrite;
 	}
+
+	free(bounce);
+	return NULL;
+}
+
+static int
+fallback_open_direct(int fd)
+{
+	char	path[64];
+	int	fl_flags;
+
+	if ((fl_flags = fcntl(fd, F_GETFL)) < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/%d", PSF_DIR, fd);
+	return open(path, (fl_flags & O_ACCMODE) | O_LARGEFILE | O_DIRECT);
+}
+
+/**
+ * Move the chunks [first_chunk, last_chunk] of the mapping between the file
+ * and the managed memory using multiple threads.
+ */
+static uxu_err_t
+fallback_transfer(uxu_ioctl_map_t *request, int is_write, size_t first_chunk, size_t last_chunk)
+{
+	fallback_worker_t	workers[MAX_FALLBACK_NR_THREADS];
+	GThread	*threads[MAX_FALLBACK_NR_THREADS];
+	unsigned int	nr_workers, i;
+	int	direct_fd = -1;
+	size_t	nbytes = 0;
+	gint64	started;
+	uxu_err_t	err = D_OK;
+
+	if (request->size == 0)
+		return D_OK;
+
+	started = g_get_monotonic_time();
+
+	if (fallback_direct_io)
+		direct_fd = fallback_open_direct(request->backing_fd);
+
+	nr_workers = MIN(last_chunk - first_chunk + 1, fallback_nr_threads);
+
+	for (i = 0; i < nr_workers; i++) {
+		workers[i] = (fallback_worker_t) {
+			.fd = request->backing_fd,
+			.direct_fd = direct_fd,
+			.file_offset = request->offset,
+			.addr = (unsigned char *)request->uvm_addr,
+			.size = request->size,
+			.chunk_size = fallback_chunk_size,
+			.first_chunk = first_chunk,
+			.last_chunk = last_chunk,
+			.digests = request->digests,
+			.index = i,
+			.nr_workers = nr_workers,
+			.is_write = is_write,
+			.nbytes = 0,
+			.err = D_OK
+		};
+		threads[i] = i > 0 ? g_thread_new("uxu-fallback", fallback_worker, &workers[i]) : NULL;
+	}
+	/* The caller thread serves as the first worker. */
+	fallback_worker(&workers[0]);
+
+	for (i = 0; i < nr_workers; i++) {
+		if (threads[i])
+			g_thread_join(threads[i]);
+		if (workers[i].err != D_OK)
+			err = workers[i].err;
+		nbytes += workers[i].nbytes;
+	}
+
+	if (direct_fd >= 0)
+		close(direct_fd);
+
+	g_mutex_lock(&fallback_stats_lock);
+	if (is_write) {
+		fallback_stats.bytes_written += nbytes;
+		fallback_stats.usecs_written += g_get_monotonic_time() - started;
+	}
+	else {
+		fallback_stats.bytes_read += nbytes;
+		fallback_stats.usecs_read += g_get_monotonic_time() - started;
+	}
+	g_mutex_unlock(&fallback_stats_lock);
+
+	return err;
+}
+
+static size_t
+fallback_nr_chunks(size_t size)
+{
+	return (size + fallback_chunk_size - 1) / fallback_chunk_size;
+}
+
+static uxu_err_t
+fillup_from_file(uxu_ioctl_map_t *request)
+{
+	uxu_err_t	err;
+
+	/* Digests let later flushes skip the chunks that have not changed. */
+	if ((request->flags & D_F_WRITE) && request->size > 0) {
+		request->digests = (uint64_t *)calloc(fallback_nr_chunks(request->size), sizeof(uint64_t));
+		if (request->digests == NULL) {
+			fprintf(stderr, "Cannot calloc digests\n");
+			return D_ERR_MEM;
+		}
+	}
+
+	if (!(request->flags & D_F_READ) || request->size == 0)
+		return D_OK;
+
+	if ((err = fallback_transfer(request, 0, 0, fallback_nr_chunks(request->size) - 1)) != D_OK)
+		fprintf(stderr, "failed to read the backing file\n");
+	return err;
+}
+
+static uxu_err_t
+flush_to_file(uxu_ioctl_map_t *request, size_t offset, size_t len)
+{
+	uxu_err_t	err;
+
+	if (!(request->flags & D_F_WRITE) || len == 0)
+		return D_OK;
+
+	err = fallback_transfer(request, 1, offset / fallback_chunk_size, (offset + len - 1) / fallback_chunk_size);
+	if (err != D_OK)
+		fprintf(stderr, "failed to write the backing file\n");
+	return err;
 }
 
 static uxu_err_t
@@ -278,9 +629,9 @@ do_uxu_map(uxu_ioctl_map_t *request)
 	uxu_err_t	err = D_OK;
 
 	if ((request->flags & D_F_READ) && !(request->flags & D_F_VOLATILE)) {
-		if ((status = posix_fadvise(request->backing_fd, 0, 0, fadvice)) != 0)
+		if ((status = posix_fadvise(request->backing_fd, request->offset, request->offset ? request->size : 0, fadvice)) != 0)
 			fprintf(stderr, "fadvise error: %d\n", status);
-		if ((fadvice == POSIX_FADV_SEQUENTIAL) && readahead(request->backing_fd, 0, request->size) != 0)
+		if ((fadvice == POSIX_FADV_SEQUENTIAL) && readahead(request->backing_fd, request->offset, request->size) != 0)
 			fprintf(stderr, "readahead error.\n");
 	}
 
@@ -296,24 +647,199 @@ static void
 free_request(uxu_ioctl_map_t *request)
 {
 	close(request->backing_fd);
+	free(request->digests);
 	free(request);
 }
 
-#define ALIGN_UP(addr, size)	(((addr)+((size)-1))&(~((typeof(addr))(size)-1)))
+static registry_snapshot_t *
+registry_reader_enter(int *pepoch)
+{
+	*pepoch = g_atomic_int_get(&registry_epoch) & 1;
+	g_atomic_int_inc(&registry_readers[*pepoch]);
+	return g_atomic_pointer_get(&registry);
+}
+
+static void
+registry_reader_leave(int epoch)
+{
+	(void)g_atomic_int_dec_and_test(&registry_readers[epoch]);
+}
+
+/* Waits until no reader can still hold a snapshot replaced before the call. */
+static void
+registry_synchronize(void)
+{
+	int	i, old;
+
+	/* A reader may have sampled either epoch, so drain both. */
+	for (i = 0; i < 2; i++) {
+		old = g_atomic_int_add(&registry_epoch, 1) & 1;
+		while (g_atomic_int_get(&registry_readers[old]) != 0)
+			g_thread_yield();
+	}
+}
+
+/* Returns the index of the last entry starting at or below addr, or -1. */
+static int
+registry_search(registry_snapshot_t *snap, uintptr_t addr)
+{
+	int	lo = 0, hi, mid;
+
+	if (snap == NULL)
+		return -1;
+
+	hi = (int)snap->nr_entries - 1;
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (snap->entries[mid].start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return hi;
+}
+
+/*
+ * Finds the mapping containing addr. With interior unset, addr must be the
+ * address returned by uxu_map(). The request stays valid until it is
+ * unmapped; using it concurrently with uxu_unmap() is a caller error.
+ */
+static uxu_ioctl_map_t *
+registry_lookup(void *addr, int interior)
+{
+	registry_snapshot_t	*snap;
+	registry_entry_t	*ent;
+	uxu_ioctl_map_t	*request = NULL;
+	int	epoch, idx;
+
+	snap = registry_reader_enter(&epoch);
+	idx = registry_search(snap, (uintptr_t)addr);
+	if (idx >= 0) {
+		ent = &snap->entries[idx];
+		if (ent->start == (uintptr_t)addr || (interior && (uintptr_t)addr < ent->end))
+			request = ent->request;
+	}
+	registry_reader_leave(epoch);
+
+	return request;
+}
+
+static void
+registry_publish(registry_snapshot_t *snap)
+{
+	registry_snapshot_t	*old;
+
+	old = g_atomic_pointer_get(&registry);
+	g_atomic_pointer_set(&registry, snap);
+	registry_synchronize();
+	free(old);
+}
+
+static uxu_err_t
+registry_insert(uxu_ioctl_map_t *request)
+{
+	registry_snapshot_t	*old, *snap;
+	unsigned int	nr_old;
+	int	idx;
+
+	g_mutex_lock(&registry_lock);
+
+	old = registry;
+	nr_old = old ? old->nr_entries : 0;
+	snap = malloc(sizeof(registry_snapshot_t) + (nr_old + 1) * sizeof(registry_entry_t));
+	if (snap == NULL) {
+		fprintf(stderr, "Cannot malloc registry_snapshot_t\n");
+		g_mutex_unlock(&registry_lock);
+		return D_ERR_MEM;
+	}
+
+	idx = registry_search(old, (uintptr_t)request->uvm_addr) + 1;
+	if (idx > 0)
+		memcpy(snap->entries, old->entries, idx * sizeof(registry_entry_t));
+	snap->entries[idx].start = (uintptr_t)request->uvm_addr;
+	snap->entries[idx].end = (uintptr_t)request->uvm_addr + (request->size ? request->size : 1);
+	snap->entries[idx].request = request;
+	if (nr_old > (unsigned int)idx)
+		memcpy(&snap->entries[idx + 1], &old->entries[idx], (nr_old - idx) * sizeof(registry_entry_t));
+	snap->nr_entries = nr_old + 1;
+
+	registry_publish(snap);
+
+	g_mutex_unlock(&registry_lock);
+
+	return D_OK;
+}
+
+/* Unlinks the mapping starting at addr; only one of racing callers gets it. */
+static uxu_ioctl_map_t *
+registry_remove(void *addr)
+{
+	registry_snapshot_t	*old, *snap = NULL;
+	uxu_ioctl_map_t	*request;
+	unsigned int	nr_old;
+	int	idx;
+
+	g_mutex_lock(&registry_lock);
+
+	old = registry;
+	idx = registry_search(old, (uintptr_t)addr);
+	if (idx < 0 || old->entries[idx].start != (uintptr_t)addr) {
+		g_mutex_unlock(&registry_lock);
+		return NULL;
+	}
+	request = old->entries[idx].request;
+
+	nr_old = old->nr_entries;
+	if (nr_old > 1) {
+		snap = malloc(sizeof(registry_snapshot_t) + (nr_old - 1) * sizeof(registry_entry_t));
+		if (snap == NULL) {
+			fprintf(stderr, "Cannot malloc registry_snapshot_t\n");
+			g_mutex_unlock(&registry_lock);
+			return NULL;
+		}
+		memcpy(snap->entries, old->entries, idx * sizeof(registry_entry_t));
+		memcpy(&snap->entries[idx], &old->entries[idx + 1], (nr_old - idx - 1) * sizeof(registry_entry_t));
+		snap->nr_entries = nr_old - 1;
+	}
+
+	registry_publish(snap);
+
+	g_mutex_unlock(&registry_lock);
+
+	return request;
+}
 
 uxu_err_t
 uxu_map(const char *filename, size_t size, unsigned short flags, void **paddr)
+{
+	int	f_fd;
+
+	/* The whole file is mapped, so D_F_CREATE starts it over as before. */
+	if (flags & D_F_CREATE) {
+		f_fd = creat(filename, S_IRUSR | S_IWUSR);
+		if (f_fd >= 0)
+			close(f_fd);
+	}
+	return uxu_map_range(filename, 0, size, flags, paddr);
+}
+
+uxu_err_t
+uxu_map_range(const char *filename, size_t offset, size_t size, unsigned short flags, void **paddr)
 {
 	int	f_flags = 0;
 	int	f_fd;
 	uxu_ioctl_map_t	*request;
 	cudaError_t	error;
+	struct stat	st;
 	int		ret = D_OK;
 
-	if (!initialized) {
-		ret = init_module();
-		if (ret != D_OK)
-			return ret;
+	ret = ensure_initialized();
+	if (ret != D_OK)
+		return ret;
+
+	if (offset & (getpagesize() - 1)) {
+		fprintf(stderr, "offset %zu is not page aligned\n", offset);
+		return D_ERR_INTVAL;
 	}
 
 	if ((request = (uxu_ioctl_map_t *)calloc(1, sizeof(uxu_ioctl_map_t))) == NULL) {
@@ -322,19 +848,17 @@ uxu_map(const char *filename, size_t size, unsigned short flags, void **paddr)
 	}
 
 	f_flags = O_RDWR | O_LARGEFILE;
-	if (flags & D_F_CREATE) {
-		f_fd = creat(filename, S_IRUSR | S_IWUSR);
-		if (f_fd >= 0)
-			close(f_fd);
-	}
+	/* A window must not destroy the rest of the file, wherever it starts. */
+	if (flags & D_F_CREATE)
+		f_flags |= O_CREAT;
 
-	if ((f_fd = open(filename, f_flags)) < 0) {
+	if ((f_fd = open(filename, f_flags, S_IRUSR | S_IWUSR)) < 0) {
 		fprintf(stderr, "Cannot open the file %s\n", filename);
 		free(request);
 		return D_ERR_FILE;
 	}
 
-	if ((flags & D_F_CREATE) && ftruncate(f_fd, size) != 0) {
+	if ((flags & D_F_CREATE) && (fstat(f_fd, &st) != 0 || (st.st_size < (off_t)(offset + size) && ftruncate(f_fd, offset + size) != 0))) {
 		fprintf(stderr, "Cannot truncate the file %s\n", filename);
 		close(f_fd);
 		free(request);
@@ -351,6 +875,7 @@ uxu_map(const char *filename, size_t size, unsigned short flags, void **paddr)
 
 	request->backing_fd = f_fd;
 	request->size = size;
+	request->offset = offset;
 	request->flags = flags;
 
 	if (disabled_uxu)
@@ -358,10 +883,11 @@ uxu_map(const char *filename, size_t size, unsigned short flags, void **paddr)
 	else
 		ret = do_uxu_map(request);
 
-	if (ret == D_OK) {
+	if (ret == D_OK && (ret = registry_insert(request)) != D_OK)
+		cudaFree(request->uvm_addr);
+
+	if (ret == D_OK)
 		*paddr = request->uvm_addr;
-		g_hash_table_insert(addr_map, request->uvm_addr, request);
-	}
 	else
 		free_request(request);
 
@@ -372,7 +898,7 @@ uxu_err_t
 uxu_remap(void *addr, unsigned short flags)
 {
 	int	status;
-	uxu_ioctl_map_t	*request = g_hash_table_lookup(addr_map, addr);
+	uxu_ioctl_map_t	*request = registry_lookup(addr, 1);
 	int	fd;
 	uxu_err_t	err = D_OK;
 
@@ -399,28 +925,127 @@ uxu_remap(void *addr, unsigned short flags)
 	return err;
 }
 
+static uxu_err_t
+set_trash(uxu_ioctl_trash_t *request)
+{
+	int	status;
+	uxu_err_t	err;
+
+	err = ensure_initialized();
+	if (err != D_OK)
+		return err;
+
+	/* There is nothing to evict without the driver. */
+	if (disabled_uxu)
+		return D_OK;
+
+	if ((status = ioctl(fd_uvm, DRAGON_IOCTL_SET_TRASH, request)) != 0) {
+		fprintf(stderr, "ioctl error: %d\n", status);
+		return D_ERR_IOCTL;
+	}
+	return D_OK;
+}
+
 uxu_err_t
 uxu_trash_set_num_blocks(unsigned long nrblocks)
 {
-	return D_ERR_NOT_IMPLEMENTED;
+	uxu_ioctl_trash_t	request = { 0 };
+
+	if (nrblocks == 0)
+		return D_ERR_INTVAL;
+
+	request.trash_nr_blocks = nrblocks;
+	request.flags = DRAGON_TRASH_SET_NR_BLOCKS;
+	return set_trash(&request);
 }
 
 uxu_err_t
 uxu_trash_set_num_reserved_sys_cache_pages(unsigned long nrpages)
 {
-	return D_ERR_NOT_IMPLEMENTED;
+	uxu_ioctl_trash_t	request = { 0 };
+
+	request.trash_reserved_nr_pages = nrpages;
+	request.flags = DRAGON_TRASH_SET_RESERVED_NR_PAGES;
+	return set_trash(&request);
+}
+
+uxu_err_t
+uxu_trash_set_adaptive(int enable)
+{
+	uxu_ioctl_trash_t	request = { 0 };
+
+	request.flags = enable ? DRAGON_TRASH_ENABLE_ADAPTIVE : DRAGON_TRASH_DISABLE_ADAPTIVE;
+	return set_trash(&request);
+}
+
+uxu_err_t
+uxu_flush_range(void *addr, size_t offset, size_t len)
+{
+	uxu_ioctl_map_t	*request = registry_lookup(addr, 1);
+	uxu_ioctl_flush_t	flush_request;
+	int	status;
+	uxu_err_t	err = D_OK;
+
+	if (request == NULL) {
+		fprintf(stderr, "%p is not mapped via uxu_map\n", addr);
+		return D_ERR_INTVAL;
+	}
+
+	/* offset is relative to addr, which may point inside the mapping. */
+	if (offset > SIZE_MAX - ((char *)addr - (char *)request->uvm_addr)) {
+		fprintf(stderr, "flush offset overflow: %zu\n", offset);
+		return D_ERR_INTVAL;
+	}
+	offset += (char *)addr - (char *)request->uvm_addr;
+
+	if (offset > request->size || len > request->size - offset) {
+		fprintf(stderr, "flush range out of mapping: %zu+%zu > %zu\n", offset, len, request->size);
+		return D_ERR_INTVAL;
+	}
+
+	if (!(request->flags & D_F_WRITE) || (request->flags & D_F_VOLATILE) || len == 0)
+		return D_OK;
+
+	if (disabled_uxu) {
+		if ((err = flush_to_file(request, offset, len)) == D_OK && fdatasync(request->backing_fd) != 0)
+			err = D_ERR_FILE;
+		return err;
+	}
+
+	/* GPU kernels may still be writing to the mapping. */
+	cudaDeviceSynchronize();
+
+	flush_request.uvm_addr = request->uvm_addr;
+	flush_request.offset = offset;
+	flush_request.length = len;
+	flush_request.status = 0;
+
+	if ((status = ioctl(fd_uvm, DRAGON_IOCTL_FLUSH, &flush_request)) != 0) {
+		fprintf(stderr, "ioctl error: %d\n", status);
+		err = D_ERR_IOCTL;
+	}
+
+	return err;
 }
 
 uxu_err_t
 uxu_flush(void *addr)
 {
-	return D_ERR_NOT_IMPLEMENTED;
+	uxu_ioctl_map_t	*request = registry_lookup(addr, 1);
+
+	if (request == NULL) {
+		fprintf(stderr, "%p is not mapped via uxu_map\n", addr);
+		return D_ERR_INTVAL;
+	}
+
+	return uxu_flush_range(request->uvm_addr, 0, request->size);
 }
 
 uxu_err_t
 uxu_unmap(void *addr)
 {
-	uxu_ioctl_map_t	*request = g_hash_table_lookup(addr_map, addr);
+	uxu_ioctl_map_t	*request = registry_remove(addr);
+	uxu_err_t	err = D_OK;
 
 	if (request == NULL) {
 		fprintf(stderr, "%p is not mapped via uxu_map\n", addr);
@@ -428,7 +1053,7 @@ uxu_unmap(void *addr)
 	}
 
 	if (disabled_uxu) {
-		flush_to_file(request);
+		err = flush_to_file(request, 0, request->size);
 	}
 	else {
 		if ((request->flags & D_F_WRITE) && !(request->flags & D_F_VOLATILE))
@@ -436,8 +1061,48 @@ uxu_unmap(void *addr)
 	}
 
 	cudaFree(request->uvm_addr);
-	g_hash_table_remove(addr_map, addr);
 	free_request(request);
 
+	return err;
+}
+
+uxu_err_t
+uxu_fallback_get_stats(uxu_fallback_stats_t *stats)
+{
+	if (stats == NULL)
+		return D_ERR_INTVAL;
+
+	g_mutex_lock(&fallback_stats_lock);
+	*stats = fallback_stats;
+	g_mutex_unlock(&fallback_stats_lock);
+
+	return D_OK;
+}
+
+uxu_err_t
+uxu_reducer_get_stats(uxu_reducer_stats_t *stats)
+{
+	uxu_ioctl_stats_t	request = { 0 };
+	int	status;
+	uxu_err_t	err;
+
+	if (stats == NULL)
+		return D_ERR_INTVAL;
+
+	err = ensure_initialized();
+	if (err != D_OK)
+		return err;
+
+	if (disabled_uxu) {
+		memset(stats, 0, sizeof(*stats));
+		return D_OK;
+	}
+
+	if ((status = ioctl(fd_uvm, DRAGON_IOCTL_GET_STATS, &request)) != 0) {
+		fprintf(stderr, "ioctl error: %d\n", status);
+		return D_ERR_IOCTL;
+	}
+
+	*stats = request.reducer;
 	return D_OK;
 }